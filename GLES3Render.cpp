@@ -29,12 +29,33 @@
 
 #include "common.h"
 #include "debug.h"
+#include "MMU.h"
 #include "NDSSystem.h"
+#include "utils/task.h"
+
+#if defined(OGLRENDER_SUPPORTS_EGL) && (defined(__linux__) || defined(__ANDROID__))
+	#include <unistd.h>
+	#define OGLRENDER_SUPPORTS_DMABUF
+#endif
 
 #define GL_TEXTURE_MAX_ANISOTROPY 0x84FE
 #define GL_MAX_TEXTURE_MAX_ANISOTROPY 0x84FF
 
 
+#ifdef OGLRENDER_SUPPORTS_EGL
+// EGL image functions are extensions, so they have to be looked up at runtime.
+static PFNEGLCREATEIMAGEKHRPROC oglEGLCreateImageKHR = NULL;
+static PFNEGLDESTROYIMAGEKHRPROC oglEGLDestroyImageKHR = NULL;
+#if defined(OGLRENDER_SUPPORTS_DMABUF) && defined(EGL_MESA_image_dma_buf_export)
+static PFNEGLEXPORTDMABUFIMAGEQUERYMESAPROC oglEGLExportDMABUFImageQueryMESA = NULL;
+static PFNEGLEXPORTDMABUFIMAGEMESAPROC oglEGLExportDMABUFImageMESA = NULL;
+#endif
+
+// EXT_multisampled_render_to_texture isn't declared by the GLES 3.0 headers, so look it up too.
+typedef void (GL_APIENTRYP OGLPFNFRAMEBUFFERTEXTURE2DMULTISAMPLEEXTPROC)(GLenum target, GLenum attachment, GLenum textarget, GLuint texture, GLint level, GLsizei samples);
+static OGLPFNFRAMEBUFFERTEXTURE2DMULTISAMPLEEXTPROC oglFramebufferTexture2DMultisampleEXT = NULL;
+#endif
+
 static inline void glDrawBuffer(GLenum attach) {
     switch(attach) {
         case GL_NONE: {
@@ -73,6 +94,16 @@ static inline void glDrawBuffer(GLenum attach) {
 #include "./utils/colorspacehandler/colorspacehandler_SSE2.h"
 #endif
 
+#ifdef ENABLE_AVX2
+#include <immintrin.h>
+#include "./utils/colorspacehandler/colorspacehandler_AVX2.h"
+#endif
+
+#ifdef ENABLE_NEON_A64
+#include <arm_neon.h>
+#include "./utils/colorspacehandler/colorspacehandler_NEON.h"
+#endif
+
 #undef GL_UNSIGNED_INT_8_8_8_8_REV
 #define GL_UNSIGNED_INT_8_8_8_8_REV GL_UNSIGNED_BYTE
 #define GL_MY_FORMAT GL_RGBA
@@ -358,6 +389,7 @@ static const char *GeometryVtxShader_100 = {"\
 in vec4 inPosition; \n\
 in vec2 inTexCoord0; \n\
 in vec3 inColor; \n\
+in vec4 inViewport; \n\
 \n\
 uniform lowp int polyMode;\n\
 uniform bool polyDrawShadow;\n\
@@ -378,7 +410,15 @@ void main() \n\
 	vtxColor = vec4(inColor / 63.0, polyAlpha); \n\
 	isPolyDrawable = ((polyMode != 3) || polyDrawShadow) ? 1.0 : -1.0;\n\
 	\n\
-	gl_Position = inPosition / 4096.0;\n\
+	// The NDS viewport is applied here instead of through glViewport() so that polygons in\n\
+	// different viewports can share a draw call. Remap the polygon's clip coordinates from its\n\
+	// own viewport into the full framebuffer viewport. Clipped polygons already lie within\n\
+	// their viewport, so nothing needs to be rejected afterwards.\n\
+	vec4 clipPosition = inPosition / 4096.0;\n\
+	vec2 viewportScale = inViewport.zw / vec2(NDS_FRAMEBUFFER_SIZE_X, NDS_FRAMEBUFFER_SIZE_Y);\n\
+	vec2 viewportOffset = (((2.0 * inViewport.xy) + inViewport.zw) / vec2(NDS_FRAMEBUFFER_SIZE_X, NDS_FRAMEBUFFER_SIZE_Y)) - 1.0;\n\
+	\n\
+	gl_Position = vec4((clipPosition.xy * viewportScale) + (clipPosition.w * viewportOffset), clipPosition.zw);\n\
 } \n\
 "};
 
@@ -403,33 +443,51 @@ uniform bool polyEnableTexture;\n\
 uniform bool polyEnableFog;\n\
 uniform bool texDrawOpaque;\n\
 uniform bool texSingleBitAlpha;\n\
-uniform bool polyIsBackFacing;\n\
+uniform bool polyLineIsBackFacing;\n\
 \n\
 uniform bool drawModeDepthEqualsTest;\n\
 uniform bool polyDrawShadow;\n\
 uniform float polyDepthOffset;\n\
 \n\
+#if ENABLE_ZERO_DST_ALPHA_FETCH\n\
+layout( location = 0 ) inout vec4 outFragColor;\n\
+#else\n\
 layout( location = 0 ) out vec4 outFragColor;\n\
+#endif\n\
 #if DRAW_MODE_OPAQUE\n\
 layout( location = ATTACHMENT_WORKING_BUFFER ) out vec4 outDstBackFacing;\n\
 #endif\n\
 \n\
-#if ENABLE_EDGE_MARK\n\
+#if ENABLE_EDGE_MARK && ENABLE_ZERO_DST_ALPHA_FETCH\n\
+layout( location = ATTACHMENT_POLY_ID ) inout vec4 outPolyID;\n\
+#elif ENABLE_EDGE_MARK\n\
 layout( location = ATTACHMENT_POLY_ID ) out vec4 outPolyID;\n\
 #endif\n\
-#if ENABLE_FOG\n\
+#if ENABLE_FOG && ENABLE_ZERO_DST_ALPHA_FETCH\n\
+layout( location = ATTACHMENT_FOG_ATTRIBUTES ) inout vec4 outFogAttributes;\n\
+#elif ENABLE_FOG\n\
 layout( location = ATTACHMENT_FOG_ATTRIBUTES ) out vec4 outFogAttributes;\n\
 #endif\n\
 \n\
 #if USE_DEPTH_LEQUAL_POLYGON_FACING && !DRAW_MODE_OPAQUE\n\
 uniform sampler2D inDstBackFacing;\n\
 #endif\n\
+#if USE_NDS_DEPTH_CALCULATION\n\
+uniform bool drawModeDepthEqualsWindow;\n\
+uniform sampler2D inDstDepth;\n\
+#endif\n\
 \n\
 void main()\n\
 {\n\
-#if USE_DEPTH_LEQUAL_POLYGON_FACING && !DRAW_MODE_OPAQUE\n\
+	// The early-Z variants are only used for opaque polygons that can't have any of their\n\
+	// fragments discarded, so they leave out every discard to keep early depth testing enabled.\n\
+	\n\
+	// Lines are always front-facing to GL, so their facing comes from the polygon instead.\n\
+	bool isBackFacing = !gl_FrontFacing || polyLineIsBackFacing;\n\
+	\n\
+#if USE_DEPTH_LEQUAL_POLYGON_FACING && !DRAW_MODE_OPAQUE && !DRAW_MODE_EARLY_Z\n\
 	bool isOpaqueDstBackFacing = bool( texture(inDstBackFacing, vec2(gl_FragCoord.x/FRAMEBUFFER_SIZE_X, gl_FragCoord.y/FRAMEBUFFER_SIZE_Y)).r );\n\
-	if (drawModeDepthEqualsTest && (polyIsBackFacing || !isOpaqueDstBackFacing))\n\
+	if (drawModeDepthEqualsTest && (isBackFacing || !isOpaqueDstBackFacing))\n\
 	{\n\
 		discard;\n\
 	}\n\
@@ -440,10 +498,12 @@ void main()\n\
 	\n\
 	if (!texSingleBitAlpha)\n\
 	{\n\
+#if !DRAW_MODE_EARLY_Z\n\
 		if (texDrawOpaque && (polyMode != 1) && (mainTexColor.a <= 0.999))\n\
 		{\n\
 			discard;\n\
 		}\n\
+#endif\n\
 	}\n\
 #if USE_TEXTURE_SMOOTHING\n\
 	else\n\
@@ -480,34 +540,69 @@ void main()\n\
 		newFragColor = vtxColor;\n\
 	}\n\
 	\n\
+#if !DRAW_MODE_EARLY_Z\n\
 	if ( (isPolyDrawable > 0.0) && ((newFragColor.a < 0.001) || (ENABLE_ALPHA_TEST && (newFragColor.a < stateAlphaTestRef))) )\n\
 	{\n\
 		discard;\n\
 	}\n\
+#endif\n\
 	\n\
+#if ENABLE_ZERO_DST_ALPHA_FETCH\n\
+	// Fixed-function blending is disabled for this program. Blending is done here instead\n\
+	// so that fragments drawn over zero-alpha pixels can replace the color unblended.\n\
+	vec4 dstFragColor = outFragColor;\n\
+	outFragColor.rgb = (dstFragColor.a <= 0.001) ? newFragColor.rgb : mix(dstFragColor.rgb, newFragColor.rgb, newFragColor.a);\n\
+	outFragColor.a = max(dstFragColor.a, newFragColor.a);\n\
+#else\n\
 	outFragColor = newFragColor;\n\
+#endif\n\
 	\n\
 #if ENABLE_EDGE_MARK\n\
-	outPolyID = (isPolyDrawable > 0.0) ? vec4( float(polyID)/63.0, float(polyIsWireframe), 0.0, float(newFragColor.a > 0.999) ) : vec4(0.0, 0.0, 0.0, 0.0);\n\
+	vec4 newPolyID = (isPolyDrawable > 0.0) ? vec4( float(polyID)/63.0, float(polyIsWireframe), 0.0, float(newFragColor.a > 0.999) ) : vec4(0.0, 0.0, 0.0, 0.0);\n\
+	#if ENABLE_ZERO_DST_ALPHA_FETCH\n\
+	outPolyID = vec4( mix(outPolyID.rgb, newPolyID.rgb, newPolyID.a), max(outPolyID.a, newPolyID.a) );\n\
+	#else\n\
+	outPolyID = newPolyID;\n\
+	#endif\n\
 #endif\n\
 #if ENABLE_FOG\n\
-	outFogAttributes = (isPolyDrawable > 0.0) ? vec4( float(polyEnableFog), 0.0, 0.0, float((newFragColor.a > 0.999) ? 1.0 : 0.5) ) : vec4(0.0, 0.0, 0.0, 0.0);\n\
+	vec4 newFogAttributes = (isPolyDrawable > 0.0) ? vec4( float(polyEnableFog), 0.0, 0.0, float((newFragColor.a > 0.999) ? 1.0 : 0.5) ) : vec4(0.0, 0.0, 0.0, 0.0);\n\
+	#if ENABLE_ZERO_DST_ALPHA_FETCH\n\
+	outFogAttributes = vec4( mix(outFogAttributes.rgb, newFogAttributes.rgb, newFogAttributes.a), max(outFogAttributes.a, newFogAttributes.a) );\n\
+	#else\n\
+	outFogAttributes = newFogAttributes;\n\
+	#endif\n\
 #endif\n\
 #if DRAW_MODE_OPAQUE\n\
-	outDstBackFacing = vec4(float(polyIsBackFacing), 0.0, 0.0, 1.0);\n\
+	outDstBackFacing = vec4(float(isBackFacing), 0.0, 0.0, 1.0);\n\
 #endif\n\
-#if USE_NDS_DEPTH_CALCULATION || ENABLE_FOG\n\
+#if (USE_NDS_DEPTH_CALCULATION || ENABLE_FOG) && !DRAW_MODE_EARLY_Z\n\
 	// It is tempting to perform the NDS depth calculation in the vertex shader rather than in the fragment shader.\n\
 	// Resist this temptation! It is much more reliable to do the depth calculation in the fragment shader due to\n\
 	// subtle interpolation differences between various GPUs and/or drivers. If the depth calculation is not done\n\
 	// here, then it is very possible for the user to experience Z-fighting in certain rendering situations.\n\
 	\n\
 	#if ENABLE_W_DEPTH\n\
-	gl_FragDepth = clamp( ((1.0/gl_FragCoord.w) * (4096.0/16777215.0)) + polyDepthOffset, 0.0, 1.0 );\n\
+	float newFragDepth = clamp( ((1.0/gl_FragCoord.w) * (4096.0/16777215.0)) + polyDepthOffset, 0.0, 1.0 );\n\
 	#else\n\
 	// hack: when using z-depth, drop some LSBs so that the overworld map in Dragon Quest IV shows up correctly\n\
-	gl_FragDepth = clamp( (floor(gl_FragCoord.z * 4194303.0) * (4.0/16777215.0)) + polyDepthOffset, 0.0, 1.0 );\n\
+	float newFragDepth = clamp( (floor(gl_FragCoord.z * 4194303.0) * (4.0/16777215.0)) + polyDepthOffset, 0.0, 1.0 );\n\
+	#endif\n\
+	\n\
+	#if USE_NDS_DEPTH_CALCULATION\n\
+	// Single-pass depth-equals test. Compare against a copy of the depth buffer to apply the\n\
+	// whole tolerance window here, instead of building a stencil mask over multiple passes.\n\
+	if (drawModeDepthEqualsWindow)\n\
+	{\n\
+		float dstDepth = texture(inDstDepth, vec2(gl_FragCoord.x/FRAMEBUFFER_SIZE_X, gl_FragCoord.y/FRAMEBUFFER_SIZE_Y)).r;\n\
+		if (abs(newFragDepth - dstDepth) > DEPTH_EQUALS_TEST_WINDOW)\n\
+		{\n\
+			discard;\n\
+		}\n\
+	}\n\
 	#endif\n\
+	\n\
+	gl_FragDepth = newFragDepth;\n\
 #endif\n\
 }\n\
 "};
@@ -721,6 +816,120 @@ void main()\n\
 }\n\
 "};
 
+// Fragment shader for applying edge marking and fog in a single pass, GLSL ES 3.00
+// Uses EdgeMarkVtxShader_100 for its texture coordinates. The edge color is blended
+// in the shader the same way that the fixed-function blending of the separate edge
+// mark pass would do it, and then fog is applied to the result.
+static const char *EdgeMarkFogFragShader_100 = {"\
+in vec2 texCoord[5];\n\
+\n\
+uniform sampler2D texInFragColor;\n\
+uniform sampler2D texInFragDepth;\n\
+uniform sampler2D texInPolyID;\n\
+uniform sampler2D texInFogAttributes;\n\
+uniform sampler2D texFogDensityTable;\n\
+\n\
+uniform int clearPolyID;\n\
+uniform float clearDepth;\n\
+uniform vec4 stateEdgeColor[8];\n\
+uniform bool stateEnableZeroDstAlphaEdgeMark;\n\
+uniform bool stateEnableFogAlphaOnly;\n\
+uniform vec4 stateFogColor;\n\
+layout( location = OUT_ATTACH ) out vec4 fragmentColor;\n\
+\n\
+void main()\n\
+{\n\
+	vec4 inFragColor = texture(texInFragColor, texCoord[0]);\n\
+	vec4 inFogAttributes = texture(texInFogAttributes, texCoord[0]);\n\
+	\n\
+	vec4 polyIDInfo[5];\n\
+	polyIDInfo[0] = texture(texInPolyID, texCoord[0]);\n\
+	polyIDInfo[1] = texture(texInPolyID, texCoord[1]);\n\
+	polyIDInfo[2] = texture(texInPolyID, texCoord[2]);\n\
+	polyIDInfo[3] = texture(texInPolyID, texCoord[3]);\n\
+	polyIDInfo[4] = texture(texInPolyID, texCoord[4]);\n\
+	\n\
+	bool isWireframe[5];\n\
+	isWireframe[0] = bool(polyIDInfo[0].g);\n\
+	\n\
+	float depth[5];\n\
+	depth[0] = texture(texInFragDepth, texCoord[0]).r;\n\
+	depth[1] = texture(texInFragDepth, texCoord[1]).r;\n\
+	depth[2] = texture(texInFragDepth, texCoord[2]).r;\n\
+	depth[3] = texture(texInFragDepth, texCoord[3]).r;\n\
+	depth[4] = texture(texInFragDepth, texCoord[4]).r;\n\
+	\n\
+	int edgePolyID = -1;\n\
+	\n\
+	if (!isWireframe[0])\n\
+	{\n\
+		int polyID[5];\n\
+		polyID[0] = int((polyIDInfo[0].r * 63.0) + 0.5);\n\
+		polyID[1] = int((polyIDInfo[1].r * 63.0) + 0.5);\n\
+		polyID[2] = int((polyIDInfo[2].r * 63.0) + 0.5);\n\
+		polyID[3] = int((polyIDInfo[3].r * 63.0) + 0.5);\n\
+		polyID[4] = int((polyIDInfo[4].r * 63.0) + 0.5);\n\
+		\n\
+		isWireframe[1] = bool(polyIDInfo[1].g);\n\
+		isWireframe[2] = bool(polyIDInfo[2].g);\n\
+		isWireframe[3] = bool(polyIDInfo[3].g);\n\
+		isWireframe[4] = bool(polyIDInfo[4].g);\n\
+		\n\
+		bool isEdgeMarkingClearValues = ((polyID[0] != clearPolyID) && (depth[0] < clearDepth) && !isWireframe[0]);\n\
+		\n\
+		if ( ((gl_FragCoord.x >= FRAMEBUFFER_SIZE_X-1.0) ? isEdgeMarkingClearValues : ((polyID[0] != polyID[1]) && (depth[0] >= depth[1]) && !isWireframe[1])) )\n\
+		{\n\
+			edgePolyID = (gl_FragCoord.x >= FRAMEBUFFER_SIZE_X-1.0) ? polyID[0] : polyID[1];\n\
+		}\n\
+		else if ( ((gl_FragCoord.y >= FRAMEBUFFER_SIZE_Y-1.0) ? isEdgeMarkingClearValues : ((polyID[0] != polyID[2]) && (depth[0] >= depth[2]) && !isWireframe[2])) )\n\
+		{\n\
+			edgePolyID = (gl_FragCoord.y >= FRAMEBUFFER_SIZE_Y-1.0) ? polyID[0] : polyID[2];\n\
+		}\n\
+		else if ( ((gl_FragCoord.x < 1.0) ? isEdgeMarkingClearValues : ((polyID[0] != polyID[3]) && (depth[0] >= depth[3]) && !isWireframe[3])) )\n\
+		{\n\
+			edgePolyID = (gl_FragCoord.x < 1.0) ? polyID[0] : polyID[3];\n\
+		}\n\
+		else if ( ((gl_FragCoord.y < 1.0) ? isEdgeMarkingClearValues : ((polyID[0] != polyID[4]) && (depth[0] >= depth[4]) && !isWireframe[4])) )\n\
+		{\n\
+			edgePolyID = (gl_FragCoord.y < 1.0) ? polyID[0] : polyID[4];\n\
+		}\n\
+	}\n\
+	\n\
+	vec4 newEdgeColor = (edgePolyID < 0) ? vec4(0.0, 0.0, 0.0, 0.0) : stateEdgeColor[edgePolyID >> 3];\n\
+	vec4 newFoggedColor = inFragColor;\n\
+	\n\
+	// Pixels with zero alpha take the edge color as-is, just like the unblended\n\
+	// pass of the separate edge mark would write it. All other pixels are blended\n\
+	// with SRC_ALPHA/ONE_MINUS_SRC_ALPHA for color and MAX for alpha.\n\
+	if (stateEnableZeroDstAlphaEdgeMark && (inFragColor.a <= 0.001))\n\
+	{\n\
+		newFoggedColor.rgb = newEdgeColor.rgb;\n\
+	}\n\
+	else\n\
+	{\n\
+		newFoggedColor.rgb = mix(inFragColor.rgb, newEdgeColor.rgb, newEdgeColor.a);\n\
+	}\n\
+	newFoggedColor.a = max(inFragColor.a, newEdgeColor.a);\n\
+	\n\
+	float fogMixWeight = 0.0;\n\
+	if (FOG_STEP == 0)\n\
+	{\n\
+		fogMixWeight = texture( texFogDensityTable, vec2((depth[0] <= FOG_OFFSETF) ? 0.0 : 1.0, 0.0)).r;\n\
+	}\n\
+	else\n\
+	{\n\
+		fogMixWeight = texture( texFogDensityTable, vec2((depth[0] * (1024.0/float(FOG_STEP))) + (((-float(FOG_OFFSET)/float(FOG_STEP)) - 0.5) / 32.0), 0.0)).r;\n\
+	}\n\
+	\n\
+	if (inFogAttributes.r > 0.999)\n\
+	{\n\
+		newFoggedColor = mix(newFoggedColor, (stateEnableFogAlphaOnly) ? vec4(newFoggedColor.rgb, stateFogColor.a) : stateFogColor, fogMixWeight);\n\
+	}\n\
+	\n\
+	fragmentColor = newFoggedColor;\n\
+}\n\
+"};
+
 // Vertex shader for the final framebuffer, GLSL ES 3.00
 static const char *FramebufferOutputVtxShader_100 = {"\
 in vec2 inPosition;\n\
@@ -777,6 +986,56 @@ void main()\n\
 }\n\
 "};
 
+// Fragment shader for the final RGBA5551 formatted framebuffer, GLSL ES 3.00
+static const char *FramebufferOutputRGBA5551FragShader_100 = {"\
+in vec2 texCoord;\n\
+\n\
+uniform sampler2D texInFragColor;\n\
+layout( location = OUT_ATTACH ) out uint fragmentColor16;\n\
+\n\
+void main()\n\
+{\n\
+	// Pack the color exactly as the NDS stores it, with red in the low bits and the\n\
+	// alpha bit on top, so that the readback can be copied as-is.\n\
+	uvec4 color8888 = uvec4( floor((texture(texInFragColor, texCoord) * 255.0) + 0.5) );\n\
+	uvec3 color555 = color8888.rgb >> 3u;\n\
+	\n\
+	fragmentColor16 = color555.r | (color555.g << 5u) | (color555.b << 10u) | ((color8888.a == 0u) ? 0u : 0x8000u);\n\
+}\n\
+"};
+
+// Fragment shader that writes both the final RGBA6665/RGBA8888 framebuffer and the
+// RGBA5551 framebuffer in a single pass, GLSL ES 3.00
+static const char *FramebufferOutputDualFragShader_100 = {"\
+in vec2 texCoord;\n\
+\n\
+uniform sampler2D texInFragColor;\n\
+layout( location = OUT_ATTACH ) out vec4 fragmentColor;\n\
+layout( location = OUT_ATTACH16 ) out uint fragmentColor16;\n\
+\n\
+void main()\n\
+{\n\
+	vec4 srcColor = texture(texInFragColor, texCoord);\n\
+	uvec4 color8888 = uvec4( floor((srcColor * 255.0) + 0.5) );\n\
+	uvec3 color555 = color8888.rgb >> 3u;\n\
+	\n\
+	fragmentColor16 = color555.r | (color555.g << 5u) | (color555.b << 10u) | ((color8888.a == 0u) ? 0u : 0x8000u);\n\
+	\n\
+#if IS_BGRA\n\
+	srcColor = srcColor.bgra;\n\
+#endif\n\
+#if OUTPUT_6665\n\
+	vec4 colorRGBA6665 = floor((srcColor * 255.0) + 0.5);\n\
+	colorRGBA6665.rgb  = floor(colorRGBA6665.rgb / 4.0);\n\
+	colorRGBA6665.a    = floor(colorRGBA6665.a   / 8.0);\n\
+	\n\
+	fragmentColor = (colorRGBA6665 / 255.0);\n\
+#else\n\
+	fragmentColor = srcColor;\n\
+#endif\n\
+}\n\
+"};
+
 bool IsOpenGLDriverVersionSupported(unsigned int checkVersionMajor, unsigned int checkVersionMinor, unsigned int checkVersionRevision)
 {
 	bool result = false;
@@ -863,13 +1122,21 @@ OpenGLTexture::OpenGLTexture(TEXIMAGE_PARAM texAttributes, u32 palAttributes) :
 	_isTexInited = false;
 
 	_upscaleBuffer = NULL;
+	_glState = NULL;
 
 	glGenTextures(1, &_texID);
 }
 
 OpenGLTexture::~OpenGLTexture()
 {
-	glDeleteTextures(1, &this->_texID);
+	if (this->_glState != NULL)
+	{
+		this->_glState->DeleteTextures(1, &this->_texID);
+	}
+	else
+	{
+		glDeleteTextures(1, &this->_texID);
+	}
 }
 
 void OpenGLTexture::Load(bool forceTextureInit)
@@ -883,7 +1150,14 @@ void OpenGLTexture::Load(bool forceTextureInit)
 		RenderDeposterize(this->_deposterizeSrcSurface, this->_deposterizeDstSurface);
 	}
 
-	glBindTexture(GL_TEXTURE_2D, this->_texID);
+	if (this->_glState != NULL)
+	{
+		this->_glState->BindTexture(GL_TEXTURE_2D, this->_texID);
+	}
+	else
+	{
+		glBindTexture(GL_TEXTURE_2D, this->_texID);
+	}
 
 	switch (this->_scalingFactor)
 	{
@@ -992,84 +1266,343 @@ void OpenGLTexture::SetUpscalingBuffer(void *upscaleBuffer)
 	this->_upscaleBuffer = (u32 *)upscaleBuffer;
 }
 
-template<bool require_profile, bool enable_3_2>
-static Render3D* OpenGLRendererCreate()
+// Routes the texture's own binds and deletion through the renderer's state cache, so that the
+// cache never holds on to a binding that the texture changed behind its back.
+void OpenGLTexture::SetStateCache(OpenGLStateCache *glState)
 {
-	OpenGLRenderer *newRenderer = NULL;
-	Render3DError error = OGLERROR_NOERR;
+	this->_glState = glState;
+}
 
-	if (oglrender_init == NULL)
-	{
-		return NULL;
+OpenGLStateCache::OpenGLStateCache()
+{
+	_issuedCallCount = 0;
+	_suppressedCallCount = 0;
+
+	this->Invalidate();
+}
+
+void OpenGLStateCache::Invalidate()
+{
+	// Use values that no valid GL call can set, so that the next call for each state is always issued.
+	this->_depthFunc = GL_NONE;
+	this->_stencilFunc = GL_NONE;
+	this->_stencilRef = 0;
+	this->_stencilFuncMask = 0;
+	this->_stencilOpFail = GL_NONE;
+	this->_stencilOpDepthFail = GL_NONE;
+	this->_stencilOpDepthPass = GL_NONE;
+	this->_stencilWriteMask = 0;
+	this->_isStencilWriteMaskValid = false;
+	this->_colorMask[0] = 0xFF;
+	this->_colorMask[1] = 0xFF;
+	this->_colorMask[2] = 0xFF;
+	this->_colorMask[3] = 0xFF;
+	this->_depthMask = 0xFF;
+	this->_blendSrcRGB = GL_NONE;
+	this->_blendDstRGB = GL_NONE;
+	this->_blendSrcAlpha = GL_NONE;
+	this->_blendDstAlpha = GL_NONE;
+	this->_blendModeRGB = GL_NONE;
+	this->_blendModeAlpha = GL_NONE;
+	this->_program = 0;
+	this->_isProgramValid = false;
+	this->_activeTextureUnit = GL_NONE;
+
+	for (size_t i = 0; i <= OGLTextureUnitID_LookupTable; i++)
+	{
+		this->_boundTexture2D[i] = 0;
+		this->_isBoundTexture2DValid[i] = false;
 	}
+}
 
-	if (!oglrender_init())
+void OpenGLStateCache::ResetCounters()
+{
+	this->_issuedCallCount = 0;
+	this->_suppressedCallCount = 0;
+}
+
+size_t OpenGLStateCache::GetIssuedCallCount() const
+{
+	return this->_issuedCallCount;
+}
+
+size_t OpenGLStateCache::GetSuppressedCallCount() const
+{
+	return this->_suppressedCallCount;
+}
+
+void OpenGLStateCache::DepthFunc(GLenum func)
+{
+	if (this->_depthFunc == func)
 	{
-		return NULL;
+		this->_suppressedCallCount++;
+		return;
 	}
 
-	__BeginOpenGL = oglrender_beginOpenGL;
-	__EndOpenGL   = oglrender_endOpenGL;
+	this->_depthFunc = func;
+	this->_issuedCallCount++;
+	glDepthFunc(func);
+}
 
-	if (!BEGINGL())
+void OpenGLStateCache::StencilFunc(GLenum func, GLint ref, GLuint mask)
+{
+	if ( (this->_stencilFunc == func) && (this->_stencilRef == ref) && (this->_stencilFuncMask == mask) )
 	{
-		INFO("OpenGL<%s,%s>: Could not initialize -- BEGINGL() failed.\n", require_profile?"force":"auto", enable_3_2?"3_2":"old");
-		return NULL;
+		this->_suppressedCallCount++;
+		return;
 	}
 
-	// Get OpenGL info
-	const char *oglVersionString = (const char *)glGetString(GL_VERSION);
-	const char *oglVendorString = (const char *)glGetString(GL_VENDOR);
-	const char *oglRendererString = (const char *)glGetString(GL_RENDERER);
+	this->_stencilFunc = func;
+	this->_stencilRef = ref;
+	this->_stencilFuncMask = mask;
+	this->_issuedCallCount++;
+	glStencilFunc(func, ref, mask);
+}
 
-	// Writing to gl_FragDepth causes the driver to fail miserably on systems equipped
-	// with a Intel G965 graphic card. Warn the user and fail gracefully.
-	// http://forums.desmume.org/viewtopic.php?id=9286
-	if(!strcmp(oglVendorString,"Intel") && strstr(oglRendererString,"965"))
+void OpenGLStateCache::StencilOp(GLenum sfail, GLenum dpfail, GLenum dppass)
+{
+	if ( (this->_stencilOpFail == sfail) && (this->_stencilOpDepthFail == dpfail) && (this->_stencilOpDepthPass == dppass) )
 	{
-		INFO("OpenGL: Incompatible graphic card detected. Disabling OpenGL support.\n");
-
-		ENDGL();
-		return newRenderer;
+		this->_suppressedCallCount++;
+		return;
 	}
 
-	// Check the driver's OpenGL version
-	OGLGetDriverVersion(oglVersionString, &_OGLDriverVersion.major, &_OGLDriverVersion.minor, &_OGLDriverVersion.revision);
+	this->_stencilOpFail = sfail;
+	this->_stencilOpDepthFail = dpfail;
+	this->_stencilOpDepthPass = dppass;
+	this->_issuedCallCount++;
+	glStencilOp(sfail, dpfail, dppass);
+}
 
-#if 0
-	if (!IsOpenGLDriverVersionSupported(OGLRENDER_MINIMUM_DRIVER_VERSION_REQUIRED_MAJOR, OGLRENDER_MINIMUM_DRIVER_VERSION_REQUIRED_MINOR, OGLRENDER_MINIMUM_DRIVER_VERSION_REQUIRED_REVISION))
+void OpenGLStateCache::StencilMask(GLuint mask)
+{
+	if (this->_isStencilWriteMaskValid && (this->_stencilWriteMask == mask))
 	{
-		INFO("OpenGL: Driver does not support OpenGL v%u.%u.%u or later. Disabling 3D renderer.\n[ Driver Info -\n    Version: %s\n    Vendor: %s\n    Renderer: %s ]\n",
-			 OGLRENDER_MINIMUM_DRIVER_VERSION_REQUIRED_MAJOR, OGLRENDER_MINIMUM_DRIVER_VERSION_REQUIRED_MINOR, OGLRENDER_MINIMUM_DRIVER_VERSION_REQUIRED_REVISION,
-			 oglVersionString, oglVendorString, oglRendererString);
-
-		ENDGL();
-		return newRenderer;
+		this->_suppressedCallCount++;
+		return;
 	}
-#endif
 
-	// If the renderer doesn't initialize with OpenGL v3.2 or higher, fall back
-	// to one of the lower versions.
-	if (newRenderer == NULL)
+	this->_stencilWriteMask = mask;
+	this->_isStencilWriteMaskValid = true;
+	this->_issuedCallCount++;
+	glStencilMask(mask);
+}
+
+void OpenGLStateCache::ColorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a)
+{
+	if ( (this->_colorMask[0] == r) && (this->_colorMask[1] == g) && (this->_colorMask[2] == b) && (this->_colorMask[3] == a) )
 	{
-        newRenderer = new OpenGLESRenderer_3_0;
-        newRenderer->SetVersion(3, 0, 0);
+		this->_suppressedCallCount++;
+		return;
 	}
 
-	if (newRenderer == NULL)
+	this->_colorMask[0] = r;
+	this->_colorMask[1] = g;
+	this->_colorMask[2] = b;
+	this->_colorMask[3] = a;
+	this->_issuedCallCount++;
+	glColorMask(r, g, b, a);
+}
+
+void OpenGLStateCache::DepthMask(GLboolean flag)
+{
+	if (this->_depthMask == flag)
 	{
-		INFO("OpenGL: Renderer did not initialize. Disabling 3D renderer.\n[ Driver Info -\n    Version: %s\n    Vendor: %s\n    Renderer: %s ]\n",
-			 oglVersionString, oglVendorString, oglRendererString);
+		this->_suppressedCallCount++;
+		return;
+	}
 
-		ENDGL();
-		return newRenderer;
+	this->_depthMask = flag;
+	this->_issuedCallCount++;
+	glDepthMask(flag);
+}
+
+void OpenGLStateCache::BlendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha)
+{
+	if ( (this->_blendSrcRGB == srcRGB) && (this->_blendDstRGB == dstRGB) && (this->_blendSrcAlpha == srcAlpha) && (this->_blendDstAlpha == dstAlpha) )
+	{
+		this->_suppressedCallCount++;
+		return;
 	}
 
-	// Initialize OpenGL extensions
-	error = newRenderer->InitExtensions();
-	if (error != OGLERROR_NOERR)
+	this->_blendSrcRGB = srcRGB;
+	this->_blendDstRGB = dstRGB;
+	this->_blendSrcAlpha = srcAlpha;
+	this->_blendDstAlpha = dstAlpha;
+	this->_issuedCallCount++;
+	glBlendFuncSeparate(srcRGB, dstRGB, srcAlpha, dstAlpha);
+}
+
+void OpenGLStateCache::BlendEquationSeparate(GLenum modeRGB, GLenum modeAlpha)
+{
+	if ( (this->_blendModeRGB == modeRGB) && (this->_blendModeAlpha == modeAlpha) )
 	{
-		if (error == OGLERROR_DRIVER_VERSION_TOO_OLD)
+		this->_suppressedCallCount++;
+		return;
+	}
+
+	this->_blendModeRGB = modeRGB;
+	this->_blendModeAlpha = modeAlpha;
+	this->_issuedCallCount++;
+	glBlendEquationSeparate(modeRGB, modeAlpha);
+}
+
+void OpenGLStateCache::UseProgram(GLuint program)
+{
+	if (this->_isProgramValid && (this->_program == program))
+	{
+		this->_suppressedCallCount++;
+		return;
+	}
+
+	this->_program = program;
+	this->_isProgramValid = true;
+	this->_issuedCallCount++;
+	glUseProgram(program);
+}
+
+void OpenGLStateCache::ActiveTexture(GLenum textureUnit)
+{
+	if (this->_activeTextureUnit == textureUnit)
+	{
+		this->_suppressedCallCount++;
+		return;
+	}
+
+	this->_activeTextureUnit = textureUnit;
+	this->_issuedCallCount++;
+	glActiveTexture(textureUnit);
+}
+
+void OpenGLStateCache::BindTexture(GLenum target, GLuint texture)
+{
+	// Only GL_TEXTURE_2D bindings on the renderer's own texture units are tracked.
+	const size_t unitIndex = (size_t)(this->_activeTextureUnit - GL_TEXTURE0);
+	if ( (target != GL_TEXTURE_2D) || (this->_activeTextureUnit == GL_NONE) || (unitIndex > OGLTextureUnitID_LookupTable) )
+	{
+		this->_issuedCallCount++;
+		glBindTexture(target, texture);
+		return;
+	}
+
+	if (this->_isBoundTexture2DValid[unitIndex] && (this->_boundTexture2D[unitIndex] == texture))
+	{
+		this->_suppressedCallCount++;
+		return;
+	}
+
+	this->_boundTexture2D[unitIndex] = texture;
+	this->_isBoundTexture2DValid[unitIndex] = true;
+	this->_issuedCallCount++;
+	glBindTexture(target, texture);
+}
+
+void OpenGLStateCache::DeleteProgram(GLuint program)
+{
+	// GL may hand out the name of a deleted program again, so forget it here.
+	if (this->_program == program)
+	{
+		this->_isProgramValid = false;
+	}
+
+	glDeleteProgram(program);
+}
+
+void OpenGLStateCache::DeleteTextures(GLsizei n, const GLuint *textures)
+{
+	// Deleting a bound texture reverts its binding to 0, so forget any bindings to these textures.
+	for (GLsizei t = 0; t < n; t++)
+	{
+		for (size_t i = 0; i <= OGLTextureUnitID_LookupTable; i++)
+		{
+			if (this->_boundTexture2D[i] == textures[t])
+			{
+				this->_isBoundTexture2DValid[i] = false;
+			}
+		}
+	}
+
+	glDeleteTextures(n, textures);
+}
+
+template<bool require_profile, bool enable_3_2>
+static Render3D* OpenGLRendererCreate()
+{
+	OpenGLRenderer *newRenderer = NULL;
+	Render3DError error = OGLERROR_NOERR;
+
+	if (oglrender_init == NULL)
+	{
+		return NULL;
+	}
+
+	if (!oglrender_init())
+	{
+		return NULL;
+	}
+
+	__BeginOpenGL = oglrender_beginOpenGL;
+	__EndOpenGL   = oglrender_endOpenGL;
+
+	if (!BEGINGL())
+	{
+		INFO("OpenGL<%s,%s>: Could not initialize -- BEGINGL() failed.\n", require_profile?"force":"auto", enable_3_2?"3_2":"old");
+		return NULL;
+	}
+
+	// Get OpenGL info
+	const char *oglVersionString = (const char *)glGetString(GL_VERSION);
+	const char *oglVendorString = (const char *)glGetString(GL_VENDOR);
+	const char *oglRendererString = (const char *)glGetString(GL_RENDERER);
+
+	// Writing to gl_FragDepth causes the driver to fail miserably on systems equipped
+	// with a Intel G965 graphic card. Warn the user and fail gracefully.
+	// http://forums.desmume.org/viewtopic.php?id=9286
+	if(!strcmp(oglVendorString,"Intel") && strstr(oglRendererString,"965"))
+	{
+		INFO("OpenGL: Incompatible graphic card detected. Disabling OpenGL support.\n");
+
+		ENDGL();
+		return newRenderer;
+	}
+
+	// Check the driver's OpenGL version
+	OGLGetDriverVersion(oglVersionString, &_OGLDriverVersion.major, &_OGLDriverVersion.minor, &_OGLDriverVersion.revision);
+
+#if 0
+	if (!IsOpenGLDriverVersionSupported(OGLRENDER_MINIMUM_DRIVER_VERSION_REQUIRED_MAJOR, OGLRENDER_MINIMUM_DRIVER_VERSION_REQUIRED_MINOR, OGLRENDER_MINIMUM_DRIVER_VERSION_REQUIRED_REVISION))
+	{
+		INFO("OpenGL: Driver does not support OpenGL v%u.%u.%u or later. Disabling 3D renderer.\n[ Driver Info -\n    Version: %s\n    Vendor: %s\n    Renderer: %s ]\n",
+			 OGLRENDER_MINIMUM_DRIVER_VERSION_REQUIRED_MAJOR, OGLRENDER_MINIMUM_DRIVER_VERSION_REQUIRED_MINOR, OGLRENDER_MINIMUM_DRIVER_VERSION_REQUIRED_REVISION,
+			 oglVersionString, oglVendorString, oglRendererString);
+
+		ENDGL();
+		return newRenderer;
+	}
+#endif
+
+	// If the renderer doesn't initialize with OpenGL v3.2 or higher, fall back
+	// to one of the lower versions.
+	if (newRenderer == NULL)
+	{
+        newRenderer = new OpenGLESRenderer_3_0;
+        newRenderer->SetVersion(3, 0, 0);
+	}
+
+	if (newRenderer == NULL)
+	{
+		INFO("OpenGL: Renderer did not initialize. Disabling 3D renderer.\n[ Driver Info -\n    Version: %s\n    Vendor: %s\n    Renderer: %s ]\n",
+			 oglVersionString, oglVendorString, oglRendererString);
+
+		ENDGL();
+		return newRenderer;
+	}
+
+	// Initialize OpenGL extensions
+	error = newRenderer->InitExtensions();
+	if (error != OGLERROR_NOERR)
+	{
+		if (error == OGLERROR_DRIVER_VERSION_TOO_OLD)
 		{
 			INFO("OpenGL: This driver does not support the minimum feature set required to run this renderer. Disabling 3D renderer.\n[ Driver Info -\n    Version: %s\n    Vendor: %s\n    Renderer: %s ]\n",
 				 oglVersionString, oglVendorString, oglRendererString);
@@ -1165,6 +1698,13 @@ OpenGLRenderer::OpenGLRenderer()
 	isMultisampledFBOSupported = false;
 	isVAOSupported = false;
 	_isDepthLEqualPolygonFacingSupported = false;
+	_isFramebufferFetchSupported = false;
+	_isMultisampledRenderToTextureSupported = false;
+	_isMSRenderToTextureFBOComplete = false;
+	_resolveAttachmentFlags = OGLAttachmentFlag_All;
+	_needsBackFacingResolve = true;
+	_isPolyIDAttachmentAllocated = false;
+	_isFogAttrAttachmentAllocated = false;
 	willFlipOnlyFramebufferOnGPU = false;
 	willFlipAndConvertFramebufferOnGPU = false;
 	willUsePerSampleZeroDstPass = false;
@@ -1175,31 +1715,138 @@ OpenGLRenderer::OpenGLRenderer()
 	_emulateDepthLEqualPolygonFacing = false;
 
 	// Init OpenGL rendering states
-	ref = (OGLRenderRef *)malloc(sizeof(OGLRenderRef));
+	// OGLRenderRef holds CACHE_ALIGN buffers that are accessed with aligned SIMD loads and stores.
+	ref = (OGLRenderRef *)malloc_alignedCacheLine(sizeof(OGLRenderRef));
 	memset(ref, 0, sizeof(OGLRenderRef));
 
 	_mappedFramebuffer = NULL;
 	_workingTextureUnpackBuffer = (Color4u8 *)malloc_alignedCacheLine(1024 * 1024 * sizeof(Color4u8));
 	_pixelReadNeedsFinish = false;
+	_pixelReadNeedsStart = false;
+	_enableZeroCopyFramebuffer = false;
+	_pboRingIndex = 0;
+
+	for (size_t i = 0; i < OGLRENDER_PBO_RING_SIZE; i++)
+	{
+		_isPBOBorrowed[i] = false;
+		_pboRetiredMapping[i] = NULL;
+		_pboInFlight[i] = 0;
+		_pboReadMode[i] = OGLFramebufferReadMode_Color;
+	}
+
+	_framePipelineDepth = 1;
+	_isPipelinedReadBack = false;
+	_pboReadIndex = 0;
+	_pboInFlightCount = 0;
+
+	_enableFrameExport = false;
+	_exportLatestIndex = OGLRENDER_EXPORT_TEXTURE_COUNT;
+#ifdef OGLRENDER_SUPPORTS_EGL
+	_exportEGLDisplay = EGL_NO_DISPLAY;
+#endif
+
+	for (size_t i = 0; i < OGLRENDER_EXPORT_TEXTURE_COUNT; i++)
+	{
+		_isExportInUse[i] = false;
+		memset(&_exportedFrame[i], 0, sizeof(OGLExportedFrame));
+		_exportedFrame[i].dmabufFD = -1;
+	}
+
+	_willFrameBeConsumed = true;
+	_wasLastFrameConsumed = true;
+	_isFramebufferOutput5551Supported = false;
+	_framebufferReadMode = OGLFramebufferReadMode_Color;
+	_lastFlushRequestMain = true;
+	_lastFlushRequest16 = true;
 	_needsZeroDstAlphaPass = true;
+	_polyFrontFace = GL_CCW;
 	_currentPolyIndex = 0;
 	_enableAlphaBlending = true;
 	_lastTextureDrawTarget = OGLTextureUnitID_GColor;
 	_geometryProgramFlags.value = 0;
 	_fogProgramKey.key = 0;
 	_fogProgramMap.clear();
+	_edgeMarkFogProgramMap.clear();
+	_isEdgeMarkFogFusionSupported = true;
 	_clearImageIndex = 0;
+	_clearImageGeneration = 0;
+	_isClearImageKeyValid = false;
+	_clearImageKey = 0;
+	_isUploadedClearImageKeyValid = false;
+	_uploadedClearImageKey = 0;
+
+	_enableOpaquePolySorting = false;
+	_opaquePolySortDrawsSaved = 0;
+
+	_enableFrameMemoization = false;
+	_isFrameMemoized = false;
+	_isLastFrameHashValid = false;
+	_lastFrameHash = 0;
+	_textureLoadCount = 0;
+	memset(&_renderStats, 0, sizeof(_renderStats));
+
+	_enablePartialReadBack = true;
+	_enableAttachmentInvalidation = true;
+	_isSinglePassDepthEqualTestSupported = false;
+	_enableSinglePassDepthEqualTest = false;
+	_willUseSinglePassDepthEqualTest = false;
+	_isDepthCopyDirty = true;
+	_enableEarlyZOpaquePolygons = false;
+	_willUseEarlyZOpaquePolygons = false;
+	memset(_isPolyEarlyZSafe, 0, sizeof(_isPolyEarlyZSafe));
+	memset(_isPolyViewportDetached, 0, sizeof(_isPolyViewportDetached));
+	_InvalidateDirtyLines();
+
+	for (size_t i = 0; i < CLIPPED_POLYLIST_SIZE; i++)
+	{
+		_clippedPolyDrawOrder[i] = (u32)i;
+	}
 
 	memset(&_pendingRenderStates, 0, sizeof(_pendingRenderStates));
+
+	// Set up the worker threads used to convert large framebuffers on the CPU.
+	_flushThreadCount = CommonSettings.num_cores;
+	if (_flushThreadCount > OGLRENDER_MAX_FLUSH_THREADS)
+	{
+		_flushThreadCount = OGLRENDER_MAX_FLUSH_THREADS;
+	}
+
+	_flushTask = NULL;
+	if (_flushThreadCount > 1)
+	{
+		_flushTask = new Task[_flushThreadCount];
+		for (size_t i = 0; i < _flushThreadCount; i++)
+		{
+			_flushTask[i].start(false);
+		}
+	}
+	else
+	{
+		_flushThreadCount = 1;
+	}
+
+	memset(_flushThreadParam, 0, sizeof(_flushThreadParam));
 }
 
 OpenGLRenderer::~OpenGLRenderer()
 {
+	if (this->_flushTask != NULL)
+	{
+		for (size_t i = 0; i < this->_flushThreadCount; i++)
+		{
+			this->_flushTask[i].finish();
+			this->_flushTask[i].shutdown();
+		}
+
+		delete[] this->_flushTask;
+		this->_flushTask = NULL;
+	}
+
 	free_aligned(this->_framebufferColor);
 	free_aligned(this->_workingTextureUnpackBuffer);
 
 	// Destroy OpenGL rendering states
-	free(this->ref);
+	free_aligned(this->ref);
 	this->ref = NULL;
 }
 
@@ -1370,631 +2017,290 @@ bool OpenGLRenderer::IsVersionSupported(unsigned int checkVersionMajor, unsigned
 	return result;
 }
 
-Render3DError OpenGLRenderer::_FlushFramebufferFlipAndConvertOnCPU_RGBA(const Color4u8 *__restrict srcFramebuffer,
-																   Color4u8 *__restrict dstFramebufferMain, u16 *__restrict dstFramebuffer16,
-																   bool doFramebufferFlip, bool doFramebufferConvert)
+// Converts a run of pixels from the OpenGL framebuffer into the main and/or 16-bit
+// framebuffers. All options are resolved at compile time so that each combination
+// gets its own loop with no per-pixel branching.
+template <bool SWAP_RB, bool OUTPUT_6665, bool WRITE_MAIN, bool WRITE_16>
+static FORCEINLINE void FlushFramebufferConvertPixels(const Color4u8 *__restrict src, Color4u8 *__restrict dstMain, u16 *__restrict dst16, const size_t pixCount)
 {
-	if ( ((dstFramebufferMain == NULL) && (dstFramebuffer16 == NULL)) || (srcFramebuffer == NULL) )
+	if (WRITE_MAIN && !WRITE_16)
 	{
-		return RENDER3DERROR_NOERR;
-	}
-
-	// Convert from 32-bit BGRA8888 format to 32-bit RGBA6665 reversed format. OpenGL
-	// stores pixels using a flipped Y-coordinate, so this needs to be flipped back
-	// to the DS Y-coordinate.
+		if (OUTPUT_6665)
+		{
+			ColorspaceConvertBuffer8888To6665<SWAP_RB, false>((u32 *)src, (u32 *)dstMain, pixCount);
+		}
+		else
+		{
+			ColorspaceCopyBuffer32<SWAP_RB, false>((u32 *)src, (u32 *)dstMain, pixCount);
+		}
 
-    const bool swaprb = this->readFormat != GL_BGRA;
+		return;
+	}
+	else if (!WRITE_MAIN && WRITE_16)
+	{
+		ColorspaceConvertBuffer8888To5551<SWAP_RB, false>((u32 *)src, dst16, pixCount);
+		return;
+	}
+	else if (!WRITE_MAIN && !WRITE_16)
+	{
+		return;
+	}
 
 	size_t i = 0;
 
-	if (!doFramebufferFlip)
+#if defined(ENABLE_AVX2)
+	const size_t avxPixCount = pixCount - (pixCount % 16);
+	for (; i < avxPixCount; i += 16)
 	{
-		if (!doFramebufferConvert)
+		const v256u32 srcColorLo = _mm256_load_si256((v256u32 *)(src + i + 0));
+		const v256u32 srcColorHi = _mm256_load_si256((v256u32 *)(src + i + 8));
+
+		if (OUTPUT_6665)
 		{
-			if ( (dstFramebufferMain != NULL) && (dstFramebuffer16 != NULL) )
-			{
-#ifdef ENABLE_SSE2
-				const size_t ssePixCount = this->_framebufferPixCount - (this->_framebufferPixCount % 8);
-				for (; i < ssePixCount; i += 8)
-				{
-					const __m128i srcColorLo = _mm_load_si128((__m128i *)(srcFramebuffer + i + 0));
-					const __m128i srcColorHi = _mm_load_si128((__m128i *)(srcFramebuffer + i + 4));
+			_mm256_store_si256( (v256u32 *)(dstMain + i + 0), ColorspaceConvert8888To6665_AVX2<SWAP_RB>(srcColorLo) );
+			_mm256_store_si256( (v256u32 *)(dstMain + i + 8), ColorspaceConvert8888To6665_AVX2<SWAP_RB>(srcColorHi) );
+		}
+		else
+		{
+			_mm256_store_si256( (v256u32 *)(dstMain + i + 0), ColorspaceCopy32_AVX2<SWAP_RB>(srcColorLo) );
+			_mm256_store_si256( (v256u32 *)(dstMain + i + 8), ColorspaceCopy32_AVX2<SWAP_RB>(srcColorHi) );
+		}
 
-					_mm_store_si128((__m128i *)(dstFramebufferMain + i + 0), ColorspaceCopy32_SSE2<false>(srcColorLo));
-					_mm_store_si128((__m128i *)(dstFramebufferMain + i + 4), ColorspaceCopy32_SSE2<false>(srcColorHi));
-					_mm_store_si128( (__m128i *)(dstFramebuffer16 + i), ColorspaceConvert8888To5551_SSE2<false>(srcColorLo, srcColorHi) );
-				}
+		_mm256_store_si256( (v256u16 *)(dst16 + i), ColorspaceConvert8888To5551_AVX2<SWAP_RB>(srcColorLo, srcColorHi) );
+	}
 
 #pragma LOOPVECTORIZE_DISABLE
-#endif
-				for (; i < this->_framebufferPixCount; i++)
-				{
-					dstFramebufferMain[i].value = ColorspaceCopy32<true>(srcFramebuffer[i]);
-					dstFramebuffer16[i]         = ColorspaceConvert8888To5551<true>(srcFramebuffer[i]);
-				}
+#elif defined(ENABLE_SSE2)
+	const size_t ssePixCount = pixCount - (pixCount % 8);
+	for (; i < ssePixCount; i += 8)
+	{
+		const __m128i srcColorLo = _mm_load_si128((__m128i *)(src + i + 0));
+		const __m128i srcColorHi = _mm_load_si128((__m128i *)(src + i + 4));
 
-				this->_renderNeedsFlushMain = false;
-				this->_renderNeedsFlush16 = false;
-			}
-			else if (dstFramebufferMain != NULL)
-			{
-				ColorspaceCopyBuffer32<true, false>((u32 *)srcFramebuffer, (u32 *)dstFramebufferMain, this->_framebufferPixCount);
-				this->_renderNeedsFlushMain = false;
-			}
-			else
-			{
-				ColorspaceConvertBuffer8888To5551<true, false>((u32 *)srcFramebuffer, dstFramebuffer16, this->_framebufferPixCount);
-				this->_renderNeedsFlush16 = false;
-			}
+		if (OUTPUT_6665)
+		{
+			_mm_store_si128( (__m128i *)(dstMain + i + 0), ColorspaceConvert8888To6665_SSE2<SWAP_RB>(srcColorLo) );
+			_mm_store_si128( (__m128i *)(dstMain + i + 4), ColorspaceConvert8888To6665_SSE2<SWAP_RB>(srcColorHi) );
 		}
 		else
 		{
-			if (this->_outputFormat == NDSColorFormat_BGR666_Rev)
-			{
-				if ( (dstFramebufferMain != NULL) && (dstFramebuffer16 != NULL) )
-				{
-#ifdef ENABLE_SSE2
-					const size_t ssePixCount = this->_framebufferPixCount - (this->_framebufferPixCount % 8);
-					for (; i < ssePixCount; i += 8)
-					{
-						const __m128i srcColorLo = _mm_load_si128((__m128i *)(srcFramebuffer + i + 0));
-						const __m128i srcColorHi = _mm_load_si128((__m128i *)(srcFramebuffer + i + 4));
+			_mm_store_si128( (__m128i *)(dstMain + i + 0), ColorspaceCopy32_SSE2<SWAP_RB>(srcColorLo) );
+			_mm_store_si128( (__m128i *)(dstMain + i + 4), ColorspaceCopy32_SSE2<SWAP_RB>(srcColorHi) );
+		}
 
-						_mm_store_si128( (__m128i *)(dstFramebufferMain + i + 0), ColorspaceConvert8888To6665_SSE2<false>(srcColorLo) );
-						_mm_store_si128( (__m128i *)(dstFramebufferMain + i + 4), ColorspaceConvert8888To6665_SSE2<false>(srcColorHi) );
-						_mm_store_si128( (__m128i *)(dstFramebuffer16 + i), ColorspaceConvert8888To5551_SSE2<false>(srcColorLo, srcColorHi) );
-					}
+		_mm_store_si128( (__m128i *)(dst16 + i), ColorspaceConvert8888To5551_SSE2<SWAP_RB>(srcColorLo, srcColorHi) );
+	}
 
 #pragma LOOPVECTORIZE_DISABLE
-#endif
-					for (; i < this->_framebufferPixCount; i++)
-					{
-						dstFramebufferMain[i].value = ColorspaceConvert8888To6665<false>(srcFramebuffer[i]);
-						dstFramebuffer16[i]         = ColorspaceConvert8888To5551<false>(srcFramebuffer[i]);
-					}
+#elif defined(ENABLE_NEON_A64)
+	const size_t neonPixCount = pixCount - (pixCount % 8);
+	for (; i < neonPixCount; i += 8)
+	{
+		const v128u32 srcColorLo = vld1q_u32((u32 *)(src + i + 0));
+		const v128u32 srcColorHi = vld1q_u32((u32 *)(src + i + 4));
 
-					this->_renderNeedsFlushMain = false;
-					this->_renderNeedsFlush16 = false;
-				}
-				else if (dstFramebufferMain != NULL)
-				{
-					ColorspaceConvertBuffer8888To6665<false, false>((u32 *)srcFramebuffer, (u32 *)dstFramebufferMain, this->_framebufferPixCount);
-					this->_renderNeedsFlushMain = false;
-				}
-				else
-				{
-					ColorspaceConvertBuffer8888To5551<false, false>((u32 *)srcFramebuffer, dstFramebuffer16, this->_framebufferPixCount);
-					this->_renderNeedsFlush16 = false;
-				}
-			}
-			else if (this->_outputFormat == NDSColorFormat_BGR888_Rev)
-			{
-				if ( (dstFramebufferMain != NULL) && (dstFramebuffer16 != NULL) )
-				{
-#ifdef ENABLE_SSE2
-					const size_t ssePixCount = this->_framebufferPixCount - (this->_framebufferPixCount % 8);
-					for (; i < ssePixCount; i += 8)
-					{
-						const __m128i srcColorLo = _mm_load_si128((__m128i *)(srcFramebuffer + i + 0));
-						const __m128i srcColorHi = _mm_load_si128((__m128i *)(srcFramebuffer + i + 4));
+		if (OUTPUT_6665)
+		{
+			vst1q_u32( (u32 *)(dstMain + i + 0), ColorspaceConvert8888To6665_NEON<SWAP_RB>(srcColorLo) );
+			vst1q_u32( (u32 *)(dstMain + i + 4), ColorspaceConvert8888To6665_NEON<SWAP_RB>(srcColorHi) );
+		}
+		else
+		{
+			vst1q_u32( (u32 *)(dstMain + i + 0), ColorspaceCopy32_NEON<SWAP_RB>(srcColorLo) );
+			vst1q_u32( (u32 *)(dstMain + i + 4), ColorspaceCopy32_NEON<SWAP_RB>(srcColorHi) );
+		}
 
-						_mm_store_si128((__m128i *)(dstFramebufferMain + i + 0), ColorspaceCopy32_SSE2<false>(srcColorLo));
-						_mm_store_si128((__m128i *)(dstFramebufferMain + i + 4), ColorspaceCopy32_SSE2<false>(srcColorHi));
-						_mm_store_si128( (__m128i *)(dstFramebuffer16 + i), ColorspaceConvert8888To5551_SSE2<false>(srcColorLo, srcColorHi) );
-					}
+		vst1q_u16( dst16 + i, ColorspaceConvert8888To5551_NEON<SWAP_RB>(srcColorLo, srcColorHi) );
+	}
 
 #pragma LOOPVECTORIZE_DISABLE
 #endif
-					for (; i < this->_framebufferPixCount; i++)
-					{
-						dstFramebufferMain[i].value = ColorspaceCopy32<false>(srcFramebuffer[i]);
-						dstFramebuffer16[i]         = ColorspaceConvert8888To5551<false>(srcFramebuffer[i]);
-					}
+	for (; i < pixCount; i++)
+	{
+		dstMain[i].value = (OUTPUT_6665) ? ColorspaceConvert8888To6665<SWAP_RB>(src[i]) : ColorspaceCopy32<SWAP_RB>(src[i]);
+		dst16[i]         = ColorspaceConvert8888To5551<SWAP_RB>(src[i]);
+	}
+}
 
-					this->_renderNeedsFlushMain = false;
-					this->_renderNeedsFlush16 = false;
-				}
-				else if (dstFramebufferMain != NULL)
-				{
-					ColorspaceCopyBuffer32<false, false>((u32 *)srcFramebuffer, (u32 *)dstFramebufferMain, this->_framebufferPixCount);
-					this->_renderNeedsFlushMain = false;
-				}
-				else
-				{
-					ColorspaceConvertBuffer8888To5551<false, false>((u32 *)srcFramebuffer, dstFramebuffer16, this->_framebufferPixCount);
-					this->_renderNeedsFlush16 = false;
-				}
-			}
-		}
+// OpenGL stores pixels using a flipped Y-coordinate. If the GPU couldn't flip the
+// framebuffer, then it needs to be flipped back to the DS Y-coordinate here.
+template <bool FLIP, bool SWAP_RB, bool OUTPUT_6665, bool WRITE_MAIN, bool WRITE_16>
+static void FlushFramebufferKernel(const Color4u8 *__restrict src, Color4u8 *__restrict dstMain, u16 *__restrict dst16,
+								   const size_t width, const size_t height, const size_t lineIndex, const size_t lineCount)
+{
+	if (!FLIP)
+	{
+		const size_t firstPixel = lineIndex * width;
+		FlushFramebufferConvertPixels<SWAP_RB, OUTPUT_6665, WRITE_MAIN, WRITE_16>(src + firstPixel,
+																				 (WRITE_MAIN) ? dstMain + firstPixel : NULL,
+																				 (WRITE_16) ? dst16 + firstPixel : NULL,
+																				 lineCount * width);
+		return;
 	}
-	else // In the case where OpenGL couldn't flip the framebuffer on the GPU, we'll instead need to flip the framebuffer during conversion.
+
+	for (size_t y = 0, ir = lineIndex * width, iw = (height - 1 - lineIndex) * width; y < lineCount; y++, ir += width, iw -= width)
 	{
-		const size_t pixCount = this->_framebufferWidth;
+		FlushFramebufferConvertPixels<SWAP_RB, OUTPUT_6665, WRITE_MAIN, WRITE_16>(src + ir,
+																				 (WRITE_MAIN) ? dstMain + iw : NULL,
+																				 (WRITE_16) ? dst16 + iw : NULL,
+																				 width);
+	}
+}
 
-		if (!doFramebufferConvert)
-		{
-			if ( (dstFramebufferMain != NULL) && (dstFramebuffer16 != NULL) )
-			{
-				for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-				{
-					size_t x = 0;
-#ifdef ENABLE_SSE2
-					const size_t ssePixCount = pixCount - (pixCount % 8);
-					for (; x < ssePixCount; x += 8, ir += 8, iw += 8)
-					{
-						const __m128i srcColorLo = _mm_load_si128((__m128i *)(srcFramebuffer + ir + 0));
-						const __m128i srcColorHi = _mm_load_si128((__m128i *)(srcFramebuffer + ir + 4));
+#define OGL_FLUSH_KERNEL_GROUP(OUTPUT_6665, WRITE_MAIN, WRITE_16) \
+	&FlushFramebufferKernel<false, false, OUTPUT_6665, WRITE_MAIN, WRITE_16>, \
+	&FlushFramebufferKernel<true,  false, OUTPUT_6665, WRITE_MAIN, WRITE_16>, \
+	&FlushFramebufferKernel<false, true,  OUTPUT_6665, WRITE_MAIN, WRITE_16>, \
+	&FlushFramebufferKernel<true,  true,  OUTPUT_6665, WRITE_MAIN, WRITE_16>
+
+// Indexed by OGLFlushKernelIndex().
+static const OGLFlushFramebufferKernel _flushFramebufferKernelTable[32] = {
+	OGL_FLUSH_KERNEL_GROUP(false, false, false),
+	OGL_FLUSH_KERNEL_GROUP(true,  false, false),
+	OGL_FLUSH_KERNEL_GROUP(false, true,  false),
+	OGL_FLUSH_KERNEL_GROUP(true,  true,  false),
+	OGL_FLUSH_KERNEL_GROUP(false, false, true),
+	OGL_FLUSH_KERNEL_GROUP(true,  false, true),
+	OGL_FLUSH_KERNEL_GROUP(false, true,  true),
+	OGL_FLUSH_KERNEL_GROUP(true,  true,  true)
+};
 
-						_mm_store_si128( (__m128i *)(dstFramebufferMain + iw + 0), ColorspaceCopy32_SSE2<true>(srcColorLo) );
-						_mm_store_si128( (__m128i *)(dstFramebufferMain + iw + 4), ColorspaceCopy32_SSE2<true>(srcColorHi) );
-						_mm_store_si128( (__m128i *)(dstFramebuffer16 + iw), ColorspaceConvert8888To5551_SSE2<true>(srcColorLo, srcColorHi) );
-					}
+#undef OGL_FLUSH_KERNEL_GROUP
 
-#pragma LOOPVECTORIZE_DISABLE
-#endif
-					for (; x < pixCount; x++, ir++, iw++)
-					{
-						dstFramebufferMain[iw].value = ColorspaceCopy32<true>(srcFramebuffer[ir]);
-						dstFramebuffer16[iw]         = ColorspaceConvert8888To5551<true>(srcFramebuffer[ir]);
-					}
-				}
+static FORCEINLINE size_t OGLFlushKernelIndex(const bool doFlip, const bool swapRB, const bool output6665, const bool writeMain, const bool write16)
+{
+	return ((doFlip)     ? 0x01 : 0) |
+	       ((swapRB)     ? 0x02 : 0) |
+	       ((output6665) ? 0x04 : 0) |
+	       ((writeMain)  ? 0x08 : 0) |
+	       ((write16)    ? 0x10 : 0);
+}
 
-				this->_renderNeedsFlushMain = false;
-				this->_renderNeedsFlush16 = false;
-			}
-			else if (dstFramebufferMain != NULL)
-			{
-				for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-				{
-					ColorspaceCopyBuffer32<true, false>((u32 *)srcFramebuffer + ir, (u32 *)dstFramebufferMain + iw, pixCount);
-				}
-
-				this->_renderNeedsFlushMain = false;
-			}
-			else
-			{
-				for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-				{
-					ColorspaceConvertBuffer8888To5551<true, false>((u32 *)srcFramebuffer + ir, dstFramebuffer16 + iw, pixCount);
-				}
-
-				this->_renderNeedsFlush16 = false;
-			}
-		}
-		else
-		{
-			if (this->_outputFormat == NDSColorFormat_BGR666_Rev)
-			{
-				if ( (dstFramebufferMain != NULL) && (dstFramebuffer16 != NULL) )
-				{
-					for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-					{
-						size_t x = 0;
-#ifdef ENABLE_SSE2
-						const size_t ssePixCount = pixCount - (pixCount % 8);
-						for (; x < ssePixCount; x += 8, ir += 8, iw += 8)
-						{
-							const __m128i srcColorLo = _mm_load_si128((__m128i *)(srcFramebuffer + ir + 0));
-							const __m128i srcColorHi = _mm_load_si128((__m128i *)(srcFramebuffer + ir + 4));
-
-							_mm_store_si128( (__m128i *)(dstFramebufferMain + iw + 0), ColorspaceConvert8888To6665_SSE2<false>(srcColorLo) );
-							_mm_store_si128( (__m128i *)(dstFramebufferMain + iw + 4), ColorspaceConvert8888To6665_SSE2<false>(srcColorHi) );
-							_mm_store_si128( (__m128i *)(dstFramebuffer16 + iw), ColorspaceConvert8888To5551_SSE2<false>(srcColorLo, srcColorHi) );
-						}
-
-#pragma LOOPVECTORIZE_DISABLE
-#endif
-						for (; x < pixCount; x++, ir++, iw++)
-						{
-							dstFramebufferMain[iw].value = ColorspaceConvert8888To6665<false>(srcFramebuffer[ir]);
-							dstFramebuffer16[iw]         = ColorspaceConvert8888To5551<false>(srcFramebuffer[ir]);
-						}
-					}
-
-					this->_renderNeedsFlushMain = false;
-					this->_renderNeedsFlush16 = false;
-				}
-				else if (dstFramebufferMain != NULL)
-				{
-					for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-					{
-						ColorspaceConvertBuffer8888To6665<false, false>((u32 *)srcFramebuffer + ir, (u32 *)dstFramebufferMain + iw, pixCount);
-					}
-
-					this->_renderNeedsFlushMain = false;
-				}
-				else
-				{
-					for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-					{
-						ColorspaceConvertBuffer8888To5551<false, false>((u32 *)srcFramebuffer + ir, dstFramebuffer16 + iw, pixCount);
-					}
-
-					this->_renderNeedsFlush16 = false;
-				}
-			}
-			else if (this->_outputFormat == NDSColorFormat_BGR888_Rev)
-			{
-				if ( (dstFramebufferMain != NULL) && (dstFramebuffer16 != NULL) )
-				{
-					for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-					{
-						size_t x = 0;
-#ifdef ENABLE_SSE2
-						const size_t ssePixCount = pixCount - (pixCount % 8);
-						for (; x < ssePixCount; x += 8, ir += 8, iw += 8)
-						{
-							const __m128i srcColorLo = _mm_load_si128((__m128i *)(srcFramebuffer + ir + 0));
-							const __m128i srcColorHi = _mm_load_si128((__m128i *)(srcFramebuffer + ir + 4));
-
-							_mm_store_si128((__m128i *)(dstFramebufferMain + iw + 0), ColorspaceCopy32_SSE2<false>(srcColorLo));
-							_mm_store_si128((__m128i *)(dstFramebufferMain + iw + 4), ColorspaceCopy32_SSE2<false>(srcColorHi));
-							_mm_store_si128( (__m128i *)(dstFramebuffer16 + iw), ColorspaceConvert8888To5551_SSE2<false>(srcColorLo, srcColorHi) );
-						}
-
-#pragma LOOPVECTORIZE_DISABLE
-#endif
-						for (; x < pixCount; x++, ir++, iw++)
-						{
-							dstFramebufferMain[iw].value = ColorspaceCopy32<false>(srcFramebuffer[ir]);
-							dstFramebuffer16[iw]         = ColorspaceConvert8888To5551<false>(srcFramebuffer[ir]);
-						}
-					}
-
-					this->_renderNeedsFlushMain = false;
-					this->_renderNeedsFlush16 = false;
-				}
-				else if (dstFramebufferMain != NULL)
-				{
-					for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-					{
-						ColorspaceCopyBuffer32<false, false>((u32 *)srcFramebuffer + ir, (u32 *)dstFramebufferMain + iw, pixCount);
-					}
-
-					this->_renderNeedsFlushMain = false;
-				}
-				else
-				{
-					for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-					{
-						ColorspaceConvertBuffer8888To5551<false, false>((u32 *)srcFramebuffer + ir, dstFramebuffer16 + iw, pixCount);
-					}
-
-					this->_renderNeedsFlush16 = false;
-				}
-			}
-		}
-	}
+static void* OpenGLRenderer_FlushFramebufferThread(void *arg)
+{
+	OGLFlushFramebufferThreadParam *param = (OGLFlushFramebufferThreadParam *)arg;
+	param->kernel(param->srcFramebuffer, param->dstFramebufferMain, param->dstFramebuffer16,
+				  param->framebufferWidth, param->framebufferHeight, param->lineIndex, param->lineCount);
 
-	return RENDER3DERROR_NOERR;
+	return NULL;
 }
 
-Render3DError OpenGLRenderer::_FlushFramebufferFlipAndConvertOnCPU(const Color4u8 *__restrict srcFramebuffer,
-																   Color4u8 *__restrict dstFramebufferMain, u16 *__restrict dstFramebuffer16,
-																   bool doFramebufferFlip, bool doFramebufferConvert)
+Render3DError OpenGLRenderer::FlushFramebuffer(const Color4u8 *__restrict srcFramebuffer, Color4u8 *__restrict dstFramebufferMain, u16 *__restrict dstFramebuffer16)
 {
-	if ( ((dstFramebufferMain == NULL) && (dstFramebuffer16 == NULL)) || (srcFramebuffer == NULL) )
+	if (this->willFlipAndConvertFramebufferOnGPU && this->isPBOSupported)
 	{
-		return RENDER3DERROR_NOERR;
-	}
-
-	// Convert from 32-bit BGRA8888 format to 32-bit RGBA6665 reversed format. OpenGL
-	// stores pixels using a flipped Y-coordinate, so this needs to be flipped back
-	// to the DS Y-coordinate.
-
-    const bool swaprb = this->readFormat != GL_BGRA;
-
-	size_t i = 0;
+		// The main framebuffer is used straight from the PBO, so the output framebuffer is stale.
+		this->_pendingFlushLinesMain.lineFirst = 0;
+		this->_pendingFlushLinesMain.lineEnd = this->_framebufferHeight;
+		this->_pendingFlushLines16.lineEnd = 0;
 
-	if (!doFramebufferFlip)
+		this->_renderNeedsFlushMain = false;
+		return Render3D::FlushFramebuffer(srcFramebuffer, NULL, dstFramebuffer16);
+	}
+	else
 	{
-		if (!doFramebufferConvert)
+		if ( ((dstFramebufferMain == NULL) && (dstFramebuffer16 == NULL)) || (srcFramebuffer == NULL) )
 		{
-			if ( (dstFramebufferMain != NULL) && (dstFramebuffer16 != NULL) )
-			{
-#ifdef ENABLE_SSE2
-				const size_t ssePixCount = this->_framebufferPixCount - (this->_framebufferPixCount % 8);
-				for (; i < ssePixCount; i += 8)
-				{
-					const __m128i srcColorLo = _mm_load_si128((__m128i *)(srcFramebuffer + i + 0));
-					const __m128i srcColorHi = _mm_load_si128((__m128i *)(srcFramebuffer + i + 4));
-
-					_mm_store_si128((__m128i *)(dstFramebufferMain + i + 0), ColorspaceCopy32_SSE2<false>(srcColorLo));
-					_mm_store_si128((__m128i *)(dstFramebufferMain + i + 4), ColorspaceCopy32_SSE2<false>(srcColorHi));
-					_mm_store_si128( (__m128i *)(dstFramebuffer16 + i), ColorspaceConvert8888To5551_SSE2<false>(srcColorLo, srcColorHi) );
-				}
-
-#pragma LOOPVECTORIZE_DISABLE
-#endif
-				for (; i < this->_framebufferPixCount; i++)
-				{
-					dstFramebufferMain[i].value = ColorspaceCopy32<false>(srcFramebuffer[i]);
-					dstFramebuffer16[i]         = ColorspaceConvert8888To5551<false>(srcFramebuffer[i]);
-				}
-
-				this->_renderNeedsFlushMain = false;
-				this->_renderNeedsFlush16 = false;
-			}
-			else if (dstFramebufferMain != NULL)
-			{
-				ColorspaceCopyBuffer32<false, false>((u32 *)srcFramebuffer, (u32 *)dstFramebufferMain, this->_framebufferPixCount);
-				this->_renderNeedsFlushMain = false;
-			}
-			else
-			{
-				ColorspaceConvertBuffer8888To5551<false, false>((u32 *)srcFramebuffer, dstFramebuffer16, this->_framebufferPixCount);
-				this->_renderNeedsFlush16 = false;
-			}
+			return RENDER3DERROR_NOERR;
 		}
-		else
-		{
-			if (this->_outputFormat == NDSColorFormat_BGR666_Rev)
-			{
-				if ( (dstFramebufferMain != NULL) && (dstFramebuffer16 != NULL) )
-				{
-#ifdef ENABLE_SSE2
-					const size_t ssePixCount = this->_framebufferPixCount - (this->_framebufferPixCount % 8);
-					for (; i < ssePixCount; i += 8)
-					{
-						const __m128i srcColorLo = _mm_load_si128((__m128i *)(srcFramebuffer + i + 0));
-						const __m128i srcColorHi = _mm_load_si128((__m128i *)(srcFramebuffer + i + 4));
-
-						_mm_store_si128( (__m128i *)(dstFramebufferMain + i + 0), ColorspaceConvert8888To6665_SSE2<true>(srcColorLo) );
-						_mm_store_si128( (__m128i *)(dstFramebufferMain + i + 4), ColorspaceConvert8888To6665_SSE2<true>(srcColorHi) );
-						_mm_store_si128( (__m128i *)(dstFramebuffer16 + i), ColorspaceConvert8888To5551_SSE2<true>(srcColorLo, srcColorHi) );
-					}
 
-#pragma LOOPVECTORIZE_DISABLE
-#endif
-					for (; i < this->_framebufferPixCount; i++)
-					{
-						dstFramebufferMain[i].value = ColorspaceConvert8888To6665<true>(srcFramebuffer[i]);
-						dstFramebuffer16[i]         = ColorspaceConvert8888To5551<true>(srcFramebuffer[i]);
-					}
+		const bool doFramebufferFlip = !this->willFlipOnlyFramebufferOnGPU;
+		const bool doFramebufferConvert = !this->willFlipAndConvertFramebufferOnGPU;
 
-					this->_renderNeedsFlushMain = false;
-					this->_renderNeedsFlush16 = false;
-				}
-				else if (dstFramebufferMain != NULL)
-				{
-					ColorspaceConvertBuffer8888To6665<true, false>((u32 *)srcFramebuffer, (u32 *)dstFramebufferMain, this->_framebufferPixCount);
-					this->_renderNeedsFlushMain = false;
-				}
-				else
-				{
-					ColorspaceConvertBuffer8888To5551<true, false>((u32 *)srcFramebuffer, dstFramebuffer16, this->_framebufferPixCount);
-					this->_renderNeedsFlush16 = false;
-				}
-			}
-			else if (this->_outputFormat == NDSColorFormat_BGR888_Rev)
-			{
-				if ( (dstFramebufferMain != NULL) && (dstFramebuffer16 != NULL) )
-				{
-#ifdef ENABLE_SSE2
-					const size_t ssePixCount = this->_framebufferPixCount - (this->_framebufferPixCount % 8);
-					for (; i < ssePixCount; i += 8)
-					{
-						const __m128i srcColorLo = _mm_load_si128((__m128i *)(srcFramebuffer + i + 0));
-						const __m128i srcColorHi = _mm_load_si128((__m128i *)(srcFramebuffer + i + 4));
+		// The framebuffer is read back as either BGRA or RGBA depending on what the driver
+		// supports. Converting to the output format requires swapping R and B from BGRA,
+		// while leaving the framebuffer unconverted requires swapping R and B from RGBA.
+		const bool isReadFormatRGBA = (this->readFormat != GL_BGRA);
+		const bool swapRB = (doFramebufferConvert != isReadFormatRGBA);
+		const bool output6665 = doFramebufferConvert && (this->_outputFormat == NDSColorFormat_BGR666_Rev);
 
-						_mm_store_si128((__m128i *)(dstFramebufferMain + i + 0), ColorspaceCopy32_SSE2<true>(srcColorLo));
-						_mm_store_si128((__m128i *)(dstFramebufferMain + i + 4), ColorspaceCopy32_SSE2<true>(srcColorHi));
-						_mm_store_si128( (__m128i *)(dstFramebuffer16 + i), ColorspaceConvert8888To5551_SSE2<true>(srcColorLo, srcColorHi) );
-					}
+		const OGLFlushFramebufferKernel kernel = _flushFramebufferKernelTable[OGLFlushKernelIndex(doFramebufferFlip, swapRB, output6665, (dstFramebufferMain != NULL), (dstFramebuffer16 != NULL))];
 
-#pragma LOOPVECTORIZE_DISABLE
-#endif
-					for (; i < this->_framebufferPixCount; i++)
-					{
-						dstFramebufferMain[i].value = ColorspaceCopy32<true>(srcFramebuffer[i]);
-						dstFramebuffer16[i]         = ColorspaceConvert8888To5551<true>(srcFramebuffer[i]);
-					}
+		// Only convert the lines that changed since the output framebuffers were last flushed.
+		OGLLineRange flushLines;
+		flushLines.lineFirst = 0;
+		flushLines.lineEnd = 0;
 
-					this->_renderNeedsFlushMain = false;
-					this->_renderNeedsFlush16 = false;
-				}
-				else if (dstFramebufferMain != NULL)
-				{
-					ColorspaceCopyBuffer32<true, false>((u32 *)srcFramebuffer, (u32 *)dstFramebufferMain, this->_framebufferPixCount);
-					this->_renderNeedsFlushMain = false;
-				}
-				else
-				{
-					ColorspaceConvertBuffer8888To5551<true, false>((u32 *)srcFramebuffer, dstFramebuffer16, this->_framebufferPixCount);
-					this->_renderNeedsFlush16 = false;
-				}
-			}
+		if (dstFramebufferMain != NULL)
+		{
+			flushLines = OGLLineRangeUnion(flushLines, this->_pendingFlushLinesMain);
 		}
-	}
-	else // In the case where OpenGL couldn't flip the framebuffer on the GPU, we'll instead need to flip the framebuffer during conversion.
-	{
-		const size_t pixCount = this->_framebufferWidth;
 
-		if (!doFramebufferConvert)
+		if (dstFramebuffer16 != NULL)
 		{
-			if ( (dstFramebufferMain != NULL) && (dstFramebuffer16 != NULL) )
-			{
-				for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-				{
-					size_t x = 0;
-#ifdef ENABLE_SSE2
-					const size_t ssePixCount = pixCount - (pixCount % 8);
-					for (; x < ssePixCount; x += 8, ir += 8, iw += 8)
-					{
-						const __m128i srcColorLo = _mm_load_si128((__m128i *)(srcFramebuffer + ir + 0));
-						const __m128i srcColorHi = _mm_load_si128((__m128i *)(srcFramebuffer + ir + 4));
+			flushLines = OGLLineRangeUnion(flushLines, this->_pendingFlushLines16);
+		}
 
-						_mm_store_si128( (__m128i *)(dstFramebufferMain + iw + 0), ColorspaceCopy32_SSE2<false>(srcColorLo) );
-						_mm_store_si128( (__m128i *)(dstFramebufferMain + iw + 4), ColorspaceCopy32_SSE2<false>(srcColorHi) );
-						_mm_store_si128( (__m128i *)(dstFramebuffer16 + iw), ColorspaceConvert8888To5551_SSE2<false>(srcColorLo, srcColorHi) );
-					}
+		const size_t flushLineCount = (OGLLineRangeIsEmpty(flushLines)) ? 0 : flushLines.lineEnd - flushLines.lineFirst;
 
-#pragma LOOPVECTORIZE_DISABLE
-#endif
-					for (; x < pixCount; x++, ir++, iw++)
-					{
-						dstFramebufferMain[iw].value = ColorspaceCopy32<false>(srcFramebuffer[ir]);
-						dstFramebuffer16[iw]         = ColorspaceConvert8888To5551<false>(srcFramebuffer[ir]);
-					}
-				}
+		if (flushLineCount == 0)
+		{
+			// Nothing changed, so the output framebuffers are already up to date.
+		}
+		else if ( (this->_flushThreadCount > 1) && ((flushLineCount * this->_framebufferWidth) >= OGLRENDER_FLUSH_THREADING_MIN_PIXELS) )
+		{
+			// Split the lines into bands, one for each thread. Any leftover lines go to the
+			// last band.
+			const size_t linesPerBand = flushLineCount / this->_flushThreadCount;
 
-				this->_renderNeedsFlushMain = false;
-				this->_renderNeedsFlush16 = false;
-			}
-			else if (dstFramebufferMain != NULL)
+			for (size_t i = 0; i < this->_flushThreadCount; i++)
 			{
-				for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-				{
-					ColorspaceCopyBuffer32<false, false>((u32 *)srcFramebuffer + ir, (u32 *)dstFramebufferMain + iw, pixCount);
-				}
-
-				this->_renderNeedsFlushMain = false;
+				OGLFlushFramebufferThreadParam &param = this->_flushThreadParam[i];
+				param.kernel = kernel;
+				param.srcFramebuffer = srcFramebuffer;
+				param.dstFramebufferMain = dstFramebufferMain;
+				param.dstFramebuffer16 = dstFramebuffer16;
+				param.framebufferWidth = this->_framebufferWidth;
+				param.framebufferHeight = this->_framebufferHeight;
+				param.lineIndex = flushLines.lineFirst + (i * linesPerBand);
+				param.lineCount = (i < this->_flushThreadCount - 1) ? linesPerBand : flushLines.lineEnd - param.lineIndex;
+
+				this->_flushTask[i].execute(&OpenGLRenderer_FlushFramebufferThread, &param);
 			}
-			else
-			{
-				for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-				{
-					ColorspaceConvertBuffer8888To5551<false, false>((u32 *)srcFramebuffer + ir, dstFramebuffer16 + iw, pixCount);
-				}
 
-				this->_renderNeedsFlush16 = false;
+			for (size_t i = 0; i < this->_flushThreadCount; i++)
+			{
+				this->_flushTask[i].finish();
 			}
 		}
 		else
 		{
-			if (this->_outputFormat == NDSColorFormat_BGR666_Rev)
-			{
-				if ( (dstFramebufferMain != NULL) && (dstFramebuffer16 != NULL) )
-				{
-					for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-					{
-						size_t x = 0;
-#ifdef ENABLE_SSE2
-						const size_t ssePixCount = pixCount - (pixCount % 8);
-						for (; x < ssePixCount; x += 8, ir += 8, iw += 8)
-						{
-							const __m128i srcColorLo = _mm_load_si128((__m128i *)(srcFramebuffer + ir + 0));
-							const __m128i srcColorHi = _mm_load_si128((__m128i *)(srcFramebuffer + ir + 4));
-
-							_mm_store_si128( (__m128i *)(dstFramebufferMain + iw + 0), ColorspaceConvert8888To6665_SSE2<true>(srcColorLo) );
-							_mm_store_si128( (__m128i *)(dstFramebufferMain + iw + 4), ColorspaceConvert8888To6665_SSE2<true>(srcColorHi) );
-							_mm_store_si128( (__m128i *)(dstFramebuffer16 + iw), ColorspaceConvert8888To5551_SSE2<true>(srcColorLo, srcColorHi) );
-						}
-
-#pragma LOOPVECTORIZE_DISABLE
-#endif
-						for (; x < pixCount; x++, ir++, iw++)
-						{
-							dstFramebufferMain[iw].value = ColorspaceConvert8888To6665<true>(srcFramebuffer[ir]);
-							dstFramebuffer16[iw]         = ColorspaceConvert8888To5551<true>(srcFramebuffer[ir]);
-						}
-					}
-
-					this->_renderNeedsFlushMain = false;
-					this->_renderNeedsFlush16 = false;
-				}
-				else if (dstFramebufferMain != NULL)
-				{
-					for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-					{
-						ColorspaceConvertBuffer8888To6665<true, false>((u32 *)srcFramebuffer + ir, (u32 *)dstFramebufferMain + iw, pixCount);
-					}
-
-					this->_renderNeedsFlushMain = false;
-				}
-				else
-				{
-					for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-					{
-						ColorspaceConvertBuffer8888To5551<true, false>((u32 *)srcFramebuffer + ir, dstFramebuffer16 + iw, pixCount);
-					}
-
-					this->_renderNeedsFlush16 = false;
-				}
-			}
-			else if (this->_outputFormat == NDSColorFormat_BGR888_Rev)
-			{
-				if ( (dstFramebufferMain != NULL) && (dstFramebuffer16 != NULL) )
-				{
-					for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-					{
-						size_t x = 0;
-#ifdef ENABLE_SSE2
-						const size_t ssePixCount = pixCount - (pixCount % 8);
-						for (; x < ssePixCount; x += 8, ir += 8, iw += 8)
-						{
-							const __m128i srcColorLo = _mm_load_si128((__m128i *)(srcFramebuffer + ir + 0));
-							const __m128i srcColorHi = _mm_load_si128((__m128i *)(srcFramebuffer + ir + 4));
-
-							_mm_store_si128((__m128i *)(dstFramebufferMain + iw + 0), ColorspaceCopy32_SSE2<true>(srcColorLo));
-							_mm_store_si128((__m128i *)(dstFramebufferMain + iw + 4), ColorspaceCopy32_SSE2<true>(srcColorHi));
-							_mm_store_si128( (__m128i *)(dstFramebuffer16 + iw), ColorspaceConvert8888To5551_SSE2<true>(srcColorLo, srcColorHi) );
-						}
-
-#pragma LOOPVECTORIZE_DISABLE
-#endif
-						for (; x < pixCount; x++, ir++, iw++)
-						{
-							dstFramebufferMain[iw].value = ColorspaceCopy32<true>(srcFramebuffer[ir]);
-							dstFramebuffer16[iw]         = ColorspaceConvert8888To5551<true>(srcFramebuffer[ir]);
-						}
-					}
-
-					this->_renderNeedsFlushMain = false;
-					this->_renderNeedsFlush16 = false;
-				}
-				else if (dstFramebufferMain != NULL)
-				{
-					for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-					{
-						ColorspaceCopyBuffer32<true, false>((u32 *)srcFramebuffer + ir, (u32 *)dstFramebufferMain + iw, pixCount);
-					}
+			kernel(srcFramebuffer, dstFramebufferMain, dstFramebuffer16, this->_framebufferWidth, this->_framebufferHeight, flushLines.lineFirst, flushLineCount);
+		}
 
-					this->_renderNeedsFlushMain = false;
-				}
-				else
-				{
-					for (size_t y = 0, ir = 0, iw = ((this->_framebufferHeight - 1) * this->_framebufferWidth); y < this->_framebufferHeight; y++, ir += this->_framebufferWidth, iw -= this->_framebufferWidth)
-					{
-						ColorspaceConvertBuffer8888To5551<true, false>((u32 *)srcFramebuffer + ir, dstFramebuffer16 + iw, pixCount);
-					}
+		if (dstFramebufferMain != NULL)
+		{
+			this->_pendingFlushLinesMain.lineEnd = 0;
+			this->_renderNeedsFlushMain = false;
+		}
 
-					this->_renderNeedsFlush16 = false;
-				}
-			}
+		if (dstFramebuffer16 != NULL)
+		{
+			this->_pendingFlushLines16.lineEnd = 0;
+			this->_renderNeedsFlush16 = false;
 		}
 	}
 
 	return RENDER3DERROR_NOERR;
 }
 
-Render3DError OpenGLRenderer::FlushFramebuffer(const Color4u8 *__restrict srcFramebuffer, Color4u8 *__restrict dstFramebufferMain, u16 *__restrict dstFramebuffer16)
+Color4u8* OpenGLRenderer::GetFramebuffer()
 {
-	if (this->willFlipAndConvertFramebufferOnGPU && this->isPBOSupported)
+	this->_wasLastFrameConsumed = true;
+
+	// The readback for this frame may have been deferred, so make sure that it's done
+	// before handing out the framebuffer.
+	if (this->_pixelReadNeedsStart)
 	{
-		this->_renderNeedsFlushMain = false;
-		return Render3D::FlushFramebuffer(srcFramebuffer, NULL, dstFramebuffer16);
+		this->RenderFinish();
 	}
-	else
+
+	if (this->isPBOSupported && (this->_framebufferReadMode == OGLFramebufferReadMode_Dual))
 	{
-        if (this->readFormat != GL_BGRA) {
-            return this->_FlushFramebufferFlipAndConvertOnCPU_RGBA(srcFramebuffer,
-														  dstFramebufferMain, dstFramebuffer16,
-														  !this->willFlipOnlyFramebufferOnGPU, !this->willFlipAndConvertFramebufferOnGPU);
-        }
-        else {
-		    return this->_FlushFramebufferFlipAndConvertOnCPU(srcFramebuffer,
-														  dstFramebufferMain, dstFramebuffer16,
-														  !this->willFlipOnlyFramebufferOnGPU, !this->willFlipAndConvertFramebufferOnGPU);
-        }
+		return this->_mappedFramebuffer;
 	}
 
-	return RENDER3DERROR_NOERR;
-}
-
-Color4u8* OpenGLRenderer::GetFramebuffer()
-{
-	return (this->willFlipAndConvertFramebufferOnGPU && this->isPBOSupported) ? this->_mappedFramebuffer : GPU->GetEngineMain()->Get3DFramebufferMain();
+	return (this->willFlipAndConvertFramebufferOnGPU && this->isPBOSupported && (this->_framebufferReadMode == OGLFramebufferReadMode_Color)) ? this->_mappedFramebuffer : GPU->GetEngineMain()->Get3DFramebufferMain();
 }
 
 GLsizei OpenGLRenderer::GetLimitedMultisampleSize() const
@@ -2035,2222 +2341,4503 @@ GLsizei OpenGLRenderer::GetLimitedMultisampleSize() const
 	return (GLsizei)deviceMultisamples;
 }
 
-OpenGLTexture* OpenGLRenderer::GetLoadedTextureFromPolygon(const POLY &thePoly, bool enableTexturing)
+const OpenGLStateCache& OpenGLRenderer::GetStateCache() const
 {
-	OpenGLTexture *theTexture = (OpenGLTexture *)texCache.GetTexture(thePoly.texParam, thePoly.texPalette);
-	const bool isNewTexture = (theTexture == NULL);
+	return this->_glState;
+}
 
-	if (isNewTexture)
-	{
-		theTexture = new OpenGLTexture(thePoly.texParam, thePoly.texPalette);
-		theTexture->SetUnpackBuffer(this->_workingTextureUnpackBuffer);
+void OpenGLRenderer::SetEnableOpaquePolySorting(const bool enable)
+{
+	this->_enableOpaquePolySorting = enable;
+}
 
-		texCache.Add(theTexture);
-	}
+bool OpenGLRenderer::GetEnableOpaquePolySorting() const
+{
+	return this->_enableOpaquePolySorting;
+}
 
-	const NDSTextureFormat packFormat = theTexture->GetPackFormat();
-	const bool isTextureEnabled = ( (packFormat != TEXMODE_NONE) && enableTexturing );
+size_t OpenGLRenderer::GetOpaquePolySortDrawsSaved() const
+{
+	return this->_opaquePolySortDrawsSaved;
+}
 
-	theTexture->SetSamplingEnabled(isTextureEnabled);
+// When enabled, a frame whose hash matches the last rendered frame skips all GPU work and
+// reuses the last framebuffer. The hash is a 64-bit non-cryptographic hash, so a collision
+// would silently show a stale frame. This is off by default for that reason.
+void OpenGLRenderer::SetEnableFrameMemoization(const bool enable)
+{
+	this->_enableFrameMemoization = enable;
+	this->_isLastFrameHashValid = false;
+}
 
-	if (theTexture->IsLoadNeeded() && isTextureEnabled)
-	{
-		const size_t previousScalingFactor = theTexture->GetScalingFactor();
+bool OpenGLRenderer::GetEnableFrameMemoization() const
+{
+	return this->_enableFrameMemoization;
+}
 
-		theTexture->SetDeposterizeBuffer(this->_workingTextureUnpackBuffer, this->_textureDeposterizeDstSurface.workingSurface[0]);
-		theTexture->SetUpscalingBuffer(this->_textureUpscaleBuffer);
+const OGLRenderStats& OpenGLRenderer::GetRenderStats() const
+{
+	return this->_renderStats;
+}
 
-		theTexture->SetUseDeposterize(this->_enableTextureDeposterize);
-		theTexture->SetScalingFactor(this->_textureScalingFactor);
+// Hints whether the frames rendered from now on will be consumed by the host. Readbacks are
+// always deferred until RenderFinish(). If this is false, then RenderFinish() skips the
+// readback too, and it only happens if the frame is actually requested through RenderFlush(),
+// GetFramebuffer() or AcquireFramebuffer(). This is useful for frameskip, fast-forward and
+// headless runs.
+void OpenGLRenderer::SetFrameWillBeConsumed(const bool willBeConsumed)
+{
+	this->_willFrameBeConsumed = willBeConsumed;
+}
 
-		theTexture->Load(isNewTexture || (previousScalingFactor != this->_textureScalingFactor));
-	}
-
-	return theTexture;
+bool OpenGLRenderer::GetFrameWillBeConsumed() const
+{
+	return this->_willFrameBeConsumed;
 }
 
-template <OGLPolyDrawMode DRAWMODE>
-size_t OpenGLRenderer::DrawPolygonsForIndexRange(const POLY *rawPolyList, const CPoly *clippedPolyList, const size_t clippedPolyCount, size_t firstIndex, size_t lastIndex, size_t &indexOffset, POLYGON_ATTR &lastPolyAttr)
+// When enabled, only the framebuffer lines that may have changed since they were last flushed
+// are read back and converted, and the output framebuffers are updated in place.
+void OpenGLRenderer::SetEnablePartialReadBack(const bool enable)
 {
-	OGLRenderRef &OGLRef = *this->ref;
+	this->_enablePartialReadBack = enable;
+	this->_InvalidateDirtyLines();
+}
 
-	if (lastIndex > (clippedPolyCount - 1))
-	{
-		lastIndex = clippedPolyCount - 1;
-	}
+bool OpenGLRenderer::GetEnablePartialReadBack() const
+{
+	return this->_enablePartialReadBack;
+}
 
-	if (firstIndex > lastIndex)
-	{
-		return 0;
-	}
+// When enabled, attachments whose contents won't be read again are invalidated with
+// glInvalidateFramebuffer(), which saves tile-based GPUs from writing them back to memory.
+// The invalidated attachments are reported in the render stats.
+void OpenGLRenderer::SetEnableAttachmentInvalidation(const bool enable)
+{
+	this->_enableAttachmentInvalidation = enable;
+}
 
-	// Map GFX3D_QUADS and GFX3D_QUAD_STRIP to GL_TRIANGLES since we will convert them.
-	//
-	// Also map GFX3D_TRIANGLE_STRIP to GL_TRIANGLES. This is okay since this is actually
-	// how the POLY struct stores triangle strip vertices, which is in sets of 3 vertices
-	// each. This redefinition is necessary since uploading more than 3 indices at a time
-	// will cause glDrawElements() to draw the triangle strip incorrectly.
-	static const GLenum oglPrimitiveType[]	= {
-		GL_TRIANGLES, GL_TRIANGLES, GL_TRIANGLES, GL_TRIANGLES, GL_LINE_LOOP, GL_LINE_LOOP, GL_LINE_STRIP, GL_LINE_STRIP, // Normal polygons
-		GL_LINE_LOOP, GL_LINE_LOOP, GL_LINE_LOOP, GL_LINE_LOOP, GL_LINE_LOOP, GL_LINE_LOOP, GL_LINE_LOOP, GL_LINE_LOOP    // Wireframe polygons
-	};
+bool OpenGLRenderer::GetEnableAttachmentInvalidation() const
+{
+	return this->_enableAttachmentInvalidation;
+}
 
-	static const GLsizei indexIncrementLUT[] = {
-		3, 6, 3, 6, 3, 4, 3, 4, // Normal polygons
-		3, 4, 3, 4, 3, 4, 3, 4  // Wireframe polygons
-	};
+// Lets the host identify the clear image sources by a generation number, which it must change
+// whenever texture slots 2 and 3 or the rear-plane offset change. If the generation is the same
+// as for the last uploaded clear image, then ClearUsingImage() skips preparing and uploading it.
+// Pass 0 if the host doesn't track this, which falls back to comparing the clear image contents.
+void OpenGLRenderer::SetClearImageGeneration(const u64 generation)
+{
+	this->_clearImageGeneration = generation;
+}
 
-	// Set up the initial polygon
-	const CPoly &initialClippedPoly = clippedPolyList[firstIndex];
-	const POLY &initialRawPoly = rawPolyList[initialClippedPoly.index];
-	TEXIMAGE_PARAM lastTexParams = initialRawPoly.texParam;
-	u32 lastTexPalette = initialRawPoly.texPalette;
-	GFX3D_Viewport lastViewport = initialRawPoly.viewport;
+u64 OpenGLRenderer::GetClearImageGeneration() const
+{
+	return this->_clearImageGeneration;
+}
 
-	this->SetupTexture(initialRawPoly, firstIndex);
-	this->SetupViewport(initialRawPoly.viewport);
+// When enabled, depth-equals polygons are tested in the fragment shader against a copy of the
+// depth buffer, instead of with the multipass stencil test. This is off by default, and should
+// only be turned on for drivers where it has been checked against the multipass output.
+void OpenGLRenderer::SetEnableSinglePassDepthEqualTest(const bool enable)
+{
+	this->_enableSinglePassDepthEqualTest = enable;
+}
 
-	// Enumerate through all polygons and render
-	GLsizei vertIndexCount = 0;
-	GLushort *indexBufferPtr = (this->isVBOSupported) ? (GLushort *)NULL + indexOffset : OGLRef.vertIndexBuffer + indexOffset;
+bool OpenGLRenderer::GetEnableSinglePassDepthEqualTest() const
+{
+	return this->_enableSinglePassDepthEqualTest;
+}
 
-	for (size_t i = firstIndex; i <= lastIndex; i++)
-	{
-		const CPoly &clippedPoly = clippedPolyList[i];
-		const POLY &rawPoly = rawPolyList[clippedPoly.index];
+bool OpenGLRenderer::IsSinglePassDepthEqualTestSupported() const
+{
+	return this->_isSinglePassDepthEqualTestSupported;
+}
 
-		// Set up the polygon if it changed
-		if (lastPolyAttr.value != rawPoly.attribute.value)
-		{
-			lastPolyAttr = rawPoly.attribute;
-			this->SetupPolygon(rawPoly, (DRAWMODE != OGLPolyDrawMode_DrawOpaquePolys), (DRAWMODE != OGLPolyDrawMode_ZeroAlphaPass), clippedPoly.isPolyBackFacing);
-		}
+// When enabled, opaque polygons that can't discard any fragments are drawn with geometry programs
+// that don't discard or write gl_FragDepth, so that the GPU can do early depth testing for them.
+// These programs take their depth straight from the rasterizer. To keep that depth consistent
+// with every other polygon, they're only used when nothing else writes gl_FragDepth either, which
+// means that the NDS depth calculation emulation and fog must both be disabled.
+void OpenGLRenderer::SetEnableEarlyZOpaquePolygons(const bool enable)
+{
+	this->_enableEarlyZOpaquePolygons = enable;
+}
 
-		// Set up the texture if it changed
-		if (lastTexParams.value != rawPoly.texParam.value || lastTexPalette != rawPoly.texPalette)
-		{
-			lastTexParams = rawPoly.texParam;
-			lastTexPalette = rawPoly.texPalette;
-			this->SetupTexture(rawPoly, i);
-		}
+bool OpenGLRenderer::GetEnableEarlyZOpaquePolygons() const
+{
+	return this->_enableEarlyZOpaquePolygons;
+}
 
-		// Set up the viewport if it changed
-		if (lastViewport.value != rawPoly.viewport.value)
-		{
-			lastViewport = rawPoly.viewport;
-			this->SetupViewport(rawPoly.viewport);
-		}
+// When enabled, frames are always read back already flipped and converted to the output
+// format, so that they can be borrowed straight from the PBO with AcquireFramebuffer().
+void OpenGLRenderer::SetEnableZeroCopyFramebuffer(const bool enable)
+{
+	this->_enableZeroCopyFramebuffer = enable;
+}
 
-		// In wireframe mode, redefine all primitives as GL_LINE_LOOP rather than
-		// setting the polygon mode to GL_LINE though glPolygonMode(). Not only is
-		// drawing more accurate this way, but it also allows GFX3D_QUADS and
-		// GFX3D_QUAD_STRIP primitives to properly draw as wireframe without the
-		// extra diagonal line.
-		const size_t LUTIndex = (!GFX3D_IsPolyWireframe(rawPoly)) ? rawPoly.vtxFormat : (0x08 | rawPoly.vtxFormat);
-		const GLenum polyPrimitive = oglPrimitiveType[LUTIndex];
+bool OpenGLRenderer::GetEnableZeroCopyFramebuffer() const
+{
+	return this->_enableZeroCopyFramebuffer;
+}
 
-		// Increment the vertex count
-		vertIndexCount += indexIncrementLUT[LUTIndex];
+// Lends out the mapped PBO that holds the current frame, which is already flipped and converted
+// to the output format. The buffer stays valid while more frames are rendered, up until it's
+// returned with ReleaseFramebuffer(). At most OGLRENDER_PBO_RING_SIZE - 1 frames may be
+// borrowed at once. Returns NULL if the current frame can't be lent out, in which case the
+// caller should use the regular output framebuffer instead.
+const Color4u8* OpenGLRenderer::AcquireFramebuffer()
+{
+	this->_wasLastFrameConsumed = true;
 
-		// Look ahead to the next polygon to see if we can simply buffer the indices
-		// instead of uploading them now. We can buffer if all polygon states remain
-		// the same and we're not drawing a line loop or line strip.
-		if (i+1 <= lastIndex)
-		{
-			const CPoly &nextClippedPoly = clippedPolyList[i+1];
-			const POLY &nextRawPoly = rawPolyList[nextClippedPoly.index];
+	if (this->_pixelReadNeedsStart)
+	{
+		this->RenderFinish();
+	}
 
-			if (lastPolyAttr.value == nextRawPoly.attribute.value &&
-				lastTexParams.value == nextRawPoly.texParam.value &&
-				lastTexPalette == nextRawPoly.texPalette &&
-				lastViewport.value == nextRawPoly.viewport.value &&
-				polyPrimitive == oglPrimitiveType[nextRawPoly.vtxFormat] &&
-				polyPrimitive != GL_LINE_LOOP &&
-				polyPrimitive != GL_LINE_STRIP &&
-				oglPrimitiveType[nextRawPoly.vtxFormat] != GL_LINE_LOOP &&
-				oglPrimitiveType[nextRawPoly.vtxFormat] != GL_LINE_STRIP &&
-				clippedPoly.isPolyBackFacing == nextClippedPoly.isPolyBackFacing)
-			{
-				continue;
-			}
-		}
+	const bool isReadBackInOutputFormat = (this->_framebufferReadMode == OGLFramebufferReadMode_Dual) ||
+	                                      ((this->_framebufferReadMode == OGLFramebufferReadMode_Color) && this->willFlipAndConvertFramebufferOnGPU);
 
-		// Render the polygons
-		this->SetPolygonIndex(i);
+	if (!this->isPBOSupported || !isReadBackInOutputFormat || (this->_mappedFramebuffer == NULL))
+	{
+		return NULL;
+	}
 
-		if (rawPoly.attribute.Mode == POLYGON_MODE_SHADOW)
-		{
-			if ((DRAWMODE != OGLPolyDrawMode_ZeroAlphaPass) && this->_emulateShadowPolygon)
-			{
-				this->DrawShadowPolygon(polyPrimitive,
-				                        vertIndexCount,
-				                        indexBufferPtr,
-				                        rawPoly.attribute.DepthEqualTest_Enable,
-				                        rawPoly.attribute.TranslucentDepthWrite_Enable,
-				                        (DRAWMODE == OGLPolyDrawMode_DrawTranslucentPolys), rawPoly.attribute.PolygonID);
-			}
-		}
-		else if ( (rawPoly.texParam.PackedFormat == TEXMODE_A3I5) || (rawPoly.texParam.PackedFormat == TEXMODE_A5I3) )
+	if (!this->_isPBOBorrowed[this->_pboRingIndex])
+	{
+		// Always leave at least one PBO free for the next readback.
+		size_t borrowCount = 0;
+		for (size_t i = 0; i < OGLRENDER_PBO_RING_SIZE; i++)
 		{
-			this->DrawAlphaTexturePolygon<DRAWMODE>(polyPrimitive,
-			                                        vertIndexCount,
-			                                        indexBufferPtr,
-			                                        rawPoly.attribute.DepthEqualTest_Enable,
-			                                        rawPoly.attribute.TranslucentDepthWrite_Enable,
-			                                        GFX3D_IsPolyWireframe(rawPoly) || GFX3D_IsPolyOpaque(rawPoly),
-			                                        rawPoly.attribute.PolygonID,
-													!clippedPoly.isPolyBackFacing);
+			borrowCount += (this->_isPBOBorrowed[i]) ? 1 : 0;
 		}
-		else
+
+		if (borrowCount >= (OGLRENDER_PBO_RING_SIZE - 1))
 		{
-			this->DrawOtherPolygon<DRAWMODE>(polyPrimitive,
-			                                 vertIndexCount,
-			                                 indexBufferPtr,
-			                                 rawPoly.attribute.DepthEqualTest_Enable,
-			                                 rawPoly.attribute.TranslucentDepthWrite_Enable,
-			                                 rawPoly.attribute.PolygonID,
-											 !clippedPoly.isPolyBackFacing);
+			return NULL;
 		}
 
-		indexBufferPtr += vertIndexCount;
-		indexOffset += vertIndexCount;
-		vertIndexCount = 0;
+		this->_isPBOBorrowed[this->_pboRingIndex] = true;
 	}
 
-	return indexOffset;
+	return this->_mappedFramebuffer;
 }
 
-template <OGLPolyDrawMode DRAWMODE>
-Render3DError OpenGLRenderer::DrawAlphaTexturePolygon(const GLenum polyPrimitive,
-													  const GLsizei vertIndexCount,
-													  const GLushort *indexBufferPtr,
-													  const bool performDepthEqualTest,
-													  const bool enableAlphaDepthWrite,
-													  const bool canHaveOpaqueFragments,
-													  const u8 opaquePolyID,
-													  const bool isPolyFrontFacing)
+// Returns a framebuffer borrowed with AcquireFramebuffer(). The PBO is unmapped on the next
+// readback. Although this doesn't call into OpenGL, the borrow flags are not synchronized
+// with the readback, so this must be called from the same thread that renders, in between
+// frames. A consumer on another thread needs to hand the buffer back to that thread first.
+void OpenGLRenderer::ReleaseFramebuffer(const Color4u8 *framebuffer)
 {
-	const OGLRenderRef &OGLRef = *this->ref;
+	if (framebuffer == NULL)
+	{
+		return;
+	}
 
+	if (framebuffer == this->_mappedFramebuffer)
 	{
-		if ((DRAWMODE != OGLPolyDrawMode_ZeroAlphaPass) && performDepthEqualTest && this->_emulateNDSDepthCalculation)
-		{
-			if (DRAWMODE == OGLPolyDrawMode_DrawTranslucentPolys)
-			{
-				glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-				glDepthMask(GL_FALSE);
+		this->_isPBOBorrowed[this->_pboRingIndex] = false;
+		return;
+	}
 
-				// Use the stencil buffer to determine which fragments pass the lower-side tolerance.
-				glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], (float)DEPTH_EQUALS_TEST_TOLERANCE / 16777215.0f);
-				glDepthFunc(GL_LEQUAL);
-				glStencilFunc(GL_ALWAYS, 0x80, 0x80);
-				glStencilOp(GL_ZERO, GL_ZERO, GL_REPLACE);
-				glStencilMask(0x80);
+	for (size_t i = 0; i < OGLRENDER_PBO_RING_SIZE; i++)
+	{
+		if (framebuffer == this->_pboRetiredMapping[i])
+		{
+			this->_isPBOBorrowed[i] = false;
+			return;
+		}
+	}
+}
 
-				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+// Sets how many frames may be in flight at once. At a depth of 1, each frame's readback is
+// delivered by the following RenderFinish(). At higher depths, frames are delivered that many
+// frames late, which gives the GPU that much more time to finish each readback so that the
+// CPU never waits on it. This trades a fixed amount of latency for throughput when GPU-bound.
+void OpenGLRenderer::SetFramePipelineDepth(const size_t depth)
+{
+	this->_framePipelineDepth = (depth < 1) ? 1 : ((depth > OGLRENDER_MAX_FRAME_PIPELINE_DEPTH) ? OGLRENDER_MAX_FRAME_PIPELINE_DEPTH : depth);
+}
 
-				if (canHaveOpaqueFragments)
-				{
-					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_TRUE);
-					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
-					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_FALSE);
-				}
+size_t OpenGLRenderer::GetFramePipelineDepth() const
+{
+	return this->_framePipelineDepth;
+}
 
-				// Use the stencil buffer to determine which fragments pass the higher-side tolerance.
-				glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], (float)-DEPTH_EQUALS_TEST_TOLERANCE / 16777215.0f);
-				glDepthFunc(GL_GEQUAL);
-				glStencilFunc(GL_EQUAL, 0x80, 0x80);
-				glStencilOp(GL_ZERO, GL_ZERO, GL_KEEP);
-				glStencilMask(0x80);
+// When enabled, every rendered frame is also copied into one of a set of textures that GPU
+// consumers can use directly, such as encoders and compositors. Combined with
+// SetFrameWillBeConsumed(false), the readback can be skipped entirely. The textures are
+// triple-buffered so that a consumer can hold one frame while the next one is written.
+// This must be called while the renderer's OpenGL context can be made current.
+//
+// Frame export is disabled by default. The EGL image and dma-buf export paths haven't been
+// exercised against a real consumer yet, so treat them as experimental.
+Render3DError OpenGLRenderer::SetEnableFrameExport(const bool enable)
+{
+	if (enable == this->_enableFrameExport)
+	{
+		return OGLERROR_NOERR;
+	}
 
-				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+	if (!BEGINGL())
+	{
+		return OGLERROR_BEGINGL_FAILED;
+	}
 
-				if (canHaveOpaqueFragments)
-				{
-					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_TRUE);
-					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
-					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_FALSE);
-				}
+	Render3DError error = OGLERROR_NOERR;
 
-				// Set up the actual drawing of the polygon, using the mask within the stencil buffer to determine which fragments should pass.
-				glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], 0.0f);
-				glDepthFunc(GL_ALWAYS);
+	if (enable)
+	{
+		error = this->CreateFrameExportResources();
+		this->_enableFrameExport = (error == OGLERROR_NOERR);
+	}
+	else
+	{
+		this->DestroyFrameExportResources();
+		this->_enableFrameExport = false;
+	}
 
-				// First do the transparent polygon ID check for the translucent fragments.
-				glStencilFunc(GL_NOTEQUAL, 0x40 | opaquePolyID, 0x7F);
-				glStencilOp(GL_ZERO, GL_ZERO, GL_KEEP);
-				glStencilMask(0x80);
-				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+	ENDGL();
 
-				// Draw the translucent fragments.
-				glStencilFunc(GL_EQUAL, 0xC0 | opaquePolyID, 0x80);
-				glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-				glStencilMask(0x7F);
-				glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-				glDepthMask((enableAlphaDepthWrite) ? GL_TRUE : GL_FALSE);
+	return error;
+}
 
-				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+bool OpenGLRenderer::GetEnableFrameExport() const
+{
+	return this->_enableFrameExport;
+}
 
-				// Draw the opaque fragments if they might exist.
-				if (canHaveOpaqueFragments)
-				{
-					glStencilFunc(GL_EQUAL, 0x80 | opaquePolyID, 0x80);
-					glDepthMask(GL_TRUE);
-					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_TRUE);
-					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
-					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_FALSE);
-				}
+// Hands out the most recently exported frame. The frame's texture won't be written to again
+// until it's returned with ReleaseExportedFrame(). Consumers must wait on the frame's fence
+// before reading from it. Returns false if no frame has been exported yet. The in-use flags
+// are not synchronized with the export, so this must be called from the render thread.
+bool OpenGLRenderer::AcquireExportedFrame(OGLExportedFrame &outFrame)
+{
+	if (!this->_enableFrameExport || (this->_exportLatestIndex >= OGLRENDER_EXPORT_TEXTURE_COUNT))
+	{
+		return false;
+	}
 
-				// Clear bit 7 (0x80) now so that future polygons don't get confused.
-				glStencilFunc(GL_ALWAYS, 0x80, 0x80);
-				glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
-				glStencilMask(0x80);
-				glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-				glDepthMask(GL_FALSE);
+	this->_isExportInUse[this->_exportLatestIndex] = true;
+	outFrame = this->_exportedFrame[this->_exportLatestIndex];
 
-				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+	return true;
+}
 
-				if (canHaveOpaqueFragments)
-				{
-					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_TRUE);
-					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
-					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_FALSE);
-				}
+// Returns a frame handed out by AcquireExportedFrame(). The consumer must be done reading
+// from it. Like AcquireExportedFrame(), this must be called from the render thread, in
+// between frames, even though it doesn't call into OpenGL.
+void OpenGLRenderer::ReleaseExportedFrame(const size_t index)
+{
+	if (index < OGLRENDER_EXPORT_TEXTURE_COUNT)
+	{
+		this->_isExportInUse[index] = false;
+	}
+}
 
-				// Finally, reset the rendering states.
-				glStencilFunc(GL_NOTEQUAL, 0x40 | opaquePolyID, 0x7F);
-				glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-				glStencilMask(0xFF);
-				glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-				glDepthMask((enableAlphaDepthWrite) ? GL_TRUE : GL_FALSE);
-			}
-			else
-			{
-				glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-				glDepthMask(GL_FALSE);
+// Mixes a block of memory into a running 64-bit hash. This isn't meant to be cryptographically
+// strong, just fast enough to run over an entire geometry list every frame.
+static u64 HashFrameData(u64 hash, const void *data, const size_t dataSize)
+{
+	const u8 *dataBytes = (const u8 *)data;
+	size_t i = 0;
 
-				glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_TRUE);
+	for (; i + sizeof(u64) <= dataSize; i += sizeof(u64))
+	{
+		u64 word;
+		memcpy(&word, dataBytes + i, sizeof(u64));
 
-				// Use the stencil buffer to determine which fragments pass the lower-side tolerance.
-				glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], (float)DEPTH_EQUALS_TEST_TOLERANCE / 16777215.0f);
-				glDepthFunc(GL_LEQUAL);
-				glStencilFunc(GL_ALWAYS, 0x80, 0x80);
-				glStencilOp(GL_ZERO, GL_ZERO, GL_REPLACE);
-				glStencilMask(0x80);
-				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+		hash ^= word;
+		hash *= 0x9E3779B97F4A7C15ULL;
+		hash ^= hash >> 32;
+	}
 
-				// Use the stencil buffer to determine which fragments pass the higher-side tolerance.
-				glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], (float)-DEPTH_EQUALS_TEST_TOLERANCE / 16777215.0f);
-				glDepthFunc(GL_GEQUAL);
-				glStencilFunc(GL_EQUAL, 0x80, 0x80);
-				glStencilOp(GL_ZERO, GL_ZERO, GL_KEEP);
-				glStencilMask(0x80);
-				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+	for (; i < dataSize; i++)
+	{
+		hash ^= dataBytes[i];
+		hash *= 0x100000001B3ULL;
+	}
 
-				// Set up the actual drawing of the polygon, using the mask within the stencil buffer to determine which fragments should pass.
-				glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], 0.0f);
-				glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-				glDepthMask(GL_TRUE);
-				glDepthFunc(GL_ALWAYS);
-				glStencilFunc(GL_EQUAL, 0x80 | opaquePolyID, 0x80);
-				glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-				glStencilMask(0x7F);
+	return hash;
+}
 
-				// Draw the polygon as completely opaque.
-				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+// Hashes everything that affects the framebuffer outside of the polygons themselves, which is
+// the renderer settings, the render states and the clear image.
+u64 OpenGLRenderer::_ComputeBackgroundHash(const GFX3D_State &renderState) const
+{
+	u64 hash = 0xCBF29CE484222325ULL;
+
+	// Renderer settings that change the output image.
+	struct
+	{
+		u64 framebufferWidth;
+		u64 framebufferHeight;
+		u64 outputFormat;
+		u64 textureScalingFactor;
+		u8 enableEdgeMark;
+		u8 enableFog;
+		u8 enableTextureSampling;
+		u8 enableTextureSmoothing;
+		u8 enableTextureDeposterize;
+		u8 enableMultisampledRendering;
+		u8 emulateDepthLEqualPolygonFacing;
+		u8 emulateNDSDepthCalculation;
+		u8 emulateShadowPolygon;
+		u8 emulateSpecialZeroAlphaBlending;
+		u64 selectedMultisampleSize;
+	} settings;
+
+	memset(&settings, 0, sizeof(settings));
+	settings.framebufferWidth = this->_framebufferWidth;
+	settings.framebufferHeight = this->_framebufferHeight;
+	settings.outputFormat = this->_outputFormat;
+	settings.textureScalingFactor = this->_textureScalingFactor;
+	settings.enableEdgeMark = (this->_enableEdgeMark) ? 1 : 0;
+	settings.enableFog = (this->_enableFog) ? 1 : 0;
+	settings.enableTextureSampling = (this->_enableTextureSampling) ? 1 : 0;
+	settings.enableTextureSmoothing = (this->_enableTextureSmoothing) ? 1 : 0;
+	settings.enableTextureDeposterize = (this->_enableTextureDeposterize) ? 1 : 0;
+	settings.enableMultisampledRendering = (this->_enableMultisampledRendering) ? 1 : 0;
+	settings.emulateDepthLEqualPolygonFacing = (this->_emulateDepthLEqualPolygonFacing) ? 1 : 0;
+	settings.emulateNDSDepthCalculation = (this->_emulateNDSDepthCalculation) ? 1 : 0;
+	settings.emulateShadowPolygon = (this->_emulateShadowPolygon) ? 1 : 0;
+	settings.emulateSpecialZeroAlphaBlending = (this->_emulateSpecialZeroAlphaBlending) ? 1 : 0;
+	settings.selectedMultisampleSize = (u64)this->_selectedMultisampleSize;
+
+	hash = HashFrameData(hash, &settings, sizeof(settings));
+	hash = HashFrameData(hash, &renderState, sizeof(GFX3D_State));
+
+	// The clear image lives in texture VRAM, so it can change without anything else changing.
+	if (renderState.DISP3DCNT.RearPlaneMode)
+	{
+		hash = HashFrameData(hash, MMU.texInfo.textureSlotAddr[2], 256 * 256 * sizeof(u16));
+		hash = HashFrameData(hash, MMU.texInfo.textureSlotAddr[3], 256 * 256 * sizeof(u16));
+	}
+
+	return hash;
+}
 
-				// Clear bit 7 (0x80) now so that future polygons don't get confused.
-				glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-				glDepthMask(GL_FALSE);
+u64 OpenGLRenderer::_ComputeFrameHash(const u64 backgroundHash, const GFX3D_GeometryList &renderGList) const
+{
+	u64 hash = backgroundHash;
 
-				glStencilFunc(GL_ALWAYS, 0x80, 0x80);
-				glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
-				glStencilMask(0x80);
-				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+	// The geometry list itself.
+	const u64 listCounts[4] = { renderGList.rawVertCount, renderGList.rawPolyCount, renderGList.clippedPolyCount, renderGList.clippedPolyOpaqueCount };
+	hash = HashFrameData(hash, listCounts, sizeof(listCounts));
+	hash = HashFrameData(hash, renderGList.rawVtxList, renderGList.rawVertCount * sizeof(NDSVertex));
+	hash = HashFrameData(hash, renderGList.rawPolyList, renderGList.rawPolyCount * sizeof(POLY));
 
-				// Finally, reset the rendering states.
-				glStencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
-				glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-				glStencilMask(0xFF);
-				glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-				glDepthMask(GL_TRUE);
-
-				glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_FALSE);
-			}
-		}
-		else if (DRAWMODE != OGLPolyDrawMode_DrawOpaquePolys)
-		{
-			// Draw the translucent fragments.
-			if (this->_emulateDepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported && isPolyFrontFacing)
-			{
-				glDepthFunc(GL_EQUAL);
-				glUniform1i(OGLRef.uniformDrawModeDepthEqualsTest[this->_geometryProgramFlags.value], GL_TRUE);
-				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+	for (size_t i = 0; i < renderGList.clippedPolyCount; i++)
+	{
+		const CPoly &cPoly = renderGList.clippedPolyList[i];
+		const u64 clippedPolyKey = ((u64)cPoly.index << 1) | ((cPoly.isPolyBackFacing) ? 1 : 0);
+		hash = HashFrameData(hash, &clippedPolyKey, sizeof(clippedPolyKey));
+	}
 
-				glDepthFunc(GL_LESS);
-				glUniform1i(OGLRef.uniformDrawModeDepthEqualsTest[this->_geometryProgramFlags.value], GL_FALSE);
-			}
-			glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+	return hash;
+}
 
-			// Draw the opaque fragments if they might exist.
-			if (canHaveOpaqueFragments)
-			{
-				if (DRAWMODE != OGLPolyDrawMode_ZeroAlphaPass)
-				{
-					glStencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
-					glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-					glDepthMask(GL_TRUE);
-				}
+OpenGLTexture* OpenGLRenderer::GetLoadedTextureFromPolygon(const POLY &thePoly, bool enableTexturing)
+{
+	OpenGLTexture *theTexture = (OpenGLTexture *)texCache.GetTexture(thePoly.texParam, thePoly.texPalette);
+	const bool isNewTexture = (theTexture == NULL);
 
-				glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_TRUE);
-				if (this->_emulateDepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported && isPolyFrontFacing)
-				{
-					glDepthFunc(GL_EQUAL);
-					glUniform1i(OGLRef.uniformDrawModeDepthEqualsTest[this->_geometryProgramFlags.value], GL_TRUE);
-					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+	if (isNewTexture)
+	{
+		theTexture = new OpenGLTexture(thePoly.texParam, thePoly.texPalette);
+		theTexture->SetUnpackBuffer(this->_workingTextureUnpackBuffer);
+		theTexture->SetStateCache(&this->_glState);
 
-					glDepthFunc(GL_LESS);
-					glUniform1i(OGLRef.uniformDrawModeDepthEqualsTest[this->_geometryProgramFlags.value], GL_FALSE);
-				}
-				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
-				glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_FALSE);
+		texCache.Add(theTexture);
+	}
 
-				if (DRAWMODE != OGLPolyDrawMode_ZeroAlphaPass)
-				{
-					glStencilFunc(GL_NOTEQUAL, 0x40 | opaquePolyID, 0x7F);
-					glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-					glDepthMask((enableAlphaDepthWrite) ? GL_TRUE : GL_FALSE);
-				}
-			}
-		}
-		else // Draw the polygon as completely opaque.
-		{
-			glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_TRUE);
+	const NDSTextureFormat packFormat = theTexture->GetPackFormat();
+	const bool isTextureEnabled = ( (packFormat != TEXMODE_NONE) && enableTexturing );
 
-			if (this->_emulateDepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported)
-			{
-				if (isPolyFrontFacing)
-				{
-					glDepthFunc(GL_EQUAL);
-					glStencilFunc(GL_EQUAL, 0x40 | opaquePolyID, 0x40);
-					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+	theTexture->SetSamplingEnabled(isTextureEnabled);
 
-					glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-					glDepthMask(GL_FALSE);
-					glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
-					glStencilMask(0x40);
-					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+	if (theTexture->IsLoadNeeded() && isTextureEnabled)
+	{
+		const size_t previousScalingFactor = theTexture->GetScalingFactor();
 
-					glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-					glDepthMask(GL_TRUE);
-					glDepthFunc(GL_LESS);
-					glStencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
-					glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-					glStencilMask(0xFF);
-					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
-				}
-				else
-				{
-					glStencilFunc(GL_ALWAYS, 0x40 | opaquePolyID, 0x40);
-					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+		theTexture->SetDeposterizeBuffer(this->_workingTextureUnpackBuffer, this->_textureDeposterizeDstSurface.workingSurface[0]);
+		theTexture->SetUpscalingBuffer(this->_textureUpscaleBuffer);
 
-					glStencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
-				}
-			}
-			else
-			{
-				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
-			}
+		theTexture->SetUseDeposterize(this->_enableTextureDeposterize);
+		theTexture->SetScalingFactor(this->_textureScalingFactor);
 
-			glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_FALSE);
-		}
+		theTexture->Load(isNewTexture || (previousScalingFactor != this->_textureScalingFactor));
+		this->_textureLoadCount++;
 	}
 
-	return OGLERROR_NOERR;
+	return theTexture;
 }
 
-template <OGLPolyDrawMode DRAWMODE>
-Render3DError OpenGLRenderer::DrawOtherPolygon(const GLenum polyPrimitive,
-											   const GLsizei vertIndexCount,
-											   const GLushort *indexBufferPtr,
-											   const bool performDepthEqualTest,
-											   const bool enableAlphaDepthWrite,
-											   const u8 opaquePolyID,
-											   const bool isPolyFrontFacing)
+// Returns a conservative bounding rectangle of the polygon in native window coordinates.
+// Returns false if the polygon crosses the w = 0 plane, in which case its bounds are unknown.
+static bool GetPolyWindowBounds(const POLY &rawPoly, const NDSVertex *vtxList, s32 &outMinX, s32 &outMinY, s32 &outMaxX, s32 &outMaxY)
 {
-	OGLRenderRef &OGLRef = *this->ref;
+	float minX =  1.0f;
+	float minY =  1.0f;
+	float maxX = -1.0f;
+	float maxY = -1.0f;
 
-	if ((DRAWMODE != OGLPolyDrawMode_ZeroAlphaPass) && performDepthEqualTest && this->_emulateNDSDepthCalculation)
+	for (size_t j = 0; j < rawPoly.type; j++)
 	{
-		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-		glDepthMask(GL_FALSE);
+		const NDSVertex &vtx = vtxList[rawPoly.vertIndexes[j]];
+		if (vtx.position.w <= 0)
+		{
+			return false;
+		}
 
-		// Use the stencil buffer to determine which fragments pass the lower-side tolerance.
-		glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], (float)DEPTH_EQUALS_TEST_TOLERANCE / 16777215.0f);
-		glDepthFunc(GL_LEQUAL);
-		glStencilFunc(GL_ALWAYS, 0x80, 0x80);
-		glStencilOp(GL_ZERO, GL_ZERO, GL_REPLACE);
-		glStencilMask(0x80);
-		glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+		const float x = (float)vtx.position.x / (float)vtx.position.w;
+		const float y = (float)vtx.position.y / (float)vtx.position.w;
+		minX = (x < minX) ? x : minX;
+		minY = (y < minY) ? y : minY;
+		maxX = (x > maxX) ? x : maxX;
+		maxY = (y > maxY) ? y : maxY;
+	}
 
-		// Use the stencil buffer to determine which fragments pass the higher-side tolerance.
-		glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], (float)-DEPTH_EQUALS_TEST_TOLERANCE / 16777215.0f);
-		glDepthFunc(GL_GEQUAL);
-		glStencilFunc(GL_EQUAL, 0x80, 0x80);
-		glStencilOp(GL_ZERO, GL_ZERO, GL_KEEP);
-		glStencilMask(0x80);
-		glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+	// GL clips everything outside of the viewport, so the bounds never need to extend past it.
+	minX = (minX < -1.0f) ? -1.0f : minX;
+	minY = (minY < -1.0f) ? -1.0f : minY;
+	maxX = (maxX >  1.0f) ?  1.0f : maxX;
+	maxY = (maxY >  1.0f) ?  1.0f : maxY;
 
-		// Set up the actual drawing of the polygon.
-		glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], 0.0f);
-		glDepthFunc(GL_ALWAYS);
+	// Pad by a pixel on each side to stay clear of any rasterization differences.
+	outMinX = (s32)floorf( (float)rawPoly.viewport.x + ((minX + 1.0f) * 0.5f * (float)rawPoly.viewport.width ) ) - 1;
+	outMinY = (s32)floorf( (float)rawPoly.viewport.y + ((minY + 1.0f) * 0.5f * (float)rawPoly.viewport.height) ) - 1;
+	outMaxX = (s32)ceilf(  (float)rawPoly.viewport.x + ((maxX + 1.0f) * 0.5f * (float)rawPoly.viewport.width ) ) + 1;
+	outMaxY = (s32)ceilf(  (float)rawPoly.viewport.y + ((maxY + 1.0f) * 0.5f * (float)rawPoly.viewport.height) ) + 1;
 
-		// If this is a transparent polygon, then we need to do the transparent polygon ID check.
-		if (DRAWMODE == OGLPolyDrawMode_DrawTranslucentPolys)
-		{
-			glStencilFunc(GL_NOTEQUAL, 0x40 | opaquePolyID, 0x7F);
-			glStencilOp(GL_ZERO, GL_ZERO, GL_KEEP);
-			glStencilMask(0x80);
-			glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
-		}
+	return true;
+}
 
-		// Draw the polygon using the mask within the stencil buffer to determine which fragments should pass.
-		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-		glDepthMask(((DRAWMODE == OGLPolyDrawMode_DrawOpaquePolys) || enableAlphaDepthWrite) ? GL_TRUE : GL_FALSE);
+static FORCEINLINE bool OGLLineRangeIsEmpty(const OGLLineRange &range)
+{
+	return (range.lineEnd <= range.lineFirst);
+}
 
-		glStencilFunc(GL_EQUAL, (DRAWMODE == OGLPolyDrawMode_DrawTranslucentPolys) ? 0xC0 | opaquePolyID : 0x80 | opaquePolyID, 0x80);
-		glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-		glStencilMask(0x7F);
-		glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+static FORCEINLINE OGLLineRange OGLLineRangeUnion(const OGLLineRange &rangeA, const OGLLineRange &rangeB)
+{
+	if (OGLLineRangeIsEmpty(rangeA))
+	{
+		return rangeB;
+	}
+	else if (OGLLineRangeIsEmpty(rangeB))
+	{
+		return rangeA;
+	}
 
-		// Clear bit 7 (0x80) now so that future polygons don't get confused.
-		glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-		glDepthMask(GL_FALSE);
+	OGLLineRange newRange;
+	newRange.lineFirst = (rangeA.lineFirst < rangeB.lineFirst) ? rangeA.lineFirst : rangeB.lineFirst;
+	newRange.lineEnd   = (rangeA.lineEnd   > rangeB.lineEnd)   ? rangeA.lineEnd   : rangeB.lineEnd;
 
-		glStencilFunc(GL_ALWAYS, 0x80, 0x80);
-		glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
-		glStencilMask(0x80);
-		glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+	return newRange;
+}
 
-		// Finally, reset the rendering states.
-		if (DRAWMODE == OGLPolyDrawMode_DrawTranslucentPolys)
-		{
-			glStencilFunc(GL_NOTEQUAL, 0x40 | opaquePolyID, 0x7F);
-		}
-		else
+static FORCEINLINE bool OGLLineRangeContains(const OGLLineRange &outerRange, const OGLLineRange &innerRange)
+{
+	return OGLLineRangeIsEmpty(innerRange) || ( (outerRange.lineFirst <= innerRange.lineFirst) && (innerRange.lineEnd <= outerRange.lineEnd) );
+}
+
+// Returns the framebuffer lines covered by all of this frame's polygons. If any polygon has
+// unknown bounds, then every line is returned.
+OGLLineRange OpenGLRenderer::_ComputePolyLines(const NDSVertex *vtxList) const
+{
+	OGLLineRange polyLines;
+	polyLines.lineFirst = 0;
+	polyLines.lineEnd = 0;
+
+	s32 minY = GPU_FRAMEBUFFER_NATIVE_HEIGHT;
+	s32 maxY = 0;
+
+	for (size_t i = 0; i < this->_clippedPolyCount; i++)
+	{
+		const POLY &rawPoly = this->_rawPolyList[this->_clippedPolyList[i].index];
+		s32 polyMinX, polyMinY, polyMaxX, polyMaxY;
+
+		if (!GetPolyWindowBounds(rawPoly, vtxList, polyMinX, polyMinY, polyMaxX, polyMaxY))
 		{
-			glStencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
+			polyLines.lineEnd = this->_framebufferHeight;
+			return polyLines;
 		}
 
-		glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-		glStencilMask(0xFF);
-		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-		glDepthMask(((DRAWMODE == OGLPolyDrawMode_DrawOpaquePolys) || enableAlphaDepthWrite) ? GL_TRUE : GL_FALSE);
+		minY = (polyMinY < minY) ? polyMinY : minY;
+		maxY = (polyMaxY > maxY) ? polyMaxY : maxY;
 	}
-	else if (DRAWMODE == OGLPolyDrawMode_DrawOpaquePolys)
+
+	minY = (minY < 0) ? 0 : minY;
+	maxY = (maxY > GPU_FRAMEBUFFER_NATIVE_HEIGHT) ? GPU_FRAMEBUFFER_NATIVE_HEIGHT : maxY;
+
+	if (maxY > minY)
 	{
-		if (this->_emulateDepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported)
-		{
-			if (isPolyFrontFacing)
-			{
-				glDepthFunc(GL_EQUAL);
-				glStencilFunc(GL_EQUAL, 0x40 | opaquePolyID, 0x40);
-				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+		// Scale up to the framebuffer size, rounding outwards.
+		polyLines.lineFirst = ((size_t)minY * this->_framebufferHeight) / GPU_FRAMEBUFFER_NATIVE_HEIGHT;
+		polyLines.lineEnd   = (((size_t)maxY * this->_framebufferHeight) + GPU_FRAMEBUFFER_NATIVE_HEIGHT - 1) / GPU_FRAMEBUFFER_NATIVE_HEIGHT;
+	}
 
-				glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-				glDepthMask(GL_FALSE);
-				glStencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
-				glStencilMask(0x40);
-				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+	return polyLines;
+}
 
-				glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-				glDepthMask(GL_TRUE);
-				glDepthFunc(GL_LESS);
-				glStencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
-				glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-				glStencilMask(0xFF);
-				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
-			}
-			else
-			{
-				glStencilFunc(GL_ALWAYS, 0x40 | opaquePolyID, 0x40);
-				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+// Adds the lines that this frame may have changed to the lines that still need to be flushed.
+// Since the whole framebuffer is cleared every frame, a line can only differ from the last frame
+// if the background changed, or if the line is covered by a polygon from either frame.
+void OpenGLRenderer::_UpdateDirtyLines(const u64 backgroundHash, const NDSVertex *vtxList)
+{
+	OGLLineRange frameDirtyLines;
+	frameDirtyLines.lineFirst = 0;
+	frameDirtyLines.lineEnd = this->_framebufferHeight;
 
-				glStencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
-			}
-		}
-		else
-		{
-			glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
-		}
-	}
-	else
+	if (this->_enablePartialReadBack)
 	{
-		if (this->_emulateDepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported && isPolyFrontFacing)
-		{
-			glDepthFunc(GL_EQUAL);
-			glUniform1i(OGLRef.uniformDrawModeDepthEqualsTest[this->_geometryProgramFlags.value], GL_TRUE);
-			glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+		const OGLLineRange polyLines = this->_ComputePolyLines(vtxList);
 
-			glDepthFunc(GL_LESS);
-			glUniform1i(OGLRef.uniformDrawModeDepthEqualsTest[this->_geometryProgramFlags.value], GL_FALSE);
+		if (this->_isLastBackgroundHashValid && (backgroundHash == this->_lastBackgroundHash))
+		{
+			frameDirtyLines = OGLLineRangeUnion(polyLines, this->_lastPolyLines);
 		}
-		glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+		this->_lastPolyLines = polyLines;
+		this->_lastBackgroundHash = backgroundHash;
+		this->_isLastBackgroundHashValid = true;
 	}
 
-	return OGLERROR_NOERR;
+	this->_pendingFlushLinesMain = OGLLineRangeUnion(this->_pendingFlushLinesMain, frameDirtyLines);
+	this->_pendingFlushLines16 = OGLLineRangeUnion(this->_pendingFlushLines16, frameDirtyLines);
 }
 
-Render3DError OpenGLRenderer::ApplyRenderingSettings(const GFX3D_State &renderState)
+// Forgets what's in the output framebuffers, so that the next flush rewrites all of them.
+void OpenGLRenderer::_InvalidateDirtyLines()
 {
-	Render3DError error = RENDER3DERROR_NOERR;
+	this->_isLastBackgroundHashValid = false;
+	this->_lastBackgroundHash = 0;
+	this->_lastPolyLines.lineFirst = 0;
+	this->_lastPolyLines.lineEnd = 0;
+	this->_pendingFlushLinesMain.lineFirst = 0;
+	this->_pendingFlushLinesMain.lineEnd = this->_framebufferHeight;
+	this->_pendingFlushLines16.lineFirst = 0;
+	this->_pendingFlushLines16.lineEnd = this->_framebufferHeight;
+	this->_readBackLines.lineFirst = 0;
+	this->_readBackLines.lineEnd = this->_framebufferHeight;
+}
 
-	const bool didSelectedMultisampleSizeChange = (this->_selectedMultisampleSize != CommonSettings.GFX3D_Renderer_MultisampleSize);
-	const bool didEmulateNDSDepthCalculationChange = (this->_emulateNDSDepthCalculation != CommonSettings.OpenGL_Emulation_NDSDepthCalculation);
-	const bool didEnableTextureSmoothingChange = (this->_enableTextureSmoothing != CommonSettings.GFX3D_Renderer_TextureSmoothing);
-	const bool didEmulateDepthLEqualPolygonFacingChange = (this->_emulateDepthLEqualPolygonFacing != (CommonSettings.OpenGL_Emulation_DepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported));
+// Returns the lines that need to be read back for the output framebuffers that are expected to
+// be flushed. Only the CPU conversion path can update the output framebuffers in place, so every
+// other path always reads back the whole framebuffer.
+OGLLineRange OpenGLRenderer::_GetReadBackLines() const
+{
+	OGLLineRange readBackLines;
+	readBackLines.lineFirst = 0;
+	readBackLines.lineEnd = this->_framebufferHeight;
 
-	this->_emulateShadowPolygon = CommonSettings.OpenGL_Emulation_ShadowPolygon;
-	this->_emulateSpecialZeroAlphaBlending = CommonSettings.OpenGL_Emulation_SpecialZeroAlphaBlending;
-	this->_emulateNDSDepthCalculation = CommonSettings.OpenGL_Emulation_NDSDepthCalculation;
-	this->_emulateDepthLEqualPolygonFacing = CommonSettings.OpenGL_Emulation_DepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported;
+	// Pipelined frames are flushed late, so the pending lines wouldn't match the PBO.
+	if ( !this->_enablePartialReadBack ||
+	     (this->_framePipelineDepth > 1) ||
+	      this->willFlipOnlyFramebufferOnGPU ||
+	      this->willFlipAndConvertFramebufferOnGPU ||
+	     (this->_framebufferReadMode != OGLFramebufferReadMode_Color) )
+	{
+		return readBackLines;
+	}
 
-	this->_selectedMultisampleSize = CommonSettings.GFX3D_Renderer_MultisampleSize;
-	this->_enableMultisampledRendering = ((this->_selectedMultisampleSize >= 2) && this->isMultisampledFBOSupported);
+	readBackLines.lineEnd = 0;
 
-	error = Render3D::ApplyRenderingSettings(renderState);
-	if (error != RENDER3DERROR_NOERR)
+	if (this->_lastFlushRequestMain)
 	{
-		return error;
+		readBackLines = OGLLineRangeUnion(readBackLines, this->_pendingFlushLinesMain);
 	}
 
-	if (didSelectedMultisampleSizeChange ||
-		didEmulateNDSDepthCalculationChange ||
-		didEnableTextureSmoothingChange ||
-		didEmulateDepthLEqualPolygonFacingChange)
+	if (this->_lastFlushRequest16)
 	{
-		if (!BEGINGL())
+		readBackLines = OGLLineRangeUnion(readBackLines, this->_pendingFlushLines16);
+	}
+
+	return readBackLines;
+}
+
+void OpenGLRenderer::_SortOpaquePolygons(const NDSVertex *vtxList)
+{
+	// Opaque polygons are gathered into runs of polygons that can be drawn together. A polygon may
+	// only be moved ahead of other polygons if the final image is guaranteed to stay the same, which
+	// means that the polygon must not touch any of the pixels of the polygons that it moves past.
+	// Depth-equal test polygons, shadow polygons, and polygons without usable bounds depend on
+	// draw order in ways that can't be checked here, so nothing is ever moved past them.
+	static const size_t maxRunSearchDepth = 32;
+
+	const bool willSplitOnFacing = this->_emulateDepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported;
+	const size_t opaqueCount = this->_clippedPolyOpaqueCount;
+	size_t originalDrawCount = 0;
+
+	this->_opaqueSortRunList.clear();
+	this->_opaqueSortRunList.reserve(opaqueCount);
+	this->_opaqueSortNextPoly.resize(opaqueCount);
+
+	for (size_t i = 0; i < opaqueCount; i++)
+	{
+		const CPoly &cPoly = this->_clippedPolyList[i];
+		const POLY &rawPoly = this->_rawPolyList[cPoly.index];
+
+		OGLOpaqueSortRun newRun;
+		newRun.attributeValue = rawPoly.attribute.value;
+		newRun.texParamValue = rawPoly.texParam.value;
+		newRun.texPalette = rawPoly.texPalette;
+		newRun.isPolyBackFacing = (willSplitOnFacing) ? cPoly.isPolyBackFacing : false;
+		newRun.canJoin = !GFX3D_IsPolyWireframe(rawPoly) && (rawPoly.vtxFormat <= GFX3D_QUAD_STRIP);
+		newRun.isBarrier = rawPoly.attribute.DepthEqualTest_Enable ||
+		                   (rawPoly.attribute.Mode == POLYGON_MODE_SHADOW) ||
+		                   !GetPolyWindowBounds(rawPoly, vtxList, newRun.minX, newRun.minY, newRun.maxX, newRun.maxY);
+		newRun.firstPoly = (u32)i;
+		newRun.lastPoly = (u32)i;
+
+		this->_opaqueSortNextPoly[i] = (u32)i;
+
+		// Count the draws that the lookahead in DrawPolygonsForIndexRange() would have made.
+		if (i > 0)
 		{
-			return OGLERROR_BEGINGL_FAILED;
+			const CPoly &prevCPoly = this->_clippedPolyList[i-1];
+			const POLY &prevRawPoly = this->_rawPolyList[prevCPoly.index];
+			const bool didStatesChange = (prevRawPoly.attribute.value != rawPoly.attribute.value) ||
+			                             (prevRawPoly.texParam.value != rawPoly.texParam.value) ||
+			                             (prevRawPoly.texPalette != rawPoly.texPalette) ||
+			                             (willSplitOnFacing && (prevCPoly.isPolyBackFacing != cPoly.isPolyBackFacing));
+			const bool couldPrevJoin = !GFX3D_IsPolyWireframe(prevRawPoly) && (prevRawPoly.vtxFormat <= GFX3D_QUAD_STRIP);
+
+			if (didStatesChange || !couldPrevJoin || !newRun.canJoin)
+			{
+				originalDrawCount++;
+			}
 		}
-
-		if (didSelectedMultisampleSizeChange)
+		else
 		{
-			GLsizei sampleSize = this->GetLimitedMultisampleSize();
-			this->ResizeMultisampledFBOs(sampleSize);
+			originalDrawCount++;
 		}
 
-		if (didEmulateNDSDepthCalculationChange ||
-			 didEnableTextureSmoothingChange ||
-			 didEmulateDepthLEqualPolygonFacingChange)
+		// Search back through the previous runs for one that this polygon can join.
+		bool didJoinRun = false;
+
+		if (newRun.canJoin && !newRun.isBarrier)
 		{
-			glUseProgram(0);
-			this->DestroyGeometryPrograms();
+			const size_t runCount = this->_opaqueSortRunList.size();
+			const size_t searchDepth = (runCount < maxRunSearchDepth) ? runCount : maxRunSearchDepth;
 
-			error = this->CreateGeometryPrograms();
-			if (error != OGLERROR_NOERR)
+			for (size_t r = 0; r < searchDepth; r++)
 			{
-				glUseProgram(0);
-				this->DestroyGeometryPrograms();
+				OGLOpaqueSortRun &run = this->_opaqueSortRunList[runCount - 1 - r];
 
-				ENDGL();
-				return error;
+				if ( run.canJoin && !run.isBarrier &&
+				     (run.attributeValue == newRun.attributeValue) &&
+				     (run.texParamValue == newRun.texParamValue) &&
+				     (run.texPalette == newRun.texPalette) &&
+				     (run.isPolyBackFacing == newRun.isPolyBackFacing) )
+				{
+					this->_opaqueSortNextPoly[run.lastPoly] = (u32)i;
+					run.lastPoly = (u32)i;
+					run.minX = (newRun.minX < run.minX) ? newRun.minX : run.minX;
+					run.minY = (newRun.minY < run.minY) ? newRun.minY : run.minY;
+					run.maxX = (newRun.maxX > run.maxX) ? newRun.maxX : run.maxX;
+					run.maxY = (newRun.maxY > run.maxY) ? newRun.maxY : run.maxY;
+					didJoinRun = true;
+					break;
+				}
+
+				// This polygon can't move past this run if they might share any pixels.
+				const bool isOverlapping = (newRun.minX < run.maxX) && (run.minX < newRun.maxX) &&
+				                           (newRun.minY < run.maxY) && (run.minY < newRun.maxY);
+				if (run.isBarrier || isOverlapping)
+				{
+					break;
+				}
 			}
 		}
 
-		ENDGL();
+		if (!didJoinRun)
+		{
+			this->_opaqueSortRunList.push_back(newRun);
+		}
 	}
 
-	return error;
-}
+	// Moving a polygon ahead can occasionally split up polygons that used to be drawn together.
+	// Keep the submission order if the new order wouldn't actually save any draws.
+	if (this->_opaqueSortRunList.size() >= originalDrawCount)
+	{
+		this->_opaquePolySortDrawsSaved = 0;
+		return;
+	}
 
-OpenGLESRenderer_3_0::~OpenGLESRenderer_3_0()
-{
-	glFinish();
+	// Write out the new draw order.
+	size_t orderIndex = 0;
+	for (size_t r = 0; r < this->_opaqueSortRunList.size(); r++)
+	{
+		const OGLOpaqueSortRun &run = this->_opaqueSortRunList[r];
+		u32 polyIndex = run.firstPoly;
 
-	_pixelReadNeedsFinish = false;
+		while (true)
+		{
+			this->_clippedPolyDrawOrder[orderIndex++] = polyIndex;
+			if (polyIndex == run.lastPoly)
+			{
+				break;
+			}
 
-	free_aligned(ref->position4fBuffer);
-	ref->position4fBuffer = NULL;
+			polyIndex = this->_opaqueSortNextPoly[polyIndex];
+		}
+	}
 
-	free_aligned(ref->texCoord2fBuffer);
-	ref->texCoord2fBuffer = NULL;
+	this->_opaquePolySortDrawsSaved = originalDrawCount - this->_opaqueSortRunList.size();
+}
 
-	free_aligned(ref->color4fBuffer);
-	ref->color4fBuffer = NULL;
+// Map GFX3D_QUADS and GFX3D_QUAD_STRIP to GL_TRIANGLES since we will convert them.
+//
+// Also map GFX3D_TRIANGLE_STRIP to GL_TRIANGLES. This is okay since this is actually
+// how the POLY struct stores triangle strip vertices, which is in sets of 3 vertices
+// each. This redefinition is necessary since uploading more than 3 indices at a time
+// will cause glDrawElements() to draw the triangle strip incorrectly.
+static const GLenum oglPrimitiveType[]	= {
+	GL_TRIANGLES, GL_TRIANGLES, GL_TRIANGLES, GL_TRIANGLES, GL_LINE_LOOP, GL_LINE_LOOP, GL_LINE_STRIP, GL_LINE_STRIP, // Normal polygons
+	GL_LINE_LOOP, GL_LINE_LOOP, GL_LINE_LOOP, GL_LINE_LOOP, GL_LINE_LOOP, GL_LINE_LOOP, GL_LINE_LOOP, GL_LINE_LOOP    // Wireframe polygons
+};
 
-	{
-		glUseProgram(0);
+static const GLsizei indexIncrementLUT[] = {
+	3, 6, 3, 6, 3, 4, 3, 4, // Normal polygons
+	3, 4, 3, 4, 3, 4, 3, 4  // Wireframe polygons
+};
 
-		this->DestroyGeometryPrograms();
-		this->DestroyGeometryZeroDstAlphaProgram();
-		this->DestroyEdgeMarkProgram();
-		this->DestroyFogPrograms();
-		this->DestroyFramebufferOutput6665Programs();
-		this->DestroyFramebufferOutput8888Programs();
+template <OGLPolyDrawMode DRAWMODE>
+size_t OpenGLRenderer::DrawPolygonsForIndexRange(const POLY *rawPolyList, const CPoly *clippedPolyList, const size_t clippedPolyCount, size_t firstIndex, size_t lastIndex, size_t &indexOffset, POLYGON_ATTR &lastPolyAttr)
+{
+	OGLRenderRef &OGLRef = *this->ref;
+
+	if (lastIndex > (clippedPolyCount - 1))
+	{
+		lastIndex = clippedPolyCount - 1;
 	}
 
-	DestroyVAOs();
-	DestroyVBOs();
-	DestroyPBOs();
-	DestroyFBOs();
-	DestroyMultisampledFBO();
+	if (firstIndex > lastIndex)
+	{
+		return 0;
+	}
 
-	// Kill the texture cache now before all of our texture IDs disappear.
-	texCache.Reset();
+	// Set up the initial polygon
+	const CPoly &initialClippedPoly = clippedPolyList[this->_clippedPolyDrawOrder[firstIndex]];
+	const POLY &initialRawPoly = rawPolyList[initialClippedPoly.index];
+	TEXIMAGE_PARAM lastTexParams = initialRawPoly.texParam;
+	u32 lastTexPalette = initialRawPoly.texPalette;
 
-	glDeleteTextures(1, &ref->texFinalColorID);
-	ref->texFinalColorID = 0;
+	this->SetupTexture(initialRawPoly, firstIndex);
 
-	glFinish();
-}
+	// Polygon facing is resolved per fragment using gl_FrontFacing, so it only needs to split
+	// batches when opaque polygons take different draw paths depending on their facing.
+	const bool willSplitBatchOnFacing = (DRAWMODE == OGLPolyDrawMode_DrawOpaquePolys) && this->_emulateDepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported;
 
-Render3DError OpenGLESRenderer_3_0::InitExtensions()
-{
-	OGLRenderRef &OGLRef = *this->ref;
-	Render3DError error = OGLERROR_NOERR;
+	// Enumerate through all polygons and render
+	GLsizei vertIndexCount = 0;
+	bool batchHasFrontFacingPoly = false;
+	GLushort *indexBufferPtr = (this->isVBOSupported) ? (GLushort *)NULL + indexOffset : OGLRef.vertIndexBuffer + indexOffset;
 
-	// Get OpenGL extensions
-	std::set<std::string> oglExtensionSet;
-	this->GetExtensionSet(&oglExtensionSet);
+	for (size_t i = firstIndex; i <= lastIndex; i++)
+	{
+		const CPoly &clippedPoly = clippedPolyList[this->_clippedPolyDrawOrder[i]];
+		const POLY &rawPoly = rawPolyList[clippedPoly.index];
 
-	// Get host GPU device properties
-	GLfloat maxAnisotropyOGL = 1.0f;
-	glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &maxAnisotropyOGL);
-	this->_deviceInfo.maxAnisotropy = maxAnisotropyOGL;
+		// Set up the polygon if it changed
+		if (lastPolyAttr.value != rawPoly.attribute.value)
+		{
+			lastPolyAttr = rawPoly.attribute;
+			this->SetupPolygon(rawPoly, (DRAWMODE != OGLPolyDrawMode_DrawOpaquePolys), (DRAWMODE != OGLPolyDrawMode_ZeroAlphaPass));
+		}
 
-	// Need to generate this texture first because FBO creation needs it.
-	// This texture is only required by shaders, and so if shader creation
-	// fails, then we can immediately delete this texture if an error occurs.
-	glGenTextures(1, &OGLRef.texFinalColorID);
-	glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_FinalColor);
-	glBindTexture(GL_TEXTURE_2D, OGLRef.texFinalColorID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_MY_FORMAT, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight, 0, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
-	glActiveTexture(GL_TEXTURE0);
+		// Set up the texture if it changed
+		if (lastTexParams.value != rawPoly.texParam.value || lastTexPalette != rawPoly.texPalette)
+		{
+			lastTexParams = rawPoly.texParam;
+			lastTexPalette = rawPoly.texPalette;
+			this->SetupTexture(rawPoly, i);
+		}
 
-    this->isVBOSupported = true;
-	this->isVAOSupported = true;
-	this->isPBOSupported = true;
-	this->isFBOSupported = true;
-	this->isMultisampledFBOSupported = true;
-    bool isShaderSupported = true;
+		// In wireframe mode, redefine all primitives as GL_LINE_LOOP rather than
+		// setting the polygon mode to GL_LINE though glPolygonMode(). Not only is
+		// drawing more accurate this way, but it also allows GFX3D_QUADS and
+		// GFX3D_QUAD_STRIP primitives to properly draw as wireframe without the
+		// extra diagonal line.
+		const size_t LUTIndex = (!GFX3D_IsPolyWireframe(rawPoly)) ? rawPoly.vtxFormat : (0x08 | rawPoly.vtxFormat);
+		const GLenum polyPrimitive = oglPrimitiveType[LUTIndex];
 
-    //glGetIntegerv( GL_IMPLEMENTATION_COLOR_READ_FORMAT, &this->readFormat );
-    //glGetIntegerv( GL_IMPLEMENTATION_COLOR_READ_TYPE, &this->readType );
-    this->readFormat = GL_RGBA;
-    this->readType = GL_UNSIGNED_BYTE;
+		// Increment the vertex count
+		vertIndexCount += indexIncrementLUT[LUTIndex];
+		batchHasFrontFacingPoly = batchHasFrontFacingPoly || !clippedPoly.isPolyBackFacing;
 
-	if (this->isVBOSupported) this->CreateVBOs();
-	if (this->isPBOSupported) this->CreatePBOs();
+		// Look ahead to the next polygon to see if we can simply buffer the indices
+		// instead of uploading them now. We can buffer if all polygon states remain
+		// the same and we're not drawing a line loop or line strip.
+		if (i+1 <= lastIndex)
+		{
+			const CPoly &nextClippedPoly = clippedPolyList[this->_clippedPolyDrawOrder[i+1]];
+			const POLY &nextRawPoly = rawPolyList[nextClippedPoly.index];
 
-	if (this->isFBOSupported)
-	{
-		GLint maxColorAttachments = 0;
-		glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &maxColorAttachments);
+			// Shadow polygons are mostly untextured, and their unused texture parameters tend to
+			// differ from polygon to polygon. Since DrawShadowPolygon() runs its whole stencil
+			// sequence for each batch, let runs of untextured shadow polygons with the same
+			// attributes share a batch regardless of those parameters.
+			const bool isNextShadowPolyInRun = (rawPoly.attribute.Mode == POLYGON_MODE_SHADOW) &&
+			                                   !this->_textureList[i]->IsSamplingEnabled() &&
+			                                   !this->_textureList[i+1]->IsSamplingEnabled();
 
-		if (maxColorAttachments >= 4)
+			if (lastPolyAttr.value == nextRawPoly.attribute.value &&
+				( isNextShadowPolyInRun || ((lastTexParams.value == nextRawPoly.texParam.value) && (lastTexPalette == nextRawPoly.texPalette)) ) &&
+				polyPrimitive == oglPrimitiveType[nextRawPoly.vtxFormat] &&
+				polyPrimitive != GL_LINE_LOOP &&
+				polyPrimitive != GL_LINE_STRIP &&
+				oglPrimitiveType[nextRawPoly.vtxFormat] != GL_LINE_LOOP &&
+				oglPrimitiveType[nextRawPoly.vtxFormat] != GL_LINE_STRIP &&
+				!this->_isPolyViewportDetached[i] &&
+				!this->_isPolyViewportDetached[i+1] &&
+				(!willSplitBatchOnFacing || (clippedPoly.isPolyBackFacing == nextClippedPoly.isPolyBackFacing)))
+			{
+				if (rawPoly.attribute.Mode == POLYGON_MODE_SHADOW)
+				{
+					this->_renderStats.shadowPolyBatchedCount++;
+				}
+
+				continue;
+			}
+		}
+
+		// Render the polygons
+		this->SetPolygonIndex(i);
+
+		// Lines never batch, and GL always treats them as front-facing, so pass along
+		// the polygon's facing for them directly.
+		const bool willOverrideLineFacing = ((polyPrimitive == GL_LINE_LOOP) || (polyPrimitive == GL_LINE_STRIP)) && clippedPoly.isPolyBackFacing;
+		if (willOverrideLineFacing)
 		{
-			error = this->CreateFBOs();
-			if (error != OGLERROR_NOERR)
+			glUniform1i(OGLRef.uniformPolyLineIsBackFacing[this->_geometryProgramFlags.value], GL_TRUE);
+		}
+
+		// A polygon whose vertices couldn't be given its viewport is drawn by itself, with the
+		// viewport attribute held constant instead of read from the viewport buffer.
+		const bool isViewportDetached = this->_isPolyViewportDetached[i];
+		if (isViewportDetached)
+		{
+			glDisableVertexAttribArray(OGLVertexAttributeID_Viewport);
+			glVertexAttrib4f(OGLVertexAttributeID_Viewport, (GLfloat)rawPoly.viewport.x, (GLfloat)rawPoly.viewport.y, (GLfloat)rawPoly.viewport.width, (GLfloat)rawPoly.viewport.height);
+		}
+
+		if (rawPoly.attribute.Mode == POLYGON_MODE_SHADOW)
+		{
+			if ((DRAWMODE != OGLPolyDrawMode_ZeroAlphaPass) && this->_emulateShadowPolygon)
 			{
-				this->isFBOSupported = false;
+				this->DrawShadowPolygon(polyPrimitive,
+				                        vertIndexCount,
+				                        indexBufferPtr,
+				                        rawPoly.attribute.DepthEqualTest_Enable,
+				                        rawPoly.attribute.TranslucentDepthWrite_Enable,
+				                        (DRAWMODE == OGLPolyDrawMode_DrawTranslucentPolys), rawPoly.attribute.PolygonID);
 			}
 		}
+		else if ( (rawPoly.texParam.PackedFormat == TEXMODE_A3I5) || (rawPoly.texParam.PackedFormat == TEXMODE_A5I3) )
+		{
+			this->DrawAlphaTexturePolygon<DRAWMODE>(polyPrimitive,
+			                                        vertIndexCount,
+			                                        indexBufferPtr,
+			                                        rawPoly.attribute.DepthEqualTest_Enable,
+			                                        rawPoly.attribute.TranslucentDepthWrite_Enable,
+			                                        GFX3D_IsPolyWireframe(rawPoly) || GFX3D_IsPolyOpaque(rawPoly),
+			                                        rawPoly.attribute.PolygonID,
+			                                        batchHasFrontFacingPoly);
+		}
 		else
 		{
-			INFO("OpenGL: Driver does not support at least 4 FBO color attachments.\n");
-			this->isFBOSupported = false;
+			this->DrawOtherPolygon<DRAWMODE>(polyPrimitive,
+			                                 vertIndexCount,
+			                                 indexBufferPtr,
+			                                 rawPoly.attribute.DepthEqualTest_Enable,
+			                                 rawPoly.attribute.TranslucentDepthWrite_Enable,
+			                                 rawPoly.attribute.PolygonID,
+			                                 batchHasFrontFacingPoly);
 		}
-	}
 
-	if (!this->isFBOSupported)
-	{
-		INFO("OpenGL: FBOs are unsupported. Some emulation features will be disabled.\n");
+		if (willOverrideLineFacing)
+		{
+			glUniform1i(OGLRef.uniformPolyLineIsBackFacing[this->_geometryProgramFlags.value], GL_FALSE);
+		}
+
+		if (isViewportDetached)
+		{
+			glEnableVertexAttribArray(OGLVertexAttributeID_Viewport);
+		}
+
+		// Anything that might have written to the depth buffer makes the depth copy stale.
+		if ( this->_willUseSinglePassDepthEqualTest &&
+		     ((DRAWMODE != OGLPolyDrawMode_DrawTranslucentPolys) || rawPoly.attribute.TranslucentDepthWrite_Enable || GFX3D_IsPolyWireframe(rawPoly) || GFX3D_IsPolyOpaque(rawPoly)) )
+		{
+			this->_isDepthCopyDirty = true;
+		}
+
+		indexBufferPtr += vertIndexCount;
+		indexOffset += vertIndexCount;
+		vertIndexCount = 0;
+		batchHasFrontFacingPoly = false;
 	}
 
-	this->_selectedMultisampleSize = CommonSettings.GFX3D_Renderer_MultisampleSize;
+	return indexOffset;
+}
 
-	if (this->isMultisampledFBOSupported)
-	{
-		GLint maxSamplesOGL = 0;
-		glGetIntegerv(GL_MAX_SAMPLES, &maxSamplesOGL);
-		this->_deviceInfo.maxSamples = (u8)maxSamplesOGL;
+template <OGLPolyDrawMode DRAWMODE>
+Render3DError OpenGLRenderer::DrawAlphaTexturePolygon(const GLenum polyPrimitive,
+													  const GLsizei vertIndexCount,
+													  const GLushort *indexBufferPtr,
+													  const bool performDepthEqualTest,
+													  const bool enableAlphaDepthWrite,
+													  const bool canHaveOpaqueFragments,
+													  const u8 opaquePolyID,
+													  const bool isPolyFrontFacing)
+{
+	const OGLRenderRef &OGLRef = *this->ref;
 
-		if (this->_deviceInfo.maxSamples >= 2)
+	{
+		if ((DRAWMODE != OGLPolyDrawMode_ZeroAlphaPass) && performDepthEqualTest && this->_emulateNDSDepthCalculation)
 		{
-			// Try and initialize the multisampled FBOs with the GFX3D_Renderer_MultisampleSize.
-			// However, if the client has this set to 0, then set sampleSize to 2 in order to
-			// force the generation and the attachments of the buffers at a meaningful sample
-			// size. If GFX3D_Renderer_MultisampleSize is 0, then we can deallocate the buffer
-			// memory afterwards.
-			GLsizei sampleSize = this->GetLimitedMultisampleSize();
-			if (sampleSize == 0)
+			if (this->_willUseSinglePassDepthEqualTest)
 			{
-				sampleSize = 2;
-			}
+				// The fragment shader discards anything outside of the depth tolerance window,
+				// so the polygon can be drawn with the normal stencil states.
+				this->_UpdateDepthEqualsTestCopy();
+				glUniform1i(OGLRef.uniformDrawModeDepthEqualsWindow[this->_geometryProgramFlags.value], GL_TRUE);
+				this->_glState.DepthFunc(GL_ALWAYS);
 
-			error = this->CreateMultisampledFBO(sampleSize);
-			if (error != OGLERROR_NOERR)
-			{
-				this->isMultisampledFBOSupported = false;
-			}
+				if (DRAWMODE == OGLPolyDrawMode_DrawTranslucentPolys)
+				{
+					this->_glState.StencilFunc(GL_NOTEQUAL, 0x40 | opaquePolyID, 0x7F);
+					this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+					this->_glState.StencilMask(0xFF);
+					this->_glState.DepthMask((enableAlphaDepthWrite) ? GL_TRUE : GL_FALSE);
+					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
 
-			// If GFX3D_Renderer_MultisampleSize is 0, then we can deallocate the buffers now
-			// in order to save some memory.
-			if (this->_selectedMultisampleSize == 0)
-			{
-				this->ResizeMultisampledFBOs(0);
+					// Draw the opaque fragments if they might exist.
+					if (canHaveOpaqueFragments)
+					{
+						this->_glState.StencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
+						this->_glState.DepthMask(GL_TRUE);
+						glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_TRUE);
+						glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+						glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_FALSE);
+
+						this->_glState.StencilFunc(GL_NOTEQUAL, 0x40 | opaquePolyID, 0x7F);
+						this->_glState.DepthMask((enableAlphaDepthWrite) ? GL_TRUE : GL_FALSE);
+					}
+				}
+				else
+				{
+					this->_glState.StencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
+					this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+					this->_glState.StencilMask(0xFF);
+					this->_glState.DepthMask(GL_TRUE);
+
+					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_TRUE);
+					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_FALSE);
+				}
+
+				glUniform1i(OGLRef.uniformDrawModeDepthEqualsWindow[this->_geometryProgramFlags.value], GL_FALSE);
 			}
-		}
-		else
-		{
-			this->isMultisampledFBOSupported = false;
-			INFO("OpenGL: Driver does not support at least 2x multisampled FBOs.\n");
-		}
+			else if (DRAWMODE == OGLPolyDrawMode_DrawTranslucentPolys)
+			{
+				this->_glState.ColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+				this->_glState.DepthMask(GL_FALSE);
+
+				// Use the stencil buffer to determine which fragments pass the lower-side tolerance.
+				glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], (float)DEPTH_EQUALS_TEST_TOLERANCE / 16777215.0f);
+				this->_glState.DepthFunc(GL_LEQUAL);
+				this->_glState.StencilFunc(GL_ALWAYS, 0x80, 0x80);
+				this->_glState.StencilOp(GL_ZERO, GL_ZERO, GL_REPLACE);
+				this->_glState.StencilMask(0x80);
+
+				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+				if (canHaveOpaqueFragments)
+				{
+					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_TRUE);
+					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_FALSE);
+				}
+
+				// Use the stencil buffer to determine which fragments pass the higher-side tolerance.
+				glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], (float)-DEPTH_EQUALS_TEST_TOLERANCE / 16777215.0f);
+				this->_glState.DepthFunc(GL_GEQUAL);
+				this->_glState.StencilFunc(GL_EQUAL, 0x80, 0x80);
+				this->_glState.StencilOp(GL_ZERO, GL_ZERO, GL_KEEP);
+				this->_glState.StencilMask(0x80);
+
+				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+				if (canHaveOpaqueFragments)
+				{
+					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_TRUE);
+					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_FALSE);
+				}
+
+				// Set up the actual drawing of the polygon, using the mask within the stencil buffer to determine which fragments should pass.
+				glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], 0.0f);
+				this->_glState.DepthFunc(GL_ALWAYS);
+
+				// First do the transparent polygon ID check for the translucent fragments.
+				this->_glState.StencilFunc(GL_NOTEQUAL, 0x40 | opaquePolyID, 0x7F);
+				this->_glState.StencilOp(GL_ZERO, GL_ZERO, GL_KEEP);
+				this->_glState.StencilMask(0x80);
+				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+				// Draw the translucent fragments.
+				this->_glState.StencilFunc(GL_EQUAL, 0xC0 | opaquePolyID, 0x80);
+				this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+				this->_glState.StencilMask(0x7F);
+				this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+				this->_glState.DepthMask((enableAlphaDepthWrite) ? GL_TRUE : GL_FALSE);
+
+				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+				// Draw the opaque fragments if they might exist.
+				if (canHaveOpaqueFragments)
+				{
+					this->_glState.StencilFunc(GL_EQUAL, 0x80 | opaquePolyID, 0x80);
+					this->_glState.DepthMask(GL_TRUE);
+					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_TRUE);
+					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_FALSE);
+				}
+
+				// Clear bit 7 (0x80) now so that future polygons don't get confused.
+				this->_glState.StencilFunc(GL_ALWAYS, 0x80, 0x80);
+				this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+				this->_glState.StencilMask(0x80);
+				this->_glState.ColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+				this->_glState.DepthMask(GL_FALSE);
+
+				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+				if (canHaveOpaqueFragments)
+				{
+					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_TRUE);
+					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+					glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_FALSE);
+				}
+
+				// Finally, reset the rendering states.
+				this->_glState.StencilFunc(GL_NOTEQUAL, 0x40 | opaquePolyID, 0x7F);
+				this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+				this->_glState.StencilMask(0xFF);
+				this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+				this->_glState.DepthMask((enableAlphaDepthWrite) ? GL_TRUE : GL_FALSE);
+			}
+			else
+			{
+				this->_glState.ColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+				this->_glState.DepthMask(GL_FALSE);
+
+				glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_TRUE);
+
+				// Use the stencil buffer to determine which fragments pass the lower-side tolerance.
+				glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], (float)DEPTH_EQUALS_TEST_TOLERANCE / 16777215.0f);
+				this->_glState.DepthFunc(GL_LEQUAL);
+				this->_glState.StencilFunc(GL_ALWAYS, 0x80, 0x80);
+				this->_glState.StencilOp(GL_ZERO, GL_ZERO, GL_REPLACE);
+				this->_glState.StencilMask(0x80);
+				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+				// Use the stencil buffer to determine which fragments pass the higher-side tolerance.
+				glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], (float)-DEPTH_EQUALS_TEST_TOLERANCE / 16777215.0f);
+				this->_glState.DepthFunc(GL_GEQUAL);
+				this->_glState.StencilFunc(GL_EQUAL, 0x80, 0x80);
+				this->_glState.StencilOp(GL_ZERO, GL_ZERO, GL_KEEP);
+				this->_glState.StencilMask(0x80);
+				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+				// Set up the actual drawing of the polygon, using the mask within the stencil buffer to determine which fragments should pass.
+				glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], 0.0f);
+				this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+				this->_glState.DepthMask(GL_TRUE);
+				this->_glState.DepthFunc(GL_ALWAYS);
+				this->_glState.StencilFunc(GL_EQUAL, 0x80 | opaquePolyID, 0x80);
+				this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+				this->_glState.StencilMask(0x7F);
+
+				// Draw the polygon as completely opaque.
+				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+				// Clear bit 7 (0x80) now so that future polygons don't get confused.
+				this->_glState.ColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+				this->_glState.DepthMask(GL_FALSE);
+
+				this->_glState.StencilFunc(GL_ALWAYS, 0x80, 0x80);
+				this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+				this->_glState.StencilMask(0x80);
+				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+				// Finally, reset the rendering states.
+				this->_glState.StencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
+				this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+				this->_glState.StencilMask(0xFF);
+				this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+				this->_glState.DepthMask(GL_TRUE);
+
+				glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_FALSE);
+			}
+		}
+		else if (DRAWMODE != OGLPolyDrawMode_DrawOpaquePolys)
+		{
+			// Draw the translucent fragments.
+			if (this->_emulateDepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported && isPolyFrontFacing)
+			{
+				this->_glState.DepthFunc(GL_EQUAL);
+				glUniform1i(OGLRef.uniformDrawModeDepthEqualsTest[this->_geometryProgramFlags.value], GL_TRUE);
+				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+				this->_glState.DepthFunc(GL_LESS);
+				glUniform1i(OGLRef.uniformDrawModeDepthEqualsTest[this->_geometryProgramFlags.value], GL_FALSE);
+			}
+			glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+			// Draw the opaque fragments if they might exist.
+			if (canHaveOpaqueFragments)
+			{
+				if (DRAWMODE != OGLPolyDrawMode_ZeroAlphaPass)
+				{
+					this->_glState.StencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
+					this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+					this->_glState.DepthMask(GL_TRUE);
+				}
+
+				glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_TRUE);
+				if (this->_emulateDepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported && isPolyFrontFacing)
+				{
+					this->_glState.DepthFunc(GL_EQUAL);
+					glUniform1i(OGLRef.uniformDrawModeDepthEqualsTest[this->_geometryProgramFlags.value], GL_TRUE);
+					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+					this->_glState.DepthFunc(GL_LESS);
+					glUniform1i(OGLRef.uniformDrawModeDepthEqualsTest[this->_geometryProgramFlags.value], GL_FALSE);
+				}
+				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+				glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_FALSE);
+
+				if (DRAWMODE != OGLPolyDrawMode_ZeroAlphaPass)
+				{
+					this->_glState.StencilFunc(GL_NOTEQUAL, 0x40 | opaquePolyID, 0x7F);
+					this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+					this->_glState.DepthMask((enableAlphaDepthWrite) ? GL_TRUE : GL_FALSE);
+				}
+			}
+		}
+		else // Draw the polygon as completely opaque.
+		{
+			glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_TRUE);
+
+			if (this->_emulateDepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported)
+			{
+				if (isPolyFrontFacing)
+				{
+					this->_glState.DepthFunc(GL_EQUAL);
+					this->_glState.StencilFunc(GL_EQUAL, 0x40 | opaquePolyID, 0x40);
+					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+					this->_glState.ColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+					this->_glState.DepthMask(GL_FALSE);
+					this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+					this->_glState.StencilMask(0x40);
+					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+					this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+					this->_glState.DepthMask(GL_TRUE);
+					this->_glState.DepthFunc(GL_LESS);
+					this->_glState.StencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
+					this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+					this->_glState.StencilMask(0xFF);
+					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+				}
+				else
+				{
+					this->_glState.StencilFunc(GL_ALWAYS, 0x40 | opaquePolyID, 0x40);
+					glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+					this->_glState.StencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
+				}
+			}
+			else
+			{
+				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+			}
+
+			glUniform1i(OGLRef.uniformTexDrawOpaque[this->_geometryProgramFlags.value], GL_FALSE);
+		}
+	}
+
+	return OGLERROR_NOERR;
+}
+
+template <OGLPolyDrawMode DRAWMODE>
+Render3DError OpenGLRenderer::DrawOtherPolygon(const GLenum polyPrimitive,
+											   const GLsizei vertIndexCount,
+											   const GLushort *indexBufferPtr,
+											   const bool performDepthEqualTest,
+											   const bool enableAlphaDepthWrite,
+											   const u8 opaquePolyID,
+											   const bool isPolyFrontFacing)
+{
+	OGLRenderRef &OGLRef = *this->ref;
+
+	if ((DRAWMODE != OGLPolyDrawMode_ZeroAlphaPass) && performDepthEqualTest && this->_emulateNDSDepthCalculation && this->_willUseSinglePassDepthEqualTest)
+	{
+		// The fragment shader discards anything outside of the depth tolerance window, so the
+		// polygon can be drawn with the normal stencil states.
+		this->_UpdateDepthEqualsTestCopy();
+		glUniform1i(OGLRef.uniformDrawModeDepthEqualsWindow[this->_geometryProgramFlags.value], GL_TRUE);
+		this->_glState.DepthFunc(GL_ALWAYS);
+
+		if (DRAWMODE == OGLPolyDrawMode_DrawTranslucentPolys)
+		{
+			this->_glState.StencilFunc(GL_NOTEQUAL, 0x40 | opaquePolyID, 0x7F);
+		}
+		else
+		{
+			this->_glState.StencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
+		}
+
+		this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+		this->_glState.StencilMask(0xFF);
+		this->_glState.DepthMask(((DRAWMODE == OGLPolyDrawMode_DrawOpaquePolys) || enableAlphaDepthWrite) ? GL_TRUE : GL_FALSE);
+		glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+		glUniform1i(OGLRef.uniformDrawModeDepthEqualsWindow[this->_geometryProgramFlags.value], GL_FALSE);
+	}
+	else if ((DRAWMODE != OGLPolyDrawMode_ZeroAlphaPass) && performDepthEqualTest && this->_emulateNDSDepthCalculation)
+	{
+		this->_glState.ColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		this->_glState.DepthMask(GL_FALSE);
+
+		// Use the stencil buffer to determine which fragments pass the lower-side tolerance.
+		glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], (float)DEPTH_EQUALS_TEST_TOLERANCE / 16777215.0f);
+		this->_glState.DepthFunc(GL_LEQUAL);
+		this->_glState.StencilFunc(GL_ALWAYS, 0x80, 0x80);
+		this->_glState.StencilOp(GL_ZERO, GL_ZERO, GL_REPLACE);
+		this->_glState.StencilMask(0x80);
+		glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+		// Use the stencil buffer to determine which fragments pass the higher-side tolerance.
+		glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], (float)-DEPTH_EQUALS_TEST_TOLERANCE / 16777215.0f);
+		this->_glState.DepthFunc(GL_GEQUAL);
+		this->_glState.StencilFunc(GL_EQUAL, 0x80, 0x80);
+		this->_glState.StencilOp(GL_ZERO, GL_ZERO, GL_KEEP);
+		this->_glState.StencilMask(0x80);
+		glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+		// Set up the actual drawing of the polygon.
+		glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], 0.0f);
+		this->_glState.DepthFunc(GL_ALWAYS);
+
+		// If this is a transparent polygon, then we need to do the transparent polygon ID check.
+		if (DRAWMODE == OGLPolyDrawMode_DrawTranslucentPolys)
+		{
+			this->_glState.StencilFunc(GL_NOTEQUAL, 0x40 | opaquePolyID, 0x7F);
+			this->_glState.StencilOp(GL_ZERO, GL_ZERO, GL_KEEP);
+			this->_glState.StencilMask(0x80);
+			glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+		}
+
+		// Draw the polygon using the mask within the stencil buffer to determine which fragments should pass.
+		this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		this->_glState.DepthMask(((DRAWMODE == OGLPolyDrawMode_DrawOpaquePolys) || enableAlphaDepthWrite) ? GL_TRUE : GL_FALSE);
+
+		this->_glState.StencilFunc(GL_EQUAL, (DRAWMODE == OGLPolyDrawMode_DrawTranslucentPolys) ? 0xC0 | opaquePolyID : 0x80 | opaquePolyID, 0x80);
+		this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+		this->_glState.StencilMask(0x7F);
+		glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+		// Clear bit 7 (0x80) now so that future polygons don't get confused.
+		this->_glState.ColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+		this->_glState.DepthMask(GL_FALSE);
+
+		this->_glState.StencilFunc(GL_ALWAYS, 0x80, 0x80);
+		this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+		this->_glState.StencilMask(0x80);
+		glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+		// Finally, reset the rendering states.
+		if (DRAWMODE == OGLPolyDrawMode_DrawTranslucentPolys)
+		{
+			this->_glState.StencilFunc(GL_NOTEQUAL, 0x40 | opaquePolyID, 0x7F);
+		}
+		else
+		{
+			this->_glState.StencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
+		}
+
+		this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+		this->_glState.StencilMask(0xFF);
+		this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		this->_glState.DepthMask(((DRAWMODE == OGLPolyDrawMode_DrawOpaquePolys) || enableAlphaDepthWrite) ? GL_TRUE : GL_FALSE);
+	}
+	else if (DRAWMODE == OGLPolyDrawMode_DrawOpaquePolys)
+	{
+		if (this->_emulateDepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported)
+		{
+			if (isPolyFrontFacing)
+			{
+				this->_glState.DepthFunc(GL_EQUAL);
+				this->_glState.StencilFunc(GL_EQUAL, 0x40 | opaquePolyID, 0x40);
+				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+				this->_glState.ColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+				this->_glState.DepthMask(GL_FALSE);
+				this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_ZERO);
+				this->_glState.StencilMask(0x40);
+				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+				this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+				this->_glState.DepthMask(GL_TRUE);
+				this->_glState.DepthFunc(GL_LESS);
+				this->_glState.StencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
+				this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+				this->_glState.StencilMask(0xFF);
+				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+			}
+			else
+			{
+				this->_glState.StencilFunc(GL_ALWAYS, 0x40 | opaquePolyID, 0x40);
+				glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+				this->_glState.StencilFunc(GL_ALWAYS, opaquePolyID, 0x3F);
+			}
+		}
+		else
+		{
+			glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+		}
+	}
+	else
+	{
+		if (this->_emulateDepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported && isPolyFrontFacing)
+		{
+			this->_glState.DepthFunc(GL_EQUAL);
+			glUniform1i(OGLRef.uniformDrawModeDepthEqualsTest[this->_geometryProgramFlags.value], GL_TRUE);
+			glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+
+			this->_glState.DepthFunc(GL_LESS);
+			glUniform1i(OGLRef.uniformDrawModeDepthEqualsTest[this->_geometryProgramFlags.value], GL_FALSE);
+		}
+		glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
+	}
+
+	return OGLERROR_NOERR;
+}
+
+Render3DError OpenGLRenderer::ApplyRenderingSettings(const GFX3D_State &renderState)
+{
+	Render3DError error = RENDER3DERROR_NOERR;
+
+	const bool didSelectedMultisampleSizeChange = (this->_selectedMultisampleSize != CommonSettings.GFX3D_Renderer_MultisampleSize);
+	const bool didEmulateNDSDepthCalculationChange = (this->_emulateNDSDepthCalculation != CommonSettings.OpenGL_Emulation_NDSDepthCalculation);
+	const bool didEnableTextureSmoothingChange = (this->_enableTextureSmoothing != CommonSettings.GFX3D_Renderer_TextureSmoothing);
+	const bool didEmulateDepthLEqualPolygonFacingChange = (this->_emulateDepthLEqualPolygonFacing != (CommonSettings.OpenGL_Emulation_DepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported));
+
+	this->_emulateShadowPolygon = CommonSettings.OpenGL_Emulation_ShadowPolygon;
+	this->_emulateSpecialZeroAlphaBlending = CommonSettings.OpenGL_Emulation_SpecialZeroAlphaBlending;
+	this->_emulateNDSDepthCalculation = CommonSettings.OpenGL_Emulation_NDSDepthCalculation;
+	this->_emulateDepthLEqualPolygonFacing = CommonSettings.OpenGL_Emulation_DepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported;
+
+	this->_selectedMultisampleSize = CommonSettings.GFX3D_Renderer_MultisampleSize;
+	this->_enableMultisampledRendering = ((this->_selectedMultisampleSize >= 2) && this->isMultisampledFBOSupported);
+
+	error = Render3D::ApplyRenderingSettings(renderState);
+	if (error != RENDER3DERROR_NOERR)
+	{
+		return error;
+	}
+
+	if (didSelectedMultisampleSizeChange ||
+		didEmulateNDSDepthCalculationChange ||
+		didEnableTextureSmoothingChange ||
+		didEmulateDepthLEqualPolygonFacingChange)
+	{
+		if (!BEGINGL())
+		{
+			return OGLERROR_BEGINGL_FAILED;
+		}
+
+		if (didSelectedMultisampleSizeChange)
+		{
+			GLsizei sampleSize = this->GetLimitedMultisampleSize();
+			this->ResizeMultisampledFBOs(sampleSize);
+		}
+
+		if (didEmulateNDSDepthCalculationChange ||
+			 didEnableTextureSmoothingChange ||
+			 didEmulateDepthLEqualPolygonFacingChange)
+		{
+			this->_glState.UseProgram(0);
+			this->DestroyGeometryPrograms();
+
+			error = this->CreateGeometryPrograms();
+			if (error != OGLERROR_NOERR)
+			{
+				this->_glState.UseProgram(0);
+				this->DestroyGeometryPrograms();
+
+				ENDGL();
+				return error;
+			}
+		}
+
+		ENDGL();
+	}
+
+	return error;
+}
+
+OpenGLESRenderer_3_0::~OpenGLESRenderer_3_0()
+{
+	glFinish();
+
+	_pixelReadNeedsFinish = false;
+
+	free_aligned(ref->position4fBuffer);
+	ref->position4fBuffer = NULL;
+
+	free_aligned(ref->texCoord2fBuffer);
+	ref->texCoord2fBuffer = NULL;
+
+	free_aligned(ref->color4fBuffer);
+	ref->color4fBuffer = NULL;
+
+	{
+		this->_glState.UseProgram(0);
+
+		this->DestroyGeometryPrograms();
+		this->DestroyGeometryZeroDstAlphaProgram();
+		this->DestroyEdgeMarkProgram();
+		this->DestroyFogPrograms();
+		this->DestroyEdgeMarkFogPrograms();
+		this->DestroyFramebufferOutput6665Programs();
+		this->DestroyFramebufferOutput8888Programs();
+		this->DestroyFramebufferOutput5551Programs();
+		this->DestroyFramebufferOutputDualPrograms();
+	}
+
+	DestroyFrameExportResources();
+	DestroyVAOs();
+	DestroyVBOs();
+	DestroyPBOs();
+	DestroyFBOs();
+	DestroyMultisampledFBO();
+
+	// Kill the texture cache now before all of our texture IDs disappear.
+	texCache.Reset();
+
+	this->_glState.DeleteTextures(1, &ref->texFinalColorID);
+	ref->texFinalColorID = 0;
+
+	glFinish();
+}
+
+Render3DError OpenGLESRenderer_3_0::InitExtensions()
+{
+	OGLRenderRef &OGLRef = *this->ref;
+	Render3DError error = OGLERROR_NOERR;
+
+	// Get OpenGL extensions
+	std::set<std::string> oglExtensionSet;
+	this->GetExtensionSet(&oglExtensionSet);
+
+	// Get host GPU device properties
+	GLfloat maxAnisotropyOGL = 1.0f;
+	glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY, &maxAnisotropyOGL);
+	this->_deviceInfo.maxAnisotropy = maxAnisotropyOGL;
+
+	// Need to generate this texture first because FBO creation needs it.
+	// This texture is only required by shaders, and so if shader creation
+	// fails, then we can immediately delete this texture if an error occurs.
+	glGenTextures(1, &OGLRef.texFinalColorID);
+	this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_FinalColor);
+	this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texFinalColorID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_MY_FORMAT, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight, 0, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+	this->_glState.ActiveTexture(GL_TEXTURE0);
+
+    this->isVBOSupported = true;
+	this->isVAOSupported = true;
+	this->isPBOSupported = true;
+	this->isFBOSupported = true;
+	this->isMultisampledFBOSupported = true;
+    bool isShaderSupported = true;
+
+    //glGetIntegerv( GL_IMPLEMENTATION_COLOR_READ_FORMAT, &this->readFormat );
+    //glGetIntegerv( GL_IMPLEMENTATION_COLOR_READ_TYPE, &this->readType );
+    this->readFormat = GL_RGBA;
+    this->readType = GL_UNSIGNED_BYTE;
+
+	// With framebuffer fetch, translucent polygons can read the destination alpha directly,
+	// so the special zero-alpha blending doesn't need the extra mask and redraw passes.
+	this->_isFramebufferFetchSupported = this->IsExtensionPresent(&oglExtensionSet, "GL_EXT_shader_framebuffer_fetch");
+	if (this->_isFramebufferFetchSupported)
+	{
+		INFO("OpenGL: Using EXT_shader_framebuffer_fetch for zero-alpha blending.\n");
+	}
+
+	// With multisampled render-to-texture, the GPU resolves the samples into the render textures
+	// by itself as it writes out each tile, so most frames won't need any resolve blits at all.
+#ifdef OGLRENDER_SUPPORTS_EGL
+	if (this->IsExtensionPresent(&oglExtensionSet, "GL_EXT_multisampled_render_to_texture"))
+	{
+		oglFramebufferTexture2DMultisampleEXT = (OGLPFNFRAMEBUFFERTEXTURE2DMULTISAMPLEEXTPROC)eglGetProcAddress("glFramebufferTexture2DMultisampleEXT");
+	}
+	this->_isMultisampledRenderToTextureSupported = (oglFramebufferTexture2DMultisampleEXT != NULL);
+#endif
+
+	if (this->isVBOSupported) this->CreateVBOs();
+	if (this->isPBOSupported) this->CreatePBOs();
+
+	if (this->isFBOSupported)
+	{
+		GLint maxColorAttachments = 0;
+		glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &maxColorAttachments);
+
+		if (maxColorAttachments >= 4)
+		{
+			error = this->CreateFBOs();
+			if (error != OGLERROR_NOERR)
+			{
+				this->isFBOSupported = false;
+			}
+		}
+		else
+		{
+			INFO("OpenGL: Driver does not support at least 4 FBO color attachments.\n");
+			this->isFBOSupported = false;
+		}
+	}
+
+	if (!this->isFBOSupported)
+	{
+		INFO("OpenGL: FBOs are unsupported. Some emulation features will be disabled.\n");
+	}
+
+	this->_selectedMultisampleSize = CommonSettings.GFX3D_Renderer_MultisampleSize;
+
+	if (this->isMultisampledFBOSupported)
+	{
+		GLint maxSamplesOGL = 0;
+		glGetIntegerv(GL_MAX_SAMPLES, &maxSamplesOGL);
+		this->_deviceInfo.maxSamples = (u8)maxSamplesOGL;
+
+		if (this->_deviceInfo.maxSamples >= 2)
+		{
+			// Try and initialize the multisampled FBOs with the GFX3D_Renderer_MultisampleSize.
+			// However, if the client has this set to 0, then set sampleSize to 2 in order to
+			// force the generation and the attachments of the buffers at a meaningful sample
+			// size. If GFX3D_Renderer_MultisampleSize is 0, then we can deallocate the buffer
+			// memory afterwards.
+			GLsizei sampleSize = this->GetLimitedMultisampleSize();
+			if (sampleSize == 0)
+			{
+				sampleSize = 2;
+			}
+
+			error = this->CreateMultisampledFBO(sampleSize);
+			if (error != OGLERROR_NOERR)
+			{
+				this->isMultisampledFBOSupported = false;
+			}
+
+			// If GFX3D_Renderer_MultisampleSize is 0, then we can deallocate the buffers now
+			// in order to save some memory.
+			if (this->_selectedMultisampleSize == 0)
+			{
+				this->ResizeMultisampledFBOs(0);
+			}
+		}
+		else
+		{
+			this->isMultisampledFBOSupported = false;
+			INFO("OpenGL: Driver does not support at least 2x multisampled FBOs.\n");
+		}
+	}
+
+	if (!this->isMultisampledFBOSupported)
+	{
+		INFO("OpenGL: Multisampled FBOs are unsupported. Multisample antialiasing will be disabled.\n");
+	}
+
+	{
+		GLint maxColorAttachmentsOGL = 0;
+		GLint maxDrawBuffersOGL = 0;
+		GLint maxShaderTexUnitsOGL = 0;
+		glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &maxColorAttachmentsOGL);
+		glGetIntegerv(GL_MAX_DRAW_BUFFERS, &maxDrawBuffersOGL);
+		glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &maxShaderTexUnitsOGL);
+
+		if ( (maxColorAttachmentsOGL >= 4) && (maxDrawBuffersOGL >= 4) && (maxShaderTexUnitsOGL >= 8) )
+		{
+			this->_enableTextureSmoothing = CommonSettings.GFX3D_Renderer_TextureSmoothing;
+			this->_emulateShadowPolygon = CommonSettings.OpenGL_Emulation_ShadowPolygon;
+			this->_emulateSpecialZeroAlphaBlending = CommonSettings.OpenGL_Emulation_SpecialZeroAlphaBlending;
+			this->_emulateNDSDepthCalculation = CommonSettings.OpenGL_Emulation_NDSDepthCalculation;
+			this->_emulateDepthLEqualPolygonFacing = CommonSettings.OpenGL_Emulation_DepthLEqualPolygonFacing;
+
+			error = this->CreateGeometryPrograms();
+			if (error == OGLERROR_NOERR)
+			{
+				error = this->CreateGeometryZeroDstAlphaProgram(GeometryZeroDstAlphaPixelMaskVtxShader_100, GeometryZeroDstAlphaPixelMaskFragShader_100);
+				if (error == OGLERROR_NOERR)
+				{
+					INFO("OpenGL: Successfully created geometry shaders.\n");
+
+					error = this->InitPostprocessingPrograms(EdgeMarkVtxShader_100,
+															 EdgeMarkFragShader_100,
+															 FramebufferOutputVtxShader_100,
+															 FramebufferOutputRGBA6665FragShader_100,
+															 FramebufferOutputRGBA8888FragShader_100);
+				}
+			}
+
+			if (error != OGLERROR_NOERR)
+			{
+				this->_glState.UseProgram(0);
+				this->DestroyGeometryPrograms();
+				this->DestroyGeometryZeroDstAlphaProgram();
+				isShaderSupported = false;
+			}
+		}
+		else
+		{
+			INFO("OpenGL: Driver does not support at least 4 color attachments, 4 draw buffers, and 8 texture image units.\n");
+			isShaderSupported = false;
+		}
+	}
+
+	if (!isShaderSupported)
+	{
+		INFO("OpenGL: Shaders are unsupported.\n");
+
+		this->_glState.DeleteTextures(1, &OGLRef.texFinalColorID);
+		OGLRef.texFinalColorID = 0;
+
+		return error;
+	}
+
+	if (this->isVAOSupported) this->CreateVAOs();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboRenderID);
+
+	// Set rendering support flags based on driver features.
+	this->willFlipAndConvertFramebufferOnGPU = false; // get much better performance with this off on android
+	this->willFlipOnlyFramebufferOnGPU = this->willFlipAndConvertFramebufferOnGPU;
+	this->_deviceInfo.isEdgeMarkSupported = this->isVBOSupported && this->isFBOSupported;
+	this->_deviceInfo.isFogSupported = this->isVBOSupported && this->isFBOSupported;
+	this->_deviceInfo.isTextureSmoothingSupported = true;
+
+	this->_isDepthLEqualPolygonFacingSupported = this->isVBOSupported && this->isFBOSupported;
+
+	this->_enableMultisampledRendering = ((this->_selectedMultisampleSize >= 2) && this->isMultisampledFBOSupported);
+
+	this->InitFinalRenderStates(&oglExtensionSet); // This must be done last
+
+	return OGLERROR_NOERR;
+}
+
+Render3DError OpenGLESRenderer_3_0::CreateVBOs()
+{
+	OGLRenderRef &OGLRef = *this->ref;
+
+	glGenBuffers(1, &OGLRef.vboGeometryVtxID);
+	glGenBuffers(1, &OGLRef.vboGeometryViewportID);
+	glGenBuffers(1, &OGLRef.iboGeometryIndexID);
+	glGenBuffers(1, &OGLRef.vboPostprocessVtxID);
+
+	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboGeometryVtxID);
+	glBufferData(GL_ARRAY_BUFFER, VERTLIST_SIZE * 2 * sizeof(NDSVertex), NULL, GL_STREAM_DRAW); // Raw vertices, then duplicates
+	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboGeometryViewportID);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(OGLRef.vtxViewportBuffer), NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, OGLRef.iboGeometryIndexID);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(OGLRef.vertIndexBuffer), NULL, GL_STREAM_DRAW);
+
+	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboPostprocessVtxID);
+	glBufferData(GL_ARRAY_BUFFER, sizeof(PostprocessVtxBuffer), PostprocessVtxBuffer, GL_STATIC_DRAW);
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	return OGLERROR_NOERR;
+}
+
+void OpenGLESRenderer_3_0::DestroyVBOs()
+{
+	if (!this->isVBOSupported)
+	{
+		return;
+	}
+
+	OGLRenderRef &OGLRef = *this->ref;
+
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	glDeleteBuffers(1, &OGLRef.vboGeometryVtxID);
+	glDeleteBuffers(1, &OGLRef.vboGeometryViewportID);
+	glDeleteBuffers(1, &OGLRef.iboGeometryIndexID);
+	glDeleteBuffers(1, &OGLRef.vboPostprocessVtxID);
+
+	this->isVBOSupported = false;
+}
+
+Render3DError OpenGLESRenderer_3_0::CreatePBOs()
+{
+	OGLRenderRef &OGLRef = *this->ref;
+
+	// Each PBO has room for the color framebuffer followed by the RGBA5551 framebuffer, so that
+	// both can be read back in one transaction. There are several PBOs so that the host can
+	// keep borrowing a frame while the next ones are read back.
+	glGenBuffers(OGLRENDER_PBO_RING_SIZE, OGLRef.pboRenderDataID);
+
+	for (size_t i = 0; i < OGLRENDER_PBO_RING_SIZE; i++)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, OGLRef.pboRenderDataID[i]);
+		glBufferData(GL_PIXEL_PACK_BUFFER, this->_framebufferColorSizeBytes + (this->_framebufferPixCount * sizeof(u16)), NULL, GL_STREAM_READ);
+		this->_isPBOBorrowed[i] = false;
+		this->_pboRetiredMapping[i] = NULL;
+	}
+
+	this->_pboRingIndex = 0;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, OGLRef.pboRenderDataID[this->_pboRingIndex]);
+	this->_mappedFramebuffer = (Color4u8 *__restrict)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, this->_framebufferColorSizeBytes, GL_MAP_READ_BIT);
+
+	return OGLERROR_NOERR;
+}
+
+void OpenGLESRenderer_3_0::DestroyPBOs()
+{
+	if (!this->isPBOSupported)
+	{
+		return;
+	}
+
+	OGLRenderRef &OGLRef = *this->ref;
+
+	if (this->_mappedFramebuffer != NULL)
+	{
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		this->_mappedFramebuffer = NULL;
+	}
+
+	for (size_t i = 0; i < OGLRENDER_PBO_RING_SIZE; i++)
+	{
+		if (this->_pboRetiredMapping[i] != NULL)
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, OGLRef.pboRenderDataID[i]);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			this->_pboRetiredMapping[i] = NULL;
+		}
+
+		this->_isPBOBorrowed[i] = false;
+	}
+
+	this->_pboInFlightCount = 0;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glDeleteBuffers(OGLRENDER_PBO_RING_SIZE, OGLRef.pboRenderDataID);
+
+	this->isPBOSupported = false;
+}
+
+Render3DError OpenGLESRenderer_3_0::CreateVAOs()
+{
+	OGLRenderRef &OGLRef = *this->ref;
+
+	glGenVertexArrays(1, &OGLRef.vaoGeometryStatesID);
+	glGenVertexArrays(1, &OGLRef.vaoPostprocessStatesID);
+
+	glBindVertexArray(OGLRef.vaoGeometryStatesID);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, OGLRef.iboGeometryIndexID);
+
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboGeometryVtxID);
+
+		glEnableVertexAttribArray(OGLVertexAttributeID_Position);
+		glEnableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
+		glEnableVertexAttribArray(OGLVertexAttributeID_Color);
+		glVertexAttribPointer(OGLVertexAttributeID_Position, 4, GL_INT, GL_FALSE, sizeof(NDSVertex), (const GLvoid *)offsetof(NDSVertex, position));
+		glVertexAttribPointer(OGLVertexAttributeID_TexCoord0, 2, GL_INT, GL_FALSE, sizeof(NDSVertex), (const GLvoid *)offsetof(NDSVertex, texCoord));
+		glVertexAttribPointer(OGLVertexAttributeID_Color, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(NDSVertex), (const GLvoid *)offsetof(NDSVertex, color));
+
+		glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboGeometryViewportID);
+		glEnableVertexAttribArray(OGLVertexAttributeID_Viewport);
+		glVertexAttribPointer(OGLVertexAttributeID_Viewport, 4, GL_SHORT, GL_FALSE, 0, 0);
+	}
+
+	glBindVertexArray(0);
+
+	glBindVertexArray(OGLRef.vaoPostprocessStatesID);
+
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboPostprocessVtxID);
+
+		glEnableVertexAttribArray(OGLVertexAttributeID_Position);
+		glEnableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
+		glVertexAttribPointer(OGLVertexAttributeID_Position, 2, GL_FLOAT, GL_FALSE, 0, 0);
+		glVertexAttribPointer(OGLVertexAttributeID_TexCoord0, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid *)(sizeof(GLfloat) * 8));
+	}
+
+	glBindVertexArray(0);
+
+	return OGLERROR_NOERR;
+}
+
+void OpenGLESRenderer_3_0::DestroyVAOs()
+{
+	OGLRenderRef &OGLRef = *this->ref;
+
+	if (!this->isVAOSupported)
+	{
+		return;
+	}
+
+	glBindVertexArray(0);
+	glDeleteVertexArrays(1, &OGLRef.vaoGeometryStatesID);
+	glDeleteVertexArrays(1, &OGLRef.vaoPostprocessStatesID);
+
+	this->isVAOSupported = false;
+}
+
+Render3DError OpenGLESRenderer_3_0::CreateFBOs()
+{
+	OGLRenderRef &OGLRef = *this->ref;
+
+	// Set up FBO render targets
+	glGenTextures(1, &OGLRef.texCIColorID);
+	glGenTextures(1, &OGLRef.texCIFogAttrID);
+	glGenTextures(1, &OGLRef.texCIDepthStencilID);
+
+	glGenTextures(1, &OGLRef.texGColorID);
+	glGenTextures(1, &OGLRef.texGFogAttrID);
+	glGenTextures(1, &OGLRef.texGPolyID);
+	glGenTextures(1, &OGLRef.texGDepthStencilID);
+	glGenTextures(1, &OGLRef.texFinal16ID);
+
+	this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_DepthStencil);
+	this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texGDepthStencilID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+
+	this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_GColor);
+	this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texGColorID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_MY_FORMAT, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight, 0, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+
+	// The polygon ID and fog attribute textures get their storage in _UpdateFeatureAttachments(),
+	// and only if edge marking or fog is actually enabled.
+	this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_GPolyID);
+	this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texGPolyID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, 0, 0, 0, GL_RG, GL_UNSIGNED_BYTE, NULL);
+
+	this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_FogAttr);
+	this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texGFogAttrID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, 0, 0, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+
+	// The single-pass depth-equals test samples a copy of the depth buffer, since the
+	// depth buffer can't be sampled while it's also bound for rendering.
+	glGenTextures(1, &OGLRef.texDepthCopyID);
+	this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_DepthCopy);
+	this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texDepthCopyID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+
+	this->_glState.ActiveTexture(GL_TEXTURE0);
+
+	this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texFinal16ID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, NULL);
+
+	CACHE_ALIGN GLint tempClearImageBuffer[GPU_FRAMEBUFFER_NATIVE_WIDTH * GPU_FRAMEBUFFER_NATIVE_HEIGHT];
+	memset(tempClearImageBuffer, 0, sizeof(tempClearImageBuffer));
+
+	this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texCIColorID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_MY_FORMAT, GPU_FRAMEBUFFER_NATIVE_WIDTH, GPU_FRAMEBUFFER_NATIVE_HEIGHT, 0, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, tempClearImageBuffer);
+
+	this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texCIDepthStencilID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, GPU_FRAMEBUFFER_NATIVE_WIDTH, GPU_FRAMEBUFFER_NATIVE_HEIGHT, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, tempClearImageBuffer);
+
+	this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texCIFogAttrID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_MY_FORMAT, GPU_FRAMEBUFFER_NATIVE_WIDTH, GPU_FRAMEBUFFER_NATIVE_HEIGHT, 0, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, tempClearImageBuffer);
+
+	this->_glState.BindTexture(GL_TEXTURE_2D, 0);
+
+	// Set up FBOs
+	glGenFramebuffers(1, &OGLRef.fboClearImageID);
+	glGenFramebuffers(1, &OGLRef.fboFramebufferFlipID);
+	glGenFramebuffers(1, &OGLRef.fboRenderID);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboClearImageID);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOROUT_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texCIColorID, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_FOGATTRIBUTES_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texCIFogAttrID, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, OGLRef.texCIDepthStencilID, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, OGLRef.texCIDepthStencilID, 0);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		INFO("OpenGL: Failed to create FBOs 1!\n");
+		this->DestroyFBOs();
+
+		return OGLERROR_FBO_CREATE_ERROR;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboFramebufferFlipID);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOROUT_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texGColorID, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_WORKING_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texFinalColorID, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_FRAMEBUFFER16_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texFinal16ID, 0);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		INFO("OpenGL: Failed to create FBOs 2!\n");
+		this->DestroyFBOs();
+
+		return OGLERROR_FBO_CREATE_ERROR;
+	}
+
+	// The RGBA5551 output can only be read back directly if the driver reads R16UI as
+	// 16-bit unsigned integers. The only readback format that GLES guarantees for
+	// integer buffers is RGBA_INTEGER with 32-bit components, which wouldn't save
+	// any bandwidth.
+	{
+		GLint implReadFormat = 0;
+		GLint implReadType = 0;
+
+		glReadBuffer(GL_FRAMEBUFFER16_ATTACHMENT_ID);
+		glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_FORMAT, &implReadFormat);
+		glGetIntegerv(GL_IMPLEMENTATION_COLOR_READ_TYPE, &implReadType);
+
+		this->_isFramebufferOutput5551Supported = (implReadFormat == GL_RED_INTEGER) && (implReadType == GL_UNSIGNED_SHORT);
+		INFO("OpenGL: RGBA5551 framebuffer readback is %s.\n", (this->_isFramebufferOutput5551Supported) ? "supported" : "unsupported");
+	}
+
+	// The depth copy FBO is optional. If the driver won't take it, then depth-equals polygons
+	// simply keep using the multipass stencil test.
+	glGenFramebuffers(1, &OGLRef.fboDepthCopyID);
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboDepthCopyID);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, OGLRef.texDepthCopyID, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, OGLRef.texDepthCopyID, 0);
+	glDrawBuffer(GL_NONE);
+	glReadBuffer(GL_NONE);
+
+	this->_isSinglePassDepthEqualTestSupported = (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+	INFO("OpenGL: Single-pass depth-equals test is %s.\n", (this->_isSinglePassDepthEqualTestSupported) ? "supported" : "unsupported");
+
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboRenderID);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOROUT_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texGColorID, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_WORKING_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texFinalColorID, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, OGLRef.texGDepthStencilID, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, OGLRef.texGDepthStencilID, 0);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		INFO("OpenGL: Failed to create FBOs 3!\n");
+		this->DestroyFBOs();
+
+		return OGLERROR_FBO_CREATE_ERROR;
+	}
+
+	glDrawBuffer(GL_COLOROUT_ATTACHMENT_ID);
+	glReadBuffer(GL_COLOROUT_ATTACHMENT_ID);
+
+	OGLRef.selectedRenderingFBO = OGLRef.fboRenderID;
+	INFO("OpenGL: Successfully created FBOs.\n");
+
+	return OGLERROR_NOERR;
+}
+
+void OpenGLESRenderer_3_0::DestroyFBOs()
+{
+	if (!this->isFBOSupported)
+	{
+		return;
+	}
+
+	OGLRenderRef &OGLRef = *this->ref;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &OGLRef.fboClearImageID);
+	glDeleteFramebuffers(1, &OGLRef.fboFramebufferFlipID);
+	glDeleteFramebuffers(1, &OGLRef.fboRenderID);
+	glDeleteFramebuffers(1, &OGLRef.fboDepthCopyID);
+	this->_glState.DeleteTextures(1, &OGLRef.texCIColorID);
+	this->_glState.DeleteTextures(1, &OGLRef.texCIFogAttrID);
+	this->_glState.DeleteTextures(1, &OGLRef.texCIDepthStencilID);
+	this->_glState.DeleteTextures(1, &OGLRef.texGColorID);
+	this->_glState.DeleteTextures(1, &OGLRef.texGPolyID);
+	this->_glState.DeleteTextures(1, &OGLRef.texGFogAttrID);
+	this->_glState.DeleteTextures(1, &OGLRef.texGDepthStencilID);
+	this->_glState.DeleteTextures(1, &OGLRef.texFinal16ID);
+	this->_glState.DeleteTextures(1, &OGLRef.texDepthCopyID);
+
+	OGLRef.fboClearImageID = 0;
+	OGLRef.fboFramebufferFlipID = 0;
+	OGLRef.fboRenderID = 0;
+	OGLRef.fboDepthCopyID = 0;
+	OGLRef.texDepthCopyID = 0;
+
+	this->_isSinglePassDepthEqualTestSupported = false;
+
+	this->isFBOSupported = false;
+}
+
+Render3DError OpenGLESRenderer_3_0::CreateMultisampledFBO(GLsizei numSamples)
+{
+	OGLRenderRef &OGLRef = *this->ref;
+
+	// Set up FBO render targets
+	glGenRenderbuffers(1, &OGLRef.rboMSGColorID);
+	glGenRenderbuffers(1, &OGLRef.rboMSGWorkingID);
+	glGenRenderbuffers(1, &OGLRef.rboMSGPolyID);
+	glGenRenderbuffers(1, &OGLRef.rboMSGFogAttrID);
+	glGenRenderbuffers(1, &OGLRef.rboMSGDepthStencilID);
+
+	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGColorID);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_RGBA, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight);
+	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGWorkingID);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_RGBA, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight);
+	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGDepthStencilID);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_DEPTH24_STENCIL8, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight);
+
+	// Set up multisampled rendering FBO
+	glGenFramebuffers(1, &OGLRef.fboMSIntermediateRenderID);
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboMSIntermediateRenderID);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOROUT_ATTACHMENT_ID, GL_RENDERBUFFER, OGLRef.rboMSGColorID);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_WORKING_ATTACHMENT_ID, GL_RENDERBUFFER, OGLRef.rboMSGWorkingID);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, OGLRef.rboMSGDepthStencilID);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, OGLRef.rboMSGDepthStencilID);
+
+	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	{
+		INFO("OpenGL: Failed to create multisampled FBO!\n");
+		this->DestroyMultisampledFBO();
+
+		return OGLERROR_FBO_CREATE_ERROR;
+	}
+
+
+	glDrawBuffer(GL_COLOROUT_ATTACHMENT_ID);
+	glReadBuffer(GL_COLOROUT_ATTACHMENT_ID);
+
+	this->_AllocateMultisampledFeatureAttachments(numSamples, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight);
+
+	if (this->_isMultisampledRenderToTextureSupported)
+	{
+		glGenFramebuffers(1, &OGLRef.fboMSRenderToTextureID);
+		this->_AttachMultisampledRenderToTexture(numSamples);
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboRenderID);
+	INFO("OpenGL: Successfully created multisampled FBO.\n");
+
+	return OGLERROR_NOERR;
+}
+
+void OpenGLESRenderer_3_0::DestroyMultisampledFBO()
+{
+	if (!this->isMultisampledFBOSupported)
+	{
+		return;
+	}
+
+	OGLRenderRef &OGLRef = *this->ref;
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	glDeleteFramebuffers(1, &OGLRef.fboMSIntermediateRenderID);
+	glDeleteFramebuffers(1, &OGLRef.fboMSRenderToTextureID);
+	glDeleteRenderbuffers(1, &OGLRef.rboMSGColorID);
+	glDeleteRenderbuffers(1, &OGLRef.rboMSGWorkingID);
+	glDeleteRenderbuffers(1, &OGLRef.rboMSGPolyID);
+	glDeleteRenderbuffers(1, &OGLRef.rboMSGFogAttrID);
+	glDeleteRenderbuffers(1, &OGLRef.rboMSGDepthStencilID);
+
+	OGLRef.fboMSIntermediateRenderID = 0;
+	OGLRef.fboMSRenderToTextureID = 0;
+	OGLRef.rboMSGColorID = 0;
+	OGLRef.rboMSGWorkingID = 0;
+	OGLRef.rboMSGPolyID = 0;
+	OGLRef.rboMSGFogAttrID = 0;
+	OGLRef.rboMSGDepthStencilID = 0;
+
+	this->_isMSRenderToTextureFBOComplete = false;
+	this->isMultisampledFBOSupported = false;
+}
+
+void OpenGLESRenderer_3_0::ResizeMultisampledFBOs(GLsizei numSamples)
+{
+	OGLRenderRef &OGLRef = *this->ref;
+	GLsizei w = (GLsizei)this->_framebufferWidth;
+	GLsizei h = (GLsizei)this->_framebufferHeight;
+
+	if ( !this->isMultisampledFBOSupported ||
+		 (numSamples == 1) ||
+		 (w < GPU_FRAMEBUFFER_NATIVE_WIDTH) || (h < GPU_FRAMEBUFFER_NATIVE_HEIGHT) )
+	{
+		return;
+	}
+
+	if (numSamples == 0)
+	{
+		w = 0;
+		h = 0;
+		numSamples = 2;
+	}
+
+	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGColorID);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_RGBA, w, h);
+	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGWorkingID);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_RGBA, w, h);
+	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGDepthStencilID);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_DEPTH24_STENCIL8, w, h);
+
+	this->_AllocateMultisampledFeatureAttachments(numSamples, w, h);
+
+	if (w > 0)
+	{
+		this->_AttachMultisampledRenderToTexture(numSamples);
+	}
+}
+
+// Sizes the multisampled polygon ID and fog attribute renderbuffers to match their textures,
+// which are only allocated while edge marking or fog is enabled. The formats must match the
+// textures exactly, since a multisample resolve can't convert between formats.
+void OpenGLESRenderer_3_0::_AllocateMultisampledFeatureAttachments(const GLsizei numSamples, const GLsizei w, const GLsizei h)
+{
+	OGLRenderRef &OGLRef = *this->ref;
+
+	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGPolyID);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_RG8, (this->_isPolyIDAttachmentAllocated) ? w : 0, (this->_isPolyIDAttachmentAllocated) ? h : 0);
+	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGFogAttrID);
+	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_R8, (this->_isFogAttrAttachmentAllocated) ? w : 0, (this->_isFogAttrAttachmentAllocated) ? h : 0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboMSIntermediateRenderID);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_POLYID_ATTACHMENT_ID, GL_RENDERBUFFER, (this->_isPolyIDAttachmentAllocated) ? OGLRef.rboMSGPolyID : 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_FOGATTRIBUTES_ATTACHMENT_ID, GL_RENDERBUFFER, (this->_isFogAttrAttachmentAllocated) ? OGLRef.rboMSGFogAttrID : 0);
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboRenderID);
+}
+
+// Allocates the polygon ID and fog attribute attachments when edge marking or fog gets turned
+// on, and frees them again when turned off. Edge marking only needs the polygon ID and the
+// wireframe flag, and fog only needs its enable bit, so these use the smallest normalized
+// formats that can hold them. Integer formats would be smaller still, but they can't be
+// blended, and translucent polygons rely on blending to leave these attachments untouched.
+void OpenGLESRenderer_3_0::_UpdateFeatureAttachments(const bool willUsePolyID, const bool willUseFogAttr)
+{
+	if ( !this->isFBOSupported ||
+		 ((willUsePolyID == this->_isPolyIDAttachmentAllocated) && (willUseFogAttr == this->_isFogAttrAttachmentAllocated)) )
+	{
+		return;
+	}
+
+	OGLRenderRef &OGLRef = *this->ref;
+	const GLsizei w = (GLsizei)this->_framebufferWidth;
+	const GLsizei h = (GLsizei)this->_framebufferHeight;
+
+	this->_isPolyIDAttachmentAllocated = willUsePolyID;
+	this->_isFogAttrAttachmentAllocated = willUseFogAttr;
+
+	this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_GPolyID);
+	this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texGPolyID);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RG8, (willUsePolyID) ? w : 0, (willUsePolyID) ? h : 0, 0, GL_RG, GL_UNSIGNED_BYTE, NULL);
+
+	this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_FogAttr);
+	this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texGFogAttrID);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, (willUseFogAttr) ? w : 0, (willUseFogAttr) ? h : 0, 0, GL_RED, GL_UNSIGNED_BYTE, NULL);
+
+	this->_glState.ActiveTexture(GL_TEXTURE0);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboRenderID);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_POLYID_ATTACHMENT_ID, GL_TEXTURE_2D, (willUsePolyID) ? OGLRef.texGPolyID : 0, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_FOGATTRIBUTES_ATTACHMENT_ID, GL_TEXTURE_2D, (willUseFogAttr) ? OGLRef.texGFogAttrID : 0, 0);
+
+	if (this->isMultisampledFBOSupported)
+	{
+		const GLsizei sampleSize = this->GetLimitedMultisampleSize();
+		if (this->_enableMultisampledRendering && (sampleSize >= 2))
+		{
+			this->_AllocateMultisampledFeatureAttachments(sampleSize, w, h);
+			this->_AttachMultisampledRenderToTexture(sampleSize);
+		}
+	}
+
+	INFO("OpenGL: Polygon ID attachment %s, fog attribute attachment %s.\n",
+		 (willUsePolyID) ? "allocated" : "released",
+		 (willUseFogAttr) ? "allocated" : "released");
+}
+
+// Attaches the render FBO's textures to the render-to-texture FBO at the given sample count.
+// If the driver can't render to this combination, then frames are resolved with blits instead.
+void OpenGLESRenderer_3_0::_AttachMultisampledRenderToTexture(const GLsizei numSamples)
+{
+	OGLRenderRef &OGLRef = *this->ref;
+
+	this->_isMSRenderToTextureFBOComplete = false;
+
+#ifdef OGLRENDER_SUPPORTS_EGL
+	if (OGLRef.fboMSRenderToTextureID == 0)
+	{
+		return;
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboMSRenderToTextureID);
+	oglFramebufferTexture2DMultisampleEXT(GL_FRAMEBUFFER, GL_COLOROUT_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texGColorID, 0, numSamples);
+	oglFramebufferTexture2DMultisampleEXT(GL_FRAMEBUFFER, GL_POLYID_ATTACHMENT_ID, GL_TEXTURE_2D, (this->_isPolyIDAttachmentAllocated) ? OGLRef.texGPolyID : 0, 0, numSamples);
+	oglFramebufferTexture2DMultisampleEXT(GL_FRAMEBUFFER, GL_FOGATTRIBUTES_ATTACHMENT_ID, GL_TEXTURE_2D, (this->_isFogAttrAttachmentAllocated) ? OGLRef.texGFogAttrID : 0, 0, numSamples);
+	oglFramebufferTexture2DMultisampleEXT(GL_FRAMEBUFFER, GL_WORKING_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texFinalColorID, 0, numSamples);
+	oglFramebufferTexture2DMultisampleEXT(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_TEXTURE_2D, OGLRef.texGDepthStencilID, 0, numSamples);
+
+	this->_isMSRenderToTextureFBOComplete = (glCheckFramebufferStatus(GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE);
+	if (!this->_isMSRenderToTextureFBOComplete)
+	{
+		INFO("OpenGL: Multisampled render-to-texture is unavailable at %dx MSAA. Using resolve blits instead.\n", (int)numSamples);
+	}
+
+	glDrawBuffer(GL_COLOROUT_ATTACHMENT_ID);
+	glReadBuffer(GL_COLOROUT_ATTACHMENT_ID);
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboRenderID);
+#endif
+}
+
+Render3DError OpenGLESRenderer_3_0::CreateGeometryPrograms()
+{
+	Render3DError error = OGLERROR_NOERR;
+	OGLRenderRef &OGLRef = *this->ref;
+
+	glGenTextures(1, &OGLRef.texToonTableID);
+	this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_LookupTable);
+	this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texToonTableID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 32, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	glGenTextures(1, &OGLRef.texEdgeColorTableID);
+	this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texEdgeColorTableID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_MY_FORMAT, 8, 1, 0, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+
+	glGenTextures(1, &OGLRef.texFogDensityTableID);
+	this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texFogDensityTableID);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, 32, 1, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
+	this->_glState.ActiveTexture(GL_TEXTURE0);
+
+	OGLGeometryFlags programFlags;
+	programFlags.value = 0;
+
+	std::stringstream vtxShaderHeader;
+
+    vtxShaderHeader << "#version 300 es\n";
+    vtxShaderHeader << "precision highp float;\n";
+
+	vtxShaderHeader << "#define DEPTH_EQUALS_TEST_TOLERANCE " << DEPTH_EQUALS_TEST_TOLERANCE << ".0\n";
+	vtxShaderHeader << "#define NDS_FRAMEBUFFER_SIZE_X " << GPU_FRAMEBUFFER_NATIVE_WIDTH  << ".0\n";
+	vtxShaderHeader << "#define NDS_FRAMEBUFFER_SIZE_Y " << GPU_FRAMEBUFFER_NATIVE_HEIGHT << ".0\n";
+	vtxShaderHeader << "\n";
+
+	std::string vtxShaderCode  = vtxShaderHeader.str() + std::string(GeometryVtxShader_100);
+
+	// The #extension directive has to come before any other tokens, so the version line
+	// is added per program instead of being part of the common header.
+	std::stringstream fragShaderHeader;
+
+    fragShaderHeader << "precision highp float;\n";
+
+	fragShaderHeader << "#define FRAMEBUFFER_SIZE_X " << this->_framebufferWidth  << ".0 \n";
+	fragShaderHeader << "#define FRAMEBUFFER_SIZE_Y " << this->_framebufferHeight << ".0 \n";
+	fragShaderHeader << "\n";
+	//fragShaderHeader << "#define OUTFRAGCOLOR " << ((this->isFBOSupported) ? "gl_FragData[0]" : "gl_FragColor") << "\n";
+	//fragShaderHeader << "\n";
+
+	for (size_t flagsValue = 0; flagsValue < 512; flagsValue++, programFlags.value++)
+	{
+		// Framebuffer fetch variants are only needed for drawing translucent polygons.
+		if ( programFlags.ZeroDstAlphaFetch && (!this->_isFramebufferFetchSupported || programFlags.OpaqueDrawMode) )
+		{
+			continue;
+		}
+
+		// Early-Z variants are only needed for drawing opaque polygons with Z-depth, and only when
+		// no other program writes gl_FragDepth. They never run the alpha test, so the alpha test
+		// flag is always cleared when selecting them.
+		if ( programFlags.EarlyZOpaque && (programFlags.ZeroDstAlphaFetch || programFlags.EnableWDepth || programFlags.EnableAlphaTest ||
+		                                   programFlags.EnableFog || this->_emulateNDSDepthCalculation) )
+		{
+			continue;
+		}
+
+		std::stringstream shaderVersion;
+		shaderVersion << "#version 300 es\n";
+		if (programFlags.ZeroDstAlphaFetch)
+		{
+			shaderVersion << "#extension GL_EXT_shader_framebuffer_fetch : require\n";
+		}
+
+		std::stringstream shaderFlags;
+		shaderFlags << "#define USE_TEXTURE_SMOOTHING " << ((this->_enableTextureSmoothing) ? 1 : 0) << "\n";
+		shaderFlags << "#define USE_NDS_DEPTH_CALCULATION " << ((this->_emulateNDSDepthCalculation) ? 1 : 0) << "\n";
+		shaderFlags << "#define USE_DEPTH_LEQUAL_POLYGON_FACING " << ((this->_emulateDepthLEqualPolygonFacing && this->isVBOSupported && this->isFBOSupported) ? 1 : 0) << "\n";
+		shaderFlags << "#define DEPTH_EQUALS_TEST_WINDOW (" << DEPTH_EQUALS_TEST_TOLERANCE << ".0/16777215.0)\n";
+		shaderFlags << "\n";
+		shaderFlags << "#define ENABLE_W_DEPTH " << ((programFlags.EnableWDepth) ? 1 : 0) << "\n";
+		shaderFlags << "#define ENABLE_ALPHA_TEST " << ((programFlags.EnableAlphaTest) ? "true\n" : "false\n");
+		shaderFlags << "#define ENABLE_TEXTURE_SAMPLING " << ((programFlags.EnableTextureSampling) ? "true\n" : "false\n");
+		shaderFlags << "#define TOON_SHADING_MODE " << ((programFlags.ToonShadingMode) ? 1 : 0) << "\n";
+		shaderFlags << "#define ENABLE_FOG " << ((programFlags.EnableFog && this->isVBOSupported && this->isFBOSupported) ? 1 : 0) << "\n";
+		shaderFlags << "#define ENABLE_EDGE_MARK " << ((programFlags.EnableEdgeMark && this->isVBOSupported && this->isFBOSupported) ? 1 : 0) << "\n";
+		shaderFlags << "#define DRAW_MODE_OPAQUE " << ((programFlags.OpaqueDrawMode && this->isVBOSupported && this->isFBOSupported) ? 1 : 0) << "\n";
+		shaderFlags << "#define ENABLE_ZERO_DST_ALPHA_FETCH " << ((programFlags.ZeroDstAlphaFetch) ? 1 : 0) << "\n";
+		shaderFlags << "#define DRAW_MODE_EARLY_Z " << ((programFlags.EarlyZOpaque) ? 1 : 0) << "\n";
+		shaderFlags << "\n";
+		shaderFlags << "#define ATTACHMENT_WORKING_BUFFER " << GeometryAttachmentWorkingBuffer[programFlags.DrawBuffersMode] << "\n";
+		shaderFlags << "#define ATTACHMENT_POLY_ID " << GeometryAttachmentPolyID[programFlags.DrawBuffersMode] << "\n";
+		shaderFlags << "#define ATTACHMENT_FOG_ATTRIBUTES " << GeometryAttachmentFogAttributes[programFlags.DrawBuffersMode] << "\n";
+		shaderFlags << "\n";
+
+		std::string fragShaderCode = shaderVersion.str() + fragShaderHeader.str() + shaderFlags.str() + std::string(GeometryFragShader_100);
+
+		error = this->ShaderProgramCreate(OGLRef.vertexGeometryShaderID,
+										  OGLRef.fragmentGeometryShaderID[flagsValue],
+										  OGLRef.programGeometryID[flagsValue],
+										  vtxShaderCode.c_str(),
+										  fragShaderCode.c_str());
+		if (error != OGLERROR_NOERR)
+		{
+			INFO("OpenGL: Failed to create the GEOMETRY shader program.\n");
+			this->_glState.UseProgram(0);
+			this->DestroyGeometryPrograms();
+			return error;
+		}
+
+		glBindAttribLocation(OGLRef.programGeometryID[flagsValue], OGLVertexAttributeID_Position, "inPosition");
+		glBindAttribLocation(OGLRef.programGeometryID[flagsValue], OGLVertexAttributeID_TexCoord0, "inTexCoord0");
+		glBindAttribLocation(OGLRef.programGeometryID[flagsValue], OGLVertexAttributeID_Color, "inColor");
+		glBindAttribLocation(OGLRef.programGeometryID[flagsValue], OGLVertexAttributeID_Viewport, "inViewport");
+
+		glLinkProgram(OGLRef.programGeometryID[flagsValue]);
+		if (!this->ValidateShaderProgramLink(OGLRef.programGeometryID[flagsValue]))
+		{
+			INFO("OpenGL: Failed to link the GEOMETRY shader program.\n");
+			this->_glState.UseProgram(0);
+			this->DestroyGeometryPrograms();
+			return OGLERROR_SHADER_CREATE_ERROR;
+		}
+
+		glValidateProgram(OGLRef.programGeometryID[flagsValue]);
+		this->_glState.UseProgram(OGLRef.programGeometryID[flagsValue]);
+
+		const GLint uniformTexRenderObject						= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "texRenderObject");
+		glUniform1i(uniformTexRenderObject, 0);
+
+		const GLint uniformTexToonTable							= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "texToonTable");
+		glUniform1i(uniformTexToonTable, OGLTextureUnitID_LookupTable);
+
+		if (this->_emulateDepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported && !programFlags.OpaqueDrawMode)
+		{
+			const GLint uniformTexBackfacing					= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "inDstBackFacing");
+			glUniform1i(uniformTexBackfacing, OGLTextureUnitID_FinalColor);
+		}
+
+		if (this->_emulateNDSDepthCalculation)
+		{
+			const GLint uniformTexDstDepth						= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "inDstDepth");
+			glUniform1i(uniformTexDstDepth, OGLTextureUnitID_DepthCopy);
+		}
+
+		OGLRef.uniformStateAlphaTestRef[flagsValue]				= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "stateAlphaTestRef");
+
+		OGLRef.uniformPolyTexScale[flagsValue]					= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyTexScale");
+		OGLRef.uniformPolyMode[flagsValue]						= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyMode");
+		OGLRef.uniformPolyIsWireframe[flagsValue]				= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyIsWireframe");
+		OGLRef.uniformPolySetNewDepthForTranslucent[flagsValue]	= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polySetNewDepthForTranslucent");
+		OGLRef.uniformPolyAlpha[flagsValue]						= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyAlpha");
+		OGLRef.uniformPolyID[flagsValue]						= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyID");
+
+		OGLRef.uniformPolyEnableTexture[flagsValue]				= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyEnableTexture");
+		OGLRef.uniformPolyEnableFog[flagsValue]					= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyEnableFog");
+		OGLRef.uniformTexSingleBitAlpha[flagsValue]				= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "texSingleBitAlpha");
+
+		OGLRef.uniformTexDrawOpaque[flagsValue]					= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "texDrawOpaque");
+		OGLRef.uniformDrawModeDepthEqualsTest[flagsValue]		= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "drawModeDepthEqualsTest");
+		OGLRef.uniformDrawModeDepthEqualsWindow[flagsValue]		= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "drawModeDepthEqualsWindow");
+		OGLRef.uniformPolyLineIsBackFacing[flagsValue]			= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyLineIsBackFacing");
+		OGLRef.uniformPolyDrawShadow[flagsValue]				= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyDrawShadow");
+		OGLRef.uniformPolyDepthOffset[flagsValue]				= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyDepthOffset");
+	}
+
+	return OGLERROR_NOERR;
+}
+
+void OpenGLESRenderer_3_0::DestroyGeometryPrograms()
+{
+
+	OGLRenderRef &OGLRef = *this->ref;
+
+	for (size_t flagsValue = 0; flagsValue < 512; flagsValue++)
+	{
+		if (OGLRef.programGeometryID[flagsValue] == 0)
+		{
+			continue;
+		}
+
+		glDetachShader(OGLRef.programGeometryID[flagsValue], OGLRef.vertexGeometryShaderID);
+		glDetachShader(OGLRef.programGeometryID[flagsValue], OGLRef.fragmentGeometryShaderID[flagsValue]);
+		this->_glState.DeleteProgram(OGLRef.programGeometryID[flagsValue]);
+		glDeleteShader(OGLRef.fragmentGeometryShaderID[flagsValue]);
+
+		OGLRef.programGeometryID[flagsValue] = 0;
+		OGLRef.fragmentGeometryShaderID[flagsValue] = 0;
+	}
+
+	glDeleteShader(OGLRef.vertexGeometryShaderID);
+	OGLRef.vertexGeometryShaderID = 0;
+
+	this->_glState.DeleteTextures(1, &ref->texToonTableID);
+	OGLRef.texToonTableID = 0;
+
+	this->_glState.DeleteTextures(1, &ref->texEdgeColorTableID);
+	OGLRef.texEdgeColorTableID = 0;
+
+	this->_glState.DeleteTextures(1, &ref->texFogDensityTableID);
+	OGLRef.texFogDensityTableID = 0;
+}
+
+Render3DError OpenGLESRenderer_3_0::CreateGeometryZeroDstAlphaProgram(const char *vtxShaderCString, const char *fragShaderCString)
+{
+	Render3DError error = OGLERROR_NOERR;
+	OGLRenderRef &OGLRef = *this->ref;
+
+	if ( (vtxShaderCString == NULL) || (fragShaderCString == NULL) )
+	{
+		return error;
+	}
+
+	error = this->ShaderProgramCreate(OGLRef.vtxShaderGeometryZeroDstAlphaID,
+									  OGLRef.fragShaderGeometryZeroDstAlphaID,
+									  OGLRef.programGeometryZeroDstAlphaID,
+									  vtxShaderCString,
+									  fragShaderCString);
+	if (error != OGLERROR_NOERR)
+	{
+		INFO("OpenGL: Failed to create the GEOMETRY ZERO DST ALPHA shader program.\n");
+		this->_glState.UseProgram(0);
+		this->DestroyGeometryZeroDstAlphaProgram();
+		return error;
+	}
+
+	glBindAttribLocation(OGLRef.programGeometryZeroDstAlphaID, OGLVertexAttributeID_Position, "inPosition");
+	glBindAttribLocation(OGLRef.programGeometryZeroDstAlphaID, OGLVertexAttributeID_TexCoord0, "inTexCoord0");
+
+	glLinkProgram(OGLRef.programGeometryZeroDstAlphaID);
+	if (!this->ValidateShaderProgramLink(OGLRef.programGeometryZeroDstAlphaID))
+	{
+		INFO("OpenGL: Failed to link the GEOMETRY ZERO DST ALPHA shader program.\n");
+		this->_glState.UseProgram(0);
+		this->DestroyGeometryZeroDstAlphaProgram();
+		return OGLERROR_SHADER_CREATE_ERROR;
+	}
+
+	glValidateProgram(OGLRef.programGeometryZeroDstAlphaID);
+	this->_glState.UseProgram(OGLRef.programGeometryZeroDstAlphaID);
+
+	const GLint uniformTexGColor = glGetUniformLocation(OGLRef.programGeometryZeroDstAlphaID, "texInFragColor");
+	glUniform1i(uniformTexGColor, OGLTextureUnitID_GColor);
+
+	return OGLERROR_NOERR;
+}
+
+void OpenGLESRenderer_3_0::DestroyGeometryZeroDstAlphaProgram()
+{
+	OGLRenderRef &OGLRef = *this->ref;
+
+	if (OGLRef.programGeometryZeroDstAlphaID == 0)
+	{
+		return;
+	}
+
+	glDetachShader(OGLRef.programGeometryZeroDstAlphaID, OGLRef.vtxShaderGeometryZeroDstAlphaID);
+	glDetachShader(OGLRef.programGeometryZeroDstAlphaID, OGLRef.fragShaderGeometryZeroDstAlphaID);
+	this->_glState.DeleteProgram(OGLRef.programGeometryZeroDstAlphaID);
+	glDeleteShader(OGLRef.vtxShaderGeometryZeroDstAlphaID);
+	glDeleteShader(OGLRef.fragShaderGeometryZeroDstAlphaID);
+
+	OGLRef.programGeometryZeroDstAlphaID = 0;
+	OGLRef.vtxShaderGeometryZeroDstAlphaID = 0;
+	OGLRef.fragShaderGeometryZeroDstAlphaID = 0;
+}
+
+Render3DError OpenGLESRenderer_3_0::CreateEdgeMarkProgram(const char *vtxShaderCString, const char *fragShaderCString)
+{
+	Render3DError error = OGLERROR_NOERR;
+	OGLRenderRef &OGLRef = *this->ref;
+
+	if ( (vtxShaderCString == NULL) || (fragShaderCString == NULL) )
+	{
+		return error;
+	}
+
+	std::stringstream shaderHeader;
+
+    shaderHeader << "#version 300 es\n";
+    shaderHeader << "precision highp float;\n";
+
+	shaderHeader << "#define FRAMEBUFFER_SIZE_X " << this->_framebufferWidth  << ".0 \n";
+	shaderHeader << "#define FRAMEBUFFER_SIZE_Y " << this->_framebufferHeight << ".0 \n";
+	shaderHeader << "\n";
+
+	std::string vtxShaderCode  = shaderHeader.str() + std::string(vtxShaderCString);
+	std::string fragShaderCode = shaderHeader.str() + std::string(fragShaderCString);
+
+	error = this->ShaderProgramCreate(OGLRef.vertexEdgeMarkShaderID,
+									  OGLRef.fragmentEdgeMarkShaderID,
+									  OGLRef.programEdgeMarkID,
+									  vtxShaderCode.c_str(),
+									  fragShaderCode.c_str());
+	if (error != OGLERROR_NOERR)
+	{
+		INFO("OpenGL: Failed to create the EDGE MARK shader program.\n");
+		this->_glState.UseProgram(0);
+		this->DestroyEdgeMarkProgram();
+		return error;
+	}
+
+	glBindAttribLocation(OGLRef.programEdgeMarkID, OGLVertexAttributeID_Position, "inPosition");
+	glBindAttribLocation(OGLRef.programEdgeMarkID, OGLVertexAttributeID_TexCoord0, "inTexCoord0");
+
+	glLinkProgram(OGLRef.programEdgeMarkID);
+	if (!this->ValidateShaderProgramLink(OGLRef.programEdgeMarkID))
+	{
+		INFO("OpenGL: Failed to link the EDGE MARK shader program.\n");
+		this->_glState.UseProgram(0);
+		this->DestroyEdgeMarkProgram();
+		return OGLERROR_SHADER_CREATE_ERROR;
+	}
+
+	glValidateProgram(OGLRef.programEdgeMarkID);
+	this->_glState.UseProgram(OGLRef.programEdgeMarkID);
+
+	const GLint uniformTexGDepth			= glGetUniformLocation(OGLRef.programEdgeMarkID, "texInFragDepth");
+	const GLint uniformTexGPolyID			= glGetUniformLocation(OGLRef.programEdgeMarkID, "texInPolyID");
+	const GLint uniformTexEdgeColorTable	= glGetUniformLocation(OGLRef.programEdgeMarkID, "texEdgeColor");
+	glUniform1i(uniformTexGDepth, OGLTextureUnitID_DepthStencil);
+	glUniform1i(uniformTexGPolyID, OGLTextureUnitID_GPolyID);
+	glUniform1i(uniformTexEdgeColorTable, OGLTextureUnitID_LookupTable);
+
+	OGLRef.uniformStateClearPolyID			= glGetUniformLocation(OGLRef.programEdgeMarkID, "clearPolyID");
+	OGLRef.uniformStateClearDepth			= glGetUniformLocation(OGLRef.programEdgeMarkID, "clearDepth");
+
+	return OGLERROR_NOERR;
+}
+
+void OpenGLESRenderer_3_0::DestroyEdgeMarkProgram()
+{
+	OGLRenderRef &OGLRef = *this->ref;
+
+	if (OGLRef.programEdgeMarkID == 0)
+	{
+		return;
+	}
+
+	glDetachShader(OGLRef.programEdgeMarkID, OGLRef.vertexEdgeMarkShaderID);
+	glDetachShader(OGLRef.programEdgeMarkID, OGLRef.fragmentEdgeMarkShaderID);
+	this->_glState.DeleteProgram(OGLRef.programEdgeMarkID);
+	glDeleteShader(OGLRef.vertexEdgeMarkShaderID);
+	glDeleteShader(OGLRef.fragmentEdgeMarkShaderID);
+
+	OGLRef.programEdgeMarkID = 0;
+	OGLRef.vertexEdgeMarkShaderID = 0;
+	OGLRef.fragmentEdgeMarkShaderID = 0;
+}
+
+Render3DError OpenGLESRenderer_3_0::CreateFogProgram(const OGLFogProgramKey fogProgramKey, const char *vtxShaderCString, const char *fragShaderCString)
+{
+	Render3DError error = OGLERROR_NOERR;
+	OGLRenderRef &OGLRef = *this->ref;
+
+	if (vtxShaderCString == NULL)
+	{
+		INFO("OpenGL: The FOG vertex shader is unavailable.\n");
+		error = OGLERROR_VERTEX_SHADER_PROGRAM_LOAD_ERROR;
+		return error;
+	}
+	else if (fragShaderCString == NULL)
+	{
+		INFO("OpenGL: The FOG fragment shader is unavailable.\n");
+		error = OGLERROR_FRAGMENT_SHADER_PROGRAM_LOAD_ERROR;
+		return error;
+	}
+
+	const s32 fogOffset = fogProgramKey.offset;
+	const GLfloat fogOffsetf = (GLfloat)fogOffset / 32767.0f;
+	const s32 fogStep = 0x0400 >> fogProgramKey.shift;
+
+	std::stringstream fragDepthConstants;
+
+    fragDepthConstants << "#version 300 es\n";
+    fragDepthConstants << "precision highp float;\n";
+
+	fragDepthConstants << "#define OUT_ATTACH " << (this->willFlipAndConvertFramebufferOnGPU ? 3 : 0) << "\n";
+
+	fragDepthConstants << "#define FOG_OFFSET " << fogOffset << "\n";
+	fragDepthConstants << "#define FOG_OFFSETF " << fogOffsetf << (((fogOffsetf == 0.0f) || (fogOffsetf == 1.0f)) ? ".0" : "") << "\n";
+	fragDepthConstants << "#define FOG_STEP " << fogStep << "\n";
+	fragDepthConstants << "\n";
+
+	std::string fragShaderCode = fragDepthConstants.str() + std::string(fragShaderCString);
+
+	OGLFogShaderID shaderID;
+	shaderID.program = 0;
+	shaderID.fragShader = 0;
+
+    std::stringstream vtxHeader;
+    vtxHeader << "#version 300 es\n";
+    vtxHeader << "precision highp float;\n";
+    std::string vtxShaderCode = vtxHeader.str() + std::string(vtxShaderCString);
+
+	error = this->ShaderProgramCreate(OGLRef.vertexFogShaderID,
+									  shaderID.fragShader,
+									  shaderID.program,
+									  vtxShaderCode.c_str(),
+									  fragShaderCode.c_str());
+
+	this->_fogProgramMap[fogProgramKey.key] = shaderID;
+
+	if (error != OGLERROR_NOERR)
+	{
+		INFO("OpenGL: Failed to create the FOG shader program.\n");
+		this->_glState.UseProgram(0);
+		this->DestroyFogProgram(fogProgramKey);
+		return error;
+	}
+
+	glBindAttribLocation(shaderID.program, OGLVertexAttributeID_Position, "inPosition");
+	glBindAttribLocation(shaderID.program, OGLVertexAttributeID_TexCoord0, "inTexCoord0");
+
+	glLinkProgram(shaderID.program);
+	if (!this->ValidateShaderProgramLink(shaderID.program))
+	{
+		INFO("OpenGL: Failed to link the FOG shader program.\n");
+		this->_glState.UseProgram(0);
+		this->DestroyFogProgram(fogProgramKey);
+		return OGLERROR_SHADER_CREATE_ERROR;
+	}
+
+	glValidateProgram(shaderID.program);
+	this->_glState.UseProgram(shaderID.program);
+
+	const GLint uniformTexGColor          = glGetUniformLocation(shaderID.program, "texInFragColor");
+	const GLint uniformTexGDepth          = glGetUniformLocation(shaderID.program, "texInFragDepth");
+	const GLint uniformTexGFog            = glGetUniformLocation(shaderID.program, "texInFogAttributes");
+	const GLint uniformTexFogDensityTable = glGetUniformLocation(shaderID.program, "texFogDensityTable");
+	glUniform1i(uniformTexGColor, OGLTextureUnitID_GColor);
+	glUniform1i(uniformTexGDepth, OGLTextureUnitID_DepthStencil);
+	glUniform1i(uniformTexGFog, OGLTextureUnitID_FogAttr);
+	glUniform1i(uniformTexFogDensityTable, OGLTextureUnitID_LookupTable);
+
+	OGLRef.uniformStateEnableFogAlphaOnly = glGetUniformLocation(shaderID.program, "stateEnableFogAlphaOnly");
+	OGLRef.uniformStateFogColor           = glGetUniformLocation(shaderID.program, "stateFogColor");
+
+	return OGLERROR_NOERR;
+}
+
+void OpenGLESRenderer_3_0::DestroyFogProgram(const OGLFogProgramKey fogProgramKey)
+{
+	OGLRenderRef &OGLRef = *this->ref;
+
+	std::map<u32, OGLFogShaderID>::iterator it = this->_fogProgramMap.find(fogProgramKey.key);
+	if (it == this->_fogProgramMap.end())
+	{
+		return;
+	}
+
+	OGLFogShaderID shaderID = this->_fogProgramMap[fogProgramKey.key];
+	glDetachShader(shaderID.program, OGLRef.vertexFogShaderID);
+	glDetachShader(shaderID.program, shaderID.fragShader);
+	this->_glState.DeleteProgram(shaderID.program);
+	glDeleteShader(shaderID.fragShader);
+
+	this->_fogProgramMap.erase(it);
+
+	if (this->_fogProgramMap.size() == 0)
+	{
+		glDeleteShader(OGLRef.vertexFogShaderID);
+		OGLRef.vertexFogShaderID = 0;
+	}
+}
+
+void OpenGLESRenderer_3_0::DestroyFogPrograms()
+{
+	OGLRenderRef &OGLRef = *this->ref;
+
+	while (this->_fogProgramMap.size() > 0)
+	{
+		std::map<u32, OGLFogShaderID>::iterator it = this->_fogProgramMap.begin();
+		OGLFogShaderID shaderID = it->second;
+
+		glDetachShader(shaderID.program, OGLRef.vertexFogShaderID);
+		glDetachShader(shaderID.program, shaderID.fragShader);
+		this->_glState.DeleteProgram(shaderID.program);
+		glDeleteShader(shaderID.fragShader);
+
+		this->_fogProgramMap.erase(it);
+
+		if (this->_fogProgramMap.size() == 0)
+		{
+			glDeleteShader(OGLRef.vertexFogShaderID);
+			OGLRef.vertexFogShaderID = 0;
+		}
+	}
+}
+
+Render3DError OpenGLESRenderer_3_0::CreateEdgeMarkFogProgram(const OGLFogProgramKey fogProgramKey, const char *vtxShaderCString, const char *fragShaderCString)
+{
+	Render3DError error = OGLERROR_NOERR;
+	OGLRenderRef &OGLRef = *this->ref;
+
+	if (vtxShaderCString == NULL)
+	{
+		INFO("OpenGL: The EDGE MARK + FOG vertex shader is unavailable.\n");
+		error = OGLERROR_VERTEX_SHADER_PROGRAM_LOAD_ERROR;
+		return error;
+	}
+	else if (fragShaderCString == NULL)
+	{
+		INFO("OpenGL: The EDGE MARK + FOG fragment shader is unavailable.\n");
+		error = OGLERROR_FRAGMENT_SHADER_PROGRAM_LOAD_ERROR;
+		return error;
+	}
+
+	const s32 fogOffset = fogProgramKey.offset;
+	const GLfloat fogOffsetf = (GLfloat)fogOffset / 32767.0f;
+	const s32 fogStep = 0x0400 >> fogProgramKey.shift;
+
+	std::stringstream shaderHeader;
+
+	shaderHeader << "#version 300 es\n";
+	shaderHeader << "precision highp float;\n";
+
+	shaderHeader << "#define FRAMEBUFFER_SIZE_X " << this->_framebufferWidth  << ".0 \n";
+	shaderHeader << "#define FRAMEBUFFER_SIZE_Y " << this->_framebufferHeight << ".0 \n";
+	shaderHeader << "\n";
+
+	std::stringstream fragDepthConstants;
+
+	fragDepthConstants << "#define OUT_ATTACH " << (this->willFlipAndConvertFramebufferOnGPU ? 3 : 0) << "\n";
+
+	fragDepthConstants << "#define FOG_OFFSET " << fogOffset << "\n";
+	fragDepthConstants << "#define FOG_OFFSETF " << fogOffsetf << (((fogOffsetf == 0.0f) || (fogOffsetf == 1.0f)) ? ".0" : "") << "\n";
+	fragDepthConstants << "#define FOG_STEP " << fogStep << "\n";
+	fragDepthConstants << "\n";
+
+	std::string vtxShaderCode  = shaderHeader.str() + std::string(vtxShaderCString);
+	std::string fragShaderCode = shaderHeader.str() + fragDepthConstants.str() + std::string(fragShaderCString);
+
+	OGLFogShaderID shaderID;
+	shaderID.program = 0;
+	shaderID.fragShader = 0;
+
+	error = this->ShaderProgramCreate(OGLRef.vertexEdgeMarkFogShaderID,
+									  shaderID.fragShader,
+									  shaderID.program,
+									  vtxShaderCode.c_str(),
+									  fragShaderCode.c_str());
+
+	this->_edgeMarkFogProgramMap[fogProgramKey.key] = shaderID;
+
+	if (error != OGLERROR_NOERR)
+	{
+		INFO("OpenGL: Failed to create the EDGE MARK + FOG shader program.\n");
+		this->_glState.UseProgram(0);
+		this->DestroyEdgeMarkFogPrograms();
+		return error;
+	}
+
+	glBindAttribLocation(shaderID.program, OGLVertexAttributeID_Position, "inPosition");
+	glBindAttribLocation(shaderID.program, OGLVertexAttributeID_TexCoord0, "inTexCoord0");
+
+	glLinkProgram(shaderID.program);
+	if (!this->ValidateShaderProgramLink(shaderID.program))
+	{
+		INFO("OpenGL: Failed to link the EDGE MARK + FOG shader program.\n");
+		this->_glState.UseProgram(0);
+		this->DestroyEdgeMarkFogPrograms();
+		return OGLERROR_SHADER_CREATE_ERROR;
+	}
+
+	glValidateProgram(shaderID.program);
+	this->_glState.UseProgram(shaderID.program);
+
+	const GLint uniformTexGColor          = glGetUniformLocation(shaderID.program, "texInFragColor");
+	const GLint uniformTexGDepth          = glGetUniformLocation(shaderID.program, "texInFragDepth");
+	const GLint uniformTexGPolyID         = glGetUniformLocation(shaderID.program, "texInPolyID");
+	const GLint uniformTexGFog            = glGetUniformLocation(shaderID.program, "texInFogAttributes");
+	const GLint uniformTexFogDensityTable = glGetUniformLocation(shaderID.program, "texFogDensityTable");
+	glUniform1i(uniformTexGColor, OGLTextureUnitID_GColor);
+	glUniform1i(uniformTexGDepth, OGLTextureUnitID_DepthStencil);
+	glUniform1i(uniformTexGPolyID, OGLTextureUnitID_GPolyID);
+	glUniform1i(uniformTexGFog, OGLTextureUnitID_FogAttr);
+	glUniform1i(uniformTexFogDensityTable, OGLTextureUnitID_LookupTable);
+
+	OGLRef.uniformStateEdgeMarkFogClearPolyID          = glGetUniformLocation(shaderID.program, "clearPolyID");
+	OGLRef.uniformStateEdgeMarkFogClearDepth           = glGetUniformLocation(shaderID.program, "clearDepth");
+	OGLRef.uniformStateEdgeMarkFogEdgeColor            = glGetUniformLocation(shaderID.program, "stateEdgeColor");
+	OGLRef.uniformStateEdgeMarkFogEnableZeroDstAlpha   = glGetUniformLocation(shaderID.program, "stateEnableZeroDstAlphaEdgeMark");
+	OGLRef.uniformStateEdgeMarkFogEnableFogAlphaOnly   = glGetUniformLocation(shaderID.program, "stateEnableFogAlphaOnly");
+	OGLRef.uniformStateEdgeMarkFogFogColor             = glGetUniformLocation(shaderID.program, "stateFogColor");
+
+	return OGLERROR_NOERR;
+}
+
+void OpenGLESRenderer_3_0::DestroyEdgeMarkFogPrograms()
+{
+	OGLRenderRef &OGLRef = *this->ref;
+
+	while (this->_edgeMarkFogProgramMap.size() > 0)
+	{
+		std::map<u32, OGLFogShaderID>::iterator it = this->_edgeMarkFogProgramMap.begin();
+		OGLFogShaderID shaderID = it->second;
+
+		glDetachShader(shaderID.program, OGLRef.vertexEdgeMarkFogShaderID);
+		glDetachShader(shaderID.program, shaderID.fragShader);
+		this->_glState.DeleteProgram(shaderID.program);
+		glDeleteShader(shaderID.fragShader);
+
+		this->_edgeMarkFogProgramMap.erase(it);
 	}
 
-	if (!this->isMultisampledFBOSupported)
+	glDeleteShader(OGLRef.vertexEdgeMarkFogShaderID);
+	OGLRef.vertexEdgeMarkFogShaderID = 0;
+}
+
+Render3DError OpenGLESRenderer_3_0::CreateFramebufferOutput6665Program(const size_t outColorIndex, const char *vtxShaderCString, const char *fragShaderCString)
+{
+	Render3DError error = OGLERROR_NOERR;
+	OGLRenderRef &OGLRef = *this->ref;
+
+	if ( (vtxShaderCString == NULL) || (fragShaderCString == NULL) )
 	{
-		INFO("OpenGL: Multisampled FBOs are unsupported. Multisample antialiasing will be disabled.\n");
+		return error;
 	}
 
-	{
-		GLint maxColorAttachmentsOGL = 0;
-		GLint maxDrawBuffersOGL = 0;
-		GLint maxShaderTexUnitsOGL = 0;
-		glGetIntegerv(GL_MAX_COLOR_ATTACHMENTS, &maxColorAttachmentsOGL);
-		glGetIntegerv(GL_MAX_DRAW_BUFFERS, &maxDrawBuffersOGL);
-		glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &maxShaderTexUnitsOGL);
+	std::stringstream shaderHeader;
 
-		if ( (maxColorAttachmentsOGL >= 4) && (maxDrawBuffersOGL >= 4) && (maxShaderTexUnitsOGL >= 8) )
-		{
-			this->_enableTextureSmoothing = CommonSettings.GFX3D_Renderer_TextureSmoothing;
-			this->_emulateShadowPolygon = CommonSettings.OpenGL_Emulation_ShadowPolygon;
-			this->_emulateSpecialZeroAlphaBlending = CommonSettings.OpenGL_Emulation_SpecialZeroAlphaBlending;
-			this->_emulateNDSDepthCalculation = CommonSettings.OpenGL_Emulation_NDSDepthCalculation;
-			this->_emulateDepthLEqualPolygonFacing = CommonSettings.OpenGL_Emulation_DepthLEqualPolygonFacing;
+    shaderHeader << "#version 300 es\n";
+    shaderHeader << "precision highp float;\n";
 
-			error = this->CreateGeometryPrograms();
-			if (error == OGLERROR_NOERR)
-			{
-				error = this->CreateGeometryZeroDstAlphaProgram(GeometryZeroDstAlphaPixelMaskVtxShader_100, GeometryZeroDstAlphaPixelMaskFragShader_100);
-				if (error == OGLERROR_NOERR)
-				{
-					INFO("OpenGL: Successfully created geometry shaders.\n");
+	shaderHeader << "#define OUT_ATTACH " << (outColorIndex == 0 ? 0 : 3) << "\n";
 
-					error = this->InitPostprocessingPrograms(EdgeMarkVtxShader_100,
-															 EdgeMarkFragShader_100,
-															 FramebufferOutputVtxShader_100,
-															 FramebufferOutputRGBA6665FragShader_100,
-															 FramebufferOutputRGBA8888FragShader_100);
-				}
-			}
+	shaderHeader << "#define FRAMEBUFFER_SIZE_X " << this->_framebufferWidth  << ".0 \n";
+	shaderHeader << "#define FRAMEBUFFER_SIZE_Y " << this->_framebufferHeight << ".0 \n";
+    shaderHeader << "#define IS_BGRA " << (this->readFormat == GL_BGRA ? 1 : 0) << "\n";
+	shaderHeader << "\n";
 
-			if (error != OGLERROR_NOERR)
-			{
-				glUseProgram(0);
-				this->DestroyGeometryPrograms();
-				this->DestroyGeometryZeroDstAlphaProgram();
-				isShaderSupported = false;
-			}
-		}
-		else
-		{
-			INFO("OpenGL: Driver does not support at least 4 color attachments, 4 draw buffers, and 8 texture image units.\n");
-			isShaderSupported = false;
-		}
-	}
+	std::string vtxShaderCode  = shaderHeader.str() + std::string(vtxShaderCString);
+    std::string fragShaderCode  = shaderHeader.str() + std::string(fragShaderCString);
 
-	if (!isShaderSupported)
+	error = this->ShaderProgramCreate(OGLRef.vertexFramebufferOutput6665ShaderID[outColorIndex],
+									  OGLRef.fragmentFramebufferRGBA6665OutputShaderID[outColorIndex],
+									  OGLRef.programFramebufferRGBA6665OutputID[outColorIndex],
+									  vtxShaderCode.c_str(),
+									  fragShaderCode.c_str());
+	if (error != OGLERROR_NOERR)
 	{
-		INFO("OpenGL: Shaders are unsupported.\n");
-
-		glDeleteTextures(1, &OGLRef.texFinalColorID);
-		OGLRef.texFinalColorID = 0;
-
+		INFO("OpenGL: Failed to create the FRAMEBUFFER OUTPUT RGBA6665 shader program.\n");
+		this->_glState.UseProgram(0);
+		this->DestroyFramebufferOutput6665Programs();
 		return error;
 	}
 
-	if (this->isVAOSupported) this->CreateVAOs();
-
-	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboRenderID);
-
-	// Set rendering support flags based on driver features.
-	this->willFlipAndConvertFramebufferOnGPU = false; // get much better performance with this off on android
-	this->willFlipOnlyFramebufferOnGPU = this->willFlipAndConvertFramebufferOnGPU;
-	this->_deviceInfo.isEdgeMarkSupported = this->isVBOSupported && this->isFBOSupported;
-	this->_deviceInfo.isFogSupported = this->isVBOSupported && this->isFBOSupported;
-	this->_deviceInfo.isTextureSmoothingSupported = true;
+	glBindAttribLocation(OGLRef.programFramebufferRGBA6665OutputID[outColorIndex], OGLVertexAttributeID_Position, "inPosition");
+	glBindAttribLocation(OGLRef.programFramebufferRGBA6665OutputID[outColorIndex], OGLVertexAttributeID_TexCoord0, "inTexCoord0");
 
-	this->_isDepthLEqualPolygonFacingSupported = this->isVBOSupported && this->isFBOSupported;
+	glLinkProgram(OGLRef.programFramebufferRGBA6665OutputID[outColorIndex]);
+	if (!this->ValidateShaderProgramLink(OGLRef.programFramebufferRGBA6665OutputID[outColorIndex]))
+	{
+		INFO("OpenGL: Failed to link the FRAMEBUFFER OUTPUT RGBA6665 shader program.\n");
+		this->_glState.UseProgram(0);
+		this->DestroyFramebufferOutput6665Programs();
+		return OGLERROR_SHADER_CREATE_ERROR;
+	}
 
-	this->_enableMultisampledRendering = ((this->_selectedMultisampleSize >= 2) && this->isMultisampledFBOSupported);
+	glValidateProgram(OGLRef.programFramebufferRGBA6665OutputID[outColorIndex]);
+	this->_glState.UseProgram(OGLRef.programFramebufferRGBA6665OutputID[outColorIndex]);
 
-	this->InitFinalRenderStates(&oglExtensionSet); // This must be done last
+	const GLint uniformTexGColor = glGetUniformLocation(OGLRef.programFramebufferRGBA6665OutputID[outColorIndex], "texInFragColor");
+	if (outColorIndex == 0)
+	{
+		glUniform1i(uniformTexGColor, OGLTextureUnitID_FinalColor);
+	}
+	else
+	{
+		glUniform1i(uniformTexGColor, OGLTextureUnitID_GColor);
+	}
 
 	return OGLERROR_NOERR;
 }
 
-Render3DError OpenGLESRenderer_3_0::CreateVBOs()
+void OpenGLESRenderer_3_0::DestroyFramebufferOutput6665Programs()
 {
 	OGLRenderRef &OGLRef = *this->ref;
 
-	glGenBuffers(1, &OGLRef.vboGeometryVtxID);
-	glGenBuffers(1, &OGLRef.iboGeometryIndexID);
-	glGenBuffers(1, &OGLRef.vboPostprocessVtxID);
+	if (OGLRef.programFramebufferRGBA6665OutputID[0] != 0)
+	{
+		glDetachShader(OGLRef.programFramebufferRGBA6665OutputID[0], OGLRef.vertexFramebufferOutput6665ShaderID[0]);
+		glDetachShader(OGLRef.programFramebufferRGBA6665OutputID[0], OGLRef.fragmentFramebufferRGBA6665OutputShaderID[0]);
+		this->_glState.DeleteProgram(OGLRef.programFramebufferRGBA6665OutputID[0]);
+		OGLRef.programFramebufferRGBA6665OutputID[0] = 0;
+	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboGeometryVtxID);
-	glBufferData(GL_ARRAY_BUFFER, VERTLIST_SIZE * sizeof(NDSVertex), NULL, GL_STREAM_DRAW);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, OGLRef.iboGeometryIndexID);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(OGLRef.vertIndexBuffer), NULL, GL_STREAM_DRAW);
+	if (OGLRef.programFramebufferRGBA6665OutputID[1] != 0)
+	{
+		glDetachShader(OGLRef.programFramebufferRGBA6665OutputID[1], OGLRef.vertexFramebufferOutput6665ShaderID[1]);
+		glDetachShader(OGLRef.programFramebufferRGBA6665OutputID[1], OGLRef.fragmentFramebufferRGBA6665OutputShaderID[1]);
+		this->_glState.DeleteProgram(OGLRef.programFramebufferRGBA6665OutputID[1]);
+		OGLRef.programFramebufferRGBA6665OutputID[1] = 0;
+	}
 
-	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboPostprocessVtxID);
-	glBufferData(GL_ARRAY_BUFFER, sizeof(PostprocessVtxBuffer), PostprocessVtxBuffer, GL_STATIC_DRAW);
+	if (OGLRef.vertexFramebufferOutput6665ShaderID[0]) glDeleteShader(OGLRef.vertexFramebufferOutput6665ShaderID[0]);
+	if (OGLRef.vertexFramebufferOutput6665ShaderID[1]) glDeleteShader(OGLRef.vertexFramebufferOutput6665ShaderID[1]);
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	if (OGLRef.fragmentFramebufferRGBA6665OutputShaderID[0]) glDeleteShader(OGLRef.fragmentFramebufferRGBA6665OutputShaderID[0]);
+	if (OGLRef.fragmentFramebufferRGBA6665OutputShaderID[1]) glDeleteShader(OGLRef.fragmentFramebufferRGBA6665OutputShaderID[1]);
 
-	return OGLERROR_NOERR;
+	OGLRef.vertexFramebufferOutput6665ShaderID[0] = OGLRef.vertexFramebufferOutput6665ShaderID[1] = 0;
+	OGLRef.fragmentFramebufferRGBA6665OutputShaderID[0] = OGLRef.fragmentFramebufferRGBA6665OutputShaderID[1] = 0;
 }
 
-void OpenGLESRenderer_3_0::DestroyVBOs()
+Render3DError OpenGLESRenderer_3_0::CreateFramebufferOutput8888Program(const size_t outColorIndex, const char *vtxShaderCString, const char *fragShaderCString)
 {
-	if (!this->isVBOSupported)
+	Render3DError error = OGLERROR_NOERR;
+	OGLRenderRef &OGLRef = *this->ref;
+
+	if ( (vtxShaderCString == NULL) || (fragShaderCString == NULL) )
 	{
-		return;
+		return error;
 	}
 
-	OGLRenderRef &OGLRef = *this->ref;
+	std::stringstream shaderHeader;
 
-	glBindBuffer(GL_ARRAY_BUFFER, 0);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+    shaderHeader << "#version 300 es\n";
+    shaderHeader << "precision highp float;\n";
 
-	glDeleteBuffers(1, &OGLRef.vboGeometryVtxID);
-	glDeleteBuffers(1, &OGLRef.iboGeometryIndexID);
-	glDeleteBuffers(1, &OGLRef.vboPostprocessVtxID);
+	shaderHeader << "#define OUT_ATTACH " << (outColorIndex == 0 ? 0 : 3) << "\n";
 
-	this->isVBOSupported = false;
-}
+	shaderHeader << "#define FRAMEBUFFER_SIZE_X " << this->_framebufferWidth  << ".0 \n";
+	shaderHeader << "#define FRAMEBUFFER_SIZE_Y " << this->_framebufferHeight << ".0 \n";
+    shaderHeader << "#define IS_BGRA " << (this->readFormat == GL_BGRA ? 1 : 0) << " \n";
+	shaderHeader << "\n";
 
-Render3DError OpenGLESRenderer_3_0::CreatePBOs()
-{
-	OGLRenderRef &OGLRef = *this->ref;
+	std::string vtxShaderCode  = shaderHeader.str() + std::string(vtxShaderCString);
+    std::string fragShaderCode  = shaderHeader.str() + std::string(fragShaderCString);
 
-	glGenBuffers(1, &OGLRef.pboRenderDataID);
-	glBindBuffer(GL_PIXEL_PACK_BUFFER, OGLRef.pboRenderDataID);
-	glBufferData(GL_PIXEL_PACK_BUFFER, this->_framebufferColorSizeBytes, NULL, GL_STREAM_READ);
-	this->_mappedFramebuffer = (Color4u8 *__restrict)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, this->_framebufferColorSizeBytes, GL_MAP_READ_BIT);
+	error = this->ShaderProgramCreate(OGLRef.vertexFramebufferOutput8888ShaderID[outColorIndex],
+									  OGLRef.fragmentFramebufferRGBA8888OutputShaderID[outColorIndex],
+									  OGLRef.programFramebufferRGBA8888OutputID[outColorIndex],
+									  vtxShaderCode.c_str(),
+									  fragShaderCode.c_str());
+	if (error != OGLERROR_NOERR)
+	{
+		INFO("OpenGL: Failed to create the FRAMEBUFFER OUTPUT RGBA8888 shader program.\n");
+		this->_glState.UseProgram(0);
+		this->DestroyFramebufferOutput8888Programs();
+		return error;
+	}
+
+	glBindAttribLocation(OGLRef.programFramebufferRGBA8888OutputID[outColorIndex], OGLVertexAttributeID_Position, "inPosition");
+	glBindAttribLocation(OGLRef.programFramebufferRGBA8888OutputID[outColorIndex], OGLVertexAttributeID_TexCoord0, "inTexCoord0");
+
+	glLinkProgram(OGLRef.programFramebufferRGBA8888OutputID[outColorIndex]);
+	if (!this->ValidateShaderProgramLink(OGLRef.programFramebufferRGBA8888OutputID[outColorIndex]))
+	{
+		INFO("OpenGL: Failed to link the FRAMEBUFFER OUTPUT RGBA8888 shader program.\n");
+		this->_glState.UseProgram(0);
+		this->DestroyFramebufferOutput8888Programs();
+		return OGLERROR_SHADER_CREATE_ERROR;
+	}
+
+	glValidateProgram(OGLRef.programFramebufferRGBA8888OutputID[outColorIndex]);
+	this->_glState.UseProgram(OGLRef.programFramebufferRGBA8888OutputID[outColorIndex]);
+
+	const GLint uniformTexGColor = glGetUniformLocation(OGLRef.programFramebufferRGBA8888OutputID[outColorIndex], "texInFragColor");
+	if (outColorIndex == 0)
+	{
+		glUniform1i(uniformTexGColor, OGLTextureUnitID_FinalColor);
+	}
+	else
+	{
+		glUniform1i(uniformTexGColor, OGLTextureUnitID_GColor);
+	}
 
 	return OGLERROR_NOERR;
 }
 
-void OpenGLESRenderer_3_0::DestroyPBOs()
+void OpenGLESRenderer_3_0::DestroyFramebufferOutput8888Programs()
 {
-	if (!this->isPBOSupported)
+	OGLRenderRef &OGLRef = *this->ref;
+
+	if (OGLRef.programFramebufferRGBA8888OutputID[0] != 0)
 	{
-		return;
+		glDetachShader(OGLRef.programFramebufferRGBA8888OutputID[0], OGLRef.vertexFramebufferOutput8888ShaderID[0]);
+		glDetachShader(OGLRef.programFramebufferRGBA8888OutputID[0], OGLRef.fragmentFramebufferRGBA8888OutputShaderID[0]);
+		this->_glState.DeleteProgram(OGLRef.programFramebufferRGBA8888OutputID[0]);
+		OGLRef.programFramebufferRGBA8888OutputID[0] = 0;
 	}
 
-	if (this->_mappedFramebuffer != NULL)
+	if (OGLRef.programFramebufferRGBA8888OutputID[1] != 0)
 	{
-		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
-		this->_mappedFramebuffer = NULL;
+		glDetachShader(OGLRef.programFramebufferRGBA8888OutputID[1], OGLRef.vertexFramebufferOutput8888ShaderID[1]);
+		glDetachShader(OGLRef.programFramebufferRGBA8888OutputID[1], OGLRef.fragmentFramebufferRGBA8888OutputShaderID[1]);
+		this->_glState.DeleteProgram(OGLRef.programFramebufferRGBA8888OutputID[1]);
+		OGLRef.programFramebufferRGBA8888OutputID[1] = 0;
 	}
 
-	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
-	glDeleteBuffers(1, &this->ref->pboRenderDataID);
+	if (OGLRef.vertexFramebufferOutput8888ShaderID[0]) glDeleteShader(OGLRef.vertexFramebufferOutput8888ShaderID[0]);
+	if (OGLRef.vertexFramebufferOutput8888ShaderID[1]) glDeleteShader(OGLRef.vertexFramebufferOutput8888ShaderID[1]);
 
-	this->isPBOSupported = false;
+	if (OGLRef.fragmentFramebufferRGBA8888OutputShaderID[0]) glDeleteShader(OGLRef.fragmentFramebufferRGBA8888OutputShaderID[0]);
+	if (OGLRef.fragmentFramebufferRGBA8888OutputShaderID[1]) glDeleteShader(OGLRef.fragmentFramebufferRGBA8888OutputShaderID[1]);
+
+	OGLRef.vertexFramebufferOutput8888ShaderID[0] = OGLRef.vertexFramebufferOutput8888ShaderID[1] = 0;
+	OGLRef.fragmentFramebufferRGBA8888OutputShaderID[0] = OGLRef.fragmentFramebufferRGBA8888OutputShaderID[1] = 0;
 }
 
-Render3DError OpenGLESRenderer_3_0::CreateVAOs()
+Render3DError OpenGLESRenderer_3_0::CreateFramebufferOutput5551Program(const size_t outColorIndex, const char *vtxShaderCString, const char *fragShaderCString)
 {
+	Render3DError error = OGLERROR_NOERR;
 	OGLRenderRef &OGLRef = *this->ref;
 
-	glGenVertexArrays(1, &OGLRef.vaoGeometryStatesID);
-	glGenVertexArrays(1, &OGLRef.vaoPostprocessStatesID);
+	if ( (vtxShaderCString == NULL) || (fragShaderCString == NULL) )
+	{
+		return error;
+	}
+
+	std::stringstream shaderHeader;
+
+    shaderHeader << "#version 300 es\n";
+    shaderHeader << "precision highp float;\n";
+    shaderHeader << "precision highp int;\n";
+
+	shaderHeader << "#define OUT_ATTACH 1\n";
+
+	shaderHeader << "#define FRAMEBUFFER_SIZE_X " << this->_framebufferWidth  << ".0 \n";
+	shaderHeader << "#define FRAMEBUFFER_SIZE_Y " << this->_framebufferHeight << ".0 \n";
+	shaderHeader << "\n";
+
+	std::string vtxShaderCode  = shaderHeader.str() + std::string(vtxShaderCString);
+    std::string fragShaderCode  = shaderHeader.str() + std::string(fragShaderCString);
+
+	error = this->ShaderProgramCreate(OGLRef.vertexFramebufferOutput5551ShaderID[outColorIndex],
+									  OGLRef.fragmentFramebufferRGBA5551OutputShaderID[outColorIndex],
+									  OGLRef.programFramebufferRGBA5551OutputID[outColorIndex],
+									  vtxShaderCode.c_str(),
+									  fragShaderCode.c_str());
+	if (error != OGLERROR_NOERR)
+	{
+		INFO("OpenGL: Failed to create the FRAMEBUFFER OUTPUT RGBA5551 shader program.\n");
+		this->_glState.UseProgram(0);
+		this->DestroyFramebufferOutput5551Programs();
+		return error;
+	}
 
-	glBindVertexArray(OGLRef.vaoGeometryStatesID);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, OGLRef.iboGeometryIndexID);
+	glBindAttribLocation(OGLRef.programFramebufferRGBA5551OutputID[outColorIndex], OGLVertexAttributeID_Position, "inPosition");
+	glBindAttribLocation(OGLRef.programFramebufferRGBA5551OutputID[outColorIndex], OGLVertexAttributeID_TexCoord0, "inTexCoord0");
 
+	glLinkProgram(OGLRef.programFramebufferRGBA5551OutputID[outColorIndex]);
+	if (!this->ValidateShaderProgramLink(OGLRef.programFramebufferRGBA5551OutputID[outColorIndex]))
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboGeometryVtxID);
-
-		glEnableVertexAttribArray(OGLVertexAttributeID_Position);
-		glEnableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
-		glEnableVertexAttribArray(OGLVertexAttributeID_Color);
-		glVertexAttribPointer(OGLVertexAttributeID_Position, 4, GL_INT, GL_FALSE, sizeof(NDSVertex), (const GLvoid *)offsetof(NDSVertex, position));
-		glVertexAttribPointer(OGLVertexAttributeID_TexCoord0, 2, GL_INT, GL_FALSE, sizeof(NDSVertex), (const GLvoid *)offsetof(NDSVertex, texCoord));
-		glVertexAttribPointer(OGLVertexAttributeID_Color, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(NDSVertex), (const GLvoid *)offsetof(NDSVertex, color));
+		INFO("OpenGL: Failed to link the FRAMEBUFFER OUTPUT RGBA5551 shader program.\n");
+		this->_glState.UseProgram(0);
+		this->DestroyFramebufferOutput5551Programs();
+		return OGLERROR_SHADER_CREATE_ERROR;
 	}
 
-	glBindVertexArray(0);
-
-	glBindVertexArray(OGLRef.vaoPostprocessStatesID);
+	glValidateProgram(OGLRef.programFramebufferRGBA5551OutputID[outColorIndex]);
+	this->_glState.UseProgram(OGLRef.programFramebufferRGBA5551OutputID[outColorIndex]);
 
+	const GLint uniformTexGColor = glGetUniformLocation(OGLRef.programFramebufferRGBA5551OutputID[outColorIndex], "texInFragColor");
+	if (outColorIndex == 0)
 	{
-		glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboPostprocessVtxID);
-
-		glEnableVertexAttribArray(OGLVertexAttributeID_Position);
-		glEnableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
-		glVertexAttribPointer(OGLVertexAttributeID_Position, 2, GL_FLOAT, GL_FALSE, 0, 0);
-		glVertexAttribPointer(OGLVertexAttributeID_TexCoord0, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid *)(sizeof(GLfloat) * 8));
+		glUniform1i(uniformTexGColor, OGLTextureUnitID_FinalColor);
+	}
+	else
+	{
+		glUniform1i(uniformTexGColor, OGLTextureUnitID_GColor);
 	}
-
-	glBindVertexArray(0);
 
 	return OGLERROR_NOERR;
 }
 
-void OpenGLESRenderer_3_0::DestroyVAOs()
+void OpenGLESRenderer_3_0::DestroyFramebufferOutput5551Programs()
 {
 	OGLRenderRef &OGLRef = *this->ref;
 
-	if (!this->isVAOSupported)
+	if (OGLRef.programFramebufferRGBA5551OutputID[0] != 0)
 	{
-		return;
+		glDetachShader(OGLRef.programFramebufferRGBA5551OutputID[0], OGLRef.vertexFramebufferOutput5551ShaderID[0]);
+		glDetachShader(OGLRef.programFramebufferRGBA5551OutputID[0], OGLRef.fragmentFramebufferRGBA5551OutputShaderID[0]);
+		this->_glState.DeleteProgram(OGLRef.programFramebufferRGBA5551OutputID[0]);
+		OGLRef.programFramebufferRGBA5551OutputID[0] = 0;
 	}
 
-	glBindVertexArray(0);
-	glDeleteVertexArrays(1, &OGLRef.vaoGeometryStatesID);
-	glDeleteVertexArrays(1, &OGLRef.vaoPostprocessStatesID);
+	if (OGLRef.programFramebufferRGBA5551OutputID[1] != 0)
+	{
+		glDetachShader(OGLRef.programFramebufferRGBA5551OutputID[1], OGLRef.vertexFramebufferOutput5551ShaderID[1]);
+		glDetachShader(OGLRef.programFramebufferRGBA5551OutputID[1], OGLRef.fragmentFramebufferRGBA5551OutputShaderID[1]);
+		this->_glState.DeleteProgram(OGLRef.programFramebufferRGBA5551OutputID[1]);
+		OGLRef.programFramebufferRGBA5551OutputID[1] = 0;
+	}
 
-	this->isVAOSupported = false;
+	if (OGLRef.vertexFramebufferOutput5551ShaderID[0]) glDeleteShader(OGLRef.vertexFramebufferOutput5551ShaderID[0]);
+	if (OGLRef.vertexFramebufferOutput5551ShaderID[1]) glDeleteShader(OGLRef.vertexFramebufferOutput5551ShaderID[1]);
+
+	if (OGLRef.fragmentFramebufferRGBA5551OutputShaderID[0]) glDeleteShader(OGLRef.fragmentFramebufferRGBA5551OutputShaderID[0]);
+	if (OGLRef.fragmentFramebufferRGBA5551OutputShaderID[1]) glDeleteShader(OGLRef.fragmentFramebufferRGBA5551OutputShaderID[1]);
+
+	OGLRef.vertexFramebufferOutput5551ShaderID[0] = OGLRef.vertexFramebufferOutput5551ShaderID[1] = 0;
+	OGLRef.fragmentFramebufferRGBA5551OutputShaderID[0] = OGLRef.fragmentFramebufferRGBA5551OutputShaderID[1] = 0;
 }
 
-Render3DError OpenGLESRenderer_3_0::CreateFBOs()
+Render3DError OpenGLESRenderer_3_0::CreateFramebufferOutputDualProgram(const size_t outColorIndex, const NDSColorFormat outputFormat, const char *vtxShaderCString, const char *fragShaderCString)
 {
+	Render3DError error = OGLERROR_NOERR;
 	OGLRenderRef &OGLRef = *this->ref;
 
-	// Set up FBO render targets
-	glGenTextures(1, &OGLRef.texCIColorID);
-	glGenTextures(1, &OGLRef.texCIFogAttrID);
-	glGenTextures(1, &OGLRef.texCIDepthStencilID);
-
-	glGenTextures(1, &OGLRef.texGColorID);
-	glGenTextures(1, &OGLRef.texGFogAttrID);
-	glGenTextures(1, &OGLRef.texGPolyID);
-	glGenTextures(1, &OGLRef.texGDepthStencilID);
-
-	glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_DepthStencil);
-	glBindTexture(GL_TEXTURE_2D, OGLRef.texGDepthStencilID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
-
-	glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_GColor);
-	glBindTexture(GL_TEXTURE_2D, OGLRef.texGColorID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_MY_FORMAT, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight, 0, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
-
-	glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_GPolyID);
-	glBindTexture(GL_TEXTURE_2D, OGLRef.texGPolyID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_MY_FORMAT, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight, 0, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
-
-	glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_FogAttr);
-	glBindTexture(GL_TEXTURE_2D, OGLRef.texGFogAttrID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_MY_FORMAT, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight, 0, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
-
-	glActiveTexture(GL_TEXTURE0);
-
-	CACHE_ALIGN GLint tempClearImageBuffer[GPU_FRAMEBUFFER_NATIVE_WIDTH * GPU_FRAMEBUFFER_NATIVE_HEIGHT];
-	memset(tempClearImageBuffer, 0, sizeof(tempClearImageBuffer));
+	if ( (vtxShaderCString == NULL) || (fragShaderCString == NULL) )
+	{
+		return error;
+	}
 
-	glBindTexture(GL_TEXTURE_2D, OGLRef.texCIColorID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_MY_FORMAT, GPU_FRAMEBUFFER_NATIVE_WIDTH, GPU_FRAMEBUFFER_NATIVE_HEIGHT, 0, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, tempClearImageBuffer);
+	// Programs 0 and 1 output RGBA6665, while programs 2 and 3 output RGBA8888.
+	const size_t programIndex = ((outputFormat == NDSColorFormat_BGR666_Rev) ? 0 : 2) + outColorIndex;
 
-	glBindTexture(GL_TEXTURE_2D, OGLRef.texCIDepthStencilID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, GL_NONE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, GPU_FRAMEBUFFER_NATIVE_WIDTH, GPU_FRAMEBUFFER_NATIVE_HEIGHT, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, tempClearImageBuffer);
+	std::stringstream shaderHeader;
 
-	glBindTexture(GL_TEXTURE_2D, OGLRef.texCIFogAttrID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_MY_FORMAT, GPU_FRAMEBUFFER_NATIVE_WIDTH, GPU_FRAMEBUFFER_NATIVE_HEIGHT, 0, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, tempClearImageBuffer);
+    shaderHeader << "#version 300 es\n";
+    shaderHeader << "precision highp float;\n";
+    shaderHeader << "precision highp int;\n";
 
-	glBindTexture(GL_TEXTURE_2D, 0);
+	shaderHeader << "#define OUT_ATTACH " << (outColorIndex == 0 ? 0 : 3) << "\n";
+	shaderHeader << "#define OUT_ATTACH16 1\n";
+	shaderHeader << "#define OUTPUT_6665 " << ((outputFormat == NDSColorFormat_BGR666_Rev) ? 1 : 0) << "\n";
 
-	// Set up FBOs
-	glGenFramebuffers(1, &OGLRef.fboClearImageID);
-	glGenFramebuffers(1, &OGLRef.fboFramebufferFlipID);
-	glGenFramebuffers(1, &OGLRef.fboRenderID);
+	shaderHeader << "#define FRAMEBUFFER_SIZE_X " << this->_framebufferWidth  << ".0 \n";
+	shaderHeader << "#define FRAMEBUFFER_SIZE_Y " << this->_framebufferHeight << ".0 \n";
+    shaderHeader << "#define IS_BGRA " << (this->readFormat == GL_BGRA ? 1 : 0) << " \n";
+	shaderHeader << "\n";
 
-	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboClearImageID);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOROUT_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texCIColorID, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_FOGATTRIBUTES_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texCIFogAttrID, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, OGLRef.texCIDepthStencilID, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, OGLRef.texCIDepthStencilID, 0);
+	std::string vtxShaderCode  = shaderHeader.str() + std::string(vtxShaderCString);
+    std::string fragShaderCode  = shaderHeader.str() + std::string(fragShaderCString);
 
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	error = this->ShaderProgramCreate(OGLRef.vertexFramebufferOutputDualShaderID[programIndex],
+									  OGLRef.fragmentFramebufferDualOutputShaderID[programIndex],
+									  OGLRef.programFramebufferDualOutputID[programIndex],
+									  vtxShaderCode.c_str(),
+									  fragShaderCode.c_str());
+	if (error != OGLERROR_NOERR)
 	{
-		INFO("OpenGL: Failed to create FBOs 1!\n");
-		this->DestroyFBOs();
-
-		return OGLERROR_FBO_CREATE_ERROR;
+		INFO("OpenGL: Failed to create the FRAMEBUFFER OUTPUT DUAL shader program.\n");
+		this->_glState.UseProgram(0);
+		this->DestroyFramebufferOutputDualPrograms();
+		return error;
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboFramebufferFlipID);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOROUT_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texGColorID, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_WORKING_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texFinalColorID, 0);
+	glBindAttribLocation(OGLRef.programFramebufferDualOutputID[programIndex], OGLVertexAttributeID_Position, "inPosition");
+	glBindAttribLocation(OGLRef.programFramebufferDualOutputID[programIndex], OGLVertexAttributeID_TexCoord0, "inTexCoord0");
 
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	glLinkProgram(OGLRef.programFramebufferDualOutputID[programIndex]);
+	if (!this->ValidateShaderProgramLink(OGLRef.programFramebufferDualOutputID[programIndex]))
 	{
-		INFO("OpenGL: Failed to create FBOs 2!\n");
-		this->DestroyFBOs();
-
-		return OGLERROR_FBO_CREATE_ERROR;
+		INFO("OpenGL: Failed to link the FRAMEBUFFER OUTPUT DUAL shader program.\n");
+		this->_glState.UseProgram(0);
+		this->DestroyFramebufferOutputDualPrograms();
+		return OGLERROR_SHADER_CREATE_ERROR;
 	}
 
-	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboRenderID);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOROUT_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texGColorID, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_POLYID_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texGPolyID, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_FOGATTRIBUTES_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texGFogAttrID, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_WORKING_ATTACHMENT_ID, GL_TEXTURE_2D, OGLRef.texFinalColorID, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, OGLRef.texGDepthStencilID, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_TEXTURE_2D, OGLRef.texGDepthStencilID, 0);
+	glValidateProgram(OGLRef.programFramebufferDualOutputID[programIndex]);
+	this->_glState.UseProgram(OGLRef.programFramebufferDualOutputID[programIndex]);
 
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	const GLint uniformTexGColor = glGetUniformLocation(OGLRef.programFramebufferDualOutputID[programIndex], "texInFragColor");
+	if (outColorIndex == 0)
 	{
-		INFO("OpenGL: Failed to create FBOs 3!\n");
-		this->DestroyFBOs();
-
-		return OGLERROR_FBO_CREATE_ERROR;
+		glUniform1i(uniformTexGColor, OGLTextureUnitID_FinalColor);
+	}
+	else
+	{
+		glUniform1i(uniformTexGColor, OGLTextureUnitID_GColor);
 	}
-
-	glDrawBuffer(GL_COLOROUT_ATTACHMENT_ID);
-	glReadBuffer(GL_COLOROUT_ATTACHMENT_ID);
-
-	OGLRef.selectedRenderingFBO = OGLRef.fboRenderID;
-	INFO("OpenGL: Successfully created FBOs.\n");
 
 	return OGLERROR_NOERR;
 }
 
-void OpenGLESRenderer_3_0::DestroyFBOs()
+void OpenGLESRenderer_3_0::DestroyFramebufferOutputDualPrograms()
 {
-	if (!this->isFBOSupported)
-	{
-		return;
-	}
-
 	OGLRenderRef &OGLRef = *this->ref;
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glDeleteFramebuffers(1, &OGLRef.fboClearImageID);
-	glDeleteFramebuffers(1, &OGLRef.fboFramebufferFlipID);
-	glDeleteFramebuffers(1, &OGLRef.fboRenderID);
-	glDeleteTextures(1, &OGLRef.texCIColorID);
-	glDeleteTextures(1, &OGLRef.texCIFogAttrID);
-	glDeleteTextures(1, &OGLRef.texCIDepthStencilID);
-	glDeleteTextures(1, &OGLRef.texGColorID);
-	glDeleteTextures(1, &OGLRef.texGPolyID);
-	glDeleteTextures(1, &OGLRef.texGFogAttrID);
-	glDeleteTextures(1, &OGLRef.texGDepthStencilID);
+	for (size_t i = 0; i < 4; i++)
+	{
+		if (OGLRef.programFramebufferDualOutputID[i] != 0)
+		{
+			glDetachShader(OGLRef.programFramebufferDualOutputID[i], OGLRef.vertexFramebufferOutputDualShaderID[i]);
+			glDetachShader(OGLRef.programFramebufferDualOutputID[i], OGLRef.fragmentFramebufferDualOutputShaderID[i]);
+			this->_glState.DeleteProgram(OGLRef.programFramebufferDualOutputID[i]);
+			OGLRef.programFramebufferDualOutputID[i] = 0;
+		}
 
-	OGLRef.fboClearImageID = 0;
-	OGLRef.fboFramebufferFlipID = 0;
-	OGLRef.fboRenderID = 0;
+		if (OGLRef.vertexFramebufferOutputDualShaderID[i]) glDeleteShader(OGLRef.vertexFramebufferOutputDualShaderID[i]);
+		if (OGLRef.fragmentFramebufferDualOutputShaderID[i]) glDeleteShader(OGLRef.fragmentFramebufferDualOutputShaderID[i]);
 
-	this->isFBOSupported = false;
+		OGLRef.vertexFramebufferOutputDualShaderID[i] = 0;
+		OGLRef.fragmentFramebufferDualOutputShaderID[i] = 0;
+	}
 }
 
-Render3DError OpenGLESRenderer_3_0::CreateMultisampledFBO(GLsizei numSamples)
+Render3DError OpenGLESRenderer_3_0::CreateFrameExportResources()
 {
 	OGLRenderRef &OGLRef = *this->ref;
 
-	// Set up FBO render targets
-	glGenRenderbuffers(1, &OGLRef.rboMSGColorID);
-	glGenRenderbuffers(1, &OGLRef.rboMSGWorkingID);
-	glGenRenderbuffers(1, &OGLRef.rboMSGPolyID);
-	glGenRenderbuffers(1, &OGLRef.rboMSGFogAttrID);
-	glGenRenderbuffers(1, &OGLRef.rboMSGDepthStencilID);
-
-	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGColorID);
-	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_RGBA, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight);
-	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGWorkingID);
-	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_RGBA, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight);
-	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGPolyID);
-	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_RGBA, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight);
-	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGFogAttrID);
-	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_RGBA, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight);
-	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGDepthStencilID);
-	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_DEPTH24_STENCIL8, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight);
+	if (!this->isFBOSupported)
+	{
+		INFO("OpenGL: Frame export requires FBO support.\n");
+		return OGLERROR_FBO_UNSUPPORTED;
+	}
 
-	// Set up multisampled rendering FBO
-	glGenFramebuffers(1, &OGLRef.fboMSIntermediateRenderID);
-	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboMSIntermediateRenderID);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOROUT_ATTACHMENT_ID, GL_RENDERBUFFER, OGLRef.rboMSGColorID);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_POLYID_ATTACHMENT_ID, GL_RENDERBUFFER, OGLRef.rboMSGPolyID);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_FOGATTRIBUTES_ATTACHMENT_ID, GL_RENDERBUFFER, OGLRef.rboMSGFogAttrID);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_WORKING_ATTACHMENT_ID, GL_RENDERBUFFER, OGLRef.rboMSGWorkingID);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, OGLRef.rboMSGDepthStencilID);
-	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_STENCIL_ATTACHMENT, GL_RENDERBUFFER, OGLRef.rboMSGDepthStencilID);
+	glGenFramebuffers(1, &OGLRef.fboExportID);
+	glGenTextures(OGLRENDER_EXPORT_TEXTURE_COUNT, OGLRef.texExportColorID);
 
-	if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
+	// Immutable storage keeps the textures eligible for EGL image export on every driver.
+	for (size_t i = 0; i < OGLRENDER_EXPORT_TEXTURE_COUNT; i++)
 	{
-		INFO("OpenGL: Failed to create multisampled FBO!\n");
-		this->DestroyMultisampledFBO();
+		this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texExportColorID[i]);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexStorage2D(GL_TEXTURE_2D, 1, GL_RGBA8, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight);
 
-		return OGLERROR_FBO_CREATE_ERROR;
+		OGLExportedFrame &frame = this->_exportedFrame[i];
+		memset(&frame, 0, sizeof(OGLExportedFrame));
+		frame.index = i;
+		frame.width = this->_framebufferWidth;
+		frame.height = this->_framebufferHeight;
+		frame.textureID = OGLRef.texExportColorID[i];
+		frame.fence = NULL;
+		frame.eglImage = NULL;
+		frame.dmabufFD = -1;
+
+		this->_isExportInUse[i] = false;
 	}
 
+	this->_glState.BindTexture(GL_TEXTURE_2D, 0);
+	this->_exportLatestIndex = OGLRENDER_EXPORT_TEXTURE_COUNT;
 
-	glDrawBuffer(GL_COLOROUT_ATTACHMENT_ID);
-	glReadBuffer(GL_COLOROUT_ATTACHMENT_ID);
+#ifdef OGLRENDER_SUPPORTS_EGL
+	// The textures work on their own for consumers sharing this context. EGL images and
+	// dma-bufs are extras for consumers outside of it, so don't fail if they're unavailable.
+	EGLDisplay eglDisplay = eglGetCurrentDisplay();
+	EGLContext eglContext = eglGetCurrentContext();
+	const char *eglExtensionsCString = (eglDisplay != EGL_NO_DISPLAY) ? eglQueryString(eglDisplay, EGL_EXTENSIONS) : NULL;
+	const std::string eglExtensions = (eglExtensionsCString != NULL) ? std::string(eglExtensionsCString) : std::string();
 
-	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboRenderID);
-	INFO("OpenGL: Successfully created multisampled FBO.\n");
+	const bool isEGLImageSupported = (eglContext != EGL_NO_CONTEXT) &&
+	                                 (eglExtensions.find("EGL_KHR_image_base") != std::string::npos) &&
+	                                 (eglExtensions.find("EGL_KHR_gl_texture_2D_image") != std::string::npos);
 
-	return OGLERROR_NOERR;
-}
+	if (isEGLImageSupported)
+	{
+		oglEGLCreateImageKHR = (PFNEGLCREATEIMAGEKHRPROC)eglGetProcAddress("eglCreateImageKHR");
+		oglEGLDestroyImageKHR = (PFNEGLDESTROYIMAGEKHRPROC)eglGetProcAddress("eglDestroyImageKHR");
+	}
 
-void OpenGLESRenderer_3_0::DestroyMultisampledFBO()
-{
-	if (!this->isMultisampledFBOSupported)
+#if defined(OGLRENDER_SUPPORTS_DMABUF) && defined(EGL_MESA_image_dma_buf_export)
+	const bool isDMABufExportSupported = isEGLImageSupported && (eglExtensions.find("EGL_MESA_image_dma_buf_export") != std::string::npos);
+
+	if (isDMABufExportSupported)
 	{
-		return;
+		oglEGLExportDMABUFImageQueryMESA = (PFNEGLEXPORTDMABUFIMAGEQUERYMESAPROC)eglGetProcAddress("eglExportDMABUFImageQueryMESA");
+		oglEGLExportDMABUFImageMESA = (PFNEGLEXPORTDMABUFIMAGEMESAPROC)eglGetProcAddress("eglExportDMABUFImageMESA");
 	}
+#endif
 
-	OGLRenderRef &OGLRef = *this->ref;
+	if ( isEGLImageSupported && (oglEGLCreateImageKHR != NULL) && (oglEGLDestroyImageKHR != NULL) )
+	{
+		const EGLint imageAttributes[] = { EGL_GL_TEXTURE_LEVEL_KHR, 0, EGL_NONE };
 
-	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	glDeleteFramebuffers(1, &OGLRef.fboMSIntermediateRenderID);
-	glDeleteRenderbuffers(1, &OGLRef.rboMSGColorID);
-	glDeleteRenderbuffers(1, &OGLRef.rboMSGWorkingID);
-	glDeleteRenderbuffers(1, &OGLRef.rboMSGPolyID);
-	glDeleteRenderbuffers(1, &OGLRef.rboMSGFogAttrID);
-	glDeleteRenderbuffers(1, &OGLRef.rboMSGDepthStencilID);
+		for (size_t i = 0; i < OGLRENDER_EXPORT_TEXTURE_COUNT; i++)
+		{
+			OGLExportedFrame &frame = this->_exportedFrame[i];
 
-	OGLRef.fboMSIntermediateRenderID = 0;
-	OGLRef.rboMSGColorID = 0;
-	OGLRef.rboMSGWorkingID = 0;
-	OGLRef.rboMSGPolyID = 0;
-	OGLRef.rboMSGFogAttrID = 0;
-	OGLRef.rboMSGDepthStencilID = 0;
+			EGLImageKHR eglImage = oglEGLCreateImageKHR(eglDisplay, eglContext, EGL_GL_TEXTURE_2D_KHR, (EGLClientBuffer)(uintptr_t)OGLRef.texExportColorID[i], imageAttributes);
+			if (eglImage == EGL_NO_IMAGE_KHR)
+			{
+				INFO("OpenGL: Failed to create an EGL image for frame export.\n");
+				continue;
+			}
+
+			frame.eglImage = (void *)eglImage;
+			this->_exportEGLDisplay = eglDisplay;
+
+#if defined(OGLRENDER_SUPPORTS_DMABUF) && defined(EGL_MESA_image_dma_buf_export)
+			if ( isDMABufExportSupported && (oglEGLExportDMABUFImageQueryMESA != NULL) && (oglEGLExportDMABUFImageMESA != NULL) )
+			{
+				int fourCC = 0;
+				int planeCount = 0;
+				EGLuint64KHR modifier = 0;
+
+				// Only single-plane images can be described by OGLExportedFrame.
+				if ( oglEGLExportDMABUFImageQueryMESA(eglDisplay, eglImage, &fourCC, &planeCount, &modifier) && (planeCount == 1) )
+				{
+					int fd = -1;
+					EGLint stride = 0;
+					EGLint offset = 0;
+
+					if (oglEGLExportDMABUFImageMESA(eglDisplay, eglImage, &fd, &stride, &offset))
+					{
+						frame.dmabufFD = fd;
+						frame.dmabufFourCC = fourCC;
+						frame.dmabufStride = stride;
+						frame.dmabufOffset = offset;
+						frame.dmabufModifier = (u64)modifier;
+					}
+				}
+			}
+#endif
+		}
+	}
+#endif
 
-	this->isMultisampledFBOSupported = false;
+	return OGLERROR_NOERR;
 }
 
-void OpenGLESRenderer_3_0::ResizeMultisampledFBOs(GLsizei numSamples)
+void OpenGLESRenderer_3_0::DestroyFrameExportResources()
 {
 	OGLRenderRef &OGLRef = *this->ref;
-	GLsizei w = (GLsizei)this->_framebufferWidth;
-	GLsizei h = (GLsizei)this->_framebufferHeight;
 
-	if ( !this->isMultisampledFBOSupported ||
-		 (numSamples == 1) ||
-		 (w < GPU_FRAMEBUFFER_NATIVE_WIDTH) || (h < GPU_FRAMEBUFFER_NATIVE_HEIGHT) )
+	for (size_t i = 0; i < OGLRENDER_EXPORT_TEXTURE_COUNT; i++)
 	{
-		return;
+		OGLExportedFrame &frame = this->_exportedFrame[i];
+
+		if (frame.fence != NULL)
+		{
+			glDeleteSync(frame.fence);
+			frame.fence = NULL;
+		}
+
+#ifdef OGLRENDER_SUPPORTS_DMABUF
+		if (frame.dmabufFD >= 0)
+		{
+			close(frame.dmabufFD);
+		}
+#endif
+		frame.dmabufFD = -1;
+
+#ifdef OGLRENDER_SUPPORTS_EGL
+		if ( (frame.eglImage != NULL) && (oglEGLDestroyImageKHR != NULL) )
+		{
+			// The images belong to the display that created them, which need not be current anymore.
+			oglEGLDestroyImageKHR(this->_exportEGLDisplay, (EGLImageKHR)frame.eglImage);
+		}
+#endif
+		frame.eglImage = NULL;
+		frame.textureID = 0;
+
+		this->_isExportInUse[i] = false;
 	}
 
-	if (numSamples == 0)
+	if (OGLRef.fboExportID != 0)
 	{
-		w = 0;
-		h = 0;
-		numSamples = 2;
+		glDeleteFramebuffers(1, &OGLRef.fboExportID);
+		OGLRef.fboExportID = 0;
 	}
 
-	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGColorID);
-	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_RGBA, w, h);
-	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGWorkingID);
-	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_RGBA, w, h);
-	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGPolyID);
-	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_RGBA, w, h);
-	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGFogAttrID);
-	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_RGBA, w, h);
-	glBindRenderbuffer(GL_RENDERBUFFER, OGLRef.rboMSGDepthStencilID);
-	glRenderbufferStorageMultisample(GL_RENDERBUFFER, numSamples, GL_DEPTH24_STENCIL8, w, h);
+	this->_glState.DeleteTextures(OGLRENDER_EXPORT_TEXTURE_COUNT, OGLRef.texExportColorID);
+
+	for (size_t i = 0; i < OGLRENDER_EXPORT_TEXTURE_COUNT; i++)
+	{
+		OGLRef.texExportColorID[i] = 0;
+	}
+
+	this->_exportLatestIndex = OGLRENDER_EXPORT_TEXTURE_COUNT;
+#ifdef OGLRENDER_SUPPORTS_EGL
+	this->_exportEGLDisplay = EGL_NO_DISPLAY;
+#endif
 }
 
-Render3DError OpenGLESRenderer_3_0::CreateGeometryPrograms()
+Render3DError OpenGLESRenderer_3_0::InitPostprocessingPrograms(const char *edgeMarkVtxShaderCString,
+															 const char *edgeMarkFragShaderCString,
+															 const char *framebufferOutputVtxShaderCString,
+															 const char *framebufferOutputRGBA6665FragShaderCString,
+															 const char *framebufferOutputRGBA8888FragShaderCString)
 {
 	Render3DError error = OGLERROR_NOERR;
 	OGLRenderRef &OGLRef = *this->ref;
 
-	glGenTextures(1, &OGLRef.texToonTableID);
-	glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_LookupTable);
-	glBindTexture(GL_TEXTURE_2D, OGLRef.texToonTableID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, 32, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-
-	glGenTextures(1, &OGLRef.texEdgeColorTableID);
-	glBindTexture(GL_TEXTURE_2D, OGLRef.texEdgeColorTableID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_MY_FORMAT, 8, 1, 0, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+	if (this->isVBOSupported && this->isFBOSupported)
+	{
+		error = this->CreateEdgeMarkProgram(edgeMarkVtxShaderCString, edgeMarkFragShaderCString);
+		if (error != OGLERROR_NOERR)
+		{
+			return error;
+		}
+	}
 
-	glGenTextures(1, &OGLRef.texFogDensityTableID);
-	glBindTexture(GL_TEXTURE_2D, OGLRef.texFogDensityTableID);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_LUMINANCE, 32, 1, 0, GL_LUMINANCE, GL_UNSIGNED_BYTE, NULL);
-	glActiveTexture(GL_TEXTURE0);
+	error = this->CreateFramebufferOutput6665Program(0, framebufferOutputVtxShaderCString, framebufferOutputRGBA6665FragShaderCString);
+	if (error != OGLERROR_NOERR)
+	{
+		return error;
+	}
 
-	OGLGeometryFlags programFlags;
-	programFlags.value = 0;
+	error = this->CreateFramebufferOutput6665Program(1, framebufferOutputVtxShaderCString, framebufferOutputRGBA6665FragShaderCString);
+	if (error != OGLERROR_NOERR)
+	{
+		return error;
+	}
 
-	std::stringstream vtxShaderHeader;
+	error = this->CreateFramebufferOutput8888Program(0, framebufferOutputVtxShaderCString, framebufferOutputRGBA8888FragShaderCString);
+	if (error != OGLERROR_NOERR)
+	{
+		return error;
+	}
 
-    vtxShaderHeader << "#version 300 es\n";
-    vtxShaderHeader << "precision highp float;\n";
+	error = this->CreateFramebufferOutput8888Program(1, framebufferOutputVtxShaderCString, framebufferOutputRGBA8888FragShaderCString);
+	if (error != OGLERROR_NOERR)
+	{
+		return error;
+	}
 
-	vtxShaderHeader << "#define DEPTH_EQUALS_TEST_TOLERANCE " << DEPTH_EQUALS_TEST_TOLERANCE << ".0\n";
-	vtxShaderHeader << "\n";
+	// The RGBA5551 outputs are only an optimization, so don't fail if they can't be created.
+	if ( (this->CreateFramebufferOutput5551Program(0, framebufferOutputVtxShaderCString, FramebufferOutputRGBA5551FragShader_100) != OGLERROR_NOERR) ||
+		 (this->CreateFramebufferOutput5551Program(1, framebufferOutputVtxShaderCString, FramebufferOutputRGBA5551FragShader_100) != OGLERROR_NOERR) ||
+		 (this->CreateFramebufferOutputDualProgram(0, NDSColorFormat_BGR666_Rev, framebufferOutputVtxShaderCString, FramebufferOutputDualFragShader_100) != OGLERROR_NOERR) ||
+		 (this->CreateFramebufferOutputDualProgram(1, NDSColorFormat_BGR666_Rev, framebufferOutputVtxShaderCString, FramebufferOutputDualFragShader_100) != OGLERROR_NOERR) ||
+		 (this->CreateFramebufferOutputDualProgram(0, NDSColorFormat_BGR888_Rev, framebufferOutputVtxShaderCString, FramebufferOutputDualFragShader_100) != OGLERROR_NOERR) ||
+		 (this->CreateFramebufferOutputDualProgram(1, NDSColorFormat_BGR888_Rev, framebufferOutputVtxShaderCString, FramebufferOutputDualFragShader_100) != OGLERROR_NOERR) )
+	{
+		INFO("OpenGL: RGBA5551 framebuffer output is unavailable.\n");
+		this->_isFramebufferOutput5551Supported = false;
+	}
 
-	std::string vtxShaderCode  = vtxShaderHeader.str() + std::string(GeometryVtxShader_100);
+	this->_glState.UseProgram(OGLRef.programGeometryID[0]);
+	INFO("OpenGL: Successfully created postprocess shaders.\n");
 
-	std::stringstream fragShaderHeader;
+	return OGLERROR_NOERR;
+}
 
-    fragShaderHeader << "#version 300 es\n";
-    fragShaderHeader << "precision highp float;\n";
+// Repacks the clear image depth and fog buffers into their upload formats, and compares the
+// results against the last clear image in the same pass. This replaces a separate full-buffer
+// memcmp() for each buffer after the repack.
+template <bool WILL_PACK_FOG>
+static FORCEINLINE void OGLPackClearImageDepthFog(const u32 *__restrict depthBuffer, const u8 *__restrict fogBuffer, const u8 opaquePolyID,
+												  GLuint *__restrict dstDepthStencil, GLuint *__restrict dstFogAttr,
+												  const GLuint *__restrict lastDepthStencil, const GLuint *__restrict lastFogAttr,
+												  bool &didDepthStencilChange, bool &didFogAttrChange)
+{
+	const size_t pixCount = GPU_FRAMEBUFFER_NATIVE_WIDTH * GPU_FRAMEBUFFER_NATIVE_HEIGHT;
+	size_t i = 0;
 
-	fragShaderHeader << "#define FRAMEBUFFER_SIZE_X " << this->_framebufferWidth  << ".0 \n";
-	fragShaderHeader << "#define FRAMEBUFFER_SIZE_Y " << this->_framebufferHeight << ".0 \n";
-	fragShaderHeader << "\n";
-	//fragShaderHeader << "#define OUTFRAGCOLOR " << ((this->isFBOSupported) ? "gl_FragData[0]" : "gl_FragColor") << "\n";
-	//fragShaderHeader << "\n";
+#if defined(ENABLE_AVX2)
+	const v256u32 polyID_vec256 = _mm256_set1_epi32(opaquePolyID);
+	const v256u32 fogBase_vec256 = _mm256_set1_epi32(0xFF000000);
+	const v256u32 fogEnable_vec256 = _mm256_set1_epi32(0x000000FF);
+	v256u32 depthDiff = _mm256_setzero_si256();
+	v256u32 fogDiff = _mm256_setzero_si256();
 
-	for (size_t flagsValue = 0; flagsValue < 128; flagsValue++, programFlags.value++)
+	for (; i < pixCount; i += 8)
 	{
-		std::stringstream shaderFlags;
-		shaderFlags << "#define USE_TEXTURE_SMOOTHING " << ((this->_enableTextureSmoothing) ? 1 : 0) << "\n";
-		shaderFlags << "#define USE_NDS_DEPTH_CALCULATION " << ((this->_emulateNDSDepthCalculation) ? 1 : 0) << "\n";
-		shaderFlags << "#define USE_DEPTH_LEQUAL_POLYGON_FACING " << ((this->_emulateDepthLEqualPolygonFacing && this->isVBOSupported && this->isFBOSupported) ? 1 : 0) << "\n";
-		shaderFlags << "\n";
-		shaderFlags << "#define ENABLE_W_DEPTH " << ((programFlags.EnableWDepth) ? 1 : 0) << "\n";
-		shaderFlags << "#define ENABLE_ALPHA_TEST " << ((programFlags.EnableAlphaTest) ? "true\n" : "false\n");
-		shaderFlags << "#define ENABLE_TEXTURE_SAMPLING " << ((programFlags.EnableTextureSampling) ? "true\n" : "false\n");
-		shaderFlags << "#define TOON_SHADING_MODE " << ((programFlags.ToonShadingMode) ? 1 : 0) << "\n";
-		shaderFlags << "#define ENABLE_FOG " << ((programFlags.EnableFog && this->isVBOSupported && this->isFBOSupported) ? 1 : 0) << "\n";
-		shaderFlags << "#define ENABLE_EDGE_MARK " << ((programFlags.EnableEdgeMark && this->isVBOSupported && this->isFBOSupported) ? 1 : 0) << "\n";
-		shaderFlags << "#define DRAW_MODE_OPAQUE " << ((programFlags.OpaqueDrawMode && this->isVBOSupported && this->isFBOSupported) ? 1 : 0) << "\n";
-		shaderFlags << "\n";
-		shaderFlags << "#define ATTACHMENT_WORKING_BUFFER " << GeometryAttachmentWorkingBuffer[programFlags.DrawBuffersMode] << "\n";
-		shaderFlags << "#define ATTACHMENT_POLY_ID " << GeometryAttachmentPolyID[programFlags.DrawBuffersMode] << "\n";
-		shaderFlags << "#define ATTACHMENT_FOG_ATTRIBUTES " << GeometryAttachmentFogAttributes[programFlags.DrawBuffersMode] << "\n";
-		shaderFlags << "\n";
-
-		std::string fragShaderCode = fragShaderHeader.str() + shaderFlags.str() + std::string(GeometryFragShader_100);
+		const v256u32 depthStencil = _mm256_or_si256( _mm256_slli_epi32(_mm256_loadu_si256((v256u32 *)(depthBuffer + i)), 8), polyID_vec256 );
+		_mm256_store_si256((v256u32 *)(dstDepthStencil + i), depthStencil);
+		depthDiff = _mm256_or_si256( depthDiff, _mm256_xor_si256(depthStencil, _mm256_load_si256((v256u32 *)(lastDepthStencil + i))) );
 
-		error = this->ShaderProgramCreate(OGLRef.vertexGeometryShaderID,
-										  OGLRef.fragmentGeometryShaderID[flagsValue],
-										  OGLRef.programGeometryID[flagsValue],
-										  vtxShaderCode.c_str(),
-										  fragShaderCode.c_str());
-		if (error != OGLERROR_NOERR)
+		if (WILL_PACK_FOG)
 		{
-			INFO("OpenGL: Failed to create the GEOMETRY shader program.\n");
-			glUseProgram(0);
-			this->DestroyGeometryPrograms();
-			return error;
+			const v256u32 fog = _mm256_cvtepu8_epi32( _mm_loadl_epi64((__m128i *)(fogBuffer + i)) );
+			const v256u32 fogAttr = _mm256_or_si256( fogBase_vec256, _mm256_andnot_si256(_mm256_cmpeq_epi32(fog, _mm256_setzero_si256()), fogEnable_vec256) );
+			_mm256_store_si256((v256u32 *)(dstFogAttr + i), fogAttr);
+			fogDiff = _mm256_or_si256( fogDiff, _mm256_xor_si256(fogAttr, _mm256_load_si256((v256u32 *)(lastFogAttr + i))) );
 		}
+	}
 
-		glBindAttribLocation(OGLRef.programGeometryID[flagsValue], OGLVertexAttributeID_Position, "inPosition");
-		glBindAttribLocation(OGLRef.programGeometryID[flagsValue], OGLVertexAttributeID_TexCoord0, "inTexCoord0");
-		glBindAttribLocation(OGLRef.programGeometryID[flagsValue], OGLVertexAttributeID_Color, "inColor");
+	didDepthStencilChange = (_mm256_testz_si256(depthDiff, depthDiff) == 0);
+	didFogAttrChange = WILL_PACK_FOG && (_mm256_testz_si256(fogDiff, fogDiff) == 0);
 
-		glLinkProgram(OGLRef.programGeometryID[flagsValue]);
-		if (!this->ValidateShaderProgramLink(OGLRef.programGeometryID[flagsValue]))
+#elif defined(ENABLE_SSE2)
+	const __m128i polyID_vec128 = _mm_set1_epi32(opaquePolyID);
+	const __m128i fogBase_vec128 = _mm_set1_epi32(0xFF000000);
+	const __m128i fogEnable_vec128 = _mm_set1_epi32(0x000000FF);
+	__m128i depthDiff = _mm_setzero_si128();
+	__m128i fogDiff = _mm_setzero_si128();
+
+	for (; i < pixCount; i += 16)
+	{
+		for (size_t j = 0; j < 16; j += 4)
 		{
-			INFO("OpenGL: Failed to link the GEOMETRY shader program.\n");
-			glUseProgram(0);
-			this->DestroyGeometryPrograms();
-			return OGLERROR_SHADER_CREATE_ERROR;
+			const __m128i depthStencil = _mm_or_si128( _mm_slli_epi32(_mm_loadu_si128((__m128i *)(depthBuffer + i + j)), 8), polyID_vec128 );
+			_mm_store_si128((__m128i *)(dstDepthStencil + i + j), depthStencil);
+			depthDiff = _mm_or_si128( depthDiff, _mm_xor_si128(depthStencil, _mm_load_si128((__m128i *)(lastDepthStencil + i + j))) );
 		}
 
-		glValidateProgram(OGLRef.programGeometryID[flagsValue]);
-		glUseProgram(OGLRef.programGeometryID[flagsValue]);
+		if (WILL_PACK_FOG)
+		{
+			// Widen the 0x00 bytes of each disabled fog flag to 32-bit masks.
+			const __m128i fogIsDisabled = _mm_cmpeq_epi8( _mm_loadu_si128((__m128i *)(fogBuffer + i)), _mm_setzero_si128() );
+			const __m128i fogIsDisabledLo = _mm_unpacklo_epi8(fogIsDisabled, fogIsDisabled);
+			const __m128i fogIsDisabledHi = _mm_unpackhi_epi8(fogIsDisabled, fogIsDisabled);
+			__m128i fogAttr[4];
+			fogAttr[0] = _mm_or_si128( fogBase_vec128, _mm_andnot_si128(_mm_unpacklo_epi16(fogIsDisabledLo, fogIsDisabledLo), fogEnable_vec128) );
+			fogAttr[1] = _mm_or_si128( fogBase_vec128, _mm_andnot_si128(_mm_unpackhi_epi16(fogIsDisabledLo, fogIsDisabledLo), fogEnable_vec128) );
+			fogAttr[2] = _mm_or_si128( fogBase_vec128, _mm_andnot_si128(_mm_unpacklo_epi16(fogIsDisabledHi, fogIsDisabledHi), fogEnable_vec128) );
+			fogAttr[3] = _mm_or_si128( fogBase_vec128, _mm_andnot_si128(_mm_unpackhi_epi16(fogIsDisabledHi, fogIsDisabledHi), fogEnable_vec128) );
+
+			for (size_t j = 0; j < 4; j++)
+			{
+				_mm_store_si128((__m128i *)(dstFogAttr + i + (j * 4)), fogAttr[j]);
+				fogDiff = _mm_or_si128( fogDiff, _mm_xor_si128(fogAttr[j], _mm_load_si128((__m128i *)(lastFogAttr + i + (j * 4)))) );
+			}
+		}
+	}
 
-		const GLint uniformTexRenderObject						= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "texRenderObject");
-		glUniform1i(uniformTexRenderObject, 0);
+	didDepthStencilChange = (_mm_movemask_epi8(_mm_cmpeq_epi32(depthDiff, _mm_setzero_si128())) != 0xFFFF);
+	didFogAttrChange = WILL_PACK_FOG && (_mm_movemask_epi8(_mm_cmpeq_epi32(fogDiff, _mm_setzero_si128())) != 0xFFFF);
 
-		const GLint uniformTexToonTable							= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "texToonTable");
-		glUniform1i(uniformTexToonTable, OGLTextureUnitID_LookupTable);
+#elif defined(ENABLE_NEON_A64)
+	const v128u32 polyID_vec128 = vdupq_n_u32(opaquePolyID);
+	const v128u32 fogBase_vec128 = vdupq_n_u32(0xFF000000);
+	const v128u32 fogEnable_vec128 = vdupq_n_u32(0x000000FF);
+	v128u32 depthDiff = vdupq_n_u32(0);
+	v128u32 fogDiff = vdupq_n_u32(0);
 
-		if (this->_emulateDepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported && !programFlags.OpaqueDrawMode)
+	for (; i < pixCount; i += 8)
+	{
+		const v128u32 depthStencilLo = vorrq_u32( vshlq_n_u32(vld1q_u32(depthBuffer + i + 0), 8), polyID_vec128 );
+		const v128u32 depthStencilHi = vorrq_u32( vshlq_n_u32(vld1q_u32(depthBuffer + i + 4), 8), polyID_vec128 );
+		vst1q_u32(dstDepthStencil + i + 0, depthStencilLo);
+		vst1q_u32(dstDepthStencil + i + 4, depthStencilHi);
+		depthDiff = vorrq_u32( depthDiff, veorq_u32(depthStencilLo, vld1q_u32(lastDepthStencil + i + 0)) );
+		depthDiff = vorrq_u32( depthDiff, veorq_u32(depthStencilHi, vld1q_u32(lastDepthStencil + i + 4)) );
+
+		if (WILL_PACK_FOG)
 		{
-			const GLint uniformTexBackfacing					= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "inDstBackFacing");
-			glUniform1i(uniformTexBackfacing, OGLTextureUnitID_FinalColor);
+			const uint16x8_t fog = vmovl_u8( vld1_u8(fogBuffer + i) );
+			const v128u32 fogAttrLo = vorrq_u32( fogBase_vec128, vandq_u32(vtstq_u32(vmovl_u16(vget_low_u16(fog)), vmovl_u16(vget_low_u16(fog))), fogEnable_vec128) );
+			const v128u32 fogAttrHi = vorrq_u32( fogBase_vec128, vandq_u32(vtstq_u32(vmovl_u16(vget_high_u16(fog)), vmovl_u16(vget_high_u16(fog))), fogEnable_vec128) );
+			vst1q_u32(dstFogAttr + i + 0, fogAttrLo);
+			vst1q_u32(dstFogAttr + i + 4, fogAttrHi);
+			fogDiff = vorrq_u32( fogDiff, veorq_u32(fogAttrLo, vld1q_u32(lastFogAttr + i + 0)) );
+			fogDiff = vorrq_u32( fogDiff, veorq_u32(fogAttrHi, vld1q_u32(lastFogAttr + i + 4)) );
 		}
+	}
 
-		OGLRef.uniformStateAlphaTestRef[flagsValue]				= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "stateAlphaTestRef");
+	didDepthStencilChange = (vmaxvq_u32(depthDiff) != 0);
+	didFogAttrChange = WILL_PACK_FOG && (vmaxvq_u32(fogDiff) != 0);
 
-		OGLRef.uniformPolyTexScale[flagsValue]					= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyTexScale");
-		OGLRef.uniformPolyMode[flagsValue]						= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyMode");
-		OGLRef.uniformPolyIsWireframe[flagsValue]				= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyIsWireframe");
-		OGLRef.uniformPolySetNewDepthForTranslucent[flagsValue]	= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polySetNewDepthForTranslucent");
-		OGLRef.uniformPolyAlpha[flagsValue]						= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyAlpha");
-		OGLRef.uniformPolyID[flagsValue]						= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyID");
+#else
+	GLuint depthDiff = 0;
+	GLuint fogDiff = 0;
 
-		OGLRef.uniformPolyEnableTexture[flagsValue]				= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyEnableTexture");
-		OGLRef.uniformPolyEnableFog[flagsValue]					= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyEnableFog");
-		OGLRef.uniformTexSingleBitAlpha[flagsValue]				= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "texSingleBitAlpha");
+	for (; i < pixCount; i++)
+	{
+		dstDepthStencil[i] = (depthBuffer[i] << 8) | opaquePolyID;
+		depthDiff |= dstDepthStencil[i] ^ lastDepthStencil[i];
 
-		OGLRef.uniformTexDrawOpaque[flagsValue]					= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "texDrawOpaque");
-		OGLRef.uniformDrawModeDepthEqualsTest[flagsValue]		= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "drawModeDepthEqualsTest");
-		OGLRef.uniformPolyIsBackFacing[flagsValue]              = glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyIsBackFacing");
-		OGLRef.uniformPolyDrawShadow[flagsValue]				= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyDrawShadow");
-		OGLRef.uniformPolyDepthOffset[flagsValue]				= glGetUniformLocation(OGLRef.programGeometryID[flagsValue], "polyDepthOffset");
+		if (WILL_PACK_FOG)
+		{
+			dstFogAttr[i] = (fogBuffer[i]) ? 0xFF0000FF : 0xFF000000;
+			fogDiff |= dstFogAttr[i] ^ lastFogAttr[i];
+		}
 	}
 
-	return OGLERROR_NOERR;
+	didDepthStencilChange = (depthDiff != 0);
+	didFogAttrChange = WILL_PACK_FOG && (fogDiff != 0);
+#endif
 }
 
-void OpenGLESRenderer_3_0::DestroyGeometryPrograms()
+Render3DError OpenGLESRenderer_3_0::UploadClearImage(const u16 *__restrict colorBuffer, const u32 *__restrict depthBuffer, const u8 *__restrict fogBuffer, const u8 opaquePolyID)
 {
-
 	OGLRenderRef &OGLRef = *this->ref;
+	this->_clearImageIndex ^= 0x01;
+
+	bool didDepthStencilChange = false;
+	bool didFogAttributesChange = false;
 
-	for (size_t flagsValue = 0; flagsValue < 128; flagsValue++)
+	if (this->_enableFog && this->_deviceInfo.isFogSupported)
 	{
-		if (OGLRef.programGeometryID[flagsValue] == 0)
-		{
-			continue;
-		}
+		OGLPackClearImageDepthFog<true>(depthBuffer, fogBuffer, opaquePolyID,
+		                                OGLRef.workingCIDepthStencilBuffer[this->_clearImageIndex], OGLRef.workingCIFogAttributesBuffer[this->_clearImageIndex],
+		                                OGLRef.workingCIDepthStencilBuffer[this->_clearImageIndex ^ 0x01], OGLRef.workingCIFogAttributesBuffer[this->_clearImageIndex ^ 0x01],
+		                                didDepthStencilChange, didFogAttributesChange);
+	}
+	else
+	{
+		OGLPackClearImageDepthFog<false>(depthBuffer, fogBuffer, opaquePolyID,
+		                                 OGLRef.workingCIDepthStencilBuffer[this->_clearImageIndex], OGLRef.workingCIFogAttributesBuffer[this->_clearImageIndex],
+		                                 OGLRef.workingCIDepthStencilBuffer[this->_clearImageIndex ^ 0x01], OGLRef.workingCIFogAttributesBuffer[this->_clearImageIndex ^ 0x01],
+		                                 didDepthStencilChange, didFogAttributesChange);
+	}
 
-		glDetachShader(OGLRef.programGeometryID[flagsValue], OGLRef.vertexGeometryShaderID);
-		glDetachShader(OGLRef.programGeometryID[flagsValue], OGLRef.fragmentGeometryShaderID[flagsValue]);
-		glDeleteProgram(OGLRef.programGeometryID[flagsValue]);
-		glDeleteShader(OGLRef.fragmentGeometryShaderID[flagsValue]);
+	const bool didColorChange = (memcmp(OGLRef.workingCIColorBuffer, colorBuffer, GPU_FRAMEBUFFER_NATIVE_WIDTH * GPU_FRAMEBUFFER_NATIVE_HEIGHT * sizeof(u16)) != 0);
 
-		OGLRef.programGeometryID[flagsValue] = 0;
-		OGLRef.fragmentGeometryShaderID[flagsValue] = 0;
+	this->_glState.ActiveTexture(GL_TEXTURE0);
+
+	if (didColorChange)
+	{
+		memcpy(OGLRef.workingCIColorBuffer, colorBuffer, GPU_FRAMEBUFFER_NATIVE_WIDTH * GPU_FRAMEBUFFER_NATIVE_HEIGHT * sizeof(u16));
+		this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texCIColorID);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GPU_FRAMEBUFFER_NATIVE_WIDTH, GPU_FRAMEBUFFER_NATIVE_HEIGHT, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, OGLRef.workingCIColorBuffer);
 	}
 
-	glDeleteShader(OGLRef.vertexGeometryShaderID);
-	OGLRef.vertexGeometryShaderID = 0;
+	if (didDepthStencilChange)
+	{
+		this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texCIDepthStencilID);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GPU_FRAMEBUFFER_NATIVE_WIDTH, GPU_FRAMEBUFFER_NATIVE_HEIGHT, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, OGLRef.workingCIDepthStencilBuffer[this->_clearImageIndex]);
+	}
 
-	glDeleteTextures(1, &ref->texToonTableID);
-	OGLRef.texToonTableID = 0;
+	if (didFogAttributesChange)
+	{
+		this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texCIFogAttrID);
+		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GPU_FRAMEBUFFER_NATIVE_WIDTH, GPU_FRAMEBUFFER_NATIVE_HEIGHT, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, OGLRef.workingCIFogAttributesBuffer[this->_clearImageIndex]);
+	}
 
-	glDeleteTextures(1, &ref->texEdgeColorTableID);
-	OGLRef.texEdgeColorTableID = 0;
+	this->_glState.BindTexture(GL_TEXTURE_2D, 0);
 
-	glDeleteTextures(1, &ref->texFogDensityTableID);
-	OGLRef.texFogDensityTableID = 0;
+	return OGLERROR_NOERR;
 }
 
-Render3DError OpenGLESRenderer_3_0::CreateGeometryZeroDstAlphaProgram(const char *vtxShaderCString, const char *fragShaderCString)
+void OpenGLESRenderer_3_0::GetExtensionSet(std::set<std::string> *oglExtensionSet)
 {
-	Render3DError error = OGLERROR_NOERR;
-	OGLRenderRef &OGLRef = *this->ref;
-
-	if ( (vtxShaderCString == NULL) || (fragShaderCString == NULL) )
-	{
-		return error;
-	}
+	std::string oglExtensionString = std::string((const char *)glGetString(GL_EXTENSIONS));
 
-	error = this->ShaderProgramCreate(OGLRef.vtxShaderGeometryZeroDstAlphaID,
-									  OGLRef.fragShaderGeometryZeroDstAlphaID,
-									  OGLRef.programGeometryZeroDstAlphaID,
-									  vtxShaderCString,
-									  fragShaderCString);
-	if (error != OGLERROR_NOERR)
-	{
-		INFO("OpenGL: Failed to create the GEOMETRY ZERO DST ALPHA shader program.\n");
-		glUseProgram(0);
-		this->DestroyGeometryZeroDstAlphaProgram();
-		return error;
-	}
+	size_t extStringStartLoc = 0;
+	size_t delimiterLoc = oglExtensionString.find_first_of(' ', extStringStartLoc);
+	while (delimiterLoc != std::string::npos)
+	{
+		std::string extensionName = oglExtensionString.substr(extStringStartLoc, delimiterLoc - extStringStartLoc);
+		oglExtensionSet->insert(extensionName);
 
-	glBindAttribLocation(OGLRef.programGeometryZeroDstAlphaID, OGLVertexAttributeID_Position, "inPosition");
-	glBindAttribLocation(OGLRef.programGeometryZeroDstAlphaID, OGLVertexAttributeID_TexCoord0, "inTexCoord0");
+		extStringStartLoc = delimiterLoc + 1;
+		delimiterLoc = oglExtensionString.find_first_of(' ', extStringStartLoc);
+	}
 
-	glLinkProgram(OGLRef.programGeometryZeroDstAlphaID);
-	if (!this->ValidateShaderProgramLink(OGLRef.programGeometryZeroDstAlphaID))
+	if (extStringStartLoc - oglExtensionString.length() > 0)
 	{
-		INFO("OpenGL: Failed to link the GEOMETRY ZERO DST ALPHA shader program.\n");
-		glUseProgram(0);
-		this->DestroyGeometryZeroDstAlphaProgram();
-		return OGLERROR_SHADER_CREATE_ERROR;
+		std::string extensionName = oglExtensionString.substr(extStringStartLoc, oglExtensionString.length() - extStringStartLoc);
+		oglExtensionSet->insert(extensionName);
 	}
+}
 
-	glValidateProgram(OGLRef.programGeometryZeroDstAlphaID);
-	glUseProgram(OGLRef.programGeometryZeroDstAlphaID);
+void OpenGLESRenderer_3_0::_SetupGeometryShaders(const OGLGeometryFlags flags)
+{
+	const OGLRenderRef &OGLRef = *this->ref;
 
-	const GLint uniformTexGColor = glGetUniformLocation(OGLRef.programGeometryZeroDstAlphaID, "texInFragColor");
-	glUniform1i(uniformTexGColor, OGLTextureUnitID_GColor);
+	this->_glState.UseProgram(OGLRef.programGeometryID[flags.value]);
+	glUniform1f(OGLRef.uniformStateAlphaTestRef[flags.value], this->_pendingRenderStates.alphaTestRef);
+	glUniform1i(OGLRef.uniformTexDrawOpaque[flags.value], GL_FALSE);
+	glUniform1i(OGLRef.uniformDrawModeDepthEqualsTest[flags.value], GL_FALSE);
+	glUniform1i(OGLRef.uniformPolyDrawShadow[flags.value], GL_FALSE);
 
-	return OGLERROR_NOERR;
+	if (this->isFBOSupported)
+	{
+		glDrawBuffers(4, GeometryDrawBuffersEnum[flags.DrawBuffersMode]);
+	}
 }
 
-void OpenGLESRenderer_3_0::DestroyGeometryZeroDstAlphaProgram()
+Render3DError OpenGLESRenderer_3_0::ZeroDstAlphaPass(const POLY *rawPolyList, const CPoly *clippedPolyList, const size_t clippedPolyCount, const size_t clippedPolyOpaqueCount, bool enableAlphaBlending, size_t indexOffset, POLYGON_ATTR lastPolyAttr)
 {
 	OGLRenderRef &OGLRef = *this->ref;
 
-	if (OGLRef.programGeometryZeroDstAlphaID == 0)
+	if (!this->isFBOSupported || !this->isVBOSupported)
 	{
-		return;
+		return OGLERROR_FEATURE_UNSUPPORTED;
 	}
 
-	glDetachShader(OGLRef.programGeometryZeroDstAlphaID, OGLRef.vtxShaderGeometryZeroDstAlphaID);
-	glDetachShader(OGLRef.programGeometryZeroDstAlphaID, OGLRef.fragShaderGeometryZeroDstAlphaID);
-	glDeleteProgram(OGLRef.programGeometryZeroDstAlphaID);
-	glDeleteShader(OGLRef.vtxShaderGeometryZeroDstAlphaID);
-	glDeleteShader(OGLRef.fragShaderGeometryZeroDstAlphaID);
+	// Pre Pass: Fill in the stencil buffer based on the alpha of the current framebuffer color.
+	// Fully transparent pixels (alpha == 0) -- Set stencil buffer to 0
+	// All other pixels (alpha != 0) -- Set stencil buffer to 1
 
-	OGLRef.programGeometryZeroDstAlphaID = 0;
-	OGLRef.vtxShaderGeometryZeroDstAlphaID = 0;
-	OGLRef.fragShaderGeometryZeroDstAlphaID = 0;
-}
+	this->DisableVertexAttributes();
 
-Render3DError OpenGLESRenderer_3_0::CreateEdgeMarkProgram(const char *vtxShaderCString, const char *fragShaderCString)
-{
-	Render3DError error = OGLERROR_NOERR;
-	OGLRenderRef &OGLRef = *this->ref;
+	const bool isRunningMSAA = this->isMultisampledFBOSupported && (OGLRef.selectedRenderingFBO == OGLRef.fboMSIntermediateRenderID);
 
-	if ( (vtxShaderCString == NULL) || (fragShaderCString == NULL) )
+	if (isRunningMSAA)
 	{
-		return error;
+		// Just downsample the color buffer now so that we have some texture data to sample from in the non-multisample shader.
+		// This is not perfectly pixel accurate, but it's better than nothing.
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, OGLRef.fboRenderID);
+		glDrawBuffer(GL_COLOROUT_ATTACHMENT_ID);
+		glBlitFramebuffer(0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, 0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+		glDrawBuffers(4, GeometryDrawBuffersEnum[this->_geometryProgramFlags.DrawBuffersMode]);
+		glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.selectedRenderingFBO);
+		this->_renderStats.resolveBlitCount++;
 	}
 
-	std::stringstream shaderHeader;
-
-    shaderHeader << "#version 300 es\n";
-    shaderHeader << "precision highp float;\n";
+	this->_glState.UseProgram(OGLRef.programGeometryZeroDstAlphaID);
+	glViewport(0, 0, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight);
+	glDisable(GL_BLEND);
+	glEnable(GL_STENCIL_TEST);
+	glDisable(GL_DEPTH_TEST);
 
-	shaderHeader << "#define FRAMEBUFFER_SIZE_X " << this->_framebufferWidth  << ".0 \n";
-	shaderHeader << "#define FRAMEBUFFER_SIZE_Y " << this->_framebufferHeight << ".0 \n";
-	shaderHeader << "\n";
+	this->_glState.StencilFunc(GL_ALWAYS, 0x40, 0x40);
+	this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+	this->_glState.StencilMask(0x40);
+	this->_glState.DepthMask(GL_FALSE);
+	glDrawBuffer(GL_NONE);
 
-	std::string vtxShaderCode  = shaderHeader.str() + std::string(vtxShaderCString);
-	std::string fragShaderCode = shaderHeader.str() + std::string(fragShaderCString);
+	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboPostprocessVtxID);
 
-	error = this->ShaderProgramCreate(OGLRef.vertexEdgeMarkShaderID,
-									  OGLRef.fragmentEdgeMarkShaderID,
-									  OGLRef.programEdgeMarkID,
-									  vtxShaderCode.c_str(),
-									  fragShaderCode.c_str());
-	if (error != OGLERROR_NOERR)
+	if (this->isVAOSupported)
 	{
-		INFO("OpenGL: Failed to create the EDGE MARK shader program.\n");
-		glUseProgram(0);
-		this->DestroyEdgeMarkProgram();
-		return error;
+		glBindVertexArray(OGLRef.vaoPostprocessStatesID);
+	}
+	else
+	{
+		glEnableVertexAttribArray(OGLVertexAttributeID_Position);
+		glEnableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
+		glVertexAttribPointer(OGLVertexAttributeID_Position, 2, GL_FLOAT, GL_FALSE, 0, 0);
+		glVertexAttribPointer(OGLVertexAttributeID_TexCoord0, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid *)(sizeof(GLfloat) * 8));
 	}
 
-	glBindAttribLocation(OGLRef.programEdgeMarkID, OGLVertexAttributeID_Position, "inPosition");
-	glBindAttribLocation(OGLRef.programEdgeMarkID, OGLVertexAttributeID_TexCoord0, "inTexCoord0");
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
-	glLinkProgram(OGLRef.programEdgeMarkID);
-	if (!this->ValidateShaderProgramLink(OGLRef.programEdgeMarkID))
+	if (this->isVAOSupported)
 	{
-		INFO("OpenGL: Failed to link the EDGE MARK shader program.\n");
-		glUseProgram(0);
-		this->DestroyEdgeMarkProgram();
-		return OGLERROR_SHADER_CREATE_ERROR;
+		glBindVertexArray(0);
+	}
+	else
+	{
+		glDisableVertexAttribArray(OGLVertexAttributeID_Position);
+		glDisableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
 	}
 
-	glValidateProgram(OGLRef.programEdgeMarkID);
-	glUseProgram(OGLRef.programEdgeMarkID);
+	// Setup for multiple pass alpha poly drawing
+	OGLGeometryFlags oldGProgramFlags = this->_geometryProgramFlags;
+	this->_geometryProgramFlags.EnableEdgeMark = 0;
+	this->_geometryProgramFlags.EnableFog = 0;
+	this->_SetupGeometryShaders(this->_geometryProgramFlags);
+	glDrawBuffer(GL_COLOROUT_ATTACHMENT_ID);
 
-	const GLint uniformTexGDepth			= glGetUniformLocation(OGLRef.programEdgeMarkID, "texInFragDepth");
-	const GLint uniformTexGPolyID			= glGetUniformLocation(OGLRef.programEdgeMarkID, "texInPolyID");
-	const GLint uniformTexEdgeColorTable	= glGetUniformLocation(OGLRef.programEdgeMarkID, "texEdgeColor");
-	glUniform1i(uniformTexGDepth, OGLTextureUnitID_DepthStencil);
-	glUniform1i(uniformTexGPolyID, OGLTextureUnitID_GPolyID);
-	glUniform1i(uniformTexEdgeColorTable, OGLTextureUnitID_LookupTable);
+	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboGeometryVtxID);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, OGLRef.iboGeometryIndexID);
+	this->EnableVertexAttributes();
 
-	OGLRef.uniformStateClearPolyID			= glGetUniformLocation(OGLRef.programEdgeMarkID, "clearPolyID");
-	OGLRef.uniformStateClearDepth			= glGetUniformLocation(OGLRef.programEdgeMarkID, "clearDepth");
+	// Draw the alpha polys, touching fully transparent pixels only once.
+	glEnable(GL_DEPTH_TEST);
+	this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_FALSE);
+	this->_glState.StencilFunc(GL_NOTEQUAL, 0x40, 0x40);
 
-	return OGLERROR_NOERR;
-}
+	this->DrawPolygonsForIndexRange<OGLPolyDrawMode_ZeroAlphaPass>(rawPolyList, clippedPolyList, clippedPolyCount, clippedPolyOpaqueCount, clippedPolyCount - 1, indexOffset, lastPolyAttr);
 
-void OpenGLESRenderer_3_0::DestroyEdgeMarkProgram()
-{
-	OGLRenderRef &OGLRef = *this->ref;
+	// Restore OpenGL states back to normal.
+	this->_geometryProgramFlags = oldGProgramFlags;
+	this->_SetupGeometryShaders(this->_geometryProgramFlags);
+	glClear(GL_STENCIL_BUFFER_BIT);
+	this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	this->_glState.DepthMask(GL_TRUE);
+	this->_glState.StencilMask(0xFF);
 
-	if (OGLRef.programEdgeMarkID == 0)
+	if (enableAlphaBlending)
 	{
-		return;
+		glEnable(GL_BLEND);
+	}
+	else
+	{
+		glDisable(GL_BLEND);
 	}
 
-	glDetachShader(OGLRef.programEdgeMarkID, OGLRef.vertexEdgeMarkShaderID);
-	glDetachShader(OGLRef.programEdgeMarkID, OGLRef.fragmentEdgeMarkShaderID);
-	glDeleteProgram(OGLRef.programEdgeMarkID);
-	glDeleteShader(OGLRef.vertexEdgeMarkShaderID);
-	glDeleteShader(OGLRef.fragmentEdgeMarkShaderID);
-
-	OGLRef.programEdgeMarkID = 0;
-	OGLRef.vertexEdgeMarkShaderID = 0;
-	OGLRef.fragmentEdgeMarkShaderID = 0;
+	return OGLERROR_NOERR;
 }
 
-Render3DError OpenGLESRenderer_3_0::CreateFogProgram(const OGLFogProgramKey fogProgramKey, const char *vtxShaderCString, const char *fragShaderCString)
+void OpenGLESRenderer_3_0::_ResolveWorkingBackFacing()
 {
-	Render3DError error = OGLERROR_NOERR;
 	OGLRenderRef &OGLRef = *this->ref;
 
-	if (vtxShaderCString == NULL)
-	{
-		INFO("OpenGL: The FOG vertex shader is unavailable.\n");
-		error = OGLERROR_VERTEX_SHADER_PROGRAM_LOAD_ERROR;
-		return error;
-	}
-	else if (fragShaderCString == NULL)
+	if (!this->_emulateDepthLEqualPolygonFacing || !this->_isDepthLEqualPolygonFacingSupported || !this->isMultisampledFBOSupported || (OGLRef.selectedRenderingFBO != OGLRef.fboMSIntermediateRenderID))
 	{
-		INFO("OpenGL: The FOG fragment shader is unavailable.\n");
-		error = OGLERROR_FRAGMENT_SHADER_PROGRAM_LOAD_ERROR;
-		return error;
+		return;
 	}
 
-	const s32 fogOffset = fogProgramKey.offset;
-	const GLfloat fogOffsetf = (GLfloat)fogOffset / 32767.0f;
-	const s32 fogStep = 0x0400 >> fogProgramKey.shift;
-
-	std::stringstream fragDepthConstants;
-
-    fragDepthConstants << "#version 300 es\n";
-    fragDepthConstants << "precision highp float;\n";
-
-	fragDepthConstants << "#define OUT_ATTACH " << (this->willFlipAndConvertFramebufferOnGPU ? 3 : 0) << "\n";
-
-	fragDepthConstants << "#define FOG_OFFSET " << fogOffset << "\n";
-	fragDepthConstants << "#define FOG_OFFSETF " << fogOffsetf << (((fogOffsetf == 0.0f) || (fogOffsetf == 1.0f)) ? ".0" : "") << "\n";
-	fragDepthConstants << "#define FOG_STEP " << fogStep << "\n";
-	fragDepthConstants << "\n";
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, OGLRef.fboMSIntermediateRenderID);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, OGLRef.fboRenderID);
 
-	std::string fragShaderCode = fragDepthConstants.str() + std::string(fragShaderCString);
+	glReadBuffer(GL_WORKING_ATTACHMENT_ID);
+	glDrawBuffer(GL_WORKING_ATTACHMENT_ID);
+	glBlitFramebuffer(0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, 0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	this->_renderStats.resolveBlitCount++;
 
-	OGLFogShaderID shaderID;
-	shaderID.program = 0;
-	shaderID.fragShader = 0;
+	// Reset framebuffer targets
+	glReadBuffer(GL_COLOROUT_ATTACHMENT_ID);
+	glDrawBuffers(4, GeometryDrawBuffersEnum[this->_geometryProgramFlags.DrawBuffersMode]);
 
-    std::stringstream vtxHeader;
-    vtxHeader << "#version 300 es\n";
-    vtxHeader << "precision highp float;\n";
-    std::string vtxShaderCode = vtxHeader.str() + std::string(vtxShaderCString);
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboMSIntermediateRenderID);
+	glDrawBuffers(4, GeometryDrawBuffersEnum[this->_geometryProgramFlags.DrawBuffersMode]);
+}
 
-	error = this->ShaderProgramCreate(OGLRef.vertexFogShaderID,
-									  shaderID.fragShader,
-									  shaderID.program,
-									  vtxShaderCode.c_str(),
-									  fragShaderCode.c_str());
+// Decides which of the geometry attachments must survive a multisample resolve this frame. Only
+// the attachments that postprocessing reads are resolved; everything else stays multisampled.
+void OpenGLESRenderer_3_0::_PlanResolves(const bool willSampleBackFacing)
+{
+	const bool willRunEdgeMark = this->_enableEdgeMark && this->_deviceInfo.isEdgeMarkSupported;
+	const bool willRunFog = this->_enableFog && this->_deviceInfo.isFogSupported;
 
-	this->_fogProgramMap[fogProgramKey.key] = shaderID;
+	this->_resolveAttachmentFlags = OGLAttachmentFlag_Color;
 
-	if (error != OGLERROR_NOERR)
+	if (willRunEdgeMark)
 	{
-		INFO("OpenGL: Failed to create the FOG shader program.\n");
-		glUseProgram(0);
-		this->DestroyFogProgram(fogProgramKey);
-		return error;
+		this->_resolveAttachmentFlags |= OGLAttachmentFlag_PolyID;
 	}
 
-	glBindAttribLocation(shaderID.program, OGLVertexAttributeID_Position, "inPosition");
-	glBindAttribLocation(shaderID.program, OGLVertexAttributeID_TexCoord0, "inTexCoord0");
-
-	glLinkProgram(shaderID.program);
-	if (!this->ValidateShaderProgramLink(shaderID.program))
+	if (willRunFog)
 	{
-		INFO("OpenGL: Failed to link the FOG shader program.\n");
-		glUseProgram(0);
-		this->DestroyFogProgram(fogProgramKey);
-		return OGLERROR_SHADER_CREATE_ERROR;
+		this->_resolveAttachmentFlags |= OGLAttachmentFlag_FogAttributes;
 	}
 
-	glValidateProgram(shaderID.program);
-	glUseProgram(shaderID.program);
-
-	const GLint uniformTexGColor          = glGetUniformLocation(shaderID.program, "texInFragColor");
-	const GLint uniformTexGDepth          = glGetUniformLocation(shaderID.program, "texInFragDepth");
-	const GLint uniformTexGFog            = glGetUniformLocation(shaderID.program, "texInFogAttributes");
-	const GLint uniformTexFogDensityTable = glGetUniformLocation(shaderID.program, "texFogDensityTable");
-	glUniform1i(uniformTexGColor, OGLTextureUnitID_GColor);
-	glUniform1i(uniformTexGDepth, OGLTextureUnitID_DepthStencil);
-	glUniform1i(uniformTexGFog, OGLTextureUnitID_FogAttr);
-	glUniform1i(uniformTexFogDensityTable, OGLTextureUnitID_LookupTable);
-
-	OGLRef.uniformStateEnableFogAlphaOnly = glGetUniformLocation(shaderID.program, "stateEnableFogAlphaOnly");
-	OGLRef.uniformStateFogColor           = glGetUniformLocation(shaderID.program, "stateFogColor");
+	if (willRunEdgeMark || willRunFog)
+	{
+		this->_resolveAttachmentFlags |= OGLAttachmentFlag_DepthStencil;
+	}
 
-	return OGLERROR_NOERR;
+	// The back-facing states of the opaque polygons are only ever sampled by translucent polygons
+	// that use the depth-equals test, so skip that mid-frame resolve when there aren't any.
+	this->_needsBackFacingResolve = this->_emulateDepthLEqualPolygonFacing && this->_isDepthLEqualPolygonFacingSupported && willSampleBackFacing;
 }
 
-void OpenGLESRenderer_3_0::DestroyFogProgram(const OGLFogProgramKey fogProgramKey)
+// Returns the FBO that geometry should be rendered to this frame.
+//
+// When the driver supports multisampled render-to-texture, the render textures are attached to
+// a special FBO that resolves its samples implicitly when rendering to it ends. This is only
+// usable when nothing needs to read back from the multisampled buffers in the middle of the
+// frame and when postprocessing doesn't need the depth buffer, since the multisampled depth
+// and stencil contents are thrown away instead of being resolved.
+GLuint OpenGLESRenderer_3_0::_SelectRenderingFBO(const bool needsZeroDstAlphaPass) const
 {
-	OGLRenderRef &OGLRef = *this->ref;
+	const OGLRenderRef &OGLRef = *this->ref;
 
-	std::map<u32, OGLFogShaderID>::iterator it = this->_fogProgramMap.find(fogProgramKey.key);
-	if (it == this->_fogProgramMap.end())
+	if (!this->isMultisampledFBOSupported || !this->_enableMultisampledRendering)
 	{
-		return;
+		return OGLRef.fboRenderID;
 	}
 
-	OGLFogShaderID shaderID = this->_fogProgramMap[fogProgramKey.key];
-	glDetachShader(shaderID.program, OGLRef.vertexFogShaderID);
-	glDetachShader(shaderID.program, shaderID.fragShader);
-	glDeleteProgram(shaderID.program);
-	glDeleteShader(shaderID.fragShader);
-
-	this->_fogProgramMap.erase(it);
+	// The zero-dst-alpha pass downsamples the color buffer mid-frame, unless framebuffer fetch
+	// handles zero-alpha blending instead.
+	const bool willRunZeroDstAlphaPass = needsZeroDstAlphaPass && this->_emulateSpecialZeroAlphaBlending &&
+		(this->_clippedPolyOpaqueCount < this->_clippedPolyCount) &&
+		!(this->_isFramebufferFetchSupported && this->_enableAlphaBlending);
 
-	if (this->_fogProgramMap.size() == 0)
+	// The depth copy for the single-pass depth-equals test is blitted from the rendering FBO,
+	// which needs the depth buffer to be resolvable.
+	if ( this->_isMSRenderToTextureFBOComplete &&
+	    !this->_needsBackFacingResolve &&
+	    !this->_willUseSinglePassDepthEqualTest &&
+	    !willRunZeroDstAlphaPass &&
+	    !(this->_resolveAttachmentFlags & OGLAttachmentFlag_DepthStencil) )
 	{
-		glDeleteShader(OGLRef.vertexFogShaderID);
-		OGLRef.vertexFogShaderID = 0;
+		return OGLRef.fboMSRenderToTextureID;
 	}
+
+	return OGLRef.fboMSIntermediateRenderID;
 }
 
-void OpenGLESRenderer_3_0::DestroyFogPrograms()
+// Copies the current depth buffer for the single-pass depth-equals test to sample from. The copy
+// is only refreshed if something might have written to the depth buffer since the last copy, so
+// runs of depth-equals polygons that don't write depth share a single copy.
+void OpenGLESRenderer_3_0::_UpdateDepthEqualsTestCopy()
 {
-	OGLRenderRef &OGLRef = *this->ref;
-
-	while (this->_fogProgramMap.size() > 0)
+	if (!this->_isDepthCopyDirty)
 	{
-		std::map<u32, OGLFogShaderID>::iterator it = this->_fogProgramMap.begin();
-		OGLFogShaderID shaderID = it->second;
+		return;
+	}
 
-		glDetachShader(shaderID.program, OGLRef.vertexFogShaderID);
-		glDetachShader(shaderID.program, shaderID.fragShader);
-		glDeleteProgram(shaderID.program);
-		glDeleteShader(shaderID.fragShader);
+	OGLRenderRef &OGLRef = *this->ref;
 
-		this->_fogProgramMap.erase(it);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, OGLRef.selectedRenderingFBO);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, OGLRef.fboDepthCopyID);
+	glBlitFramebuffer(0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, 0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, GL_DEPTH_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.selectedRenderingFBO);
 
-		if (this->_fogProgramMap.size() == 0)
-		{
-			glDeleteShader(OGLRef.vertexFogShaderID);
-			OGLRef.vertexFogShaderID = 0;
-		}
-	}
+	this->_isDepthCopyDirty = false;
+	this->_renderStats.depthCopyCount++;
 }
 
-Render3DError OpenGLESRenderer_3_0::CreateFramebufferOutput6665Program(const size_t outColorIndex, const char *vtxShaderCString, const char *fragShaderCString)
+void OpenGLESRenderer_3_0::_ResolveGeometry()
 {
-	Render3DError error = OGLERROR_NOERR;
 	OGLRenderRef &OGLRef = *this->ref;
 
-	if ( (vtxShaderCString == NULL) || (fragShaderCString == NULL) )
+	if (!this->isMultisampledFBOSupported || (OGLRef.selectedRenderingFBO == OGLRef.fboRenderID))
 	{
-		return error;
+		return;
 	}
 
-	std::stringstream shaderHeader;
+	if (OGLRef.selectedRenderingFBO == OGLRef.fboMSRenderToTextureID)
+	{
+		// Discard whatever won't be read so that the driver only resolves what's left, then
+		// switch back to the render FBO to let the implicit resolve happen.
+		const u32 discardFlags = ~this->_resolveAttachmentFlags & (OGLAttachmentFlag_PolyID | OGLAttachmentFlag_FogAttributes | OGLAttachmentFlag_Working | OGLAttachmentFlag_DepthStencil);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, OGLRef.fboMSRenderToTextureID);
+		this->_InvalidateAttachments(discardFlags, this->_renderStats.invalidatedAfterGeometry);
 
-    shaderHeader << "#version 300 es\n";
-    shaderHeader << "precision highp float;\n";
+		glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboRenderID);
+		glDrawBuffers(4, GeometryDrawBuffersEnum[this->_geometryProgramFlags.DrawBuffersMode]);
+		this->_renderStats.implicitResolveCount++;
+		return;
+	}
 
-	shaderHeader << "#define OUT_ATTACH " << (outColorIndex == 0 ? 0 : 3) << "\n";
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, OGLRef.fboMSIntermediateRenderID);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, OGLRef.fboRenderID);
 
-	shaderHeader << "#define FRAMEBUFFER_SIZE_X " << this->_framebufferWidth  << ".0 \n";
-	shaderHeader << "#define FRAMEBUFFER_SIZE_Y " << this->_framebufferHeight << ".0 \n";
-    shaderHeader << "#define IS_BGRA " << (this->readFormat == GL_BGRA ? 1 : 0) << "\n";
-	shaderHeader << "\n";
+	{
+		if (this->_resolveAttachmentFlags & OGLAttachmentFlag_PolyID)
+		{
+			glReadBuffer(GL_POLYID_ATTACHMENT_ID);
+			glDrawBuffer(GL_POLYID_ATTACHMENT_ID);
+			glBlitFramebuffer(0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, 0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+			this->_renderStats.resolveBlitCount++;
+		}
 
-	std::string vtxShaderCode  = shaderHeader.str() + std::string(vtxShaderCString);
-    std::string fragShaderCode  = shaderHeader.str() + std::string(fragShaderCString);
+		if (this->_resolveAttachmentFlags & OGLAttachmentFlag_FogAttributes)
+		{
+			glReadBuffer(GL_FOGATTRIBUTES_ATTACHMENT_ID);
+			glDrawBuffer(GL_FOGATTRIBUTES_ATTACHMENT_ID);
+			glBlitFramebuffer(0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, 0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+			this->_renderStats.resolveBlitCount++;
+		}
 
-	error = this->ShaderProgramCreate(OGLRef.vertexFramebufferOutput6665ShaderID[outColorIndex],
-									  OGLRef.fragmentFramebufferRGBA6665OutputShaderID[outColorIndex],
-									  OGLRef.programFramebufferRGBA6665OutputID[outColorIndex],
-									  vtxShaderCode.c_str(),
-									  fragShaderCode.c_str());
-	if (error != OGLERROR_NOERR)
-	{
-		INFO("OpenGL: Failed to create the FRAMEBUFFER OUTPUT RGBA6665 shader program.\n");
-		glUseProgram(0);
-		this->DestroyFramebufferOutput6665Programs();
-		return error;
-	}
+		// Blit the color buffer, along with the depth buffer if postprocessing will need it.
+		// Riding along with the color blit saves a separate pass over the framebuffer.
+		const GLbitfield colorDepthMask = (this->_resolveAttachmentFlags & OGLAttachmentFlag_DepthStencil) ? (GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT) : GL_COLOR_BUFFER_BIT;
+		glReadBuffer(GL_COLOROUT_ATTACHMENT_ID);
+		glDrawBuffer(GL_COLOROUT_ATTACHMENT_ID);
+		glBlitFramebuffer(0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, 0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, colorDepthMask, GL_NEAREST);
+		this->_renderStats.resolveBlitCount++;
 
-	glBindAttribLocation(OGLRef.programFramebufferRGBA6665OutputID[outColorIndex], OGLVertexAttributeID_Position, "inPosition");
-	glBindAttribLocation(OGLRef.programFramebufferRGBA6665OutputID[outColorIndex], OGLVertexAttributeID_TexCoord0, "inTexCoord0");
+		// Reset framebuffer targets
+		glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboRenderID);
+		glDrawBuffers(4, GeometryDrawBuffersEnum[this->_geometryProgramFlags.DrawBuffersMode]);
+	}
+}
 
-	glLinkProgram(OGLRef.programFramebufferRGBA6665OutputID[outColorIndex]);
-	if (!this->ValidateShaderProgramLink(OGLRef.programFramebufferRGBA6665OutputID[outColorIndex]))
+// Invalidates the given attachments of the currently bound draw framebuffer. Only call this
+// when nothing will read the attachments before they are completely overwritten again.
+void OpenGLESRenderer_3_0::_InvalidateAttachments(const u32 attachmentFlags, u32 &reportFlags)
+{
+	if (!this->_enableAttachmentInvalidation || !this->isFBOSupported || (attachmentFlags == 0))
 	{
-		INFO("OpenGL: Failed to link the FRAMEBUFFER OUTPUT RGBA6665 shader program.\n");
-		glUseProgram(0);
-		this->DestroyFramebufferOutput6665Programs();
-		return OGLERROR_SHADER_CREATE_ERROR;
+		return;
 	}
 
-	glValidateProgram(OGLRef.programFramebufferRGBA6665OutputID[outColorIndex]);
-	glUseProgram(OGLRef.programFramebufferRGBA6665OutputID[outColorIndex]);
+	GLenum attachmentList[5];
+	GLsizei attachmentCount = 0;
 
-	const GLint uniformTexGColor = glGetUniformLocation(OGLRef.programFramebufferRGBA6665OutputID[outColorIndex], "texInFragColor");
-	if (outColorIndex == 0)
+	if (attachmentFlags & OGLAttachmentFlag_Color)
 	{
-		glUniform1i(uniformTexGColor, OGLTextureUnitID_FinalColor);
+		attachmentList[attachmentCount++] = GL_COLOROUT_ATTACHMENT_ID;
 	}
-	else
+
+	if (attachmentFlags & OGLAttachmentFlag_PolyID)
 	{
-		glUniform1i(uniformTexGColor, OGLTextureUnitID_GColor);
+		attachmentList[attachmentCount++] = GL_POLYID_ATTACHMENT_ID;
 	}
 
-	return OGLERROR_NOERR;
-}
-
-void OpenGLESRenderer_3_0::DestroyFramebufferOutput6665Programs()
-{
-	OGLRenderRef &OGLRef = *this->ref;
-
-	if (OGLRef.programFramebufferRGBA6665OutputID[0] != 0)
+	if (attachmentFlags & OGLAttachmentFlag_FogAttributes)
 	{
-		glDetachShader(OGLRef.programFramebufferRGBA6665OutputID[0], OGLRef.vertexFramebufferOutput6665ShaderID[0]);
-		glDetachShader(OGLRef.programFramebufferRGBA6665OutputID[0], OGLRef.fragmentFramebufferRGBA6665OutputShaderID[0]);
-		glDeleteProgram(OGLRef.programFramebufferRGBA6665OutputID[0]);
-		OGLRef.programFramebufferRGBA6665OutputID[0] = 0;
+		attachmentList[attachmentCount++] = GL_FOGATTRIBUTES_ATTACHMENT_ID;
 	}
 
-	if (OGLRef.programFramebufferRGBA6665OutputID[1] != 0)
+	if (attachmentFlags & OGLAttachmentFlag_Working)
 	{
-		glDetachShader(OGLRef.programFramebufferRGBA6665OutputID[1], OGLRef.vertexFramebufferOutput6665ShaderID[1]);
-		glDetachShader(OGLRef.programFramebufferRGBA6665OutputID[1], OGLRef.fragmentFramebufferRGBA6665OutputShaderID[1]);
-		glDeleteProgram(OGLRef.programFramebufferRGBA6665OutputID[1]);
-		OGLRef.programFramebufferRGBA6665OutputID[1] = 0;
+		attachmentList[attachmentCount++] = GL_WORKING_ATTACHMENT_ID;
 	}
 
-	if (OGLRef.vertexFramebufferOutput6665ShaderID[0]) glDeleteShader(OGLRef.vertexFramebufferOutput6665ShaderID[0]);
-	if (OGLRef.vertexFramebufferOutput6665ShaderID[1]) glDeleteShader(OGLRef.vertexFramebufferOutput6665ShaderID[1]);
+	if (attachmentFlags & OGLAttachmentFlag_DepthStencil)
+	{
+		attachmentList[attachmentCount++] = GL_DEPTH_STENCIL_ATTACHMENT;
+	}
 
-	if (OGLRef.fragmentFramebufferRGBA6665OutputShaderID[0]) glDeleteShader(OGLRef.fragmentFramebufferRGBA6665OutputShaderID[0]);
-	if (OGLRef.fragmentFramebufferRGBA6665OutputShaderID[1]) glDeleteShader(OGLRef.fragmentFramebufferRGBA6665OutputShaderID[1]);
+	glInvalidateFramebuffer(GL_DRAW_FRAMEBUFFER, attachmentCount, attachmentList);
 
-	OGLRef.vertexFramebufferOutput6665ShaderID[0] = OGLRef.vertexFramebufferOutput6665ShaderID[1] = 0;
-	OGLRef.fragmentFramebufferRGBA6665OutputShaderID[0] = OGLRef.fragmentFramebufferRGBA6665OutputShaderID[1] = 0;
+	reportFlags |= attachmentFlags;
+	this->_renderStats.attachmentInvalidateCount++;
 }
 
-Render3DError OpenGLESRenderer_3_0::CreateFramebufferOutput8888Program(const size_t outColorIndex, const char *vtxShaderCString, const char *fragShaderCString)
+void OpenGLESRenderer_3_0::_DrawFramebufferOutputQuad()
 {
-	Render3DError error = OGLERROR_NOERR;
 	OGLRenderRef &OGLRef = *this->ref;
 
-	if ( (vtxShaderCString == NULL) || (fragShaderCString == NULL) )
-	{
-		return error;
-	}
-
-	std::stringstream shaderHeader;
-
-    shaderHeader << "#version 300 es\n";
-    shaderHeader << "precision highp float;\n";
-
-	shaderHeader << "#define OUT_ATTACH " << (outColorIndex == 0 ? 0 : 3) << "\n";
-
-	shaderHeader << "#define FRAMEBUFFER_SIZE_X " << this->_framebufferWidth  << ".0 \n";
-	shaderHeader << "#define FRAMEBUFFER_SIZE_Y " << this->_framebufferHeight << ".0 \n";
-    shaderHeader << "#define IS_BGRA " << (this->readFormat == GL_BGRA ? 1 : 0) << " \n";
-	shaderHeader << "\n";
+	glViewport(0, 0, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight);
+	glDisable(GL_DEPTH_TEST);
+	glDisable(GL_STENCIL_TEST);
+	glDisable(GL_BLEND);
 
-	std::string vtxShaderCode  = shaderHeader.str() + std::string(vtxShaderCString);
-    std::string fragShaderCode  = shaderHeader.str() + std::string(fragShaderCString);
+	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboPostprocessVtxID);
 
-	error = this->ShaderProgramCreate(OGLRef.vertexFramebufferOutput8888ShaderID[outColorIndex],
-									  OGLRef.fragmentFramebufferRGBA8888OutputShaderID[outColorIndex],
-									  OGLRef.programFramebufferRGBA8888OutputID[outColorIndex],
-									  vtxShaderCode.c_str(),
-									  fragShaderCode.c_str());
-	if (error != OGLERROR_NOERR)
+	if (this->isVAOSupported)
 	{
-		INFO("OpenGL: Failed to create the FRAMEBUFFER OUTPUT RGBA8888 shader program.\n");
-		glUseProgram(0);
-		this->DestroyFramebufferOutput8888Programs();
-		return error;
+		glBindVertexArray(OGLRef.vaoPostprocessStatesID);
 	}
-
-	glBindAttribLocation(OGLRef.programFramebufferRGBA8888OutputID[outColorIndex], OGLVertexAttributeID_Position, "inPosition");
-	glBindAttribLocation(OGLRef.programFramebufferRGBA8888OutputID[outColorIndex], OGLVertexAttributeID_TexCoord0, "inTexCoord0");
-
-	glLinkProgram(OGLRef.programFramebufferRGBA8888OutputID[outColorIndex]);
-	if (!this->ValidateShaderProgramLink(OGLRef.programFramebufferRGBA8888OutputID[outColorIndex]))
+	else
 	{
-		INFO("OpenGL: Failed to link the FRAMEBUFFER OUTPUT RGBA8888 shader program.\n");
-		glUseProgram(0);
-		this->DestroyFramebufferOutput8888Programs();
-		return OGLERROR_SHADER_CREATE_ERROR;
+		glEnableVertexAttribArray(OGLVertexAttributeID_Position);
+		glEnableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
+		glVertexAttribPointer(OGLVertexAttributeID_Position, 2, GL_FLOAT, GL_FALSE, 0, 0);
+		glVertexAttribPointer(OGLVertexAttributeID_TexCoord0, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid *)(sizeof(GLfloat) * 8));
 	}
 
-	glValidateProgram(OGLRef.programFramebufferRGBA8888OutputID[outColorIndex]);
-	glUseProgram(OGLRef.programFramebufferRGBA8888OutputID[outColorIndex]);
+	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
-	const GLint uniformTexGColor = glGetUniformLocation(OGLRef.programFramebufferRGBA8888OutputID[outColorIndex], "texInFragColor");
-	if (outColorIndex == 0)
+	if (this->isVAOSupported)
 	{
-		glUniform1i(uniformTexGColor, OGLTextureUnitID_FinalColor);
+		glBindVertexArray(0);
 	}
 	else
 	{
-		glUniform1i(uniformTexGColor, OGLTextureUnitID_GColor);
+		glDisableVertexAttribArray(OGLVertexAttributeID_Position);
+		glDisableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
 	}
+}
 
-	return OGLERROR_NOERR;
+size_t OpenGLESRenderer_3_0::_GetReadBackSizeBytes() const
+{
+	switch (this->_framebufferReadMode)
+	{
+		case OGLFramebufferReadMode_16Only:
+			return this->_framebufferPixCount * sizeof(u16);
+
+		case OGLFramebufferReadMode_Dual:
+			return this->_framebufferColorSizeBytes + (this->_framebufferPixCount * sizeof(u16));
+
+		default:
+			break;
+	}
+
+	return this->_framebufferColorSizeBytes;
 }
 
-void OpenGLESRenderer_3_0::DestroyFramebufferOutput8888Programs()
+Render3DError OpenGLESRenderer_3_0::_ReadBackPixels16()
 {
 	OGLRenderRef &OGLRef = *this->ref;
 
-	if (OGLRef.programFramebufferRGBA8888OutputID[0] != 0)
-	{
-		glDetachShader(OGLRef.programFramebufferRGBA8888OutputID[0], OGLRef.vertexFramebufferOutput8888ShaderID[0]);
-		glDetachShader(OGLRef.programFramebufferRGBA8888OutputID[0], OGLRef.fragmentFramebufferRGBA8888OutputShaderID[0]);
-		glDeleteProgram(OGLRef.programFramebufferRGBA8888OutputID[0]);
-		OGLRef.programFramebufferRGBA8888OutputID[0] = 0;
-	}
+	// Convert directly to the 16-bit framebuffer format on the GPU. Only the GPU flip and
+	// convert path ever renders the final color into the working attachment.
+	const bool isFinalColorInWorking = this->willFlipAndConvertFramebufferOnGPU && (this->_lastTextureDrawTarget == OGLTextureUnitID_FinalColor);
+	this->_glState.UseProgram( (isFinalColorInWorking) ? OGLRef.programFramebufferRGBA5551OutputID[0] : OGLRef.programFramebufferRGBA5551OutputID[1] );
 
-	if (OGLRef.programFramebufferRGBA8888OutputID[1] != 0)
-	{
-		glDetachShader(OGLRef.programFramebufferRGBA8888OutputID[1], OGLRef.vertexFramebufferOutput8888ShaderID[1]);
-		glDetachShader(OGLRef.programFramebufferRGBA8888OutputID[1], OGLRef.fragmentFramebufferRGBA8888OutputShaderID[1]);
-		glDeleteProgram(OGLRef.programFramebufferRGBA8888OutputID[1]);
-		OGLRef.programFramebufferRGBA8888OutputID[1] = 0;
-	}
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboFramebufferFlipID);
+	glDrawBuffer(GL_FRAMEBUFFER16_ATTACHMENT_ID);
+	glReadBuffer(GL_FRAMEBUFFER16_ATTACHMENT_ID);
 
-	if (OGLRef.vertexFramebufferOutput8888ShaderID[0]) glDeleteShader(OGLRef.vertexFramebufferOutput8888ShaderID[0]);
-	if (OGLRef.vertexFramebufferOutput8888ShaderID[1]) glDeleteShader(OGLRef.vertexFramebufferOutput8888ShaderID[1]);
+	this->_DrawFramebufferOutputQuad();
 
-	if (OGLRef.fragmentFramebufferRGBA8888OutputShaderID[0]) glDeleteShader(OGLRef.fragmentFramebufferRGBA8888OutputShaderID[0]);
-	if (OGLRef.fragmentFramebufferRGBA8888OutputShaderID[1]) glDeleteShader(OGLRef.fragmentFramebufferRGBA8888OutputShaderID[1]);
+	this->_PreparePixelPackBuffer();
 
-	OGLRef.vertexFramebufferOutput8888ShaderID[0] = OGLRef.vertexFramebufferOutput8888ShaderID[1] = 0;
-	OGLRef.fragmentFramebufferRGBA8888OutputShaderID[0] = OGLRef.fragmentFramebufferRGBA8888OutputShaderID[1] = 0;
+	glReadPixels(0, 0, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight, GL_RED_INTEGER, GL_UNSIGNED_SHORT, 0);
+
+	// If the 16-bit only prediction turns out wrong, then the frame is read back again in
+	// color mode, which expects to read the final color from the render FBO.
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboRenderID);
+	glReadBuffer(GL_COLOROUT_ATTACHMENT_ID);
+
+	this->_pixelReadNeedsFinish = true;
+	return OGLERROR_NOERR;
 }
 
-Render3DError OpenGLESRenderer_3_0::InitPostprocessingPrograms(const char *edgeMarkVtxShaderCString,
-															 const char *edgeMarkFragShaderCString,
-															 const char *framebufferOutputVtxShaderCString,
-															 const char *framebufferOutputRGBA6665FragShaderCString,
-															 const char *framebufferOutputRGBA8888FragShaderCString)
+Render3DError OpenGLESRenderer_3_0::_ReadBackPixelsDual()
 {
-	Render3DError error = OGLERROR_NOERR;
 	OGLRenderRef &OGLRef = *this->ref;
 
-	if (this->isVBOSupported && this->isFBOSupported)
-	{
-		error = this->CreateEdgeMarkProgram(edgeMarkVtxShaderCString, edgeMarkFragShaderCString);
-		if (error != OGLERROR_NOERR)
-		{
-			return error;
-		}
-	}
+	// Write the converted color framebuffer into whichever of the GColor or FinalColor
+	// attachments doesn't hold the rendered frame, and the RGBA5551 framebuffer into its
+	// own attachment, all in one pass.
+	const bool isFinalColorInWorking = this->willFlipAndConvertFramebufferOnGPU && (this->_lastTextureDrawTarget == OGLTextureUnitID_FinalColor);
+	const size_t outColorIndex = (isFinalColorInWorking) ? 0 : 1;
+	const size_t programIndex = ((this->_outputFormat == NDSColorFormat_BGR666_Rev) ? 0 : 2) + outColorIndex;
+	const GLenum outColorAttachment = (outColorIndex == 0) ? GL_COLOROUT_ATTACHMENT_ID : GL_WORKING_ATTACHMENT_ID;
+
+	this->_glState.UseProgram(OGLRef.programFramebufferDualOutputID[programIndex]);
+
+	const GLenum drawBuffers[4] = {
+		(outColorIndex == 0) ? GL_COLOROUT_ATTACHMENT_ID : GL_NONE,
+		GL_FRAMEBUFFER16_ATTACHMENT_ID,
+		GL_NONE,
+		(outColorIndex == 1) ? GL_WORKING_ATTACHMENT_ID : GL_NONE
+	};
 
-	error = this->CreateFramebufferOutput6665Program(0, framebufferOutputVtxShaderCString, framebufferOutputRGBA6665FragShaderCString);
-	if (error != OGLERROR_NOERR)
-	{
-		return error;
-	}
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboFramebufferFlipID);
+	glDrawBuffers(4, drawBuffers);
 
-	error = this->CreateFramebufferOutput6665Program(1, framebufferOutputVtxShaderCString, framebufferOutputRGBA6665FragShaderCString);
-	if (error != OGLERROR_NOERR)
-	{
-		return error;
-	}
+	this->_DrawFramebufferOutputQuad();
 
-	error = this->CreateFramebufferOutput8888Program(0, framebufferOutputVtxShaderCString, framebufferOutputRGBA8888FragShaderCString);
-	if (error != OGLERROR_NOERR)
-	{
-		return error;
-	}
+	this->_PreparePixelPackBuffer();
 
-	error = this->CreateFramebufferOutput8888Program(1, framebufferOutputVtxShaderCString, framebufferOutputRGBA8888FragShaderCString);
-	if (error != OGLERROR_NOERR)
+	// Both readbacks go into the same PBO, with the RGBA5551 framebuffer placed right after
+	// the color framebuffer, so that a single map retrieves both of them.
+	glReadBuffer(outColorAttachment);
+	glReadPixels(0, 0, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight, this->readFormat, this->readType, 0);
+
+	glReadBuffer(GL_FRAMEBUFFER16_ATTACHMENT_ID);
+	glReadPixels(0, 0, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight, GL_RED_INTEGER, GL_UNSIGNED_SHORT, (const GLvoid *)this->_framebufferColorSizeBytes);
+
+	// Put back the framebuffer and read buffer that the color mode readback expects.
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboRenderID);
+	glReadBuffer(GL_COLOROUT_ATTACHMENT_ID);
+
+	this->_pixelReadNeedsFinish = true;
+	return OGLERROR_NOERR;
+}
+
+Render3DError OpenGLESRenderer_3_0::_ReadBackFullFramebufferNow()
+{
+	// The last readback didn't include everything that the requested framebuffers need. The
+	// rendered frame is still in the FBO, so read it back again.
+	if (!BEGINGL())
 	{
-		return error;
+		return OGLERROR_BEGINGL_FAILED;
 	}
 
-	glUseProgram(OGLRef.programGeometryID[0]);
-	INFO("OpenGL: Successfully created postprocess shaders.\n");
+	this->ReadBackPixels();
+	this->_pixelReadNeedsFinish = false;
+	this->_FinishReadBackPixels();
+
+	ENDGL();
 
 	return OGLERROR_NOERR;
 }
 
-Render3DError OpenGLESRenderer_3_0::UploadClearImage(const u16 *__restrict colorBuffer, const u32 *__restrict depthBuffer, const u8 *__restrict fogBuffer, const u8 opaquePolyID)
+void OpenGLESRenderer_3_0::_FinishReadBackPixels()
 {
 	OGLRenderRef &OGLRef = *this->ref;
-	this->_clearImageIndex ^= 0x01;
 
-	if (this->_enableFog && this->_deviceInfo.isFogSupported)
+	if (this->isPBOSupported && (this->_pboInFlightCount > 0))
 	{
-		for (size_t i = 0; i < GPU_FRAMEBUFFER_NATIVE_WIDTH * GPU_FRAMEBUFFER_NATIVE_HEIGHT; i++)
+		// Keep the newest _framePipelineDepth - 1 frames in flight, and deliver the newest of
+		// the rest. Any older ones are simply dropped.
+		const size_t keepCount = this->_framePipelineDepth - 1;
+		if (this->_pboInFlightCount <= keepCount)
 		{
-			OGLRef.workingCIDepthStencilBuffer[this->_clearImageIndex][i] = (depthBuffer[i] << 8) | opaquePolyID;
-			OGLRef.workingCIFogAttributesBuffer[this->_clearImageIndex][i] = (fogBuffer[i]) ? 0xFF0000FF : 0xFF000000;
+			return;
 		}
-	}
-	else
-	{
-		for (size_t i = 0; i < GPU_FRAMEBUFFER_NATIVE_WIDTH * GPU_FRAMEBUFFER_NATIVE_HEIGHT; i++)
+
+		const size_t deliverCount = this->_pboInFlightCount - keepCount;
+		const size_t deliverIndex = this->_pboInFlight[deliverCount - 1];
+
+		for (size_t i = 0; i < keepCount; i++)
 		{
-			OGLRef.workingCIDepthStencilBuffer[this->_clearImageIndex][i] = (depthBuffer[i] << 8) | opaquePolyID;
+			this->_pboInFlight[i] = this->_pboInFlight[deliverCount + i];
 		}
-	}
 
-	const bool didColorChange = (memcmp(OGLRef.workingCIColorBuffer, colorBuffer, GPU_FRAMEBUFFER_NATIVE_WIDTH * GPU_FRAMEBUFFER_NATIVE_HEIGHT * sizeof(u16)) != 0);
-	const bool didDepthStencilChange = (memcmp(OGLRef.workingCIDepthStencilBuffer[this->_clearImageIndex], OGLRef.workingCIDepthStencilBuffer[this->_clearImageIndex ^ 0x01], GPU_FRAMEBUFFER_NATIVE_WIDTH * GPU_FRAMEBUFFER_NATIVE_HEIGHT * sizeof(GLuint)) != 0);
-	const bool didFogAttributesChange = this->_enableFog && this->_deviceInfo.isFogSupported && (memcmp(OGLRef.workingCIFogAttributesBuffer[this->_clearImageIndex], OGLRef.workingCIFogAttributesBuffer[this->_clearImageIndex ^ 0x01], GPU_FRAMEBUFFER_NATIVE_WIDTH * GPU_FRAMEBUFFER_NATIVE_HEIGHT * sizeof(GLuint)) != 0);
+		this->_pboInFlightCount = keepCount;
 
-	glActiveTexture(GL_TEXTURE0);
+		if ( (deliverIndex == this->_pboRingIndex) && (this->_mappedFramebuffer != NULL) )
+		{
+			// A memoized frame requeued a PBO that's already delivered and mapped.
+			return;
+		}
 
-	if (didColorChange)
-	{
-		memcpy(OGLRef.workingCIColorBuffer, colorBuffer, GPU_FRAMEBUFFER_NATIVE_WIDTH * GPU_FRAMEBUFFER_NATIVE_HEIGHT * sizeof(u16));
-		glBindTexture(GL_TEXTURE_2D, OGLRef.texCIColorID);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GPU_FRAMEBUFFER_NATIVE_WIDTH, GPU_FRAMEBUFFER_NATIVE_HEIGHT, GL_RGBA, GL_UNSIGNED_SHORT_5_5_5_1, OGLRef.workingCIColorBuffer);
-	}
+		if (deliverIndex != this->_pboRingIndex)
+		{
+			if (this->_mappedFramebuffer != NULL)
+			{
+				if (this->_isPBOBorrowed[this->_pboRingIndex])
+				{
+					this->_pboRetiredMapping[this->_pboRingIndex] = this->_mappedFramebuffer;
+				}
+				else
+				{
+					glBindBuffer(GL_PIXEL_PACK_BUFFER, OGLRef.pboRenderDataID[this->_pboRingIndex]);
+					glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+				}
 
-	if (didDepthStencilChange)
-	{
-		glBindTexture(GL_TEXTURE_2D, OGLRef.texCIDepthStencilID);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GPU_FRAMEBUFFER_NATIVE_WIDTH, GPU_FRAMEBUFFER_NATIVE_HEIGHT, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, OGLRef.workingCIDepthStencilBuffer[this->_clearImageIndex]);
-	}
+				this->_mappedFramebuffer = NULL;
+			}
 
-	if (didFogAttributesChange)
+			this->_pboRingIndex = deliverIndex;
+		}
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, OGLRef.pboRenderDataID[deliverIndex]);
+		this->_framebufferReadMode = this->_pboReadMode[deliverIndex];
+		this->_mappedFramebuffer = (Color4u8 *__restrict)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, this->_GetReadBackSizeBytes(), GL_MAP_READ_BIT);
+
+		// The delivered frame isn't necessarily the one that the dirty lines were tracked
+		// against, so flush all of it.
+		this->_pendingFlushLinesMain.lineFirst = 0;
+		this->_pendingFlushLinesMain.lineEnd = this->_framebufferHeight;
+		this->_pendingFlushLines16.lineFirst = 0;
+		this->_pendingFlushLines16.lineEnd = this->_framebufferHeight;
+		this->_readBackLines.lineFirst = 0;
+		this->_readBackLines.lineEnd = this->_framebufferHeight;
+	}
+	else if (this->isPBOSupported)
 	{
-		glBindTexture(GL_TEXTURE_2D, OGLRef.texCIFogAttrID);
-		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, GPU_FRAMEBUFFER_NATIVE_WIDTH, GPU_FRAMEBUFFER_NATIVE_HEIGHT, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, OGLRef.workingCIFogAttributesBuffer[this->_clearImageIndex]);
+		this->_mappedFramebuffer = (Color4u8 *__restrict)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, this->_GetReadBackSizeBytes(), GL_MAP_READ_BIT);
+		//memset(this->_mappedFramebuffer, 255, this->_framebufferColorSizeBytes);
 	}
+	else
+	{
+		this->_readBackLines = this->_GetReadBackLines();
 
-	glBindTexture(GL_TEXTURE_2D, 0);
-
-	return OGLERROR_NOERR;
+		if (!OGLLineRangeIsEmpty(this->_readBackLines))
+		{
+			const size_t readLineCount = this->_readBackLines.lineEnd - this->_readBackLines.lineFirst;
+			glReadPixels(0, (GLint)this->_readBackLines.lineFirst, (GLsizei)this->_framebufferWidth, (GLsizei)readLineCount, this->readFormat, this->readType, this->_framebufferColor + (this->_readBackLines.lineFirst * this->_framebufferWidth));
+		}
+	}
 }
 
-void OpenGLESRenderer_3_0::GetExtensionSet(std::set<std::string> *oglExtensionSet)
+// Gets the PBO ready to receive a new readback. The current PBO is reused unless the host is
+// still borrowing it, in which case it stays mapped and the next free PBO in the ring is used.
+void OpenGLESRenderer_3_0::_PreparePixelPackBuffer()
 {
-	std::string oglExtensionString = std::string((const char *)glGetString(GL_EXTENSIONS));
+	OGLRenderRef &OGLRef = *this->ref;
 
-	size_t extStringStartLoc = 0;
-	size_t delimiterLoc = oglExtensionString.find_first_of(' ', extStringStartLoc);
-	while (delimiterLoc != std::string::npos)
+	// Unmap any PBOs that were returned since the last readback.
+	for (size_t i = 0; i < OGLRENDER_PBO_RING_SIZE; i++)
 	{
-		std::string extensionName = oglExtensionString.substr(extStringStartLoc, delimiterLoc - extStringStartLoc);
-		oglExtensionSet->insert(extensionName);
-
-		extStringStartLoc = delimiterLoc + 1;
-		delimiterLoc = oglExtensionString.find_first_of(' ', extStringStartLoc);
+		if (!this->_isPBOBorrowed[i] && (this->_pboRetiredMapping[i] != NULL))
+		{
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, OGLRef.pboRenderDataID[i]);
+			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+			this->_pboRetiredMapping[i] = NULL;
+		}
 	}
 
-	if (extStringStartLoc - oglExtensionString.length() > 0)
+	if (this->_isPipelinedReadBack)
 	{
-		std::string extensionName = oglExtensionString.substr(extStringStartLoc, oglExtensionString.length() - extStringStartLoc);
-		oglExtensionSet->insert(extensionName);
-	}
-}
+		// Leave the delivered frame mapped for the host, and read back into a PBO that isn't
+		// mapped, borrowed or still in flight.
+		for (size_t i = 1; i < OGLRENDER_PBO_RING_SIZE; i++)
+		{
+			const size_t nextIndex = (this->_pboRingIndex + i) % OGLRENDER_PBO_RING_SIZE;
+			bool isInFlight = false;
 
-void OpenGLESRenderer_3_0::_SetupGeometryShaders(const OGLGeometryFlags flags)
-{
-	const OGLRenderRef &OGLRef = *this->ref;
+			for (size_t j = 0; j < this->_pboInFlightCount; j++)
+			{
+				isInFlight = isInFlight || (this->_pboInFlight[j] == nextIndex);
+			}
 
-	glUseProgram(OGLRef.programGeometryID[flags.value]);
-	glUniform1f(OGLRef.uniformStateAlphaTestRef[flags.value], this->_pendingRenderStates.alphaTestRef);
-	glUniform1i(OGLRef.uniformTexDrawOpaque[flags.value], GL_FALSE);
-	glUniform1i(OGLRef.uniformDrawModeDepthEqualsTest[flags.value], GL_FALSE);
-	glUniform1i(OGLRef.uniformPolyDrawShadow[flags.value], GL_FALSE);
+			if ( !isInFlight && !this->_isPBOBorrowed[nextIndex] && (this->_pboRetiredMapping[nextIndex] == NULL) )
+			{
+				this->_pboReadIndex = nextIndex;
+				glBindBuffer(GL_PIXEL_PACK_BUFFER, OGLRef.pboRenderDataID[nextIndex]);
+				return;
+			}
+		}
 
-	if (this->isFBOSupported)
+		// Every PBO is busy, so drop the newest frame in flight and reuse its PBO.
+		if (this->_pboInFlightCount > 0)
+		{
+			this->_pboInFlightCount--;
+			this->_pboReadIndex = this->_pboInFlight[this->_pboInFlightCount];
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, OGLRef.pboRenderDataID[this->_pboReadIndex]);
+			return;
+		}
+	}
+
+	if (this->_isPBOBorrowed[this->_pboRingIndex])
 	{
-		glDrawBuffers(4, GeometryDrawBuffersEnum[flags.DrawBuffersMode]);
+		this->_pboRetiredMapping[this->_pboRingIndex] = this->_mappedFramebuffer;
+		this->_mappedFramebuffer = NULL;
+
+		// AcquireFramebuffer() always leaves at least one PBO free.
+		for (size_t i = 1; i < OGLRENDER_PBO_RING_SIZE; i++)
+		{
+			const size_t nextIndex = (this->_pboRingIndex + i) % OGLRENDER_PBO_RING_SIZE;
+			if (!this->_isPBOBorrowed[nextIndex])
+			{
+				this->_pboRingIndex = nextIndex;
+				break;
+			}
+		}
 	}
-}
 
-Render3DError OpenGLESRenderer_3_0::ZeroDstAlphaPass(const POLY *rawPolyList, const CPoly *clippedPolyList, const size_t clippedPolyCount, const size_t clippedPolyOpaqueCount, bool enableAlphaBlending, size_t indexOffset, POLYGON_ATTR lastPolyAttr)
-{
-	OGLRenderRef &OGLRef = *this->ref;
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, OGLRef.pboRenderDataID[this->_pboRingIndex]);
 
-	if (!this->isFBOSupported || !this->isVBOSupported)
+	if (this->_mappedFramebuffer != NULL)
 	{
-		return OGLERROR_FEATURE_UNSUPPORTED;
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		this->_mappedFramebuffer = NULL;
 	}
 
-	// Pre Pass: Fill in the stencil buffer based on the alpha of the current framebuffer color.
-	// Fully transparent pixels (alpha == 0) -- Set stencil buffer to 0
-	// All other pixels (alpha != 0) -- Set stencil buffer to 1
+	this->_pboReadIndex = this->_pboRingIndex;
+}
 
-	this->DisableVertexAttributes();
+// Starts a readback without waiting for any earlier ones. The readback is queued up, and
+// RenderFinish() delivers it once _framePipelineDepth - 1 newer frames are behind it.
+Render3DError OpenGLESRenderer_3_0::_ReadBackPixelsPipelined()
+{
+	// The delivered frame keeps its own read mode until the next one is mapped.
+	const OGLFramebufferReadMode deliveredReadMode = this->_framebufferReadMode;
 
-	const bool isRunningMSAA = this->isMultisampledFBOSupported && (OGLRef.selectedRenderingFBO == OGLRef.fboMSIntermediateRenderID);
+	this->_isPipelinedReadBack = true;
+	const Render3DError error = this->ReadBackPixels();
+	this->_isPipelinedReadBack = false;
 
-	if (isRunningMSAA)
+	this->_pboReadMode[this->_pboReadIndex] = this->_framebufferReadMode;
+	this->_framebufferReadMode = deliveredReadMode;
+
+	if (this->_pboReadIndex == this->_pboRingIndex)
 	{
-		// Just downsample the color buffer now so that we have some texture data to sample from in the non-multisample shader.
-		// This is not perfectly pixel accurate, but it's better than nothing.
-		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, OGLRef.fboRenderID);
-		glDrawBuffer(GL_COLOROUT_ATTACHMENT_ID);
-		glBlitFramebuffer(0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, 0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
-		glDrawBuffers(4, GeometryDrawBuffersEnum[this->_geometryProgramFlags.DrawBuffersMode]);
-		glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.selectedRenderingFBO);
+		// There was no free PBO, so the delivered frame was replaced, just like when not
+		// pipelining. Deliver this frame next, ahead of anything still in flight.
+		this->_pboInFlightCount = 0;
 	}
 
-	glUseProgram(OGLRef.programGeometryZeroDstAlphaID);
-	glViewport(0, 0, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight);
-	glDisable(GL_BLEND);
-	glEnable(GL_STENCIL_TEST);
-	glDisable(GL_DEPTH_TEST);
+	this->_pboInFlight[this->_pboInFlightCount] = this->_pboReadIndex;
+	this->_pboInFlightCount++;
 
-	glStencilFunc(GL_ALWAYS, 0x40, 0x40);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-	glStencilMask(0x40);
-	glDepthMask(GL_FALSE);
-	glDrawBuffer(GL_NONE);
+	return error;
+}
 
-	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboPostprocessVtxID);
+// Copies the final color into the next free export texture, and fences it so that consumers
+// know when the copy is done.
+void OpenGLESRenderer_3_0::_ExportFrame()
+{
+	OGLRenderRef &OGLRef = *this->ref;
 
-	if (this->isVAOSupported)
+	// Never overwrite the latest frame or any frame that a consumer is still holding on to.
+	size_t exportIndex = OGLRENDER_EXPORT_TEXTURE_COUNT;
+
+	for (size_t i = 1; i <= OGLRENDER_EXPORT_TEXTURE_COUNT; i++)
 	{
-		glBindVertexArray(OGLRef.vaoPostprocessStatesID);
+		const size_t nextIndex = (this->_exportLatestIndex + i) % OGLRENDER_EXPORT_TEXTURE_COUNT;
+		if ( (nextIndex != this->_exportLatestIndex) && !this->_isExportInUse[nextIndex] )
+		{
+			exportIndex = nextIndex;
+			break;
+		}
 	}
-	else
+
+	if (exportIndex >= OGLRENDER_EXPORT_TEXTURE_COUNT)
 	{
-		glEnableVertexAttribArray(OGLVertexAttributeID_Position);
-		glEnableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
-		glVertexAttribPointer(OGLVertexAttributeID_Position, 2, GL_FLOAT, GL_FALSE, 0, 0);
-		glVertexAttribPointer(OGLVertexAttributeID_TexCoord0, 2, GL_FLOAT, GL_FALSE, 0, (const GLvoid *)(sizeof(GLfloat) * 8));
+		this->_renderStats.frameExportDropCount++;
+		return;
 	}
 
-	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	OGLExportedFrame &frame = this->_exportedFrame[exportIndex];
 
-	if (this->isVAOSupported)
-	{
-		glBindVertexArray(0);
-	}
-	else
+	if (frame.fence != NULL)
 	{
-		glDisableVertexAttribArray(OGLVertexAttributeID_Position);
-		glDisableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
+		glDeleteSync(frame.fence);
+		frame.fence = NULL;
 	}
 
-	// Setup for multiple pass alpha poly drawing
-	OGLGeometryFlags oldGProgramFlags = this->_geometryProgramFlags;
-	this->_geometryProgramFlags.EnableEdgeMark = 0;
-	this->_geometryProgramFlags.EnableFog = 0;
-	this->_SetupGeometryShaders(this->_geometryProgramFlags);
-	glDrawBuffer(GL_COLOROUT_ATTACHMENT_ID);
+	// Only the GPU flip and convert path ever renders the final color into the working attachment.
+	const bool isFinalColorInWorking = this->willFlipAndConvertFramebufferOnGPU && (this->_lastTextureDrawTarget == OGLTextureUnitID_FinalColor);
 
-	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboGeometryVtxID);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, OGLRef.iboGeometryIndexID);
-	this->EnableVertexAttributes();
+	// The read buffer belongs to the FBO, so put it back the way it was afterwards.
+	GLint lastReadBuffer = GL_COLOROUT_ATTACHMENT_ID;
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, OGLRef.fboRenderID);
+	glGetIntegerv(GL_READ_BUFFER, &lastReadBuffer);
+	glReadBuffer( (isFinalColorInWorking) ? GL_WORKING_ATTACHMENT_ID : GL_COLOROUT_ATTACHMENT_ID );
 
-	// Draw the alpha polys, touching fully transparent pixels only once.
-	glEnable(GL_DEPTH_TEST);
-	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_FALSE);
-	glStencilFunc(GL_NOTEQUAL, 0x40, 0x40);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, OGLRef.fboExportID);
+	glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, OGLRef.texExportColorID[exportIndex], 0);
+	glDrawBuffer(GL_COLOR_ATTACHMENT0);
 
-	this->DrawPolygonsForIndexRange<OGLPolyDrawMode_ZeroAlphaPass>(rawPolyList, clippedPolyList, clippedPolyCount, clippedPolyOpaqueCount, clippedPolyCount - 1, indexOffset, lastPolyAttr);
+	// Flip the frame to the NDS Y-coordinate order while copying it.
+	glBlitFramebuffer(0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight,
+	                  0, (GLint)this->_framebufferHeight, (GLint)this->_framebufferWidth, 0,
+	                  GL_COLOR_BUFFER_BIT, GL_NEAREST);
 
-	// Restore OpenGL states back to normal.
-	this->_geometryProgramFlags = oldGProgramFlags;
-	this->_SetupGeometryShaders(this->_geometryProgramFlags);
-	glClear(GL_STENCIL_BUFFER_BIT);
-	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-	glDepthMask(GL_TRUE);
-	glStencilMask(0xFF);
+	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboRenderID);
+	glReadBuffer((GLenum)lastReadBuffer);
 
-	if (enableAlphaBlending)
-	{
-		glEnable(GL_BLEND);
-	}
-	else
-	{
-		glDisable(GL_BLEND);
-	}
+	// Flush so that consumers in other contexts can actually see the fence get signaled.
+	frame.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	glFlush();
 
-	return OGLERROR_NOERR;
+	this->_exportLatestIndex = exportIndex;
+	this->_renderStats.frameExportCount++;
 }
 
-void OpenGLESRenderer_3_0::_ResolveWorkingBackFacing()
+Render3DError OpenGLESRenderer_3_0::_StartDeferredReadBack()
 {
-	OGLRenderRef &OGLRef = *this->ref;
-
-	if (!this->_emulateDepthLEqualPolygonFacing || !this->_isDepthLEqualPolygonFacingSupported || !this->isMultisampledFBOSupported || (OGLRef.selectedRenderingFBO != OGLRef.fboMSIntermediateRenderID))
+	// The render result is still in the FBO, so read it back now that it's needed.
+	if (!BEGINGL())
 	{
-		return;
+		return OGLERROR_BEGINGL_FAILED;
 	}
 
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, OGLRef.fboMSIntermediateRenderID);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, OGLRef.fboRenderID);
-
-	glReadBuffer(GL_WORKING_ATTACHMENT_ID);
-	glDrawBuffer(GL_WORKING_ATTACHMENT_ID);
-	glBlitFramebuffer(0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, 0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	this->ReadBackPixels();
+	this->_pixelReadNeedsStart = false;
 
-	// Reset framebuffer targets
-	glReadBuffer(GL_COLOROUT_ATTACHMENT_ID);
-	glDrawBuffers(4, GeometryDrawBuffersEnum[this->_geometryProgramFlags.DrawBuffersMode]);
+	ENDGL();
 
-	glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboMSIntermediateRenderID);
-	glDrawBuffers(4, GeometryDrawBuffersEnum[this->_geometryProgramFlags.DrawBuffersMode]);
+	return OGLERROR_NOERR;
 }
 
-void OpenGLESRenderer_3_0::_ResolveGeometry()
+Render3DError OpenGLESRenderer_3_0::ReadBackPixels()
 {
 	OGLRenderRef &OGLRef = *this->ref;
 
-	if (!this->isMultisampledFBOSupported || (OGLRef.selectedRenderingFBO != OGLRef.fboMSIntermediateRenderID))
-	{
-		return;
-	}
-
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, OGLRef.fboMSIntermediateRenderID);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, OGLRef.fboRenderID);
+	// Assume that this frame will be flushed the same way as the last one. If only the 16-bit
+	// framebuffer is needed, read back only that, which halves the readback size. If both
+	// framebuffers are needed, produce both of them on the GPU in a single pass. Either way,
+	// no CPU color conversion will be needed.
+	this->_framebufferReadMode = OGLFramebufferReadMode_Color;
+	this->_readBackLines.lineFirst = 0;
+	this->_readBackLines.lineEnd = this->_framebufferHeight;
 
+	if (this->_isFramebufferOutput5551Supported && this->isPBOSupported && this->isFBOSupported)
 	{
-		if (this->_enableEdgeMark && this->_deviceInfo.isEdgeMarkSupported)
+		if (this->_enableZeroCopyFramebuffer || (this->_lastFlushRequestMain && this->_lastFlushRequest16))
 		{
-			glReadBuffer(GL_POLYID_ATTACHMENT_ID);
-			glDrawBuffer(GL_POLYID_ATTACHMENT_ID);
-			glBlitFramebuffer(0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, 0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+			// Zero-copy always needs the main framebuffer in its output format.
+			this->_framebufferReadMode = OGLFramebufferReadMode_Dual;
+			return this->_ReadBackPixelsDual();
 		}
-
-		if (this->_enableFog && this->_deviceInfo.isFogSupported)
+		else if (!this->_lastFlushRequestMain && this->_lastFlushRequest16 && !this->_isPipelinedReadBack)
 		{
-			glReadBuffer(GL_FOGATTRIBUTES_ATTACHMENT_ID);
-			glDrawBuffer(GL_FOGATTRIBUTES_ATTACHMENT_ID);
-			glBlitFramebuffer(0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, 0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, GL_COLOR_BUFFER_BIT, GL_NEAREST);
+			// This relies on rereading the FBO if the main framebuffer gets requested after
+			// all, which doesn't work once the FBO has moved on to later frames.
+			this->_framebufferReadMode = OGLFramebufferReadMode_16Only;
+			return this->_ReadBackPixels16();
 		}
-
-		// Blit the color and depth buffers
-		glReadBuffer(GL_COLOROUT_ATTACHMENT_ID);
-		glDrawBuffer(GL_COLOROUT_ATTACHMENT_ID);
-		glBlitFramebuffer(0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, 0, 0, (GLint)this->_framebufferWidth, (GLint)this->_framebufferHeight, GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT, GL_NEAREST);
-
-		// Reset framebuffer targets
-		glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.fboRenderID);
-		glDrawBuffers(4, GeometryDrawBuffersEnum[this->_geometryProgramFlags.DrawBuffersMode]);
 	}
-}
-
-Render3DError OpenGLESRenderer_3_0::ReadBackPixels()
-{
-	OGLRenderRef &OGLRef = *this->ref;
 
 	if (this->willFlipAndConvertFramebufferOnGPU)
 	{
@@ -4261,7 +6848,7 @@ Render3DError OpenGLESRenderer_3_0::ReadBackPixels()
 			if (this->_lastTextureDrawTarget == OGLTextureUnitID_GColor )
 			{
 				const GLuint convertProgramID = (this->_outputFormat == NDSColorFormat_BGR666_Rev) ? OGLRef.programFramebufferRGBA6665OutputID[1] : OGLRef.programFramebufferRGBA8888OutputID[1];
-				glUseProgram(convertProgramID);
+				this->_glState.UseProgram(convertProgramID);
 				glDrawBuffer(GL_WORKING_ATTACHMENT_ID);
 				glReadBuffer(GL_WORKING_ATTACHMENT_ID);
 				this->_lastTextureDrawTarget = OGLTextureUnitID_FinalColor;
@@ -4269,7 +6856,7 @@ Render3DError OpenGLESRenderer_3_0::ReadBackPixels()
 			else
 			{
 				const GLuint convertProgramID = (this->_outputFormat == NDSColorFormat_BGR666_Rev) ? OGLRef.programFramebufferRGBA6665OutputID[0] : OGLRef.programFramebufferRGBA8888OutputID[0];
-				glUseProgram(convertProgramID);
+				this->_glState.UseProgram(convertProgramID);
 				glDrawBuffer(GL_COLOROUT_ATTACHMENT_ID);
 				glReadBuffer(GL_COLOROUT_ATTACHMENT_ID);
 				this->_lastTextureDrawTarget = OGLTextureUnitID_GColor;
@@ -4278,11 +6865,11 @@ Render3DError OpenGLESRenderer_3_0::ReadBackPixels()
 		else
 		{
 			const GLuint convertProgramID = (this->_outputFormat == NDSColorFormat_BGR666_Rev) ? OGLRef.programFramebufferRGBA6665OutputID[0] : OGLRef.programFramebufferRGBA8888OutputID[0];
-			glUseProgram(convertProgramID);
+			this->_glState.UseProgram(convertProgramID);
 
-			glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_FinalColor);
+			this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_FinalColor);
 			glCopyTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 0, 0, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight);
-			glActiveTexture(GL_TEXTURE0);
+			this->_glState.ActiveTexture(GL_TEXTURE0);
 		}
 
 		glViewport(0, 0, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight);
@@ -4336,15 +6923,25 @@ Render3DError OpenGLESRenderer_3_0::ReadBackPixels()
 	{
 		// Read back the pixels in BGRA format, since legacy OpenGL devices may experience a performance
 		// penalty if the readback is in any other format.
-		if (this->_mappedFramebuffer != NULL)
-		{
-			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
-			this->_mappedFramebuffer = NULL;
-		}
+		this->_PreparePixelPackBuffer();
 
         glGetError();
 
-		glReadPixels(0, 0, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight, this->readFormat, this->readType, 0);
+		// Lines that haven't changed since they were last flushed don't need to be read back.
+		// The PBO keeps the same layout as the whole framebuffer, so only the lines being
+		// read back are ever written.
+		this->_readBackLines = this->_GetReadBackLines();
+		const size_t readLineCount = (OGLLineRangeIsEmpty(this->_readBackLines)) ? 0 : this->_readBackLines.lineEnd - this->_readBackLines.lineFirst;
+
+		if (readLineCount > 0)
+		{
+			glReadPixels(0, (GLint)this->_readBackLines.lineFirst, (GLsizei)this->_framebufferWidth, (GLsizei)readLineCount, this->readFormat, this->readType, (const GLvoid *)(this->_readBackLines.lineFirst * this->_framebufferWidth * sizeof(Color4u8)));
+		}
+
+		if (readLineCount < this->_framebufferHeight)
+		{
+			this->_renderStats.framePartialReadBackCount++;
+		}
 
 		GLint err = glGetError();
 		if (err) printf("read err %x\n", err);
@@ -4356,10 +6953,23 @@ Render3DError OpenGLESRenderer_3_0::ReadBackPixels()
 
 Render3DError OpenGLESRenderer_3_0::RenderGeometry()
 {
+	if (this->_isFrameMemoized)
+	{
+		return OGLERROR_NOERR;
+	}
+
+	OGLRenderRef &OGLRef = *this->ref;
+	this->_isDepthCopyDirty = true;
+
 	if (this->_clippedPolyCount > 0)
 	{
 		glDisable(GL_CULL_FACE); // Polygons should already be culled before we get here.
+		glFrontFace(this->_polyFrontFace);
 		glEnable(GL_DEPTH_TEST);
+
+		// Per-polygon viewports are applied in the geometry vertex shader, so the GL viewport
+		// always covers the entire framebuffer.
+		glViewport(0, 0, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight);
 		glEnable(GL_STENCIL_TEST);
 
 		if (this->_enableAlphaBlending)
@@ -4371,20 +6981,59 @@ Render3DError OpenGLESRenderer_3_0::RenderGeometry()
 			glDisable(GL_BLEND);
 		}
 
-		glActiveTexture(GL_TEXTURE0);
+		this->_glState.ActiveTexture(GL_TEXTURE0);
+
+		this->EnableVertexAttributes();
+
+		size_t indexOffset = 0;
+
+		const CPoly &firstCPoly = this->_clippedPolyList[this->_clippedPolyDrawOrder[0]];
+		const POLY *rawPolyList = this->_rawPolyList;
+		const POLY &firstPoly = rawPolyList[firstCPoly.index];
+		POLYGON_ATTR lastPolyAttr = firstPoly.attribute;
+
+		if (this->_willUseEarlyZOpaquePolygons)
+		{
+			// Draw the opaque polygons in runs that switch between the early-Z programs and the
+			// regular programs. Every run starts on a new program, so its polygon and texture
+			// states need to be set up again.
+			const OGLGeometryFlags frameProgramFlags = this->_geometryProgramFlags;
+			size_t runFirstIndex = 0;
+
+			while (runFirstIndex < this->_clippedPolyOpaqueCount)
+			{
+				const bool isRunEarlyZ = this->_isPolyEarlyZSafe[runFirstIndex];
+				size_t runLastIndex = runFirstIndex;
+
+				while ( ((runLastIndex + 1) < this->_clippedPolyOpaqueCount) && (this->_isPolyEarlyZSafe[runLastIndex + 1] == isRunEarlyZ) )
+				{
+					runLastIndex++;
+				}
+
+				this->_geometryProgramFlags = frameProgramFlags;
+				if (isRunEarlyZ)
+				{
+					this->_geometryProgramFlags.EarlyZOpaque = 1;
+					this->_geometryProgramFlags.EnableAlphaTest = 0;
+					this->_renderStats.earlyZPolyCount += runLastIndex - runFirstIndex + 1;
+				}
 
-		this->EnableVertexAttributes();
+				this->_SetupGeometryShaders(this->_geometryProgramFlags);
 
-		size_t indexOffset = 0;
+				const CPoly &runFirstCPoly = this->_clippedPolyList[this->_clippedPolyDrawOrder[runFirstIndex]];
+				const POLY &runFirstPoly = rawPolyList[runFirstCPoly.index];
+				lastPolyAttr = runFirstPoly.attribute;
+				this->SetupPolygon(runFirstPoly, false, true);
+				this->DrawPolygonsForIndexRange<OGLPolyDrawMode_DrawOpaquePolys>(rawPolyList, this->_clippedPolyList, this->_clippedPolyCount, runFirstIndex, runLastIndex, indexOffset, lastPolyAttr);
 
-		const CPoly &firstCPoly = this->_clippedPolyList[0];
-		const POLY *rawPolyList = this->_rawPolyList;
-		const POLY &firstPoly = rawPolyList[firstCPoly.index];
-		POLYGON_ATTR lastPolyAttr = firstPoly.attribute;
+				runFirstIndex = runLastIndex + 1;
+			}
 
-		if (this->_clippedPolyOpaqueCount > 0)
+			this->_geometryProgramFlags = frameProgramFlags;
+		}
+		else if (this->_clippedPolyOpaqueCount > 0)
 		{
-			this->SetupPolygon(firstPoly, false, true, firstCPoly.isPolyBackFacing);
+			this->SetupPolygon(firstPoly, false, true);
 			this->DrawPolygonsForIndexRange<OGLPolyDrawMode_DrawOpaquePolys>(rawPolyList, this->_clippedPolyList, this->_clippedPolyCount, 0, this->_clippedPolyOpaqueCount - 1, indexOffset, lastPolyAttr);
 		}
 
@@ -4392,54 +7041,82 @@ Render3DError OpenGLESRenderer_3_0::RenderGeometry()
 		{
 			this->_geometryProgramFlags.OpaqueDrawMode = 0;
 
-			if (this->_needsZeroDstAlphaPass && this->_emulateSpecialZeroAlphaBlending)
+			const bool willUseZeroDstAlphaFetch = this->_needsZeroDstAlphaPass && this->_emulateSpecialZeroAlphaBlending &&
+				this->_isFramebufferFetchSupported && this->_enableAlphaBlending;
+
+			if (this->_needsZeroDstAlphaPass && this->_emulateSpecialZeroAlphaBlending && !willUseZeroDstAlphaFetch)
 			{
 				if (this->_clippedPolyOpaqueCount == 0)
 				{
-					this->SetupPolygon(firstPoly, true, false, firstCPoly.isPolyBackFacing);
+					this->SetupPolygon(firstPoly, true, false);
 				}
 
 				this->ZeroDstAlphaPass(rawPolyList, this->_clippedPolyList, this->_clippedPolyCount, this->_clippedPolyOpaqueCount, this->_enableAlphaBlending, indexOffset, lastPolyAttr);
 
 				if (this->_clippedPolyOpaqueCount > 0)
 				{
-					const CPoly &lastOpaqueCPoly = this->_clippedPolyList[this->_clippedPolyOpaqueCount - 1];
+					const CPoly &lastOpaqueCPoly = this->_clippedPolyList[this->_clippedPolyDrawOrder[this->_clippedPolyOpaqueCount - 1]];
 					const POLY &lastOpaquePoly = rawPolyList[lastOpaqueCPoly.index];
 					lastPolyAttr = lastOpaquePoly.attribute;
-					this->SetupPolygon(lastOpaquePoly, false, true, lastOpaqueCPoly.isPolyBackFacing);
+					this->SetupPolygon(lastOpaquePoly, false, true);
 				}
 			}
 			else
 			{
 				// If we're not doing the zero-dst-alpha pass, then we need to make sure to
 				// clear the stencil bit that we will use to mark transparent fragments.
-				glStencilMask(0x40);
+				this->_glState.StencilMask(0x40);
 				glClearStencil(0);
 				glClear(GL_STENCIL_BUFFER_BIT);
-				glStencilMask(0xFF);
+				this->_glState.StencilMask(0xFF);
+
+				if (willUseZeroDstAlphaFetch)
+				{
+					// The translucent geometry programs blend against the fetched destination
+					// color themselves, so fixed-function blending must be off while they draw.
+					this->_geometryProgramFlags.ZeroDstAlphaFetch = 1;
+					glDisable(GL_BLEND);
+				}
 
 				this->_SetupGeometryShaders(this->_geometryProgramFlags);
 			}
 
 			if (this->_clippedPolyOpaqueCount == 0)
 			{
-				this->SetupPolygon(firstPoly, true, true, firstCPoly.isPolyBackFacing);
+				this->SetupPolygon(firstPoly, true, true);
 			}
-			else
+			else if (this->_needsBackFacingResolve)
 			{
 				this->_ResolveWorkingBackFacing();
 			}
 
 			this->DrawPolygonsForIndexRange<OGLPolyDrawMode_DrawTranslucentPolys>(rawPolyList, this->_clippedPolyList, this->_clippedPolyCount, this->_clippedPolyOpaqueCount, this->_clippedPolyCount - 1, indexOffset, lastPolyAttr);
+
+			if (willUseZeroDstAlphaFetch)
+			{
+				this->_geometryProgramFlags.ZeroDstAlphaFetch = 0;
+				glEnable(GL_BLEND);
+			}
 		}
 
-		glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-		glDepthMask(GL_TRUE);
+		this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		this->_glState.DepthMask(GL_TRUE);
 		this->DisableVertexAttributes();
 	}
 
 	this->_ResolveGeometry();
 
+	// Once resolved, none of the multisampled attachments are read again. The working attachment
+	// only held the back-facing states of the opaque polygons, which are no longer needed either.
+	if (this->isMultisampledFBOSupported && (OGLRef.selectedRenderingFBO == OGLRef.fboMSIntermediateRenderID))
+	{
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, OGLRef.fboMSIntermediateRenderID);
+		this->_InvalidateAttachments(OGLAttachmentFlag_All, this->_renderStats.invalidatedAfterGeometry);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, OGLRef.fboRenderID);
+	}
+
+	this->_InvalidateAttachments(OGLAttachmentFlag_Working, this->_renderStats.invalidatedAfterGeometry);
+
 	this->_lastTextureDrawTarget = OGLTextureUnitID_GColor;
 
 	return OGLERROR_NOERR;
@@ -4447,6 +7124,11 @@ Render3DError OpenGLESRenderer_3_0::RenderGeometry()
 
 Render3DError OpenGLESRenderer_3_0::PostprocessFramebuffer()
 {
+	if (this->_isFrameMemoized)
+	{
+		return OGLERROR_NOERR;
+	}
+
 	OGLRenderRef &OGLRef = *this->ref;
 
 	if ( (this->_enableEdgeMark && this->_deviceInfo.isEdgeMarkSupported) ||
@@ -4472,10 +7154,63 @@ Render3DError OpenGLESRenderer_3_0::PostprocessFramebuffer()
 	}
 	else
 	{
+		this->_InvalidateAttachments(OGLAttachmentFlag_DepthStencil | OGLAttachmentFlag_PolyID | OGLAttachmentFlag_FogAttributes, this->_renderStats.invalidatedAfterPostprocess);
 		return OGLERROR_NOERR;
 	}
 
-	if (this->_enableEdgeMark && this->_deviceInfo.isEdgeMarkSupported)
+	bool willFuseEdgeMarkAndFog = this->_isEdgeMarkFogFusionSupported &&
+		(this->_enableEdgeMark && this->_deviceInfo.isEdgeMarkSupported) &&
+		(this->_enableFog && this->_deviceInfo.isFogSupported);
+
+	if (willFuseEdgeMarkAndFog)
+	{
+		std::map<u32, OGLFogShaderID>::iterator it = this->_edgeMarkFogProgramMap.find(this->_fogProgramKey.key);
+		if (it == this->_edgeMarkFogProgramMap.end())
+		{
+			Render3DError error = this->CreateEdgeMarkFogProgram(this->_fogProgramKey, EdgeMarkVtxShader_100, EdgeMarkFogFragShader_100);
+			if (error != OGLERROR_NOERR)
+			{
+				// Don't keep retrying a program that the driver won't build. The separate
+				// edge mark and fog passes produce the same image.
+				INFO("OpenGL: Falling back to separate EDGE MARK and FOG passes.\n");
+				this->_isEdgeMarkFogFusionSupported = false;
+				willFuseEdgeMarkAndFog = false;
+			}
+		}
+	}
+
+	if (willFuseEdgeMarkAndFog)
+	{
+		// Edge marking, the zero-alpha rule and fog are all done in one pass that
+		// reads each input once, instead of up to four fullscreen passes.
+		this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_LookupTable);
+		this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texFogDensityTableID);
+		this->_glState.ActiveTexture(GL_TEXTURE0);
+
+		OGLFogShaderID shaderID = this->_edgeMarkFogProgramMap[this->_fogProgramKey.key];
+
+		if (this->willFlipAndConvertFramebufferOnGPU) {
+			glDrawBuffer(GL_WORKING_ATTACHMENT_ID);
+		}
+		else {
+			glDrawBuffer(GL_COLOROUT_ATTACHMENT_ID);
+		}
+		this->_glState.UseProgram(shaderID.program);
+		glUniform1i(OGLRef.uniformStateEdgeMarkFogClearPolyID, this->_pendingRenderStates.clearPolyID);
+		glUniform1f(OGLRef.uniformStateEdgeMarkFogClearDepth, this->_pendingRenderStates.clearDepth);
+		glUniform4fv(OGLRef.uniformStateEdgeMarkFogEdgeColor, 8, (const GLfloat *)this->_pendingRenderStates.edgeColor);
+		glUniform1i(OGLRef.uniformStateEdgeMarkFogEnableZeroDstAlpha, (this->_needsZeroDstAlphaPass && this->_emulateSpecialZeroAlphaBlending) ? GL_TRUE : GL_FALSE);
+		glUniform1i(OGLRef.uniformStateEdgeMarkFogEnableFogAlphaOnly, this->_pendingRenderStates.enableFogAlphaOnly);
+		glUniform4fv(OGLRef.uniformStateEdgeMarkFogFogColor, 1, (const GLfloat *)&this->_pendingRenderStates.fogColor);
+
+		glDisable(GL_STENCIL_TEST);
+		glDisable(GL_BLEND);
+		this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+
+		this->_lastTextureDrawTarget = OGLTextureUnitID_FinalColor;
+	}
+	else if (this->_enableEdgeMark && this->_deviceInfo.isEdgeMarkSupported)
 	{
 		if (this->_needsZeroDstAlphaPass && this->_emulateSpecialZeroAlphaBlending)
 		{
@@ -4483,54 +7218,54 @@ Render3DError OpenGLESRenderer_3_0::PostprocessFramebuffer()
 			glDrawBuffer(GL_NONE);
 			glDisable(GL_BLEND);
 			glEnable(GL_STENCIL_TEST);
-			glStencilFunc(GL_ALWAYS, 0x40, 0x40);
-			glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-			glStencilMask(0x40);
+			this->_glState.StencilFunc(GL_ALWAYS, 0x40, 0x40);
+			this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+			this->_glState.StencilMask(0x40);
 
-			glUseProgram(OGLRef.programGeometryZeroDstAlphaID);
+			this->_glState.UseProgram(OGLRef.programGeometryZeroDstAlphaID);
 			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
 			// Pass 2: Unblended edge mark colors to zero-alpha pixels
-			glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_LookupTable);
-			glBindTexture(GL_TEXTURE_2D, OGLRef.texEdgeColorTableID);
-			glActiveTexture(GL_TEXTURE0);
+			this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_LookupTable);
+			this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texEdgeColorTableID);
+			this->_glState.ActiveTexture(GL_TEXTURE0);
 
 			glDrawBuffer(GL_COLOROUT_ATTACHMENT_ID);
-			glUseProgram(OGLRef.programEdgeMarkID);
+			this->_glState.UseProgram(OGLRef.programEdgeMarkID);
 			glUniform1i(OGLRef.uniformStateClearPolyID, this->_pendingRenderStates.clearPolyID);
 			glUniform1f(OGLRef.uniformStateClearDepth, this->_pendingRenderStates.clearDepth);
-			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_FALSE);
-			glStencilFunc(GL_NOTEQUAL, 0x40, 0x40);
+			this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_FALSE);
+			this->_glState.StencilFunc(GL_NOTEQUAL, 0x40, 0x40);
 			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
 			// Pass 3: Blended edge mark
 			glEnable(GL_BLEND);
 			glDisable(GL_STENCIL_TEST);
-			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 		}
 		else
 		{
-			glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_LookupTable);
-			glBindTexture(GL_TEXTURE_2D, OGLRef.texEdgeColorTableID);
-			glActiveTexture(GL_TEXTURE0);
+			this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_LookupTable);
+			this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texEdgeColorTableID);
+			this->_glState.ActiveTexture(GL_TEXTURE0);
 
-			glUseProgram(OGLRef.programEdgeMarkID);
+			this->_glState.UseProgram(OGLRef.programEdgeMarkID);
 			glUniform1i(OGLRef.uniformStateClearPolyID, this->_pendingRenderStates.clearPolyID);
 			glUniform1f(OGLRef.uniformStateClearDepth, this->_pendingRenderStates.clearDepth);
 			glDrawBuffer(GL_COLOROUT_ATTACHMENT_ID);
 			glEnable(GL_BLEND);
 			glDisable(GL_STENCIL_TEST);
-			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
 			glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 		}
 	}
 
-	if (this->_enableFog && this->_deviceInfo.isFogSupported)
+	if (!willFuseEdgeMarkAndFog && this->_enableFog && this->_deviceInfo.isFogSupported)
 	{
-		glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_LookupTable);
-		glBindTexture(GL_TEXTURE_2D, OGLRef.texFogDensityTableID);
-		glActiveTexture(GL_TEXTURE0);
+		this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_LookupTable);
+		this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texFogDensityTableID);
+		this->_glState.ActiveTexture(GL_TEXTURE0);
 
 		std::map<u32, OGLFogShaderID>::iterator it = this->_fogProgramMap.find(this->_fogProgramKey.key);
 		if (it == this->_fogProgramMap.end())
@@ -4550,7 +7285,7 @@ Render3DError OpenGLESRenderer_3_0::PostprocessFramebuffer()
 		else {
 			glDrawBuffer(GL_COLOROUT_ATTACHMENT_ID);
 		}
-		glUseProgram(shaderID.program);
+		this->_glState.UseProgram(shaderID.program);
 		glUniform1i(OGLRef.uniformStateEnableFogAlphaOnly, this->_pendingRenderStates.enableFogAlphaOnly);
 		glUniform4fv(OGLRef.uniformStateFogColor, 1, (const GLfloat *)&this->_pendingRenderStates.fogColor);
 
@@ -4571,6 +7306,9 @@ Render3DError OpenGLESRenderer_3_0::PostprocessFramebuffer()
 		glDisableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
 	}
 
+	// Only the final color is read from here on.
+	this->_InvalidateAttachments(OGLAttachmentFlag_DepthStencil | OGLAttachmentFlag_PolyID | OGLAttachmentFlag_FogAttributes, this->_renderStats.invalidatedAfterPostprocess);
+
 	return OGLERROR_NOERR;
 }
 
@@ -4579,7 +7317,66 @@ Render3DError OpenGLESRenderer_3_0::EndRender()
 	//needs to happen before endgl because it could free some textureids for expired cache items
 	texCache.Evict();
 
-	this->ReadBackPixels();
+	if ( (this->_framePipelineDepth > 1) && this->isPBOSupported )
+	{
+		if (!this->_isFrameMemoized && this->_enableFrameExport)
+		{
+			this->_ExportFrame();
+		}
+
+		if (!this->_isFrameMemoized)
+		{
+			this->_ReadBackPixelsPipelined();
+		}
+		else if (this->_pboInFlightCount > 0)
+		{
+			// A memoized frame is identical to the newest frame in flight, so queue up that
+			// frame's PBO again instead of reading back the FBO. The FBO can't be read back
+			// again anyways, since the GPU flip and convert has already moved the final color
+			// into the other attachment. Queueing still has to happen so that the frames in
+			// flight keep moving towards delivery.
+			if (this->_pboInFlightCount >= OGLRENDER_PBO_RING_SIZE)
+			{
+				// The queue is full, so retire the oldest frame, just like RenderFinish()
+				// would drop it for being older than the delivered frame.
+				for (size_t i = 1; i < this->_pboInFlightCount; i++)
+				{
+					this->_pboInFlight[i - 1] = this->_pboInFlight[i];
+				}
+
+				this->_pboInFlightCount--;
+			}
+
+			this->_pboInFlight[this->_pboInFlightCount] =this->_pboInFlight[this->_pboInFlightCount - 1];
+			this->_pboInFlightCount++;
+		}
+
+		this->_pixelReadNeedsStart = false;
+	}
+	else if (!this->_isFrameMemoized)
+	{
+		// A memoized frame is identical to the last one, whose pixels are still in the PBO, or
+		// are still in the FBO if the last readback was deferred.
+		this->_pboInFlightCount = 0;
+
+		if (this->_enableFrameExport)
+		{
+			this->_ExportFrame();
+		}
+
+		if (this->_pixelReadNeedsStart)
+		{
+			// The last frame was never requested, so its readback never happened.
+			this->_renderStats.frameReadBackSkipCount++;
+		}
+
+		// Leave the frame in the FBO. The readback starts in RenderFinish(), or when someone
+		// actually asks for the frame.
+		this->_pixelReadNeedsStart = true;
+		this->_renderStats.frameReadBackDeferCount++;
+	}
+
+	this->_wasLastFrameConsumed = false;
 
 	ENDGL();
 
@@ -4593,6 +7390,11 @@ Render3DError OpenGLESRenderer_3_0::EndRender()
 
 Render3DError OpenGLESRenderer_3_0::ClearUsingImage(const u16 *__restrict colorBuffer, const u32 *__restrict depthBuffer, const u8 *__restrict fogBuffer, const u8 opaquePolyID)
 {
+	if (this->_isFrameMemoized)
+	{
+		return OGLERROR_NOERR;
+	}
+
 	if (!this->isFBOSupported)
 	{
 		return OGLERROR_FEATURE_UNSUPPORTED;
@@ -4600,10 +7402,25 @@ Render3DError OpenGLESRenderer_3_0::ClearUsingImage(const u16 *__restrict colorB
 
 	OGLRenderRef &OGLRef = *this->ref;
 
-	this->UploadClearImage(colorBuffer, depthBuffer, fogBuffer, opaquePolyID);
+	// The uploaded clear image also depends on the opaque polygon ID and on whether the fog
+	// attributes are uploaded.
+	const u8 clearImageKeyExtra[2] = { opaquePolyID, (u8)((this->_enableFog && this->_deviceInfo.isFogSupported) ? 1 : 0) };
+	const u64 clearImageKey = HashFrameData(this->_clearImageKey, clearImageKeyExtra, sizeof(clearImageKeyExtra));
+
+	if (this->_isClearImageKeyValid && this->_isUploadedClearImageKeyValid && (clearImageKey == this->_uploadedClearImageKey))
+	{
+		this->_renderStats.clearImageUploadSkipCount++;
+	}
+	else
+	{
+		this->UploadClearImage(colorBuffer, depthBuffer, fogBuffer, opaquePolyID);
+		this->_isUploadedClearImageKeyValid = this->_isClearImageKeyValid;
+		this->_uploadedClearImageKey = clearImageKey;
+	}
 
 	glBindFramebuffer(GL_READ_FRAMEBUFFER, OGLRef.fboClearImageID);
 	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, OGLRef.fboRenderID);
+	this->_InvalidateAttachments(OGLAttachmentFlag_All, this->_renderStats.invalidatedBeforeClear);
 
 	// It might seem wasteful to be doing a separate glClear(GL_STENCIL_BUFFER_BIT) instead
 	// of simply blitting the stencil buffer with everything else.
@@ -4647,11 +7464,19 @@ Render3DError OpenGLESRenderer_3_0::ClearUsingImage(const u16 *__restrict colorB
 
 	if (this->isMultisampledFBOSupported)
 	{
-		OGLRef.selectedRenderingFBO = (this->_enableMultisampledRendering) ? OGLRef.fboMSIntermediateRenderID : OGLRef.fboRenderID;
-		if (OGLRef.selectedRenderingFBO == OGLRef.fboMSIntermediateRenderID)
+		OGLRef.selectedRenderingFBO = this->_SelectRenderingFBO(this->_needsZeroDstAlphaPass);
+		if (OGLRef.selectedRenderingFBO == OGLRef.fboMSRenderToTextureID)
+		{
+			// The render textures already hold the clear image, and they get loaded into the
+			// multisampled buffers on first use.
+			glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.selectedRenderingFBO);
+			glDrawBuffers(4, GeometryDrawBuffersEnum[this->_geometryProgramFlags.DrawBuffersMode]);
+		}
+		else if (OGLRef.selectedRenderingFBO == OGLRef.fboMSIntermediateRenderID)
 		{
 			glBindFramebuffer(GL_READ_FRAMEBUFFER, OGLRef.fboRenderID);
 			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, OGLRef.selectedRenderingFBO);
+			this->_InvalidateAttachments(OGLAttachmentFlag_All, this->_renderStats.invalidatedBeforeClear);
 
 			glClearStencil(opaquePolyID);
 			glClear(GL_STENCIL_BUFFER_BIT);
@@ -4694,12 +7519,27 @@ Render3DError OpenGLESRenderer_3_0::ClearUsingImage(const u16 *__restrict colorB
 
 Render3DError OpenGLESRenderer_3_0::ClearUsingValues(const Color4u8 &clearColor6665, const FragmentAttributes &clearAttributes)
 {
+	if (this->_isFrameMemoized)
+	{
+		return OGLERROR_NOERR;
+	}
+
 	OGLRenderRef &OGLRef = *this->ref;
 
 	if (this->isFBOSupported)
 	{
-		OGLRef.selectedRenderingFBO = (this->_enableMultisampledRendering) ? OGLRef.fboMSIntermediateRenderID : OGLRef.fboRenderID;
+		OGLRef.selectedRenderingFBO = this->_SelectRenderingFBO(clearColor6665.a == 0);
+
+		// Everything in the render FBO gets overwritten this frame, either by the clear or by the
+		// multisample resolve, so none of its old contents need to be loaded back in.
+		if (OGLRef.selectedRenderingFBO == OGLRef.fboMSIntermediateRenderID)
+		{
+			glBindFramebuffer(GL_DRAW_FRAMEBUFFER, OGLRef.fboRenderID);
+			this->_InvalidateAttachments(OGLAttachmentFlag_All, this->_renderStats.invalidatedBeforeClear);
+		}
+
 		glBindFramebuffer(GL_FRAMEBUFFER, OGLRef.selectedRenderingFBO);
+		this->_InvalidateAttachments(OGLAttachmentFlag_All, this->_renderStats.invalidatedBeforeClear);
 	}
 
 	if (this->isFBOSupported)
@@ -4756,10 +7596,10 @@ void OpenGLESRenderer_3_0::SetPolygonIndex(const size_t index)
 	this->_currentPolyIndex = index;
 }
 
-Render3DError OpenGLESRenderer_3_0::SetupPolygon(const POLY &thePoly, bool treatAsTranslucent, bool willChangeStencilBuffer, bool isBackFacing)
+Render3DError OpenGLESRenderer_3_0::SetupPolygon(const POLY &thePoly, bool treatAsTranslucent, bool willChangeStencilBuffer)
 {
 	// Set up depth test mode
-	glDepthFunc((thePoly.attribute.DepthEqualTest_Enable) ? GL_EQUAL : GL_LESS);
+	this->_glState.DepthFunc((thePoly.attribute.DepthEqualTest_Enable) ? GL_EQUAL : GL_LESS);
 
 	if (willChangeStencilBuffer)
 	{
@@ -4776,21 +7616,21 @@ Render3DError OpenGLESRenderer_3_0::SetupPolygon(const POLY &thePoly, bool treat
 				{
 					// 1st pass: Use stencil buffer bit 7 (0x80) for the shadow volume mask.
 					// Write only on depth-fail.
-					glStencilFunc(GL_ALWAYS, 0x80, 0x80);
-					glStencilOp(GL_KEEP, GL_REPLACE, GL_KEEP);
-					glStencilMask(0x80);
+					this->_glState.StencilFunc(GL_ALWAYS, 0x80, 0x80);
+					this->_glState.StencilOp(GL_KEEP, GL_REPLACE, GL_KEEP);
+					this->_glState.StencilMask(0x80);
 				}
 				else
 				{
 					// 2nd pass: Compare stencil buffer bits 0-5 (0x3F) with this polygon's ID. If this stencil
 					// test fails, remove the fragment from the shadow volume mask by clearing bit 7.
-					glStencilFunc(GL_NOTEQUAL, thePoly.attribute.PolygonID, 0x3F);
-					glStencilOp(GL_ZERO, GL_KEEP, GL_KEEP);
-					glStencilMask(0x80);
+					this->_glState.StencilFunc(GL_NOTEQUAL, thePoly.attribute.PolygonID, 0x3F);
+					this->_glState.StencilOp(GL_ZERO, GL_KEEP, GL_KEEP);
+					this->_glState.StencilMask(0x80);
 				}
 
-				glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-				glDepthMask(GL_FALSE);
+				this->_glState.ColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+				this->_glState.DepthMask(GL_FALSE);
 			}
 		}
 		else
@@ -4809,18 +7649,18 @@ Render3DError OpenGLESRenderer_3_0::SetupPolygon(const POLY &thePoly, bool treat
 			// and depth tests, it writes out its polygon ID with a translucent fragment flag of 1.
 			if (treatAsTranslucent)
 			{
-				glStencilFunc(GL_NOTEQUAL, 0x40 | thePoly.attribute.PolygonID, 0x7F);
+				this->_glState.StencilFunc(GL_NOTEQUAL, 0x40 | thePoly.attribute.PolygonID, 0x7F);
 			}
 			else
 			{
-				glStencilFunc(GL_ALWAYS, thePoly.attribute.PolygonID, 0x3F);
+				this->_glState.StencilFunc(GL_ALWAYS, thePoly.attribute.PolygonID, 0x3F);
 			}
 
-			glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-			glStencilMask(0xFF); // Drawing non-shadow polygons will implicitly reset the shadow volume mask.
+			this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+			this->_glState.StencilMask(0xFF); // Drawing non-shadow polygons will implicitly reset the shadow volume mask.
 
-			glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-			glDepthMask((!treatAsTranslucent || thePoly.attribute.TranslucentDepthWrite_Enable) ? GL_TRUE : GL_FALSE);
+			this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+			this->_glState.DepthMask((!treatAsTranslucent || thePoly.attribute.TranslucentDepthWrite_Enable) ? GL_TRUE : GL_FALSE);
 		}
 	}
 
@@ -4834,25 +7674,11 @@ Render3DError OpenGLESRenderer_3_0::SetupPolygon(const POLY &thePoly, bool treat
 		glUniform1i(OGLRef.uniformPolyIsWireframe[this->_geometryProgramFlags.value], (GFX3D_IsPolyWireframe(thePoly)) ? GL_TRUE : GL_FALSE);
 		glUniform1i(OGLRef.uniformPolySetNewDepthForTranslucent[this->_geometryProgramFlags.value], (thePoly.attribute.TranslucentDepthWrite_Enable) ? GL_TRUE : GL_FALSE);
 		glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], 0.0f);
-		glUniform1i(OGLRef.uniformPolyIsBackFacing[this->_geometryProgramFlags.value], (isBackFacing) ? GL_TRUE : GL_FALSE);
 	}
 
 	return OGLERROR_NOERR;
 }
 
-Render3DError OpenGLESRenderer_3_0::SetupViewport(const GFX3D_Viewport viewport)
-{
-	const GLfloat wScalar = this->_framebufferWidth  / (GLfloat)GPU_FRAMEBUFFER_NATIVE_WIDTH;
-	const GLfloat hScalar = this->_framebufferHeight / (GLfloat)GPU_FRAMEBUFFER_NATIVE_HEIGHT;
-
-	glViewport(viewport.x * wScalar,
-	           viewport.y * hScalar,
-	           viewport.width * wScalar,
-	           viewport.height * hScalar);
-
-	return OGLERROR_NOERR;
-}
-
 Render3DError OpenGLESRenderer_3_0::DrawShadowPolygon(const GLenum polyPrimitive, const GLsizei vertIndexCount, const GLushort *indexBufferPtr, const bool performDepthEqualTest, const bool enableAlphaDepthWrite, const bool isTranslucent, const u8 opaquePolyID)
 {
 	OGLRenderRef &OGLRef = *this->ref;
@@ -4891,6 +7717,9 @@ Render3DError OpenGLESRenderer_3_0::DrawShadowPolygon(const GLenum polyPrimitive
 	// mask and draw the shadow polygon fragments only within the mask. Color writes are always
 	// enabled and depth writes are enabled if the shadow polygon is opaque or if transparent
 	// polygon depth writes are enabled.
+	//
+	// Consecutive shadow polygons with the same attributes, and therefore the same polygon ID,
+	// arrive here as a single run of indices, so each pass is drawn once for the whole run.
 
 	// 1st pass: Create the shadow volume.
 	if (opaquePolyID == 0)
@@ -4899,18 +7728,18 @@ Render3DError OpenGLESRenderer_3_0::DrawShadowPolygon(const GLenum polyPrimitive
 		{
 			// Use the stencil buffer to determine which fragments fail the depth test using the lower-side tolerance.
 			glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], (float)DEPTH_EQUALS_TEST_TOLERANCE / 16777215.0f);
-			glDepthFunc(GL_LEQUAL);
-			glStencilFunc(GL_ALWAYS, 0x80, 0x80);
-			glStencilOp(GL_KEEP, GL_REPLACE, GL_KEEP);
-			glStencilMask(0x80);
+			this->_glState.DepthFunc(GL_LEQUAL);
+			this->_glState.StencilFunc(GL_ALWAYS, 0x80, 0x80);
+			this->_glState.StencilOp(GL_KEEP, GL_REPLACE, GL_KEEP);
+			this->_glState.StencilMask(0x80);
 			glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
 
 			// Use the stencil buffer to determine which fragments fail the depth test using the higher-side tolerance.
 			glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], (float)-DEPTH_EQUALS_TEST_TOLERANCE / 16777215.0f);
-			glDepthFunc(GL_GEQUAL);
-			glStencilFunc(GL_NOTEQUAL, 0x80, 0x80);
-			glStencilOp(GL_KEEP, GL_REPLACE, GL_KEEP);
-			glStencilMask(0x80);
+			this->_glState.DepthFunc(GL_GEQUAL);
+			this->_glState.StencilFunc(GL_NOTEQUAL, 0x80, 0x80);
+			this->_glState.StencilOp(GL_KEEP, GL_REPLACE, GL_KEEP);
+			this->_glState.StencilMask(0x80);
 			glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
 
 			glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], 0.0f);
@@ -4928,26 +7757,26 @@ Render3DError OpenGLESRenderer_3_0::DrawShadowPolygon(const GLenum polyPrimitive
 	{
 		// Use the stencil buffer to determine which fragments pass the lower-side tolerance.
 		glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], (float)DEPTH_EQUALS_TEST_TOLERANCE / 16777215.0f);
-		glDepthFunc(GL_LEQUAL);
-		glStencilFunc(GL_EQUAL, 0x80, 0x80);
-		glStencilOp(GL_ZERO, GL_ZERO, GL_KEEP);
-		glStencilMask(0x80);
+		this->_glState.DepthFunc(GL_LEQUAL);
+		this->_glState.StencilFunc(GL_EQUAL, 0x80, 0x80);
+		this->_glState.StencilOp(GL_ZERO, GL_ZERO, GL_KEEP);
+		this->_glState.StencilMask(0x80);
 		glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
 
 		// Use the stencil buffer to determine which fragments pass the higher-side tolerance.
 		glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], (float)-DEPTH_EQUALS_TEST_TOLERANCE / 16777215.0f);
-		glDepthFunc(GL_GEQUAL);
-		glStencilFunc(GL_EQUAL, 0x80, 0x80);
-		glStencilOp(GL_ZERO, GL_ZERO, GL_KEEP);
-		glStencilMask(0x80);
+		this->_glState.DepthFunc(GL_GEQUAL);
+		this->_glState.StencilFunc(GL_EQUAL, 0x80, 0x80);
+		this->_glState.StencilOp(GL_ZERO, GL_ZERO, GL_KEEP);
+		this->_glState.StencilMask(0x80);
 		glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
 
 		// Finally, do the polygon ID check.
 		glUniform1f(OGLRef.uniformPolyDepthOffset[this->_geometryProgramFlags.value], 0.0f);
-		glDepthFunc(GL_ALWAYS);
-		glStencilFunc(GL_NOTEQUAL, opaquePolyID, 0x3F);
-		glStencilOp(GL_ZERO, GL_ZERO, GL_KEEP);
-		glStencilMask(0x80);
+		this->_glState.DepthFunc(GL_ALWAYS);
+		this->_glState.StencilFunc(GL_NOTEQUAL, opaquePolyID, 0x3F);
+		this->_glState.StencilOp(GL_ZERO, GL_ZERO, GL_KEEP);
+		this->_glState.StencilMask(0x80);
 		glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
 	}
 	else
@@ -4959,27 +7788,27 @@ Render3DError OpenGLESRenderer_3_0::DrawShadowPolygon(const GLenum polyPrimitive
 	// also ensure that we're not drawing over translucent fragments with the same polygon IDs.
 	if (isTranslucent)
 	{
-		glStencilFunc(GL_NOTEQUAL, 0xC0 | opaquePolyID, 0x7F);
-		glStencilOp(GL_ZERO, GL_KEEP, GL_KEEP);
-		glStencilMask(0x80);
+		this->_glState.StencilFunc(GL_NOTEQUAL, 0xC0 | opaquePolyID, 0x7F);
+		this->_glState.StencilOp(GL_ZERO, GL_KEEP, GL_KEEP);
+		this->_glState.StencilMask(0x80);
 		glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
 	}
 
 	// 4th pass: Update the polygon IDs in the stencil buffer.
-	glStencilFunc(GL_EQUAL, (isTranslucent) ? 0xC0 | opaquePolyID : 0x80 | opaquePolyID, 0x80);
-	glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-	glStencilMask(0x7F);
+	this->_glState.StencilFunc(GL_EQUAL, (isTranslucent) ? 0xC0 | opaquePolyID : 0x80 | opaquePolyID, 0x80);
+	this->_glState.StencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+	this->_glState.StencilMask(0x7F);
 	glDrawElements(polyPrimitive, vertIndexCount, GL_UNSIGNED_SHORT, indexBufferPtr);
 
 	// 5th pass: Draw the shadow polygon.
-	glStencilFunc(GL_EQUAL, 0x80, 0x80);
+	this->_glState.StencilFunc(GL_EQUAL, 0x80, 0x80);
 	// Technically, a depth-fail result should also clear the shadow volume mask, but
 	// Mario Kart DS draws shadow polygons better when it doesn't clear bits on depth-fail.
 	// I have no idea why this works. - rogerman 2016/12/21
-	glStencilOp(GL_ZERO, GL_KEEP, GL_ZERO);
-	glStencilMask(0x80);
-	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-	glDepthMask((!isTranslucent || enableAlphaDepthWrite) ? GL_TRUE : GL_FALSE);
+	this->_glState.StencilOp(GL_ZERO, GL_KEEP, GL_ZERO);
+	this->_glState.StencilMask(0x80);
+	this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	this->_glState.DepthMask((!isTranslucent || enableAlphaDepthWrite) ? GL_TRUE : GL_FALSE);
 
 	{
 		glUniform1i(OGLRef.uniformPolyDrawShadow[this->_geometryProgramFlags.value], GL_TRUE);
@@ -4988,11 +7817,11 @@ Render3DError OpenGLESRenderer_3_0::DrawShadowPolygon(const GLenum polyPrimitive
 	}
 
 	// Reset the OpenGL states back to their original shadow polygon states.
-	glStencilFunc(GL_NOTEQUAL, opaquePolyID, 0x3F);
-	glStencilOp(GL_ZERO, GL_KEEP, GL_KEEP);
-	glStencilMask(0x80);
-	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-	glDepthMask(GL_FALSE);
+	this->_glState.StencilFunc(GL_NOTEQUAL, opaquePolyID, 0x3F);
+	this->_glState.StencilOp(GL_ZERO, GL_KEEP, GL_KEEP);
+	this->_glState.StencilMask(0x80);
+	this->_glState.ColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	this->_glState.DepthMask(GL_FALSE);
 
 	return OGLERROR_NOERR;
 }
@@ -5011,6 +7840,10 @@ Render3DError OpenGLESRenderer_3_0::Reset()
 	ENDGL();
 
 	this->_pixelReadNeedsFinish = false;
+	this->_pixelReadNeedsStart = false;
+	this->_isLastFrameHashValid = false;
+	this->_isFrameMemoized = false;
+	this->_InvalidateDirtyLines();
 
 	if (OGLRef.position4fBuffer != NULL)
 	{
@@ -5045,6 +7878,8 @@ Render3DError OpenGLESRenderer_3_0::RenderPowerOff()
 		return OGLERROR_NOERR;
 	}
 
+	this->_isLastFrameHashValid = false;
+
 	this->_isPoweredOn = false;
 	memset(GPU->GetEngineMain()->Get3DFramebufferMain(), 0, this->_framebufferColorSizeBytes);
 	memset(GPU->GetEngineMain()->Get3DFramebuffer16(), 0, this->_framebufferPixCount * sizeof(u16));
@@ -5066,18 +7901,19 @@ Render3DError OpenGLESRenderer_3_0::RenderPowerOff()
 
 	if (this->isPBOSupported)
 	{
-		if (this->_mappedFramebuffer != NULL)
-		{
-			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
-			this->_mappedFramebuffer = NULL;
-		}
+		// The cleared framebuffer replaces anything still in flight.
+		this->_pboInFlightCount = 0;
+		this->_PreparePixelPackBuffer();
 
 		glReadPixels(0, 0, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight, this->readFormat, this->readType, 0);
 	}
 
 	ENDGL();
 
+	this->_framebufferReadMode = OGLFramebufferReadMode_Color;
+	this->_pixelReadNeedsStart = false;
 	this->_pixelReadNeedsFinish = true;
+	this->_InvalidateDirtyLines();
 	return OGLERROR_NOERR;
 }
 
@@ -5085,11 +7921,24 @@ Render3DError OpenGLESRenderer_3_0::RenderFinish()
 {
     OGLRenderRef &OGLRef = *this->ref;
 
-	if (!this->_renderNeedsFinish)
+	// A deferred readback may still be pending after the core already finished the frame, if
+	// the host requests the frame afterwards.
+	if (!this->_renderNeedsFinish && !this->_pixelReadNeedsStart)
 	{
 		return OGLERROR_NOERR;
 	}
 
+	// Frames that the host hinted it won't consume are only read back if they get requested
+	// anyways, which sets _wasLastFrameConsumed before calling here.
+	if ( this->_pixelReadNeedsStart && (this->_willFrameBeConsumed || this->_wasLastFrameConsumed) )
+	{
+		const Render3DError error = this->_StartDeferredReadBack();
+		if (error != OGLERROR_NOERR)
+		{
+			return error;
+		}
+	}
+
 	if (this->_pixelReadNeedsFinish)
 	{
 		this->_pixelReadNeedsFinish = false;
@@ -5099,15 +7948,7 @@ Render3DError OpenGLESRenderer_3_0::RenderFinish()
 			return OGLERROR_BEGINGL_FAILED;
 		}
 
-		if (this->isPBOSupported)
-		{
-			this->_mappedFramebuffer = (Color4u8 *__restrict)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, this->_framebufferColorSizeBytes, GL_MAP_READ_BIT);
-			//memset(this->_mappedFramebuffer, 255, this->_framebufferColorSizeBytes);
-		}
-		else
-		{
-			glReadPixels(0, 0, (GLsizei)this->_framebufferWidth, (GLsizei)this->_framebufferHeight, this->readFormat, this->readType, this->_framebufferColor);
-		}
+		this->_FinishReadBackPixels();
 
 		ENDGL();
 	}
@@ -5128,6 +7969,66 @@ Render3DError OpenGLESRenderer_3_0::RenderFlush(bool willFlushBuffer32, bool wil
 	Color4u8 *framebufferMain = (willFlushBuffer32) ? GPU->GetEngineMain()->Get3DFramebufferMain() : NULL;
 	u16 *framebuffer16 = (willFlushBuffer16) ? GPU->GetEngineMain()->Get3DFramebuffer16() : NULL;
 
+	this->_lastFlushRequestMain = willFlushBuffer32;
+	this->_lastFlushRequest16 = willFlushBuffer16;
+	this->_wasLastFrameConsumed = true;
+
+	if (this->_pixelReadNeedsStart)
+	{
+		this->RenderFinish();
+	}
+
+	if (this->_framebufferReadMode == OGLFramebufferReadMode_16Only)
+	{
+		if (!willFlushBuffer32)
+		{
+			// The readback is already in the 16-bit framebuffer format.
+			if ( (framebuffer16 != NULL) && (this->_mappedFramebuffer != NULL) )
+			{
+				memcpy(framebuffer16, this->_mappedFramebuffer, this->_framebufferPixCount * sizeof(u16));
+				this->_pendingFlushLines16.lineEnd = 0;
+				this->_renderNeedsFlush16 = false;
+			}
+
+			return RENDER3DERROR_NOERR;
+		}
+
+		this->_ReadBackFullFramebufferNow();
+	}
+	else if (this->_framebufferReadMode == OGLFramebufferReadMode_Color)
+	{
+		// A partial readback only covers the lines needed by the output framebuffers that were
+		// expected to be flushed. If an output framebuffer needs more lines than that, then
+		// read back the lines that it needs now.
+		if ( ((framebufferMain != NULL) && !OGLLineRangeContains(this->_readBackLines, this->_pendingFlushLinesMain)) ||
+		     ((framebuffer16   != NULL) && !OGLLineRangeContains(this->_readBackLines, this->_pendingFlushLines16)) )
+		{
+			this->_ReadBackFullFramebufferNow();
+		}
+	}
+
+	if (this->_framebufferReadMode == OGLFramebufferReadMode_Dual)
+	{
+		// Both framebuffers were already converted on the GPU. The color framebuffer is used
+		// in place through GetFramebuffer(), while the RGBA5551 framebuffer follows it in
+		// the PBO.
+		if (this->_mappedFramebuffer != NULL)
+		{
+			this->_pendingFlushLinesMain.lineFirst = 0;
+			this->_pendingFlushLinesMain.lineEnd = this->_framebufferHeight;
+			this->_renderNeedsFlushMain = false;
+
+			if (framebuffer16 != NULL)
+			{
+				memcpy(framebuffer16, (u8 *)this->_mappedFramebuffer + this->_framebufferColorSizeBytes, this->_framebufferPixCount * sizeof(u16));
+				this->_pendingFlushLines16.lineEnd = 0;
+				this->_renderNeedsFlush16 = false;
+			}
+		}
+
+		return RENDER3DERROR_NOERR;
+	}
+
 	if (this->isPBOSupported)
 	{
 		this->FlushFramebuffer(this->_mappedFramebuffer, framebufferMain, framebuffer16);
@@ -5142,6 +8043,7 @@ Render3DError OpenGLESRenderer_3_0::RenderFlush(bool willFlushBuffer32, bool wil
 
 Render3DError OpenGLESRenderer_3_0::SetFramebufferSize(size_t w, size_t h)
 {
+	OGLRenderRef &OGLRef = *this->ref;
 	Render3DError error = OGLERROR_NOERR;
 
 	if (w < GPU_FRAMEBUFFER_NATIVE_WIDTH || h < GPU_FRAMEBUFFER_NATIVE_HEIGHT)
@@ -5157,58 +8059,93 @@ Render3DError OpenGLESRenderer_3_0::SetFramebufferSize(size_t w, size_t h)
 
 	glFinish();
 
+	this->_isLastFrameHashValid = false;
+	this->_pixelReadNeedsStart = false;
+
 	const size_t newFramebufferColorSizeBytes = w * h * sizeof(Color4u8);
+	const bool wasFramebufferMapped = this->isPBOSupported && (this->_mappedFramebuffer != NULL);
 
 	if (this->isPBOSupported)
 	{
-		if (this->_mappedFramebuffer != NULL)
+		// Resizing invalidates every PBO, including any that the host is still borrowing.
+		for (size_t i = 0; i < OGLRENDER_PBO_RING_SIZE; i++)
 		{
-			glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
-			glFinish();
-		}
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, OGLRef.pboRenderDataID[i]);
 
-		glBufferData(GL_PIXEL_PACK_BUFFER, newFramebufferColorSizeBytes, NULL, GL_STREAM_READ);
+			if ( ((i == this->_pboRingIndex) && (this->_mappedFramebuffer != NULL)) || (this->_pboRetiredMapping[i] != NULL) )
+			{
+				glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+				glFinish();
+			}
 
-		if (this->_mappedFramebuffer != NULL)
-		{
-			this->_mappedFramebuffer = (Color4u8 *__restrict)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, newFramebufferColorSizeBytes, GL_MAP_READ_BIT);
-			glFinish();
+			glBufferData(GL_PIXEL_PACK_BUFFER, newFramebufferColorSizeBytes + (w * h * sizeof(u16)), NULL, GL_STREAM_READ);
+			this->_isPBOBorrowed[i] = false;
+			this->_pboRetiredMapping[i] = NULL;
 		}
+
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, OGLRef.pboRenderDataID[this->_pboRingIndex]);
+		this->_pboInFlightCount = 0;
+		this->_mappedFramebuffer = NULL;
 	}
 
 	if (this->isFBOSupported)
 	{
-		glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_FinalColor);
+		this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_FinalColor);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_MY_FORMAT, (GLsizei)w, (GLsizei)h, 0, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
 	}
 
 	if (this->isFBOSupported)
 	{
-		glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_DepthStencil);
+		this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_DepthStencil);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, (GLsizei)w, (GLsizei)h, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
 
-		glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_GColor);
+		this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_GColor);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_MY_FORMAT, (GLsizei)w, (GLsizei)h, 0, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
 
-		glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_GPolyID);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_MY_FORMAT, (GLsizei)w, (GLsizei)h, 0, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+		// Drop the polygon ID and fog attribute attachments. They get reallocated at the new
+		// size on the next frame that uses them.
+		this->_UpdateFeatureAttachments(false, false);
 
-		glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_FogAttr);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_MY_FORMAT, (GLsizei)w, (GLsizei)h, 0, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, NULL);
+		this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_DepthCopy);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH24_STENCIL8, (GLsizei)w, (GLsizei)h, 0, GL_DEPTH_STENCIL, GL_UNSIGNED_INT_24_8, NULL);
+		this->_isDepthCopyDirty = true;
+
+		this->_glState.ActiveTexture(GL_TEXTURE0);
+		this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texFinal16ID);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_R16UI, (GLsizei)w, (GLsizei)h, 0, GL_RED_INTEGER, GL_UNSIGNED_SHORT, NULL);
+		this->_glState.BindTexture(GL_TEXTURE_2D, 0);
 	}
 
-	glActiveTexture(GL_TEXTURE0);
+	this->_glState.ActiveTexture(GL_TEXTURE0);
 
 	this->_framebufferWidth = w;
 	this->_framebufferHeight = h;
 	this->_framebufferPixCount = w * h;
 	this->_framebufferColorSizeBytes = newFramebufferColorSizeBytes;
+	this->_InvalidateDirtyLines();
+
+	// Remap the current PBO only now that the new sizes are set, so that the mapping covers
+	// everything the current read mode reads from it, including the RGBA5551 framebuffer.
+	if (wasFramebufferMapped)
+	{
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, OGLRef.pboRenderDataID[this->_pboRingIndex]);
+		this->_mappedFramebuffer = (Color4u8 *__restrict)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, this->_GetReadBackSizeBytes(), GL_MAP_READ_BIT);
+		glFinish();
+	}
 
 	// Call ResizeMultisampledFBOs() after _framebufferWidth and _framebufferHeight are set
 	// since this method depends on them.
 	GLsizei sampleSize = this->GetLimitedMultisampleSize();
 	this->ResizeMultisampledFBOs(sampleSize);
 
+	// The export textures have immutable storage, so recreate them at the new size. This also
+	// invalidates any exported frames that consumers are still holding on to.
+	if (this->_enableFrameExport)
+	{
+		this->DestroyFrameExportResources();
+		this->_enableFrameExport = (this->CreateFrameExportResources() == OGLERROR_NOERR);
+	}
+
 	if (this->isPBOSupported)
 	{
 		this->_framebufferColor = NULL;
@@ -5223,10 +8160,13 @@ Render3DError OpenGLESRenderer_3_0::SetFramebufferSize(size_t w, size_t h)
 
 	{
 		// Recreate shaders that use the framebuffer size.
-		glUseProgram(0);
+		this->_glState.UseProgram(0);
 		this->DestroyEdgeMarkProgram();
+		this->DestroyEdgeMarkFogPrograms();
 		this->DestroyFramebufferOutput6665Programs();
 		this->DestroyFramebufferOutput8888Programs();
+		this->DestroyFramebufferOutput5551Programs();
+		this->DestroyFramebufferOutputDualPrograms();
 		this->DestroyGeometryPrograms();
 
 		this->CreateGeometryPrograms();
@@ -5240,6 +8180,19 @@ Render3DError OpenGLESRenderer_3_0::SetFramebufferSize(size_t w, size_t h)
 		this->CreateFramebufferOutput6665Program(1, FramebufferOutputVtxShader_100, FramebufferOutputRGBA6665FragShader_100);
 		this->CreateFramebufferOutput8888Program(0, FramebufferOutputVtxShader_100, FramebufferOutputRGBA8888FragShader_100);
 		this->CreateFramebufferOutput8888Program(1, FramebufferOutputVtxShader_100, FramebufferOutputRGBA8888FragShader_100);
+
+		if (this->_isFramebufferOutput5551Supported)
+		{
+			if ( (this->CreateFramebufferOutput5551Program(0, FramebufferOutputVtxShader_100, FramebufferOutputRGBA5551FragShader_100) != OGLERROR_NOERR) ||
+				 (this->CreateFramebufferOutput5551Program(1, FramebufferOutputVtxShader_100, FramebufferOutputRGBA5551FragShader_100) != OGLERROR_NOERR) ||
+				 (this->CreateFramebufferOutputDualProgram(0, NDSColorFormat_BGR666_Rev, FramebufferOutputVtxShader_100, FramebufferOutputDualFragShader_100) != OGLERROR_NOERR) ||
+				 (this->CreateFramebufferOutputDualProgram(1, NDSColorFormat_BGR666_Rev, FramebufferOutputVtxShader_100, FramebufferOutputDualFragShader_100) != OGLERROR_NOERR) ||
+				 (this->CreateFramebufferOutputDualProgram(0, NDSColorFormat_BGR888_Rev, FramebufferOutputVtxShader_100, FramebufferOutputDualFragShader_100) != OGLERROR_NOERR) ||
+				 (this->CreateFramebufferOutputDualProgram(1, NDSColorFormat_BGR888_Rev, FramebufferOutputVtxShader_100, FramebufferOutputDualFragShader_100) != OGLERROR_NOERR) )
+			{
+				this->_isFramebufferOutput5551Supported = false;
+			}
+		}
 	}
 
 	if (oglrender_framebufferDidResizeCallback != NULL)
@@ -5265,8 +8218,8 @@ Render3DError OpenGLESRenderer_3_0::InitFinalRenderStates(const std::set<std::st
 	// test: new super mario brothers renders the stormclouds at the beginning
 
 	// Blending Support
-	glBlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA, GL_DST_ALPHA);
-	glBlendEquationSeparate(GL_FUNC_ADD, GL_MAX);
+	this->_glState.BlendFuncSeparate(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA, GL_SRC_ALPHA, GL_DST_ALPHA);
+	this->_glState.BlendEquationSeparate(GL_FUNC_ADD, GL_MAX);
 
 	// Mirrored Repeat Mode Support
 	OGLRef.stateTexMirroredRepeat = GL_MIRRORED_REPEAT;
@@ -5292,9 +8245,14 @@ Render3DError OpenGLESRenderer_3_0::EnableVertexAttributes()
 		glEnableVertexAttribArray(OGLVertexAttributeID_Position);
 		glEnableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
 		glEnableVertexAttribArray(OGLVertexAttributeID_Color);
+		glEnableVertexAttribArray(OGLVertexAttributeID_Viewport);
+		glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboGeometryVtxID);
 		glVertexAttribPointer(OGLVertexAttributeID_Position, 4, GL_INT, GL_FALSE, sizeof(NDSVertex), (const GLvoid *)offsetof(NDSVertex, position));
 		glVertexAttribPointer(OGLVertexAttributeID_TexCoord0, 2, GL_INT, GL_FALSE, sizeof(NDSVertex), (const GLvoid *)offsetof(NDSVertex, texCoord));
 		glVertexAttribPointer(OGLVertexAttributeID_Color, 4, GL_UNSIGNED_BYTE, GL_FALSE, sizeof(NDSVertex), (const GLvoid *)offsetof(NDSVertex, color));
+		glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboGeometryViewportID);
+		glVertexAttribPointer(OGLVertexAttributeID_Viewport, 4, GL_SHORT, GL_FALSE, 0, 0);
+		glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboGeometryVtxID);
 	}
 
 	return OGLERROR_NOERR;
@@ -5311,6 +8269,7 @@ Render3DError OpenGLESRenderer_3_0::DisableVertexAttributes()
 		glDisableVertexAttribArray(OGLVertexAttributeID_Position);
 		glDisableVertexAttribArray(OGLVertexAttributeID_TexCoord0);
 		glDisableVertexAttribArray(OGLVertexAttributeID_Color);
+		glDisableVertexAttribArray(OGLVertexAttributeID_Viewport);
 	}
 
 	return OGLERROR_NOERR;
@@ -5334,30 +8293,153 @@ Render3DError OpenGLESRenderer_3_0::BeginRender(const GFX3D_State &renderState,
 
 	this->_enableAlphaBlending = (renderState.DISP3DCNT.EnableAlphaBlending) ? true : false;
 
+	this->_renderStats.frameCount++;
+	this->_glState.ResetCounters();
+	this->_renderStats.invalidatedBeforeClear = 0;
+	this->_renderStats.invalidatedAfterGeometry = 0;
+	this->_renderStats.invalidatedAfterPostprocess = 0;
+	this->_isFrameMemoized = false;
+
+	// Menus, pause screens and other static scenes tend to resubmit the exact same frame over and
+	// over again. If nothing about this frame differs from the last rendered frame, then skip all
+	// of the GPU work and let the last read back framebuffer be used again.
+	const u64 backgroundHash = (this->_enableFrameMemoization || this->_enablePartialReadBack) ? this->_ComputeBackgroundHash(renderState) : 0;
+	const u64 frameHash = (this->_enableFrameMemoization) ? this->_ComputeFrameHash(backgroundHash, renderGList) : 0;
+
+	if (this->_enableFrameMemoization && this->_isLastFrameHashValid && (frameHash == this->_lastFrameHash))
+	{
+		// Texture data isn't part of the hash, so check if any of the textures changed.
+		const size_t lastTextureLoadCount = this->_textureLoadCount;
+
+		for (size_t i = 0; i < this->_clippedPolyCount; i++)
+		{
+			const POLY &rawPoly = this->_rawPolyList[this->_clippedPolyList[i].index];
+			this->GetLoadedTextureFromPolygon(rawPoly, this->_enableTextureSampling);
+		}
+
+		if (this->_textureLoadCount == lastTextureLoadCount)
+		{
+			this->_isFrameMemoized = true;
+			this->_renderStats.frameMemoHitCount++;
+			return OGLERROR_NOERR;
+		}
+	}
+
+	this->_UpdateDirtyLines(backgroundHash, renderGList.rawVtxList);
+
+	// Only skip the clear image upload on the host's word. A hash collision must never leave a
+	// stale clear image behind, so without a generation, UploadClearImage() compares the actual
+	// clear image contents instead.
+	this->_isClearImageKeyValid = (this->_clearImageGeneration != 0);
+	this->_clearImageKey = HashFrameData(0xCBF29CE484222325ULL, &this->_clearImageGeneration, sizeof(u64));
+
 	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboGeometryVtxID);
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, OGLRef.iboGeometryIndexID);
 
 	// Only copy as much vertex data as we need to, since this can be a potentially large upload size.
 	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(NDSVertex) * renderGList.rawVertCount, renderGList.rawVtxList);
 
+	// Determine the order in which the polygons will be drawn. Only opaque polygons are
+	// ever reordered, and only if polygon sorting is enabled.
+	for (size_t i = 0; i < this->_clippedPolyCount; i++)
+	{
+		this->_clippedPolyDrawOrder[i] = (u32)i;
+	}
+
+	this->_opaquePolySortDrawsSaved = 0;
+
+	if (this->_enableOpaquePolySorting && (this->_clippedPolyOpaqueCount > 1))
+	{
+		this->_SortOpaquePolygons(renderGList.rawVtxList);
+	}
+
 	// Generate the clipped polygon list.
 	bool renderNeedsToonTable = false;
+	bool renderSamplesBackFacing = false;
+	bool renderHasDepthEqualPolys = false;
+	bool didDetermineFrontFace = false;
+	this->_polyFrontFace = GL_CCW;
+
+	size_t vtxDuplicateCount = 0;
+	memset(OGLRef.vtxViewportAssigned, 0, renderGList.rawVertCount * sizeof(u8));
+	memset(OGLRef.vtxDuplicateLink, 0, renderGList.rawVertCount * sizeof(GLushort));
 
 	for (size_t i = 0, vertIndexCount = 0; i < this->_clippedPolyCount; i++)
 	{
-		const CPoly &cPoly = this->_clippedPolyList[i];
+		const CPoly &cPoly = this->_clippedPolyList[this->_clippedPolyDrawOrder[i]];
 		const POLY &rawPoly = this->_rawPolyList[cPoly.index];
 		const size_t polyType = rawPoly.type;
 
+		// Store the polygon's viewport with each of its vertices so that the viewport transform can
+		// happen in the vertex shader. Vertices can be shared between polygons, so if a vertex was
+		// already given a different viewport for this frame, then draw this polygon from a copy of
+		// the vertex instead. Copies are reused by any later polygon with the same viewport. If no
+		// more copies can be made, then the polygon is drawn on its own with its viewport passed
+		// as a constant vertex attribute.
+		const GLshort polyViewport[4] = {
+			(GLshort)rawPoly.viewport.x,
+			(GLshort)rawPoly.viewport.y,
+			(GLshort)rawPoly.viewport.width,
+			(GLshort)rawPoly.viewport.height
+		};
+		GLushort polyVertIndexes[4];
+		this->_isPolyViewportDetached[i] = false;
+
+		for (size_t j = 0; j < polyType; j++)
+		{
+			const GLushort rawVertIndex = rawPoly.vertIndexes[j];
+			GLushort vertIndex = rawVertIndex;
+
+			if (!OGLRef.vtxViewportAssigned[rawVertIndex])
+			{
+				memcpy(OGLRef.vtxViewportBuffer + (rawVertIndex * 4), polyViewport, sizeof(polyViewport));
+				OGLRef.vtxViewportAssigned[rawVertIndex] = 1;
+			}
+			else if (memcmp(OGLRef.vtxViewportBuffer + (rawVertIndex * 4), polyViewport, sizeof(polyViewport)) != 0)
+			{
+				// Look for an earlier copy of this vertex with the same viewport.
+				GLushort linkIndex = rawVertIndex;
+				vertIndex = OGLRef.vtxDuplicateLink[rawVertIndex];
+
+				while ( (vertIndex != 0) && (memcmp(OGLRef.vtxViewportBuffer + (vertIndex * 4), polyViewport, sizeof(polyViewport)) != 0) )
+				{
+					linkIndex = vertIndex;
+					vertIndex = OGLRef.vtxDuplicateLink[vertIndex];
+				}
+
+				if (vertIndex == 0)
+				{
+					const size_t duplicateIndex = renderGList.rawVertCount + vtxDuplicateCount;
+
+					if ( (vtxDuplicateCount < VERTLIST_SIZE) && (duplicateIndex <= 0xFFFF) )
+					{
+						OGLRef.vtxDuplicateBuffer[vtxDuplicateCount++] = renderGList.rawVtxList[rawVertIndex];
+						memcpy(OGLRef.vtxViewportBuffer + (duplicateIndex * 4), polyViewport, sizeof(polyViewport));
+						OGLRef.vtxDuplicateLink[duplicateIndex] = 0;
+						OGLRef.vtxDuplicateLink[linkIndex] = (GLushort)duplicateIndex;
+						vertIndex = (GLushort)duplicateIndex;
+					}
+					else
+					{
+						this->_isPolyViewportDetached[i] = true;
+						vertIndex = rawVertIndex;
+					}
+				}
+			}
+
+			polyVertIndexes[j] = vertIndex;
+		}
+
 		for (size_t j = 0; j < polyType; j++)
 		{
-			const GLushort vertIndex = rawPoly.vertIndexes[j];
+			const GLushort vertIndex = polyVertIndexes[j];
 
 			// While we're looping through our vertices, add each vertex index to
 			// a buffer. For GFX3D_QUADS and GFX3D_QUAD_STRIP, we also add additional
 			// vertices here to convert them to GL_TRIANGLES, which are much easier
 			// to work with and won't be deprecated in future OpenGL versions.
 			OGLRef.vertIndexBuffer[vertIndexCount++] = vertIndex;
+
 			if (!GFX3D_IsPolyWireframe(rawPoly) && (rawPoly.vtxFormat == GFX3D_QUADS || rawPoly.vtxFormat == GFX3D_QUAD_STRIP))
 			{
 				if (j == 2)
@@ -5366,21 +8448,103 @@ Render3DError OpenGLESRenderer_3_0::BeginRender(const GFX3D_State &renderState,
 				}
 				else if (j == 3)
 				{
-					OGLRef.vertIndexBuffer[vertIndexCount++] = rawPoly.vertIndexes[0];
+					OGLRef.vertIndexBuffer[vertIndexCount++] = polyVertIndexes[0];
+				}
+			}
+		}
+
+		// Polygon facing is read from gl_FrontFacing in the fragment shader, so pick the winding
+		// order that agrees with the facing that was already determined for the polygon. Only one
+		// non-degenerate triangle is needed to figure this out, since all polygons share the same
+		// projection to window space.
+		if (!didDetermineFrontFace && !GFX3D_IsPolyWireframe(rawPoly))
+		{
+			const NDSVertex &v0 = renderGList.rawVtxList[rawPoly.vertIndexes[0]];
+			const NDSVertex &v1 = renderGList.rawVtxList[rawPoly.vertIndexes[1]];
+			const NDSVertex &v2 = renderGList.rawVtxList[rawPoly.vertIndexes[2]];
+
+			if ( (v0.position.w > 0) && (v1.position.w > 0) && (v2.position.w > 0) )
+			{
+				const float x0 = (float)v0.position.x / (float)v0.position.w;
+				const float y0 = (float)v0.position.y / (float)v0.position.w;
+				const float x1 = (float)v1.position.x / (float)v1.position.w;
+				const float y1 = (float)v1.position.y / (float)v1.position.w;
+				const float x2 = (float)v2.position.x / (float)v2.position.w;
+				const float y2 = (float)v2.position.y / (float)v2.position.w;
+				const float signedArea = ((x1 - x0) * (y2 - y0)) - ((x2 - x0) * (y1 - y0));
+
+				if (signedArea != 0.0f)
+				{
+					const bool isCCW = (signedArea > 0.0f);
+					this->_polyFrontFace = (isCCW != cPoly.isPolyBackFacing) ? GL_CCW : GL_CW;
+					didDetermineFrontFace = true;
 				}
 			}
 		}
 
 		renderNeedsToonTable = renderNeedsToonTable || (rawPoly.attribute.Mode == POLYGON_MODE_TOONHIGHLIGHT);
+		renderSamplesBackFacing = renderSamplesBackFacing || ((i >= this->_clippedPolyOpaqueCount) && (this->_clippedPolyOpaqueCount > 0) && rawPoly.attribute.DepthEqualTest_Enable);
+		renderHasDepthEqualPolys = renderHasDepthEqualPolys || (rawPoly.attribute.DepthEqualTest_Enable && (rawPoly.attribute.Mode != POLYGON_MODE_SHADOW));
 
 		// Get the texture that is to be attached to this polygon.
 		this->_textureList[i] = this->GetLoadedTextureFromPolygon(rawPoly, this->_enableTextureSampling);
+
+		// An opaque polygon can be drawn with the early-Z programs if the fragment shader would never
+		// discard any of its fragments. The alpha checks can't discard anything if both the polygon
+		// and its texture are fully opaque.
+		if (this->_enableEarlyZOpaquePolygons && (i < this->_clippedPolyOpaqueCount))
+		{
+			const NDSTextureFormat texFormat = (this->_textureList[i]->IsSamplingEnabled()) ? (NDSTextureFormat)rawPoly.texParam.PackedFormat : TEXMODE_NONE;
+			const bool isTextureOpaque = (texFormat == TEXMODE_NONE) ||
+			                             ( ((texFormat == TEXMODE_I2) || (texFormat == TEXMODE_I4) || (texFormat == TEXMODE_I8)) && !rawPoly.texParam.KeyColor0_Enable );
+
+			this->_isPolyEarlyZSafe[i] = (rawPoly.attribute.Mode != POLYGON_MODE_SHADOW) &&
+			                             !rawPoly.attribute.DepthEqualTest_Enable &&
+			                             !GFX3D_IsPolyWireframe(rawPoly) &&
+			                             GFX3D_IsPolyOpaque(rawPoly) &&
+			                             (oglPrimitiveType[rawPoly.vtxFormat] == GL_TRIANGLES) &&
+			                             isTextureOpaque;
+		}
 	}
 
+	this->_UpdateFeatureAttachments(this->_enableEdgeMark && this->_deviceInfo.isEdgeMarkSupported, this->_enableFog && this->_deviceInfo.isFogSupported);
+	this->_PlanResolves(renderSamplesBackFacing);
+
+	// Shadow polygons always use the multipass depth-equals test, so only bother with the depth
+	// copy if some other polygon needs it.
+	this->_willUseSinglePassDepthEqualTest = this->_enableSinglePassDepthEqualTest &&
+	                                         this->_isSinglePassDepthEqualTestSupported &&
+	                                         this->_emulateNDSDepthCalculation &&
+	                                         renderHasDepthEqualPolys;
+
+	// W-depth isn't linear in window space, so it can't come from the vertex stage. The NDS depth
+	// calculation and fog both make the other programs write a quantized gl_FragDepth, which the
+	// rasterized depth of the early-Z programs would Z-fight with.
+	this->_willUseEarlyZOpaquePolygons = this->_enableEarlyZOpaquePolygons &&
+	                                     !this->_emulateNDSDepthCalculation &&
+	                                     !(this->_enableFog && this->_deviceInfo.isFogSupported) &&
+	                                     (renderState.SWAP_BUFFERS.DepthMode == 0) &&
+	                                     (this->_clippedPolyOpaqueCount > 0);
+
+	// GL states may have been changed outside of the renderer since the last frame. Start this
+	// frame's state tracking over from scratch.
+	this->_glState.Invalidate();
+
 	// Replace the entire index buffer as a hint to the driver that we can orphan the index buffer and
 	// avoid a synchronization cost.
 	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, sizeof(OGLRef.vertIndexBuffer), OGLRef.vertIndexBuffer);
 
+	// Vertex duplicates for conflicting viewports go right after the raw vertices.
+	if (vtxDuplicateCount > 0)
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboGeometryVtxID);
+		glBufferSubData(GL_ARRAY_BUFFER, sizeof(NDSVertex) * renderGList.rawVertCount, sizeof(NDSVertex) * vtxDuplicateCount, OGLRef.vtxDuplicateBuffer);
+	}
+
+	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboGeometryViewportID);
+	glBufferSubData(GL_ARRAY_BUFFER, 0, sizeof(GLshort) * 4 * (renderGList.rawVertCount + vtxDuplicateCount), OGLRef.vtxViewportBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, OGLRef.vboGeometryVtxID);
+
 	// Set up rendering states that will remain constant for the entire frame.
 	this->_pendingRenderStates.enableAntialiasing = (renderState.DISP3DCNT.EnableAntialiasing) ? GL_TRUE : GL_FALSE;
 	this->_pendingRenderStates.enableFogAlphaOnly = (renderState.DISP3DCNT.FogOnlyAlpha) ? GL_TRUE : GL_FALSE;
@@ -5406,8 +8570,8 @@ Render3DError OpenGLESRenderer_3_0::BeginRender(const GFX3D_State &renderState,
 		{
 			fogDensityTable[i] = (renderState.fogDensityTable[i] == 127) ? 255 : renderState.fogDensityTable[i] << 1;
 		}
-		glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_LookupTable);
-		glBindTexture(GL_TEXTURE_2D, OGLRef.texFogDensityTableID);
+		this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_LookupTable);
+		this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texFogDensityTableID);
 		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 32, 1, GL_LUMINANCE, GL_UNSIGNED_BYTE, fogDensityTable);
 	}
 
@@ -5419,10 +8583,15 @@ Render3DError OpenGLESRenderer_3_0::BeginRender(const GFX3D_State &renderState,
 		for (size_t i = 0; i < 8; i++)
 		{
 			edgeColor32[i].value = COLOR555TO8888(renderState.edgeMarkColorTable[i] & 0x7FFF, alpha8);
+
+			this->_pendingRenderStates.edgeColor[i].r = (GLfloat)edgeColor32[i].r / 255.0f;
+			this->_pendingRenderStates.edgeColor[i].g = (GLfloat)edgeColor32[i].g / 255.0f;
+			this->_pendingRenderStates.edgeColor[i].b = (GLfloat)edgeColor32[i].b / 255.0f;
+			this->_pendingRenderStates.edgeColor[i].a = (GLfloat)edgeColor32[i].a / 255.0f;
 		}
 
-		glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_LookupTable);
-		glBindTexture(GL_TEXTURE_2D, OGLRef.texEdgeColorTableID);
+		this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_LookupTable);
+		this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texEdgeColorTableID);
 		glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, 8, 1, GL_MY_FORMAT, GL_UNSIGNED_INT_8_8_8_8_REV, edgeColor32);
 	}
 
@@ -5440,8 +8609,8 @@ Render3DError OpenGLESRenderer_3_0::BeginRender(const GFX3D_State &renderState,
 
 	if (renderNeedsToonTable)
 	{
-		glActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_LookupTable);
-		glBindTexture(GL_TEXTURE_2D, OGLRef.texToonTableID);
+		this->_glState.ActiveTexture(GL_TEXTURE0 + OGLTextureUnitID_LookupTable);
+		this->_glState.BindTexture(GL_TEXTURE_2D, OGLRef.texToonTableID);
 
 		unsigned char toonColor[32*4];
 		{
@@ -5460,11 +8629,14 @@ Render3DError OpenGLESRenderer_3_0::BeginRender(const GFX3D_State &renderState,
 
 	glReadBuffer(GL_COLOROUT_ATTACHMENT_ID);
 
-	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-	glDepthMask(GL_TRUE);
+	this->_glState.ColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	this->_glState.DepthMask(GL_TRUE);
 
 	this->_needsZeroDstAlphaPass = true;
 
+	this->_lastFrameHash = frameHash;
+	this->_isLastFrameHashValid = this->_enableFrameMemoization;
+
 	return OGLERROR_NOERR;
 }
 
@@ -5487,7 +8659,7 @@ Render3DError OpenGLESRenderer_3_0::SetupTexture(const POLY &thePoly, size_t pol
 	glUniform1i(OGLRef.uniformPolyEnableTexture[this->_geometryProgramFlags.value], GL_TRUE);
 	glUniform1i(OGLRef.uniformTexSingleBitAlpha[this->_geometryProgramFlags.value], (packFormat != TEXMODE_A3I5 && packFormat != TEXMODE_A5I3) ? GL_TRUE : GL_FALSE);
 
-	glBindTexture(GL_TEXTURE_2D, theTexture->GetID());
+	this->_glState.BindTexture(GL_TEXTURE_2D, theTexture->GetID());
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, ((thePoly.texParam.RepeatS_Enable) ? ((thePoly.texParam.MirroredRepeatS_Enable) ? GL_MIRRORED_REPEAT : GL_REPEAT) : GL_CLAMP_TO_EDGE));
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, ((thePoly.texParam.RepeatT_Enable) ? ((thePoly.texParam.MirroredRepeatT_Enable) ? GL_MIRRORED_REPEAT : GL_REPEAT) : GL_CLAMP_TO_EDGE));
 
@@ -25,6 +25,7 @@
 #include <queue>
 #include <set>
 #include <string>
+#include <vector>
 #include "render3D.h"
 #include "types.h"
 
@@ -33,8 +34,13 @@
     #include <GLES3/gl3.h>
     #include <GLES3/gl3ext.h>
     #include <EGL/egl.h>
+    #include <EGL/eglext.h>
     #include "opengl.h"
 
+    // These platforms always pair GLES3 with EGL, so frame export can hand out EGL images
+    // (and dma-bufs on Linux/Android). Builds without EGL must use the other branch.
+    #define OGLRENDER_SUPPORTS_EGL
+
     // Ignore dynamic linking
     #define OGLEXT(procPtr, func)
     #define INITOGLEXT(procPtr, func)
@@ -51,17 +57,29 @@
 
 #define OGLRENDER_VERT_INDEX_BUFFER_COUNT	(CLIPPED_POLYLIST_SIZE * 6)
 
+// Framebuffers smaller than this are converted on a single thread, since the
+// cost of waking up the worker threads would outweigh the conversion itself.
+#define OGLRENDER_MAX_FLUSH_THREADS				32
+#define OGLRENDER_FLUSH_THREADING_MIN_PIXELS	(GPU_FRAMEBUFFER_NATIVE_WIDTH * GPU_FRAMEBUFFER_NATIVE_HEIGHT * 4)
+#define OGLRENDER_PBO_RING_SIZE					4
+#define OGLRENDER_MAX_FRAME_PIPELINE_DEPTH		(OGLRENDER_PBO_RING_SIZE - 1)
+#define OGLRENDER_EXPORT_TEXTURE_COUNT			3
+
 // Assign the FBO attachments for the main geometry render
 #define GL_COLOROUT_ATTACHMENT_ID			GL_COLOR_ATTACHMENT0
 #define GL_WORKING_ATTACHMENT_ID			GL_COLOR_ATTACHMENT3
 #define GL_POLYID_ATTACHMENT_ID				GL_COLOR_ATTACHMENT1
 #define GL_FOGATTRIBUTES_ATTACHMENT_ID		GL_COLOR_ATTACHMENT2
 
+// Attachment on the framebuffer flip FBO that receives the packed RGBA5551 output
+#define GL_FRAMEBUFFER16_ATTACHMENT_ID		GL_COLOR_ATTACHMENT1
+
 enum OGLVertexAttributeID
 {
 	OGLVertexAttributeID_Position	= 0,
 	OGLVertexAttributeID_TexCoord0	= 8,
-	OGLVertexAttributeID_Color		= 3
+	OGLVertexAttributeID_Color		= 3,
+	OGLVertexAttributeID_Viewport	= 4
 };
 
 enum OGLTextureUnitID
@@ -74,6 +92,7 @@ enum OGLTextureUnitID
 	OGLTextureUnitID_FogAttr,
 	OGLTextureUnitID_PolyStates,
 	OGLTextureUnitID_LookupTable,
+	OGLTextureUnitID_DepthCopy,
 };
 
 enum OGLBindingPointID
@@ -106,6 +125,25 @@ enum OGLErrorCode
 	OGLERROR_FBO_CREATE_ERROR
 };
 
+enum OGLFramebufferReadMode
+{
+	OGLFramebufferReadMode_Color	= 0,	// The raw or GPU-converted color framebuffer
+	OGLFramebufferReadMode_16Only	= 1,	// Only the RGBA5551 framebuffer
+	OGLFramebufferReadMode_Dual		= 2		// The GPU-converted color framebuffer, followed by the RGBA5551 framebuffer
+};
+
+// Framebuffer attachments, as reported in the attachment invalidation counters.
+enum OGLAttachmentFlag
+{
+	OGLAttachmentFlag_Color			= 0x01,
+	OGLAttachmentFlag_PolyID		= 0x02,
+	OGLAttachmentFlag_FogAttributes	= 0x04,
+	OGLAttachmentFlag_Working		= 0x08,
+	OGLAttachmentFlag_DepthStencil	= 0x10,
+
+	OGLAttachmentFlag_All			= 0x1F
+};
+
 enum OGLPolyDrawMode
 {
 	OGLPolyDrawMode_DrawOpaquePolys			= 0,
@@ -187,43 +225,47 @@ typedef union OGLPolyStates OGLPolyStates;
 
 union OGLGeometryFlags
 {
-	u8 value;
+	u16 value;
 
 #ifndef MSB_FIRST
 	struct
 	{
-		u8 EnableFog:1;
-		u8 EnableEdgeMark:1;
-		u8 OpaqueDrawMode:1;
-		u8 EnableWDepth:1;
-		u8 EnableAlphaTest:1;
-		u8 EnableTextureSampling:1;
-		u8 ToonShadingMode:1;
-		u8 unused:1;
+		u16 EnableFog:1;
+		u16 EnableEdgeMark:1;
+		u16 OpaqueDrawMode:1;
+		u16 EnableWDepth:1;
+		u16 EnableAlphaTest:1;
+		u16 EnableTextureSampling:1;
+		u16 ToonShadingMode:1;
+		u16 ZeroDstAlphaFetch:1;
+		u16 EarlyZOpaque:1;
+		u16 :7;
 	};
 
 	struct
 	{
-		u8 DrawBuffersMode:3;
-		u8 :5;
+		u16 DrawBuffersMode:3;
+		u16 :13;
 	};
 #else
 	struct
 	{
-		u8 unused:1;
-		u8 ToonShadingMode:1;
-		u8 EnableTextureSampling:1;
-		u8 EnableAlphaTest:1;
-		u8 EnableWDepth:1;
-		u8 OpaqueDrawMode:1;
-		u8 EnableEdgeMark:1;
-		u8 EnableFog:1;
+		u16 :7;
+		u16 EarlyZOpaque:1;
+		u16 ZeroDstAlphaFetch:1;
+		u16 ToonShadingMode:1;
+		u16 EnableTextureSampling:1;
+		u16 EnableAlphaTest:1;
+		u16 EnableWDepth:1;
+		u16 OpaqueDrawMode:1;
+		u16 EnableEdgeMark:1;
+		u16 EnableFog:1;
 	};
 
 	struct
 	{
-		u8 :5;
-		u8 DrawBuffersMode:3;
+		u16 :13;
+		u16 DrawBuffersMode:3;
 	};
 #endif
 };
@@ -249,6 +291,81 @@ struct OGLFogShaderID
 };
 typedef OGLFogShaderID OGLFogShaderID;
 
+// Per-frame counters that the renderer keeps for diagnostic purposes.
+struct OGLRenderStats
+{
+	size_t frameCount;
+	size_t frameMemoHitCount;
+	size_t frameReadBackDeferCount;
+	size_t frameReadBackSkipCount;
+	size_t framePartialReadBackCount;
+	size_t frameExportCount;
+	size_t frameExportDropCount;
+	size_t attachmentInvalidateCount;
+	size_t resolveBlitCount;			// Explicit blits from the multisampled FBO
+	size_t implicitResolveCount;		// Frames resolved through EXT_multisampled_render_to_texture
+	size_t clearImageUploadSkipCount;
+	size_t depthCopyCount;				// Depth buffer copies made for the single-pass depth-equals test
+	size_t shadowPolyBatchedCount;		// Shadow polygons that joined the previous shadow polygon's draw
+	size_t earlyZPolyCount;				// Opaque polygons drawn with the early-Z geometry programs
+
+	// OGLAttachmentFlag bits for the attachments invalidated during the last rendered frame.
+	u32 invalidatedBeforeClear;
+	u32 invalidatedAfterGeometry;
+	u32 invalidatedAfterPostprocess;
+};
+typedef OGLRenderStats OGLRenderStats;
+
+// A rendered frame that stays on the GPU, for consumers that don't need a readback. The
+// texture holds the final color as RGBA8888, already flipped to the NDS Y-coordinate order.
+// The EGL image and the dma-buf are only available if the driver supports exporting them.
+struct OGLExportedFrame
+{
+	size_t index;
+	size_t width;
+	size_t height;
+	GLuint textureID;
+	GLsync fence;				// Signaled once the GPU has finished writing the texture
+
+	void *eglImage;				// EGLImageKHR, or NULL if unavailable
+	int dmabufFD;				// -1 if unavailable
+	int dmabufFourCC;
+	int dmabufStride;
+	int dmabufOffset;
+	u64 dmabufModifier;
+};
+typedef OGLExportedFrame OGLExportedFrame;
+
+// A range of framebuffer lines, in OpenGL's bottom-up Y-coordinate order. The range is
+// empty if lineEnd <= lineFirst.
+struct OGLLineRange
+{
+	size_t lineFirst;
+	size_t lineEnd;
+};
+typedef OGLLineRange OGLLineRange;
+
+// A run of opaque polygons that share the same draw states, as built by the opaque
+// polygon sorting pass. Bounds are in native window coordinates.
+struct OGLOpaqueSortRun
+{
+	u32 attributeValue;
+	u32 texParamValue;
+	u32 texPalette;
+	bool isPolyBackFacing;
+	bool canJoin;
+	bool isBarrier;
+
+	s32 minX;
+	s32 minY;
+	s32 maxX;
+	s32 maxY;
+
+	u32 firstPoly;
+	u32 lastPoly;
+};
+typedef OGLOpaqueSortRun OGLOpaqueSortRun;
+
 struct OGLRenderRef
 {
 	// OpenGL Feature Support
@@ -256,11 +373,12 @@ struct OGLRenderRef
 
 	// VBO
 	GLuint vboGeometryVtxID;
+	GLuint vboGeometryViewportID;
 	GLuint iboGeometryIndexID;
 	GLuint vboPostprocessVtxID;
 
 	// PBO
-	GLuint pboRenderDataID;
+	GLuint pboRenderDataID[OGLRENDER_PBO_RING_SIZE];
 
 	// UBO / TBO
 	GLuint uboRenderStatesID;
@@ -278,11 +396,14 @@ struct OGLRenderRef
 	GLuint texGPolyID;
 	GLuint texGDepthStencilID;
 	GLuint texFinalColorID;
+	GLuint texDepthCopyID;
+	GLuint texFinal16ID;
 	GLuint texFogDensityTableID;
 	GLuint texToonTableID;
 	GLuint texEdgeColorTableID;
 	GLuint texMSGColorID;
 	GLuint texMSGWorkingID;
+	GLuint texExportColorID[OGLRENDER_EXPORT_TEXTURE_COUNT];
 
 	GLuint rboMSGColorID;
 	GLuint rboMSGWorkingID;
@@ -293,13 +414,16 @@ struct OGLRenderRef
 	GLuint fboClearImageID;
 	GLuint fboRenderID;
 	GLuint fboFramebufferFlipID;
+	GLuint fboExportID;
 	GLuint fboMSIntermediateRenderID;
+	GLuint fboMSRenderToTextureID;
+	GLuint fboDepthCopyID;
 	GLuint selectedRenderingFBO;
 
 	// Shader states
 	GLuint vertexGeometryShaderID;
-	GLuint fragmentGeometryShaderID[128];
-	GLuint programGeometryID[128];
+	GLuint fragmentGeometryShaderID[512];
+	GLuint programGeometryID[512];
 
 	GLuint vtxShaderGeometryZeroDstAlphaID;
 	GLuint fragShaderGeometryZeroDstAlphaID;
@@ -311,38 +435,52 @@ struct OGLRenderRef
 
 	GLuint vertexEdgeMarkShaderID;
 	GLuint vertexFogShaderID;
+	GLuint vertexEdgeMarkFogShaderID;
 	GLuint vertexFramebufferOutput6665ShaderID[2];
 	GLuint vertexFramebufferOutput8888ShaderID[2];
+	GLuint vertexFramebufferOutput5551ShaderID[2];
+	GLuint vertexFramebufferOutputDualShaderID[4];
 	GLuint fragmentEdgeMarkShaderID;
 	GLuint fragmentFramebufferRGBA6665OutputShaderID[2];
 	GLuint fragmentFramebufferRGBA8888OutputShaderID[2];
+	GLuint fragmentFramebufferRGBA5551OutputShaderID[2];
+	GLuint fragmentFramebufferDualOutputShaderID[4];
 	GLuint programEdgeMarkID;
 	GLuint programFramebufferRGBA6665OutputID[2];
 	GLuint programFramebufferRGBA8888OutputID[2];
+	GLuint programFramebufferRGBA5551OutputID[2];
+	GLuint programFramebufferDualOutputID[4];
 
 	GLint uniformStateEnableFogAlphaOnly;
 	GLint uniformStateClearPolyID;
 	GLint uniformStateClearDepth;
 	GLint uniformStateFogColor;
-
-	GLint uniformStateAlphaTestRef[256];
-	GLint uniformPolyTexScale[256];
-	GLint uniformPolyMode[256];
-	GLint uniformPolyIsWireframe[256];
-	GLint uniformPolySetNewDepthForTranslucent[256];
-	GLint uniformPolyAlpha[256];
-	GLint uniformPolyID[256];
-
-	GLint uniformPolyEnableTexture[256];
-	GLint uniformPolyEnableFog[256];
-	GLint uniformTexSingleBitAlpha[256];
-	GLint uniformTexDrawOpaque[256];
-	GLint uniformDrawModeDepthEqualsTest[256];
-	GLint uniformPolyIsBackFacing[256];
-
-	GLint uniformPolyStateIndex[256];
-	GLfloat uniformPolyDepthOffset[256];
-	GLint uniformPolyDrawShadow[256];
+	GLint uniformStateEdgeMarkFogClearPolyID;
+	GLint uniformStateEdgeMarkFogClearDepth;
+	GLint uniformStateEdgeMarkFogEdgeColor;
+	GLint uniformStateEdgeMarkFogEnableZeroDstAlpha;
+	GLint uniformStateEdgeMarkFogEnableFogAlphaOnly;
+	GLint uniformStateEdgeMarkFogFogColor;
+
+	GLint uniformStateAlphaTestRef[512];
+	GLint uniformPolyTexScale[512];
+	GLint uniformPolyMode[512];
+	GLint uniformPolyIsWireframe[512];
+	GLint uniformPolySetNewDepthForTranslucent[512];
+	GLint uniformPolyAlpha[512];
+	GLint uniformPolyID[512];
+
+	GLint uniformPolyEnableTexture[512];
+	GLint uniformPolyEnableFog[512];
+	GLint uniformTexSingleBitAlpha[512];
+	GLint uniformTexDrawOpaque[512];
+	GLint uniformDrawModeDepthEqualsTest[512];
+	GLint uniformDrawModeDepthEqualsWindow[512];
+	GLint uniformPolyLineIsBackFacing[512];
+
+	GLint uniformPolyStateIndex[512];
+	GLfloat uniformPolyDepthOffset[512];
+	GLint uniformPolyDrawShadow[512];
 
 	// VAO
 	GLuint vaoGeometryStatesID;
@@ -353,6 +491,10 @@ struct OGLRenderRef
 	GLfloat *texCoord2fBuffer;
 	GLfloat *color4fBuffer;
 	CACHE_ALIGN GLushort vertIndexBuffer[OGLRENDER_VERT_INDEX_BUFFER_COUNT];
+	CACHE_ALIGN GLshort vtxViewportBuffer[VERTLIST_SIZE * 2 * 4];
+	CACHE_ALIGN NDSVertex vtxDuplicateBuffer[VERTLIST_SIZE];
+	CACHE_ALIGN u8 vtxViewportAssigned[VERTLIST_SIZE];
+	CACHE_ALIGN GLushort vtxDuplicateLink[VERTLIST_SIZE * 2];
 	CACHE_ALIGN GLushort workingCIColorBuffer[GPU_FRAMEBUFFER_NATIVE_WIDTH * GPU_FRAMEBUFFER_NATIVE_HEIGHT];
 	CACHE_ALIGN GLuint workingCIDepthStencilBuffer[2][GPU_FRAMEBUFFER_NATIVE_WIDTH * GPU_FRAMEBUFFER_NATIVE_HEIGHT];
 	CACHE_ALIGN GLuint workingCIFogAttributesBuffer[2][GPU_FRAMEBUFFER_NATIVE_WIDTH * GPU_FRAMEBUFFER_NATIVE_HEIGHT];
@@ -362,6 +504,7 @@ typedef struct OGLRenderRef OGLRenderRef;
 struct GFX3D_State;
 struct POLY;
 class OpenGLRenderer;
+class OpenGLStateCache;
 
 extern GPU3DInterface gpu3Dgl;
 extern GPU3DInterface gpu3DglOld;
@@ -419,6 +562,7 @@ protected:
 	bool _isTexInited;
 
 	u32 *_upscaleBuffer;
+	OpenGLStateCache *_glState;
 
 public:
 	OpenGLTexture(TEXIMAGE_PARAM texAttributes, u32 palAttributes);
@@ -433,8 +577,86 @@ public:
 	void SetUnpackBuffer(void *unpackBuffer);
 	void SetDeposterizeBuffer(void *dstBuffer, void *workingBuffer);
 	void SetUpscalingBuffer(void *upscaleBuffer);
+	void SetStateCache(OpenGLStateCache *glState);
+};
+
+// Shadows the GL states that the draw path changes most often, so that setting a
+// state to the value it already has never reaches the driver. Every call that goes
+// through here is counted as either issued or suppressed.
+//
+// Anything that changes these states without going through the cache, such as the
+// frontend, must be followed by a call to Invalidate(). OpenGLTexture binds and deletes
+// its texture through the cache once it's given one with SetStateCache().
+class OpenGLStateCache
+{
+protected:
+	GLenum _depthFunc;
+	GLenum _stencilFunc;
+	GLint _stencilRef;
+	GLuint _stencilFuncMask;
+	GLenum _stencilOpFail;
+	GLenum _stencilOpDepthFail;
+	GLenum _stencilOpDepthPass;
+	GLuint _stencilWriteMask;
+	bool _isStencilWriteMaskValid;
+	GLboolean _colorMask[4];
+	GLboolean _depthMask;
+	GLenum _blendSrcRGB;
+	GLenum _blendDstRGB;
+	GLenum _blendSrcAlpha;
+	GLenum _blendDstAlpha;
+	GLenum _blendModeRGB;
+	GLenum _blendModeAlpha;
+	GLuint _program;
+	bool _isProgramValid;
+	GLenum _activeTextureUnit;
+	GLuint _boundTexture2D[OGLTextureUnitID_LookupTable + 1];
+	bool _isBoundTexture2DValid[OGLTextureUnitID_LookupTable + 1];
+
+	size_t _issuedCallCount;
+	size_t _suppressedCallCount;
+
+public:
+	OpenGLStateCache();
+
+	void Invalidate();
+	void ResetCounters();
+	size_t GetIssuedCallCount() const;
+	size_t GetSuppressedCallCount() const;
+
+	void DepthFunc(GLenum func);
+	void StencilFunc(GLenum func, GLint ref, GLuint mask);
+	void StencilOp(GLenum sfail, GLenum dpfail, GLenum dppass);
+	void StencilMask(GLuint mask);
+	void ColorMask(GLboolean r, GLboolean g, GLboolean b, GLboolean a);
+	void DepthMask(GLboolean flag);
+	void BlendFuncSeparate(GLenum srcRGB, GLenum dstRGB, GLenum srcAlpha, GLenum dstAlpha);
+	void BlendEquationSeparate(GLenum modeRGB, GLenum modeAlpha);
+	void UseProgram(GLuint program);
+	void ActiveTexture(GLenum textureUnit);
+	void BindTexture(GLenum target, GLuint texture);
+	void DeleteProgram(GLuint program);
+	void DeleteTextures(GLsizei n, const GLuint *textures);
 };
 
+class Task;
+
+typedef void (*OGLFlushFramebufferKernel)(const Color4u8 *__restrict src, Color4u8 *__restrict dstMain, u16 *__restrict dst16,
+										  const size_t width, const size_t height, const size_t lineIndex, const size_t lineCount);
+
+struct OGLFlushFramebufferThreadParam
+{
+	OGLFlushFramebufferKernel kernel;
+	const Color4u8 *srcFramebuffer;
+	Color4u8 *dstFramebufferMain;
+	u16 *dstFramebuffer16;
+	size_t framebufferWidth;
+	size_t framebufferHeight;
+	size_t lineIndex;
+	size_t lineCount;
+};
+typedef OGLFlushFramebufferThreadParam OGLFlushFramebufferThreadParam;
+
 #if defined(ENABLE_AVX2)
 class OpenGLRenderer : public Render3D_AVX2
 #elif defined(ENABLE_SSE2)
@@ -454,13 +676,9 @@ private:
 	unsigned int versionRevision;
 
 private:
-	Render3DError _FlushFramebufferFlipAndConvertOnCPU(const Color4u8 *__restrict srcFramebuffer,
-													   Color4u8 *__restrict dstFramebufferMain, u16 *__restrict dstFramebuffer16,
-													   bool doFramebufferFlip, bool doFramebufferConvert);
-
-    Render3DError _FlushFramebufferFlipAndConvertOnCPU_RGBA(const Color4u8 *__restrict srcFramebuffer,
-													   Color4u8 *__restrict dstFramebufferMain, u16 *__restrict dstFramebuffer16,
-													   bool doFramebufferFlip, bool doFramebufferConvert);
+	size_t _flushThreadCount;
+	Task *_flushTask;
+	OGLFlushFramebufferThreadParam _flushThreadParam[OGLRENDER_MAX_FLUSH_THREADS];
 
 protected:
 	// OpenGL-specific References
@@ -482,26 +700,109 @@ protected:
 	bool _emulateNDSDepthCalculation;
 	bool _emulateDepthLEqualPolygonFacing;
 	bool _isDepthLEqualPolygonFacingSupported;
+	bool _isFramebufferFetchSupported;
+	bool _isMultisampledRenderToTextureSupported;
+	bool _isMSRenderToTextureFBOComplete;
+
+	u32 _resolveAttachmentFlags;
+	bool _needsBackFacingResolve;
+
+	bool _isPolyIDAttachmentAllocated;
+	bool _isFogAttrAttachmentAllocated;
 
 	Color4u8 *_mappedFramebuffer;
 	Color4u8 *_workingTextureUnpackBuffer;
 	bool _pixelReadNeedsFinish;
+	bool _pixelReadNeedsStart;
+	bool _enableZeroCopyFramebuffer;
+	size_t _pboRingIndex;
+	bool _isPBOBorrowed[OGLRENDER_PBO_RING_SIZE];
+	Color4u8 *_pboRetiredMapping[OGLRENDER_PBO_RING_SIZE];
+	size_t _framePipelineDepth;
+	bool _isPipelinedReadBack;
+	size_t _pboReadIndex;
+	size_t _pboInFlight[OGLRENDER_PBO_RING_SIZE];
+	size_t _pboInFlightCount;
+	OGLFramebufferReadMode _pboReadMode[OGLRENDER_PBO_RING_SIZE];
+	bool _enableFrameExport;
+	size_t _exportLatestIndex;
+#ifdef OGLRENDER_SUPPORTS_EGL
+	EGLDisplay _exportEGLDisplay;
+#endif
+	bool _isExportInUse[OGLRENDER_EXPORT_TEXTURE_COUNT];
+	OGLExportedFrame _exportedFrame[OGLRENDER_EXPORT_TEXTURE_COUNT];
+	bool _willFrameBeConsumed;
+	bool _wasLastFrameConsumed;
+	bool _isFramebufferOutput5551Supported;
+	OGLFramebufferReadMode _framebufferReadMode;
+	bool _lastFlushRequestMain;
+	bool _lastFlushRequest16;
 	bool _needsZeroDstAlphaPass;
+	GLenum _polyFrontFace;
 	size_t _currentPolyIndex;
 	bool _enableAlphaBlending;
 	OGLTextureUnitID _lastTextureDrawTarget;
 	OGLGeometryFlags _geometryProgramFlags;
 	OGLFogProgramKey _fogProgramKey;
 	std::map<u32, OGLFogShaderID> _fogProgramMap;
+	std::map<u32, OGLFogShaderID> _edgeMarkFogProgramMap;
+	bool _isEdgeMarkFogFusionSupported;
 
     GLint readFormat;
     GLint readType;
 
 	CACHE_ALIGN OGLRenderStates _pendingRenderStates;
+	OpenGLStateCache _glState;
 
 	bool _enableMultisampledRendering;
 	int _selectedMultisampleSize;
 	size_t _clearImageIndex;
+	u64 _clearImageGeneration;
+	bool _isClearImageKeyValid;
+	u64 _clearImageKey;
+	bool _isUploadedClearImageKeyValid;
+	u64 _uploadedClearImageKey;
+
+	bool _enableOpaquePolySorting;
+	size_t _opaquePolySortDrawsSaved;
+	std::vector<OGLOpaqueSortRun> _opaqueSortRunList;
+	std::vector<u32> _opaqueSortNextPoly;
+	CACHE_ALIGN u32 _clippedPolyDrawOrder[CLIPPED_POLYLIST_SIZE];
+
+	bool _enableFrameMemoization;
+	bool _isFrameMemoized;
+	bool _isLastFrameHashValid;
+	u64 _lastFrameHash;
+	size_t _textureLoadCount;
+	OGLRenderStats _renderStats;
+
+	bool _enablePartialReadBack;
+	bool _isLastBackgroundHashValid;
+	u64 _lastBackgroundHash;
+	OGLLineRange _lastPolyLines;
+	OGLLineRange _pendingFlushLinesMain;
+	OGLLineRange _pendingFlushLines16;
+	OGLLineRange _readBackLines;
+
+	bool _enableAttachmentInvalidation;
+
+	bool _isSinglePassDepthEqualTestSupported;
+	bool _enableSinglePassDepthEqualTest;
+	bool _willUseSinglePassDepthEqualTest;
+	bool _isDepthCopyDirty;
+
+	bool _enableEarlyZOpaquePolygons;
+	bool _willUseEarlyZOpaquePolygons;
+	CACHE_ALIGN bool _isPolyEarlyZSafe[CLIPPED_POLYLIST_SIZE];
+	CACHE_ALIGN bool _isPolyViewportDetached[CLIPPED_POLYLIST_SIZE];
+
+	void _SortOpaquePolygons(const NDSVertex *vtxList);
+	u64 _ComputeBackgroundHash(const GFX3D_State &renderState) const;
+	u64 _ComputeFrameHash(const u64 backgroundHash, const GFX3D_GeometryList &renderGList) const;
+	OGLLineRange _ComputePolyLines(const NDSVertex *vtxList) const;
+	void _UpdateDirtyLines(const u64 backgroundHash, const NDSVertex *vtxList);
+	void _InvalidateDirtyLines();
+	OGLLineRange _GetReadBackLines() const;
 
 	Render3DError FlushFramebuffer(const Color4u8 *__restrict srcFramebuffer, Color4u8 *__restrict dstFramebufferMain, u16 *__restrict dstFramebuffer16);
 	OpenGLTexture* GetLoadedTextureFromPolygon(const POLY &thePoly, bool enableTexturing);
@@ -545,10 +846,18 @@ protected:
 	virtual Render3DError CreateFogProgram(const OGLFogProgramKey fogProgramKey, const char *vtxShaderCString, const char *fragShaderCString) = 0;
 	virtual void DestroyFogProgram(const OGLFogProgramKey fogProgramKey) = 0;
 	virtual void DestroyFogPrograms() = 0;
+	virtual Render3DError CreateEdgeMarkFogProgram(const OGLFogProgramKey fogProgramKey, const char *vtxShaderCString, const char *fragShaderCString) = 0;
+	virtual void DestroyEdgeMarkFogPrograms() = 0;
 	virtual Render3DError CreateFramebufferOutput6665Program(const size_t outColorIndex, const char *vtxShaderCString, const char *fragShaderCString) = 0;
 	virtual void DestroyFramebufferOutput6665Programs() = 0;
 	virtual Render3DError CreateFramebufferOutput8888Program(const size_t outColorIndex, const char *vtxShaderCString, const char *fragShaderCString) = 0;
 	virtual void DestroyFramebufferOutput8888Programs() = 0;
+	virtual Render3DError CreateFramebufferOutput5551Program(const size_t outColorIndex, const char *vtxShaderCString, const char *fragShaderCString) = 0;
+	virtual void DestroyFramebufferOutput5551Programs() = 0;
+	virtual Render3DError CreateFramebufferOutputDualProgram(const size_t outColorIndex, const NDSColorFormat outputFormat, const char *vtxShaderCString, const char *fragShaderCString) = 0;
+	virtual void DestroyFramebufferOutputDualPrograms() = 0;
+	virtual Render3DError CreateFrameExportResources() = 0;
+	virtual void DestroyFrameExportResources() = 0;
 
 	virtual Render3DError InitFinalRenderStates(const std::set<std::string> *oglExtensionSet) = 0;
 	virtual Render3DError InitPostprocessingPrograms(const char *edgeMarkVtxShader,
@@ -565,11 +874,12 @@ protected:
 	virtual Render3DError DisableVertexAttributes() = 0;
 	virtual void _ResolveWorkingBackFacing() = 0;
 	virtual void _ResolveGeometry() = 0;
+	virtual void _UpdateDepthEqualsTestCopy() = 0;
 	virtual Render3DError ReadBackPixels() = 0;
 
 	virtual Render3DError DrawShadowPolygon(const GLenum polyPrimitive, const GLsizei vertIndexCount, const GLushort *indexBufferPtr, const bool performDepthEqualTest, const bool enableAlphaDepthWrite, const bool isTranslucent, const u8 opaquePolyID) = 0;
 	virtual void SetPolygonIndex(const size_t index) = 0;
-	virtual Render3DError SetupPolygon(const POLY &thePoly, bool treatAsTranslucent, bool willChangeStencilBuffer, bool isBackFacing) = 0;
+	virtual Render3DError SetupPolygon(const POLY &thePoly, bool treatAsTranslucent, bool willChangeStencilBuffer) = 0;
 
 public:
 	OpenGLRenderer();
@@ -591,6 +901,47 @@ public:
 
 	virtual Color4u8* GetFramebuffer();
 	virtual GLsizei GetLimitedMultisampleSize() const;
+	const OpenGLStateCache& GetStateCache() const; // Call counters are reset at the start of each frame.
+
+	void SetEnableOpaquePolySorting(const bool enable);
+	bool GetEnableOpaquePolySorting() const;
+	size_t GetOpaquePolySortDrawsSaved() const;
+
+	void SetEnableFrameMemoization(const bool enable);
+	bool GetEnableFrameMemoization() const;
+	const OGLRenderStats& GetRenderStats() const;
+
+	void SetFrameWillBeConsumed(const bool willBeConsumed);
+	bool GetFrameWillBeConsumed() const;
+
+	void SetEnablePartialReadBack(const bool enable);
+	bool GetEnablePartialReadBack() const;
+
+	void SetEnableAttachmentInvalidation(const bool enable);
+	bool GetEnableAttachmentInvalidation() const;
+
+	void SetClearImageGeneration(const u64 generation);
+	u64 GetClearImageGeneration() const;
+
+	void SetEnableSinglePassDepthEqualTest(const bool enable);
+	bool GetEnableSinglePassDepthEqualTest() const;
+	bool IsSinglePassDepthEqualTestSupported() const;
+
+	void SetEnableEarlyZOpaquePolygons(const bool enable);
+	bool GetEnableEarlyZOpaquePolygons() const;
+
+	void SetEnableZeroCopyFramebuffer(const bool enable);
+	bool GetEnableZeroCopyFramebuffer() const;
+	const Color4u8* AcquireFramebuffer();
+	void ReleaseFramebuffer(const Color4u8 *framebuffer);
+
+	void SetFramePipelineDepth(const size_t depth);
+	size_t GetFramePipelineDepth() const;
+
+	Render3DError SetEnableFrameExport(const bool enable);
+	bool GetEnableFrameExport() const;
+	bool AcquireExportedFrame(OGLExportedFrame &outFrame);
+	void ReleaseExportedFrame(const size_t index);
 
 	Render3DError ApplyRenderingSettings(const GFX3D_State &renderState);
 };
@@ -620,10 +971,18 @@ protected:
 	virtual Render3DError CreateFogProgram(const OGLFogProgramKey fogProgramKey, const char *vtxShaderCString, const char *fragShaderCString);
 	virtual void DestroyFogProgram(const OGLFogProgramKey fogProgramKey);
 	virtual void DestroyFogPrograms();
+	virtual Render3DError CreateEdgeMarkFogProgram(const OGLFogProgramKey fogProgramKey, const char *vtxShaderCString, const char *fragShaderCString);
+	virtual void DestroyEdgeMarkFogPrograms();
 	virtual Render3DError CreateFramebufferOutput6665Program(const size_t outColorIndex, const char *vtxShaderCString, const char *fragShaderCString);
 	virtual void DestroyFramebufferOutput6665Programs();
 	virtual Render3DError CreateFramebufferOutput8888Program(const size_t outColorIndex, const char *vtxShaderCString, const char *fragShaderCString);
 	virtual void DestroyFramebufferOutput8888Programs();
+	virtual Render3DError CreateFramebufferOutput5551Program(const size_t outColorIndex, const char *vtxShaderCString, const char *fragShaderCString);
+	virtual void DestroyFramebufferOutput5551Programs();
+	virtual Render3DError CreateFramebufferOutputDualProgram(const size_t outColorIndex, const NDSColorFormat outputFormat, const char *vtxShaderCString, const char *fragShaderCString);
+	virtual void DestroyFramebufferOutputDualPrograms();
+	virtual Render3DError CreateFrameExportResources();
+	virtual void DestroyFrameExportResources();
 
 	virtual Render3DError InitFinalRenderStates(const std::set<std::string> *oglExtensionSet);
 	virtual Render3DError InitPostprocessingPrograms(const char *edgeMarkVtxShader,
@@ -641,7 +1000,24 @@ protected:
 	virtual Render3DError ZeroDstAlphaPass(const POLY *rawPolyList, const CPoly *clippedPolyList, const size_t clippedPolyCount, const size_t clippedPolyOpaqueCount, bool enableAlphaBlending, size_t indexOffset, POLYGON_ATTR lastPolyAttr);
 	virtual void _ResolveWorkingBackFacing();
 	virtual void _ResolveGeometry();
+	virtual void _UpdateDepthEqualsTestCopy();
+	void _AttachMultisampledRenderToTexture(const GLsizei numSamples);
+	void _AllocateMultisampledFeatureAttachments(const GLsizei numSamples, const GLsizei w, const GLsizei h);
+	void _UpdateFeatureAttachments(const bool willUsePolyID, const bool willUseFogAttr);
+	void _PlanResolves(const bool willSampleBackFacing);
+	GLuint _SelectRenderingFBO(const bool needsZeroDstAlphaPass) const;
 	virtual Render3DError ReadBackPixels();
+	void _DrawFramebufferOutputQuad();
+	size_t _GetReadBackSizeBytes() const;
+	Render3DError _ReadBackPixels16();
+	Render3DError _ReadBackPixelsDual();
+	Render3DError _ReadBackFullFramebufferNow();
+	Render3DError _StartDeferredReadBack();
+	void _FinishReadBackPixels();
+	void _PreparePixelPackBuffer();
+	Render3DError _ReadBackPixelsPipelined();
+	void _ExportFrame();
+	void _InvalidateAttachments(const u32 attachmentFlags, u32 &reportFlags);
 
 	// Base rendering methods
 	virtual Render3DError BeginRender(const GFX3D_State &renderState, const GFX3D_GeometryList &renderGList);
@@ -653,9 +1029,8 @@ protected:
 	virtual Render3DError ClearUsingValues(const Color4u8 &clearColor6665, const FragmentAttributes &clearAttributes);
 
 	virtual void SetPolygonIndex(const size_t index);
-	virtual Render3DError SetupPolygon(const POLY &thePoly, bool treatAsTranslucent, bool willChangeStencilBuffer, bool isBackFacing);
+	virtual Render3DError SetupPolygon(const POLY &thePoly, bool treatAsTranslucent, bool willChangeStencilBuffer);
 	virtual Render3DError SetupTexture(const POLY &thePoly, size_t polyRenderIndex);
-	virtual Render3DError SetupViewport(const GFX3D_Viewport viewport);
 
 	virtual Render3DError DrawShadowPolygon(const GLenum polyPrimitive, const GLsizei vertIndexCount, const GLushort *indexBufferPtr, const bool performDepthEqualTest, const bool enableAlphaDepthWrite, const bool isTranslucent, const u8 opaquePolyID);
 